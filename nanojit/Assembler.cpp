@@ -173,6 +173,11 @@ typedef void* (*decode_instructions_ftype) (void* start, void* end,
     #ifdef VMCFG_VTUNE
         , vtuneHandle(NULL)
     #endif
+        , _nSpills(0)
+        , _nRestores(0)
+        , _nForwardedLoads(0)
+        , _nRemovedStores(0)
+        , _liveRanges(NULL)
         , _mdWriter(mdWriter)
 	#if NJ_BLIND_CONSTANTS
         , _blindMask32(0)
@@ -355,6 +360,11 @@ typedef void* (*decode_instructions_ftype) (void* start, void* end,
                 NanoAssert(_entries[i + 3]==ins);
                 i += 3; // skip high words
             }
+            else if (ins->isV256()) {
+                for (int j = 1; j < 8; j++)
+                    NanoAssert(_entries[i + j]==ins);
+                i += 7; // skip high words
+            }
             else {
                 NanoAssertMsg(arIndex == i, "Stack record index mismatch");
             }
@@ -800,8 +810,10 @@ typedef void* (*decode_instructions_ftype) (void* start, void* end,
                           if (_logc->lcbits & LC_Native) {
                              setOutputForEOL("  <= spill %s",
                              _thisfrag->lirbuf->printer->formatRef(&b, ins)); } )
-            int8_t nWords = ins->isF4() ? 4 : 
+            int8_t nWords = ins->isV256() ? 8 :
+                            ins->isF4() ? 4 :
                         ( ins->isQorD() ? 2 : 1 );
+            _nSpills++;
 #ifdef NANOJIT_IA32
             asm_spill(r, d, pop, nWords);
 #else
@@ -872,6 +884,8 @@ typedef void* (*decode_instructions_ftype) (void* start, void* end,
                         setOutputForEOL("  <= restore %s",
                         _thisfrag->lirbuf->printer->formatRef(&b, vic)); } )
         asm_restore(vic, r);
+        if (!RegAlloc::canRemat(vic))
+            _nRestores++;
 
         _allocator.retire(r);
         vic->clearReg();
@@ -961,7 +975,13 @@ typedef void* (*decode_instructions_ftype) (void* start, void* end,
         RegAlloc capture = _allocator;
         releaseRegisters();
 
-        swapCodeChunks();
+        // When relocations are being recorded the exit is kept inline in the
+        // main code chunk, so that the function's code stays contiguous and
+        // the branches into it remain valid when it is moved.
+        bool inlineExit = relocating();
+        NIns* resume = _nIns;
+        if (!inlineExit)
+            swapCodeChunks();
         _inExit = true;
         verbose_only( _nInsAfter = _nIns; )
 
@@ -985,7 +1005,10 @@ typedef void* (*decode_instructions_ftype) (void* start, void* end,
         NIns* jmpTarget = _nIns;     // target in exit path for our mainline conditional jump
 
         // swap back pointers, effectively storing the last location used in the exit path
-        swapCodeChunks();
+        if (inlineExit)
+            JMP(resume);    // the mainline falls through past the exit code
+        else
+            swapCodeChunks();
         _inExit = false;
         verbose_only( _nInsAfter = _nIns; )
 
@@ -1062,9 +1085,51 @@ typedef void* (*decode_instructions_ftype) (void* start, void* end,
         // The LIR passes through these filters as listed in this
         // function, viz, top to bottom.
 
-        // set up backwards pipeline: assembler <- StackFilter <- LirReader
+        // set up backwards pipeline: assembler <- StackFilter <- LiveRanges <- LoopLiveFilter <- LicmFilter <- RangeFilter <- MemFilter <- GvnFilter <- UnrollFilter <- DivFilter <- ColdFilter <- LirReader
         LirFilter* lir = new (alloc) LirReader(frag->lastIns);
 
+        // HOT/COLD SPLITTING
+        bool hints = frag->lirbuf->hasBranchHints;
+        if (hints)
+            lir = new (alloc) ColdFilter(lir, alloc);
+
+#if defined NANOJIT_IA32 || defined NANOJIT_X64
+        // DIVISION BY CONSTANTS
+        if (_config.divconst)
+            lir = new (alloc) DivFilter(lir, alloc);
+#endif
+
+        // LOOP UNROLLING
+        if (_config.unroll > 1)
+            lir = new (alloc) UnrollFilter(lir, alloc, _config.unroll);
+
+        // GLOBAL VALUE NUMBERING
+        if (_config.gvn)
+            lir = new (alloc) GvnFilter(lir, alloc);
+
+        // LOAD AND STORE REMOVAL
+        _nForwardedLoads = 0;
+        _nRemovedStores = 0;
+        if (_config.memopt) {
+            MemFilter* memfilter = new (alloc) MemFilter(lir, alloc);
+            _nForwardedLoads = memfilter->forwardedLoads();
+            _nRemovedStores = memfilter->removedStores();
+            lir = memfilter;
+        }
+
+        // RANGE ANALYSIS
+        if (_config.ranges)
+            lir = new (alloc) RangeFilter(lir, alloc);
+
+        // LOOP-INVARIANT CODE MOTION
+        if (_config.licm)
+            lir = new (alloc) LicmFilter(lir, alloc);
+
+        // LOOP LIVENESS
+        if (_config.loop_lives || _config.licm || _config.gvn || _config.memopt ||
+            _config.ranges || _config.unroll > 1 || hints)
+            lir = new (alloc) LoopLiveFilter(lir, alloc);
+
 #ifdef DEBUG
         // VALIDATION
         validate = new (alloc) ValidateReader(lir);
@@ -1078,6 +1143,12 @@ typedef void* (*decode_instructions_ftype) (void* start, void* end,
         lir = pp_init;
         })
 
+        // LIVE RANGES (for lookahead register allocation)
+        if (_config.regalloc_lookahead) {
+            _liveRanges = new (alloc) LiveRanges(lir, alloc);
+            lir = _liveRanges;
+        }
+
         // STACKFILTER
         if (optimize) {
             StackFilter* stackfilter = new (alloc) StackFilter(lir, alloc, frag->lirbuf->sp);
@@ -1091,6 +1162,7 @@ typedef void* (*decode_instructions_ftype) (void* start, void* end,
         })
 
         assemble(frag, lir);
+        _liveRanges = NULL;
 
         // If we were accumulating debug info in the various ReverseListers,
         // call finish() to emit whatever contents they have accumulated.
@@ -1216,6 +1288,8 @@ typedef void* (*decode_instructions_ftype) (void* start, void* end,
                           NanoAssert(frag->profFragID == 0); )
 
         _inExit = false;
+        _nSpills = 0;
+        _nRestores = 0;
 
         gen(reader);
 
@@ -1683,6 +1757,11 @@ typedef void* (*decode_instructions_ftype) (void* start, void* end,
                    reader->finalIns()->isRet()        ||
                    isLiveOpcode(reader->finalIns()->opcode()));
 
+        // With lookahead allocation, compile() has found out where every
+        // value is used before the walk starts.
+        LiveRanges* ranges = _liveRanges;
+        _allocator.setLiveRanges(ranges);
+
         for (currIns = reader->read(); !currIns->isop(LIR_start); currIns = reader->read())
         {
             LIns* ins = currIns;        // give it a shorter name for local use
@@ -1692,6 +1771,9 @@ typedef void* (*decode_instructions_ftype) (void* start, void* end,
                 continue;
             }
 
+            if (ranges)
+                ranges->setCurrent(ins);
+
 #ifdef NJ_VERBOSE
             // Output the post-regstate (registers and/or activation).
             // Because asm output comes in reverse order, doing it now means
@@ -1748,6 +1830,10 @@ typedef void* (*decode_instructions_ftype) (void* start, void* end,
                 case LIR_regfence:
                     evictAllActiveRegs();
                     break;
+                case LIR_likely:
+                case LIR_unlikely:
+                    // Only used by ColdFilter, which drops them.
+                    break;
 #if NJ_SAFEPOINT_POLLING_SUPPORTED
                 case LIR_pushstate:
                    asm_pushstate();
@@ -1765,12 +1851,21 @@ typedef void* (*decode_instructions_ftype) (void* start, void* end,
                 case LIR_memfence:
 				   asm_memfence();
 				   break;
+#endif
+#if defined NANOJIT_IA32 || defined NANOJIT_X64
+                case LIR_count:
+                    ins->oprnd1()->setResultLive();
+                    asm_count(ins);
+                    break;
 #endif
                 case LIR_livei:
                 CASE64(LIR_liveq:)
                 case LIR_lived:
                 case LIR_livef:
                 case LIR_livef4:
+                CASEAVX(LIR_livef8:)
+                CASEAVX(LIR_lived4:)
+                CASEAVX(LIR_livei8:)
                 {
                     countlir_live();
                     LIns* op1 = ins->oprnd1();
@@ -1859,6 +1954,9 @@ typedef void* (*decode_instructions_ftype) (void* start, void* end,
                    break;
 
                 case LIR_paramp:
+                CASE86(LIR_paramd:)
+                CASE86(LIR_paramf:)
+                CASE86(LIR_paramf4:)
                     countlir_param();
                     if (ins->isExtant()) {
                         asm_param(ins);
@@ -1923,6 +2021,20 @@ typedef void* (*decode_instructions_ftype) (void* start, void* end,
                     }
                     break;
 
+#if NJ_FMA_SUPPORTED
+                case LIR_fmad:
+                case LIR_fmaf:
+                case LIR_fmaf4:
+                    countlir_fpu();
+                    ins->oprnd1()->setResultLive();
+                    ins->oprnd2()->setResultLive();
+                    ins->oprnd3()->setResultLive();
+                    if (ins->isExtant()) {
+                        asm_fma(ins);
+                    }
+                    break;
+#endif
+
                 case LIR_lduc2ui:
                 case LIR_ldus2ui:
                 case LIR_ldc2i:
@@ -1955,6 +2067,79 @@ typedef void* (*decode_instructions_ftype) (void* start, void* end,
                     }
                     break;
 
+#ifdef NANOJIT_X64
+                case LIR_ldf8:
+                case LIR_ldd4:
+                case LIR_ldi8:
+                    countlir_ld();
+                    ins->oprnd1()->setResultLive();
+                    if (ins->isExtant()) {
+                        asm_load256(ins);
+                    }
+                    break;
+
+                // 256-bit vector arithmetic, comparisons, broadcasts and
+                // extracts all go through asm_vec256().
+                case LIR_f2f8:
+                case LIR_f8x:
+                case LIR_d2d4:
+                case LIR_d4x:
+                case LIR_i2i8:
+                case LIR_i8x:
+                    countlir_fpu();
+                    ins->oprnd1()->setResultLive();
+                    if (ins->isExtant()) {
+                        asm_vec256(ins);
+                    }
+                    break;
+
+                case LIR_addf8:
+                case LIR_subf8:
+                case LIR_mulf8:
+                case LIR_divf8:
+                case LIR_minf8:
+                case LIR_maxf8:
+                case LIR_cmpeqf8:
+                case LIR_cmpltf8:
+                case LIR_cmplef8:
+                case LIR_addd4:
+                case LIR_subd4:
+                case LIR_muld4:
+                case LIR_divd4:
+                case LIR_mind4:
+                case LIR_maxd4:
+                case LIR_cmpeqd4:
+                case LIR_cmpltd4:
+                case LIR_cmpled4:
+                case LIR_addi8:
+                case LIR_subi8:
+                case LIR_muli8:
+                case LIR_andi8:
+                case LIR_ori8:
+                case LIR_xori8:
+                case LIR_cmpeqi8:
+                case LIR_cmpgti8:
+                    countlir_fpu();
+                    ins->oprnd1()->setResultLive();
+                    ins->oprnd2()->setResultLive();
+                    if (ins->isExtant()) {
+                        asm_vec256(ins);
+                    }
+                    break;
+
+                case LIR_blendf8:
+                case LIR_blendd4:
+                case LIR_blendi8:
+                    countlir_fpu();
+                    ins->oprnd1()->setResultLive();
+                    ins->oprnd2()->setResultLive();
+                    ins->oprnd3()->setResultLive();
+                    if (ins->isExtant()) {
+                        asm_vec256(ins);
+                    }
+                    break;
+#endif
+
                 case LIR_negi:
                 CASE86(LIR_negq:)
                 case LIR_noti:
@@ -1966,6 +2151,23 @@ typedef void* (*decode_instructions_ftype) (void* start, void* end,
                     }
                     break;
 
+#if NJ_BITOPS_SUPPORTED
+                case LIR_popcnti:
+                case LIR_lzcnti:
+                case LIR_tzcnti:
+                case LIR_bswapi:
+                case LIR_popcntq:
+                case LIR_lzcntq:
+                case LIR_tzcntq:
+                case LIR_bswapq:
+                    countlir_alu();
+                    ins->oprnd1()->setResultLive();
+                    if (ins->isExtant()) {
+                        asm_bitop(ins);
+                    }
+                    break;
+#endif
+
 #if defined NANOJIT_64BIT
                 case LIR_addq:
                 case LIR_subq:
@@ -1976,6 +2178,9 @@ typedef void* (*decode_instructions_ftype) (void* start, void* end,
                 case LIR_orq:
                 case LIR_xorq:
                 CASE86(LIR_mulq:)
+                CASE86(LIR_mulhq:)
+                CASEBIT(LIR_rolq:)
+                CASEBIT(LIR_rorq:)
                     countlir_alu();
                     ins->oprnd1()->setResultLive();
                     ins->oprnd2()->setResultLive();
@@ -1994,6 +2199,8 @@ typedef void* (*decode_instructions_ftype) (void* start, void* end,
                 case LIR_lshi:
                 case LIR_rshi:
                 case LIR_rshui:
+                CASEBIT(LIR_roli:)
+                CASEBIT(LIR_rori:)
                 CASE86(LIR_divi:)
                 CASE86(LIR_divq:)
                     countlir_alu();
@@ -2064,6 +2271,10 @@ typedef void* (*decode_instructions_ftype) (void* start, void* end,
                 case LIR_dotf2:
                 case LIR_minf4:
                 case LIR_maxf4:
+                case LIR_minf:
+                case LIR_maxf:
+                CASEFPX(LIR_mind:)
+                CASEFPX(LIR_maxd:)
                 case LIR_cmpgtf4:
                 case LIR_cmpgef4:
                 case LIR_cmpltf4:
@@ -2078,6 +2289,36 @@ typedef void* (*decode_instructions_ftype) (void* start, void* end,
                     }
                     break;
 
+#if NJ_FPEXT_SUPPORTED
+                case LIR_floord:
+                case LIR_ceild:
+                case LIR_truncd:
+                case LIR_roundd:
+                case LIR_floorf:
+                case LIR_ceilf:
+                case LIR_truncf:
+                case LIR_roundf:
+                    countlir_fpu();
+                    ins->oprnd1()->setResultLive();
+                    if (ins->isExtant()) {
+                        asm_round(ins);
+                    }
+                    break;
+
+                case LIR_d2ui:
+                case LIR_f2ui:
+                case LIR_f2q:
+                case LIR_q2f:
+                case LIR_uq2d:
+                case LIR_uq2f:
+                    countlir_fpu();
+                    ins->oprnd1()->setResultLive();
+                    if (ins->isExtant()) {
+                        asm_fpconv(ins);
+                    }
+                    break;
+#endif
+
                 case LIR_i2d:
                     countlir_fpu();
                     ins->oprnd1()->setResultLive();
@@ -2289,6 +2530,18 @@ typedef void* (*decode_instructions_ftype) (void* start, void* end,
                     break;
                 }
 
+#ifdef NANOJIT_X64
+                case LIR_stf8:
+                case LIR_std4:
+                case LIR_sti8: {
+                    countlir_st();
+                    ins->oprnd1()->setResultLive();
+                    ins->oprnd2()->setResultLive();
+                    asm_store256(op, ins->oprnd1(), ins->disp(), ins->oprnd2(), ins->isTainted());
+                    break;
+                }
+#endif
+
                 case LIR_j:
                     asm_jmp(ins, pending_lives);
                     break;
@@ -2595,12 +2848,14 @@ typedef void* (*decode_instructions_ftype) (void* start, void* end,
 #endif
 
             if (error())
-                return;
+                break;
 
             // check that all is well (don't check in exit paths since its more complicated)
             debug_only( pageValidate(); )
             debug_only( resourceConsistencyCheck();  )
         }
+
+        _allocator.setLiveRanges(NULL);
     }
 
     void Assembler::assignSavedRegs()
@@ -2676,6 +2931,9 @@ typedef void* (*decode_instructions_ftype) (void* start, void* end,
                     allowed = FpSRegs;
                     break;
                 case LIR_livef4:
+                CASEAVX(LIR_livef8:)
+                CASEAVX(LIR_lived4:)
+                CASEAVX(LIR_livei8:)
                     allowed = FpQRegs;
                     break;
                 case LIR_livei:
@@ -2799,11 +3057,12 @@ typedef void* (*decode_instructions_ftype) (void* start, void* end,
         else
         {
             // alloc larger block on 8-byte boundary.
-            // except float4 values which need to be aligned on a 16-byte boundary
-            uint32_t const extraStackSlots = ins->isF4() ? ((4 - (nStackSlots & 3)) & 3): // 16-byte align
-                                                           (nStackSlots & 1);             // 8-byte align
+            // except vector values which need to be aligned on a 16-byte boundary
+            bool const align16 = ins->isF4() || ins->isV256();
+            uint32_t const extraStackSlots = align16 ? ((4 - (nStackSlots & 3)) & 3): // 16-byte align
+                                                       (nStackSlots & 1);             // 8-byte align
             uint32_t const start = nStackSlots + extraStackSlots; 
-            uint32_t increment = ins->isF4() ? 4 : 2;
+            uint32_t increment = align16 ? 4 : 2;
             for (uint32_t i = start; i <= _highWaterMark; i += increment)
             {
                 if (isEmptyRange(i, nStackSlots))
@@ -2826,7 +3085,7 @@ typedef void* (*decode_instructions_ftype) (void* start, void* end,
             uint32_t const padding8byteAlign =
                 (_highWaterMark & 1) != (nStackSlots & 1);
             uint32_t const padding16byteAlign = (4 - (_highWaterMark & 3)) & 3;
-            uint32_t const extraSpaceForAlignment = ins->isF4() ?
+            uint32_t const extraSpaceForAlignment = align16 ?
                                                           padding16byteAlign:
                                                           padding8byteAlign;
             uint32_t const spaceNeeded = nStackSlots + extraSpaceForAlignment;
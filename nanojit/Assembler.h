@@ -33,6 +33,16 @@ namespace nanojit
 
     class MetaDataWriter;
 
+    // What an absolute address embedded in relocatable code refers to; see
+    // MetaDataWriter::relocation().
+    enum RelocKind {
+        RELOC_CODE,     // address within the fragment's own code, final after patching
+        RELOC_CALL,     // call target; 'target' is the CallInfo
+        RELOC_GUARD,    // GuardRecord returned by an exit; 'target' is the record
+        RELOC_JTBL,     // jump table; 'target' is the NIns* table, 'size' its byte size
+        RELOC_DATA      // read-only data; 'target' points to 'size' bytes
+    };
+
     // Basics:
     // - 'entry' records the state of the native machine stack at particular
     //   points during assembly.  Each entry represents four bytes.
@@ -129,6 +139,9 @@ namespace nanojit
             case LTy_I:   n = 1;          break;
             case LTy_F:   n = 1;          break; 
             case LTy_F4:  n = 4;          break; 
+            case LTy_F8:
+            case LTy_D4:
+            case LTy_I8:  n = 8;          break;
             CASE64(LTy_Q:)
             case LTy_D:   n = 2;          break;
             case LTy_V:   NanoAssert(0);  break;
@@ -159,6 +172,7 @@ namespace nanojit
         ,StackFull
         ,UnknownBranch
         ,BranchTooFar
+        ,UnsupportedOpcode
     };
 
     typedef SeqBuilder<NIns*> NInsList;
@@ -315,6 +329,10 @@ namespace nanojit
             void        releaseRegisters();
             void        patch(GuardRecord *lr);
             void        patch(SideExit *exit);
+            uint32_t    spillCount() const    { return _nSpills; }
+            uint32_t    restoreCount() const  { return _nRestores; }
+            uint32_t    forwardedLoadCount() const { return _nForwardedLoads; }
+            uint32_t    removedStoreCount() const  { return _nRemovedStores; }
             AssmError   error()               { return _err; }
             void        setError(AssmError e) { _err = e; }
             void        cleanupAfterError();
@@ -452,8 +470,23 @@ namespace nanojit
             AR          _activation;
             RegAlloc    _allocator;
 
+            // Spills and (non-rematerializing) restores emitted by assemble().
+            uint32_t    _nSpills;
+            uint32_t    _nRestores;
+
+            // Loads replaced and stores removed by the MemFilter of compile().
+            uint32_t    _nForwardedLoads;
+            uint32_t    _nRemovedStores;
+
+            // Set by compile() when allocating registers with lookahead.
+            LiveRanges* _liveRanges;
+
             MetaDataWriter* _mdWriter;
 
+            // True if the code must be movable after assembly, see
+            // MetaDataWriter::wantsRelocations().
+            bool relocating() const;
+
 #if NJ_BLIND_CONSTANTS
             uint32_t    _blindMask32;
 #ifdef NANOJIT_64BIT
@@ -461,6 +494,9 @@ namespace nanojit
 #endif
 #endif
             verbose_only( void asm_inc_m32(uint32_t*); )
+#if defined NANOJIT_IA32 || defined NANOJIT_X64
+            void        asm_count(LIns* ins);
+#endif
             void        asm_mmq(Register rd, int dd, Register rs, int ds);
 			void		asm_unreachable();
             void        asm_jmp(LIns* ins, InsList& pending_lives);
@@ -504,6 +540,9 @@ namespace nanojit
             void        asm_cond(LIns* ins);
             void        asm_arith(LIns* ins);
             void        asm_neg_not(LIns* ins);
+#if NJ_BITOPS_SUPPORTED
+            void        asm_bitop(LIns* ins);   // popcnt, lzcnt, tzcnt, bswap
+#endif
             void        asm_load32(LIns* ins);
             void        asm_load64(LIns* ins);
             void        asm_cmov(LIns* ins);
@@ -517,6 +556,13 @@ namespace nanojit
             void        asm_neg_abs(LIns* ins); // fpu neg, abs
             void        asm_recip_sqrt(LIns* ins);  // fpu recip, rsqrt, sqrt
             void        asm_fop(LIns* ins);     // fpu add, sub, mul, div
+#if NJ_FMA_SUPPORTED
+            void        asm_fma(LIns* ins);     // fpu fused multiply-add
+#endif
+#if NJ_FPEXT_SUPPORTED
+            void        asm_round(LIns* ins);   // fpu floor, ceil, trunc, round
+            void        asm_fpconv(LIns* ins);  // d2ui, f2ui, f2q, q2f, uq2d, uq2f
+#endif
             void        asm_i2d(LIns* ins);
             void        asm_ui2d(LIns* ins);
             void        asm_d2i(LIns* ins);
@@ -609,11 +655,28 @@ namespace nanojit
         // Abandon metadata if assembly has failed.
         virtual void abandon() = 0;
 
+        // Return true to have the Assembler generate code that can be copied
+        // elsewhere after assembly.  Such code only uses pc-relative
+        // addressing within the fragment and loads every other address as a
+        // 64-bit immediate, which is reported via relocation().  Only backends
+        // that define NJ_RELOCATION_SUPPORTED honour this.
+        virtual bool wantsRelocations() { return false; }
+
+        // Report an absolute address held in the 8 code bytes that end at
+        // 'address'.
+        virtual void relocation(Assembler* assm, RelocKind kind, uint8_t* address,
+                                const void* target, size_t size) {
+            (void)assm; (void)kind; (void)address; (void)target; (void)size;
+        }
+
         // We do not expect to invoke the destructor polymorphically,
         // but some compilers complain if a class with virtual methods
         // does not have a virtual destructor.
         virtual ~MetaDataWriter() {}
     };
 
+    inline bool Assembler::relocating() const {
+        return NJ_RELOCATION_SUPPORTED && _mdWriter && _mdWriter->wantsRelocations();
+    }
 }
 #endif // __nanojit_Assembler__
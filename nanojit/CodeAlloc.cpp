@@ -37,13 +37,16 @@ namespace nanojit
         , bytesPerAlloc(pagesPerAlloc * bytesPerPage)
         , _config(config)
     {
+        VMPI_mutexInit(&_lock);
     }
 
     CodeAlloc::~CodeAlloc() {
         reset();
+        VMPI_mutexDestroy(&_lock);
     }
 
     void CodeAlloc::reset() {
+        Guard guard(&_lock);
         // give all memory back to gcheap.  Assumption is that all
         // code is done being used by now.
         for (CodeList* hb = heapblocks; hb != 0; ) {
@@ -70,6 +73,7 @@ namespace nanojit
     }
 
     void CodeAlloc::getStats(size_t& total, size_t& frag_size, size_t& free_size) {
+        Guard guard(&_lock);
         total = 0;
         frag_size = 0;
         free_size = 0;
@@ -104,6 +108,7 @@ namespace nanojit
     }
 
    void CodeAlloc::alloc(NIns* &start, NIns* &end, size_t byteLimit) {
+        Guard guard(&_lock);
         if (!availblocks) {
             // no free mem, get more
             addMem();
@@ -158,11 +163,15 @@ namespace nanojit
     }
 
     void CodeAlloc::free(NIns* start, NIns *end) {
+        Guard guard(&_lock);
         NanoAssert(heapblocks);
         CodeList *blk = getBlock(start, end);
         if (verbose)
             avmplus::AvmLog("free %p-%p %d\n", start, end, (int)blk->size());
 
+        // coalescing rewrites block headers, which live in the chunk
+        markBlockWrite(blk);
+
         NanoAssert(!blk->isFree);
 
         // coalesce adjacent blocks.
@@ -224,6 +233,7 @@ namespace nanojit
     }
 
     void CodeAlloc::freeAll(CodeList* &code) {
+        Guard guard(&_lock);
         while (code) {
             CodeList *b = removeBlock(code);
             free(b->start(), b->end);
@@ -408,6 +418,7 @@ extern  "C" void sync_instruction_memory(caddr_t v, u_int len);
      * and adding the used prefix and suffix parts to the blocks CodeList.
      */
     void CodeAlloc::addRemainder(CodeList* &blocks, NIns* start, NIns* end, NIns* holeStart, NIns* holeEnd) {
+        Guard guard(&_lock);
         NanoAssert(start < end && start <= holeStart && holeStart <= holeEnd && holeEnd <= end);
         // shrink the hole by aligning holeStart forward and holeEnd backward
         holeStart = (NIns*) ((uintptr_t(holeStart) + sizeof(NIns*)-1) & ~(sizeof(NIns*)-1));
@@ -477,6 +488,7 @@ extern  "C" void sync_instruction_memory(caddr_t v, u_int len);
 #endif
 
     size_t CodeAlloc::size() {
+        Guard guard(&_lock);
         return totalAllocated;
     }
 
@@ -532,6 +544,7 @@ extern  "C" void sync_instruction_memory(caddr_t v, u_int len);
 	void CodeAlloc::markExec(CodeList* &blocks) 
 #endif
 	{
+        Guard guard(&_lock);
         for (CodeList *b = blocks; b != 0; b = b->next) {
             markChunkExec(b->terminator
 #if defined(NANOJIT_WIN_CFG)
@@ -545,6 +558,7 @@ extern  "C" void sync_instruction_memory(caddr_t v, u_int len);
     // each one executable.   On systems where bytesPerAlloc is low (i.e. have lots
     // of elements in the list) this can be expensive.
     void CodeAlloc::markAllExec() {
+        Guard guard(&_lock);
         for (CodeList* hb = heapblocks; hb != NULL; hb = hb->next) {
 #if defined(NANOJIT_WIN_CFG)
 			markChunkExec(hb, NULL);
@@ -561,6 +575,7 @@ extern  "C" void sync_instruction_memory(caddr_t v, u_int len);
 	void CodeAlloc::markChunkExec(CodeList* term)
 #endif
 	{
+        Guard guard(&_lock);
         NanoAssert(term->terminator == NULL);
         if (!term->isExec) {
             term->isExec = true;
@@ -60,6 +60,12 @@ namespace nanojit
     public:
         /** true is the given NIns is contained within this block */
         bool isInBlock(NIns* n) { return (n >= this->start() && n < this->end); }
+
+        /** return the next block of a list, e.g. the code of a fragment */
+        CodeList* nextBlock() const { return next; }
+
+        /** return the address just past the end of this block */
+        NIns* blockEnd() const { return end; }
     };
 
     /**
@@ -110,6 +116,18 @@ namespace nanojit
 
         const Config* _config;
 
+        /** Serializes access to the block lists, so that several Assemblers
+            running on different threads can share one CodeAlloc. */
+        vmpi_mutex_t _lock;
+
+        /** Holds _lock for the lifetime of the enclosing scope. */
+        class Guard {
+            vmpi_mutex_t* _m;
+        public:
+            Guard(vmpi_mutex_t* m) : _m(m) { VMPI_mutexAcquire(_m); }
+            ~Guard() { VMPI_mutexRelease(_m); }
+        };
+
         /** remove one block from a list */
         static CodeList* removeBlock(CodeList* &list);
 
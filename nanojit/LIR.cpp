@@ -502,6 +502,8 @@ namespace nanojit
         _unused = 0;
         _limit = 0;
         _stats.lir = 0;
+        usesV256 = false;
+        hasBranchHints = false;
         for (int i = 0; i < NumSavedRegs; ++i)
             savedRegs[i] = NULL;
         chunkAlloc();
@@ -520,6 +522,16 @@ namespace nanojit
         return _stats.lir;
     }
 
+    LIns* LirBuffer::lastIns()
+    {
+        // Every LInsXYZ ends with its LIns, and a chunk that was just started
+        // begins with a skip back to the previous one.
+        LIns* ins = (LIns*)(_unused - sizeof(LIns));
+        if (ins->isop(LIR_skip))
+            ins = ins->prevLIns();
+        return ins;
+    }
+
     // Allocate a new page, and write the first instruction to it -- a skip
     // linking to last instruction of the previous page.
     void LirBuffer::moveToNewChunk(uintptr_t addrOfLastLInsOnCurrentChunk)
@@ -602,6 +614,8 @@ namespace nanojit
         LInsOp0* insOp0 = (LInsOp0*)_buf->makeRoom(sizeof(LInsOp0));
         LIns*    ins    = insOp0->getLIns();
         ins->initLInsOp0(op);
+        if (op == LIR_likely || op == LIR_unlikely)
+            _buf->hasBranchHints = true;
         return ins;
     }
 
@@ -610,6 +624,8 @@ namespace nanojit
         LInsOp1* insOp1 = (LInsOp1*)_buf->makeRoom(sizeof(LInsOp1));
         LIns*    ins    = insOp1->getLIns();
         ins->initLInsOp1(op, o1);
+        if (ins->isV256())
+            _buf->usesV256 = true;
         return ins;
     }
 
@@ -618,6 +634,8 @@ namespace nanojit
         LInsOp2* insOp2 = (LInsOp2*)_buf->makeRoom(sizeof(LInsOp2));
         LIns*    ins    = insOp2->getLIns();
         ins->initLInsOp2(op, o1, o2);
+        if (ins->isV256())
+            _buf->usesV256 = true;
         return ins;
     }
 
@@ -626,6 +644,8 @@ namespace nanojit
         LInsOp3* insOp3 = (LInsOp3*)_buf->makeRoom(sizeof(LInsOp3));
         LIns*    ins    = insOp3->getLIns();
         ins->initLInsOp3(op, o1, o2, o3);
+        if (ins->isV256())
+            _buf->usesV256 = true;
         return ins;
     }
     
@@ -643,6 +663,8 @@ namespace nanojit
             LInsLd* insLd = (LInsLd*)_buf->makeRoom(sizeof(LInsLd));
             LIns*   ins   = insLd->getLIns();
             ins->initLInsLd(op, base, d, accSet, loadQual);
+            if (ins->isV256())
+                _buf->usesV256 = true;
             return ins;
         } else {
             // If the displacement is more than 16 bits, put it in a separate instruction.
@@ -694,11 +716,11 @@ namespace nanojit
         return ins;
     }
 
-    LIns* LirBufWriter::insParam(int32_t arg, int32_t kind)
+    LIns* LirBufWriter::insParam(int32_t arg, int32_t kind, LOpcode op)
     {
         LInsP* insP = (LInsP*)_buf->makeRoom(sizeof(LInsP));
         LIns*  ins  = insP->getLIns();
-        ins->initLInsP(arg, kind);
+        ins->initLInsP(op, arg, kind);
         if (kind) {
             NanoAssert(arg < NumSavedRegs);
             _buf->savedRegs[arg] = ins;
@@ -929,6 +951,10 @@ namespace nanojit
         case LIR_q2i:
             if (oprnd->isImmQ())
                 return insImmI(oprnd->immQlo(), oprnd->isTainted());
+            // Truncating a widened int gives back the int, eg. an inlined
+            // callee's int parameter.
+            if (oprnd->isop(LIR_i2q) || oprnd->isop(LIR_ui2uq))
+                return oprnd->oprnd1();
             break;
         case LIR_i2q:
             if (oprnd->isImmI())
@@ -973,6 +999,66 @@ namespace nanojit
             if (oprnd->isImmQ())
                 return insImmQ(~oprnd->immQ(), oprnd->isTainted());
             goto involution;
+#endif
+#if NJ_BITOPS_SUPPORTED
+        case LIR_popcnti:
+            if (oprnd->isImmI()) {
+                uint32_t c = uint32_t(oprnd->immI());
+                int32_t n = 0;
+                for (; c != 0; c &= c - 1)
+                    n++;
+                return insImmI(n, oprnd->isTainted());
+            }
+            break;
+        case LIR_lzcnti:
+            if (oprnd->isImmI()) {
+                uint32_t c = uint32_t(oprnd->immI());
+                return insImmI(c ? 31 - msbSet32(c) : 32, oprnd->isTainted());
+            }
+            break;
+        case LIR_tzcnti:
+            if (oprnd->isImmI()) {
+                uint32_t c = uint32_t(oprnd->immI());
+                return insImmI(c ? lsbSet32(c) : 32, oprnd->isTainted());
+            }
+            break;
+        case LIR_bswapi:
+            if (oprnd->isImmI()) {
+                uint32_t c = uint32_t(oprnd->immI());
+                c = (c >> 24) | ((c >> 8) & 0xff00) | ((c << 8) & 0xff0000) | (c << 24);
+                return insImmI(int32_t(c), oprnd->isTainted());
+            }
+            goto involution;
+        case LIR_popcntq:
+            if (oprnd->isImmQ()) {
+                uint64_t c = uint64_t(oprnd->immQ());
+                int32_t n = 0;
+                for (; c != 0; c &= c - 1)
+                    n++;
+                return insImmI(n, oprnd->isTainted());
+            }
+            break;
+        case LIR_lzcntq:
+            if (oprnd->isImmQ()) {
+                uint64_t c = uint64_t(oprnd->immQ());
+                return insImmI(c ? 63 - msbSet64(c) : 64, oprnd->isTainted());
+            }
+            break;
+        case LIR_tzcntq:
+            if (oprnd->isImmQ()) {
+                uint64_t c = uint64_t(oprnd->immQ());
+                return insImmI(c ? lsbSet64(c) : 64, oprnd->isTainted());
+            }
+            break;
+        case LIR_bswapq:
+            if (oprnd->isImmQ()) {
+                uint64_t c = uint64_t(oprnd->immQ());
+                uint64_t r = 0;
+                for (int i = 0; i < 8; i++, c >>= 8)
+                    r = (r << 8) | (c & 0xff);
+                return insImmQ(int64_t(r), oprnd->isTainted());
+            }
+            goto involution;
 #endif
         case LIR_negi:
             if (oprnd->isImmI())
@@ -1034,6 +1120,63 @@ namespace nanojit
             if (oprnd->isImmI())
                 return insImmD(uint32_t(oprnd->immI()), oprnd->isTainted());
             break;
+#if NJ_FPEXT_SUPPORTED
+        case LIR_floord:
+        case LIR_ceild:
+        case LIR_truncd:
+        case LIR_roundd:
+            if (oprnd->isImmD()) {
+                double c = oprnd->immD();
+                double r = v == LIR_floord ? floor(c) : v == LIR_ceild ? ceil(c) :
+                           v == LIR_truncd ? trunc(c) : round(c);
+                return insImmD(r, oprnd->isTainted());
+            }
+            if (oprnd->opcode() == v)
+                return oprnd;   // floor(floor(x)) = floor(x), etc.
+            break;
+        case LIR_floorf:
+        case LIR_ceilf:
+        case LIR_truncf:
+        case LIR_roundf:
+            if (oprnd->isImmF()) {
+                float c = oprnd->immF();
+                float r = v == LIR_floorf ? floorf(c) : v == LIR_ceilf ? ceilf(c) :
+                          v == LIR_truncf ? truncf(c) : roundf(c);
+                return insImmF(r, oprnd->isTainted());
+            }
+            if (oprnd->opcode() == v)
+                return oprnd;
+            break;
+        case LIR_d2ui:
+            // Only fold values that are in range, the result is otherwise
+            // unspecified and may differ from the machine code's.
+            if (oprnd->isImmD() && oprnd->immD() > -1.0 && oprnd->immD() < 4294967296.0)
+                return insImmI(int32_t(uint32_t(oprnd->immD())), oprnd->isTainted());
+            if (oprnd->isop(LIR_ui2d))
+                return oprnd->oprnd1();
+            break;
+        case LIR_f2ui:
+            if (oprnd->isImmF() && oprnd->immF() > -1.0f && oprnd->immF() < 4294967296.0f)
+                return insImmI(int32_t(uint32_t(oprnd->immF())), oprnd->isTainted());
+            break;
+        case LIR_f2q:
+            if (oprnd->isImmF() && oprnd->immF() > -9223372036854775808.0f &&
+                oprnd->immF() < 9223372036854775808.0f)
+                return insImmQ(int64_t(oprnd->immF()), oprnd->isTainted());
+            break;
+        case LIR_q2f:
+            if (oprnd->isImmQ())
+                return insImmF(float(oprnd->immQ()), oprnd->isTainted());
+            break;
+        case LIR_uq2d:
+            if (oprnd->isImmQ())
+                return insImmD(double(uint64_t(oprnd->immQ())), oprnd->isTainted());
+            break;
+        case LIR_uq2f:
+            if (oprnd->isImmQ())
+                return insImmF(float(uint64_t(oprnd->immQ())), oprnd->isTainted());
+            break;
+#endif
         case LIR_absd:
         case LIR_absf:
         case LIR_absf4:
@@ -1061,6 +1204,27 @@ namespace nanojit
         return u.d;
     }
 
+#ifdef NANOJIT_64BIT
+    // The high 64 bits of the 128-bit signed product of 'a' and 'b'.
+    static int64_t mulHighQ(int64_t a, int64_t b)
+    {
+        // Multiply the magnitudes in 32-bit halves, then negate the 128-bit
+        // result if the signs differ.
+        uint64_t ua = a < 0 ? 0 - uint64_t(a) : uint64_t(a);
+        uint64_t ub = b < 0 ? 0 - uint64_t(b) : uint64_t(b);
+        uint64_t ll = (ua & 0xffffffff) * (ub & 0xffffffff);
+        uint64_t lh = (ua & 0xffffffff) * (ub >> 32);
+        uint64_t hl = (ua >> 32) * (ub & 0xffffffff);
+        uint64_t hh = (ua >> 32) * (ub >> 32);
+        uint64_t mid = (ll >> 32) + (lh & 0xffffffff) + (hl & 0xffffffff);
+        uint64_t lo = (mid << 32) | (ll & 0xffffffff);
+        uint64_t hi = hh + (lh >> 32) + (hl >> 32) + (mid >> 32);
+        if ((a < 0) != (b < 0))
+            hi = ~hi + (lo == 0 ? 1 : 0);
+        return int64_t(hi);
+    }
+#endif
+
     LIns* ExprFilter::ins2(LOpcode v, LIns* oprnd1, LIns* oprnd2)
     {
         NanoAssert(oprnd1 && oprnd2);
@@ -1136,6 +1300,12 @@ namespace nanojit
             case LIR_lshi:  return insImmI(c1 << (c2 & 0x1f), tainted);
             case LIR_rshi:  return insImmI(c1 >> (c2 & 0x1f), tainted);
             case LIR_rshui: return insImmI(uint32_t(c1) >> (c2 & 0x1f), tainted);
+#if NJ_BITOPS_SUPPORTED
+            case LIR_roli:  c2 &= 0x1f;
+                            return insImmI(c2 ? int32_t(uint32_t(c1) << c2 | uint32_t(c1) >> (32 - c2)) : c1, tainted);
+            case LIR_rori:  c2 &= 0x1f;
+                            return insImmI(c2 ? int32_t(uint32_t(c1) >> c2 | uint32_t(c1) << (32 - c2)) : c1, tainted);
+#endif
 
             case LIR_ori:   return insImmI(c1 | c2, tainted);
             case LIR_andi:  return insImmI(c1 & c2, tainted);
@@ -1191,6 +1361,7 @@ namespace nanojit
             case LIR_xorq:  return insImmQ(c1 ^ c2, tainted);
 #if defined NANOJIT_X64
             case LIR_mulq:  return insImmQ(c1 * c2, tainted);
+            case LIR_mulhq: return insImmQ(mulHighQ(c1, c2), tainted);
 #endif
             // Nb: LIR_rshq, LIR_lshq and LIR_rshuq aren't here because their
             // RHS is an int.  They are below.
@@ -1254,6 +1425,12 @@ namespace nanojit
             case LIR_lshq:  return insImmQ(c1 << (c2 & 0x3f), tainted);
             case LIR_rshq:  return insImmQ(c1 >> (c2 & 0x3f), tainted);
             case LIR_rshuq: return insImmQ(uint64_t(c1) >> (c2 & 0x3f), tainted);
+#if NJ_BITOPS_SUPPORTED
+            case LIR_rolq:  c2 &= 0x3f;
+                            return insImmQ(c2 ? int64_t(uint64_t(c1) << c2 | uint64_t(c1) >> (64 - c2)) : c1, tainted);
+            case LIR_rorq:  c2 &= 0x3f;
+                            return insImmQ(c2 ? int64_t(uint64_t(c1) >> c2 | uint64_t(c1) << (64 - c2)) : c1, tainted);
+#endif
 
             default:        break;
             }
@@ -1334,6 +1511,7 @@ namespace nanojit
             case LIR_muli:
             case LIR_muld:
             CASE86(LIR_mulq:)
+            CASE86(LIR_mulhq:)
             case LIR_mulf:
             case LIR_mulf4:
             case LIR_andi:
@@ -1412,6 +1590,10 @@ namespace nanojit
                 CASE64(LIR_lshq:)   // These are here because their RHS is an int
                 CASE64(LIR_rshq:)
                 CASE64(LIR_rshuq:)
+                CASEBIT(LIR_roli:)
+                CASEBIT(LIR_rori:)
+                CASEBIT(LIR_rolq:)
+                CASEBIT(LIR_rorq:)
                     return oprnd1;
 
                 case LIR_andi:
@@ -1471,6 +1653,7 @@ namespace nanojit
 
                 case LIR_andq:
                 CASE86(LIR_mulq:)
+                CASE86(LIR_mulhq:)
                     return oprnd2;
 
                 case LIR_ltuq: // unsigned < 0 -> always false
@@ -1510,6 +1693,29 @@ namespace nanojit
 #endif  // NANOJIT_64BIT
         }
 
+#if NJ_FMA_SUPPORTED
+        //-------------------------------------------------------------------
+        // Multiply-add contraction
+        //-------------------------------------------------------------------
+        if (contractFma) {
+            LOpcode mul, fma;
+            switch (v) {
+            case LIR_addd:  mul = LIR_muld;  fma = LIR_fmad;  break;
+            case LIR_addf:  mul = LIR_mulf;  fma = LIR_fmaf;  break;
+            case LIR_addf4: mul = LIR_mulf4; fma = LIR_fmaf4; break;
+            default:        mul = fma = LIR_skip;           break;
+            }
+            if (fma != LIR_skip) {
+                // a * b + c => fma(a, b, c)
+                // c + a * b => fma(a, b, c)
+                if (oprnd1->isop(mul))
+                    return ins3(fma, oprnd1->oprnd1(), oprnd1->oprnd2(), oprnd2);
+                if (oprnd2->isop(mul))
+                    return ins3(fma, oprnd2->oprnd1(), oprnd2->oprnd2(), oprnd1);
+            }
+        }
+#endif
+
 #if NJ_SOFTFLOAT_SUPPORTED
         //-------------------------------------------------------------------
         // SoftFloat-specific folding
@@ -1532,7 +1738,10 @@ namespace nanojit
     LIns* ExprFilter::ins3(LOpcode v, LIns* oprnd1, LIns* oprnd2, LIns* oprnd3)
     {
         NanoAssert(oprnd1 && oprnd2 && oprnd3);
-        NanoAssert(isCmovOpcode(v));
+        if (!isCmovOpcode(v)) {
+            // Blends and fused multiply-adds aren't folded.
+            return out->ins3(v, oprnd1, oprnd2, oprnd3);
+        }
         if (oprnd2 == oprnd3) {
             // c ? a : a => a
             return oprnd2;
@@ -1734,6 +1943,11 @@ namespace nanojit
 #endif
         case LTy_F: op = LIR_stf;   break;
         case LTy_F4:op = LIR_stf4;  break;
+#ifdef NANOJIT_X64
+        case LTy_F8:op = LIR_stf8;  break;
+        case LTy_D4:op = LIR_std4;  break;
+        case LTy_I8:op = LIR_sti8;  break;
+#endif
         case LTy_D: op = LIR_std;   break;
         case LTy_V: NanoAssert(0);  break;
         default:    NanoAssert(0);  break;
@@ -1886,1833 +2100,5499 @@ namespace nanojit
         }
     }
 
-#ifdef NJ_VERBOSE
-    class RetiredEntry
+    LIns** LirFilter::readAll(Allocator& alloc, uint32_t& n)
     {
-    public:
-        Seq<LIns*>* live;
-        LIns* i;
-        RetiredEntry(): live(NULL), i(NULL) {}
-    };
+        uint32_t cap = 256;
+        LIns** insns = new (alloc) LIns*[cap];
+        n = 0;
+        for (;;) {
+            LIns* ins = in->read();
+            if (n == cap) {
+                LIns** bigger = new (alloc) LIns*[cap * 2];
+                memcpy(bigger, insns, cap * sizeof(LIns*));
+                insns = bigger;
+                cap *= 2;
+            }
+            insns[n++] = ins;
+            if (ins->isop(LIR_start))
+                break;
+        }
+        for (uint32_t i = 0, j = n - 1; i < j; i++, j--) {
+            LIns* t = insns[i];
+            insns[i] = insns[j];
+            insns[j] = t;
+        }
+        return insns;
+    }
 
-    class LiveTable
+    LoopLiveFilter::LoopLiveFilter(LirFilter* in, Allocator& alloc)
+        : LirFilter(in), _alloc(alloc), _lives(alloc), _dropped(alloc), _pending(NULL)
     {
-        Allocator& alloc;
-    public:
-        HashMap<LIns*, LIns*> live;
-        SeqBuilder<RetiredEntry*> retired;
-        int retiredCount;
-        int maxlive;
-        LiveTable(Allocator& alloc)
-            : alloc(alloc)
-            , live(alloc)
-            , retired(alloc)
-            , retiredCount(0)
-            , maxlive(0)
-        { }
+        // The analysis goes forwards, in buffer order.
+        _insns = readAll(alloc, _next);
+        analyze(_insns, _next);
+    }
 
-        void add(LIns* ins, LIns* use) {
-            if (!ins->isImmAny() && !live.containsKey(ins)) {
-                NanoAssert(size_t(ins->opcode()) < sizeof(lirNames) / sizeof(lirNames[0]));
-                live.put(ins,use);
+    // Constants that are rematerialized on use need not be kept alive.
+    static bool isRematImm(LIns* ins)
+    {
+        return ins->isImmAny() && RegAlloc::canRemat(ins);
+    }
+
+    static inline bool testBit(const uint64_t* bits, uint32_t i)
+    {
+        return (bits[i / 64] & (uint64_t(1) << (i % 64))) != 0;
+    }
+
+    static inline void setBit(uint64_t* bits, uint32_t i)
+    {
+        bits[i / 64] |= uint64_t(1) << (i % 64);
+    }
+
+    // Returns the LIR_allocp that 'ins' points into, if it is one.
+    static LIns* allocpBase(LIns* ins)
+    {
+        while (ins->isop(LIR_addp)) {
+            if (ins->oprnd2()->isop(LIR_allocp))
+                return ins->oprnd2();
+            ins = ins->oprnd1();
+        }
+        return ins->isop(LIR_allocp) ? ins : NULL;
+    }
+
+    void LoopLiveFilter::analyze(LIns** insns, uint32_t n)
+    {
+        // Number the instructions, and give up early if no branch goes
+        // backwards.
+        HashMap<LIns*, uint32_t> index(_alloc, n / 4 + 16);
+        bool loops = false;
+        for (uint32_t i = 0; i < n; i++) {
+            LIns* ins = insns[i];
+            if (ins->isop(LIR_jtbl)) {
+                for (uint32_t t = 0; t < ins->getTableSize(); t++)
+                    loops |= index.containsKey(ins->getTarget(t));
+            } else if (ins->isBranch()) {
+                loops |= index.containsKey(ins->getTarget());
             }
+            index.put(ins, i);
         }
+        if (!loops)
+            return;
 
-        void retire(LIns* i) {
-            RetiredEntry *e = new (alloc) RetiredEntry();
-            e->i = i;
-            InsList livelist(alloc);
-            HashMap<LIns*, LIns*>::Iter iter(live);
-            int live_count = 0;
-            while (iter.next()) {
-                LIns* ins = iter.key();
-                if (!ins->isV()) {
-                    live_count++;
-                    livelist.insert(ins);
+        // Each label starts a new block.
+        uint32_t* blockOf = new (_alloc) uint32_t[n];
+        uint32_t nblocks = 0;
+        for (uint32_t i = 0; i < n; i++) {
+            if (insns[i]->isop(LIR_label) && i > 0)
+                nblocks++;
+            blockOf[i] = nblocks;
+        }
+        nblocks++;
+        uint32_t* start = new (_alloc) uint32_t[nblocks];
+        for (uint32_t i = n; i > 0; i--)
+            start[blockOf[i - 1]] = i - 1;
+
+        // Only values used outside their own block can be live into a label;
+        // they are numbered in buffer order, so that the values defined
+        // before block b are exactly those numbered below firstId[b].
+        bool* crosses = new (_alloc) bool[n];
+        VMPI_memset(crosses, 0, n * sizeof(bool));
+        for (uint32_t i = 0; i < n; i++) {
+            LIns* ins = insns[i];
+            if (isLiveOpcode(ins->opcode()))
+                continue;
+            for (uint32_t k = 0, nops = ins->numOperands(); k < nops; k++) {
+                LIns* v = ins->operand(k);
+                if (!v || isRematImm(v))
+                    continue;
+                NanoAssert(index.containsKey(v));
+                uint32_t d = index.get(v);
+                if (blockOf[d] != blockOf[i])
+                    crosses[d] = true;
+            }
+        }
+        uint32_t* id = new (_alloc) uint32_t[n];
+        LIns** values = new (_alloc) LIns*[n];
+        uint32_t* firstId = new (_alloc) uint32_t[nblocks];
+        uint32_t nvalues = 0;
+        for (uint32_t i = 0; i < n; i++) {
+            if (i == start[blockOf[i]])
+                firstId[blockOf[i]] = nvalues;
+            if (crosses[i]) {
+                id[i] = nvalues;
+                values[nvalues++] = insns[i];
+            }
+        }
+
+        // live[b] starts out as the values block b uses but doesn't define.
+        uint32_t nwords = (nvalues + 63) / 64;
+        uint64_t* live = new (_alloc) uint64_t[nblocks * nwords + 1];
+        VMPI_memset(live, 0, (nblocks * nwords + 1) * sizeof(uint64_t));
+        Seq<uint32_t>** succs = new (_alloc) Seq<uint32_t>*[nblocks];
+        VMPI_memset(succs, 0, nblocks * sizeof(Seq<uint32_t>*));
+        for (uint32_t i = 0; i < n; i++) {
+            LIns* ins = insns[i];
+            uint32_t b = blockOf[i];
+            if (isLiveOpcode(ins->opcode()))
+                continue;
+            for (uint32_t k = 0, nops = ins->numOperands(); k < nops; k++) {
+                LIns* v = ins->operand(k);
+                if (!v || isRematImm(v))
+                    continue;
+                uint32_t d = index.get(v);
+                if (d < start[b]) {
+                    NanoAssert(crosses[d]);
+                    setBit(&live[b * nwords], id[d]);
                 }
             }
-            e->live = livelist.get();
-            if (live_count > maxlive)
-                maxlive = live_count;
+            if (ins->isop(LIR_jtbl)) {
+                for (uint32_t t = 0; t < ins->getTableSize(); t++)
+                    succs[b] = new (_alloc) Seq<uint32_t>(blockOf[index.get(ins->getTarget(t))], succs[b]);
+            } else if (ins->isBranch()) {
+                succs[b] = new (_alloc) Seq<uint32_t>(blockOf[index.get(ins->getTarget())], succs[b]);
+            }
+        }
+        for (uint32_t b = 0; b + 1 < nblocks; b++) {
+            // Control falls into the next block unless it ends with a jump,
+            // return or exit (ignoring any LIR_lives and comments after it).
+            uint32_t i = start[b + 1];
+            while (i > start[b] && (isLiveOpcode(insns[i - 1]->opcode()) ||
+                                    insns[i - 1]->isop(LIR_comment)))
+                i--;
+            LIns* last = i > start[b] ? insns[i - 1] : NULL;
+            if (!last || !(last->isUnConditionalBranch() || last->isRet() || last->isop(LIR_x)))
+                succs[b] = new (_alloc) Seq<uint32_t>(b + 1, succs[b]);
+        }
 
-            live.remove(i);
-            retired.insert(e);
-            retiredCount++;
+        // Iterate to a fixed point: a block's successors' live values are
+        // live into the block too, unless the block defines them.
+        for (bool changed = true; changed; ) {
+            changed = false;
+            for (uint32_t b = nblocks; b-- > 0; ) {
+                uint64_t* in = &live[b * nwords];
+                uint32_t limit = firstId[b];
+                for (Seq<uint32_t>* s = succs[b]; s; s = s->tail) {
+                    uint64_t* out = &live[s->head * nwords];
+                    for (uint32_t w = 0; w * 64 < limit; w++) {
+                        uint64_t bits = out[w];
+                        if (limit - w * 64 < 64)
+                            bits &= (uint64_t(1) << (limit - w * 64)) - 1;
+                        if (bits & ~in[w]) {
+                            in[w] |= bits;
+                            changed = true;
+                        }
+                    }
+                }
+            }
         }
 
-        bool contains(LIns* i) {
-            return live.containsKey(i);
+        // Put the values live into the target of each backward branch
+        // after the branch.
+        uint64_t* set = new (_alloc) uint64_t[nwords + 1];
+        for (uint32_t i = 0; i < n; i++) {
+            LIns* ins = insns[i];
+            if (!ins->isBranch())
+                continue;
+            VMPI_memset(set, 0, (nwords + 1) * sizeof(uint64_t));
+            bool backward = false;
+            uint32_t ntargets = ins->isop(LIR_jtbl) ? ins->getTableSize() : 1;
+            for (uint32_t t = 0; t < ntargets; t++) {
+                uint32_t l = index.get(ins->isop(LIR_jtbl) ? ins->getTarget(t) : ins->getTarget());
+                if (l < i) {
+                    backward = true;
+                    for (uint32_t w = 0; w < nwords; w++)
+                        set[w] |= live[blockOf[l] * nwords + w];
+                }
+            }
+            if (!backward)
+                continue;
+
+            for (uint32_t k = i + 1; k < n && isLiveOpcode(insns[k]->opcode()); k++) {
+                if (!insns[k]->oprnd1()->isop(LIR_allocp))
+                    _dropped.put(insns[k], true);
+            }
+            Seq<LIns*>* list = new (_alloc) Seq<LIns*>(ins);
+            for (uint32_t v = 0; v < nvalues; v++) {
+                if (!testBit(set, v))
+                    continue;
+                list = new (_alloc) Seq<LIns*>(makeLive(values[v]), list);
+                // A pointer into a LIR_allocp area needs the area too.
+                LIns* area = allocpBase(values[v]);
+                if (area && area != values[v]) {
+                    uint32_t a = index.get(area);
+                    if (!crosses[a] || !testBit(set, id[a]))
+                        list = new (_alloc) Seq<LIns*>(makeLive(area), list);
+                }
+            }
+            if (list->tail)
+                _lives.put(ins, list);
         }
-    };
+    }
 
-    /*
-     * traverse the LIR buffer and discover which instructions are live
-     * by starting from instructions with side effects (stores, calls, branches)
-     * and marking instructions used by them.  Works bottom-up, in one pass.
-     * if showLiveRefs == true, also print the set of live expressions next to
-     * each instruction
-     */
-    void live(LirFilter* in, Allocator& alloc, Fragment *frag, LogControl *logc)
+    LIns* LoopLiveFilter::makeLive(LIns* value)
     {
-        // traverse backwards to find live exprs and a few other stats.
+        LOpcode op;
+        switch (value->retType()) {
+        case LTy_I:     op = LIR_livei;     break;
+#ifdef NANOJIT_64BIT
+        case LTy_Q:     op = LIR_liveq;     break;
+#endif
+        case LTy_D:     op = LIR_lived;     break;
+        case LTy_F:     op = LIR_livef;     break;
+        case LTy_F4:    op = LIR_livef4;    break;
+#ifdef NANOJIT_X64
+        case LTy_F8:    op = LIR_livef8;    break;
+        case LTy_D4:    op = LIR_lived4;    break;
+        case LTy_I8:    op = LIR_livei8;    break;
+#endif
+        default:
+            NanoAssert(!"bad LIR_live operand");
+            op = LIR_livei;
+            break;
+        }
+        LIns* ins = (new (_alloc) LInsOp1())->getLIns();
+        ins->initLInsOp1(op, value);
+        return ins;
+    }
 
-        LiveTable live(alloc);
-        uint32_t exits = 0;
-        int total = 0;
-        if (frag->lirbuf->state)
-            live.add(frag->lirbuf->state, 0);
-        for (LIns* ins = in->read(); !ins->isop(LIR_start); ins = in->read())
-        {
-            total++;
+    LIns* LoopLiveFilter::read()
+    {
+        if (_pending) {
+            LIns* ins = _pending->head;
+            _pending = _pending->tail;
+            return ins;
+        }
+        for (;;) {
+            // Keep returning LIR_start once everything else has gone.
+            LIns* ins = _insns[_next > 1 ? --_next : 0];
+            if (_dropped.containsKey(ins))
+                continue;
+            if (Seq<LIns*>* list = _lives.get(ins)) {
+                _pending = list->tail;
+                return list->head;
+            }
+            return ins;
+        }
+    }
 
-            // First handle instructions that are always live (ie. those that
-            // don't require being marked as live), eg. those with
-            // side-effects.  We ignore LIR_paramp.
-            if (ins->isLive() && !ins->isop(LIR_paramp))
-            {
-                live.add(ins, 0);
-                if (ins->isGuard())
-                    exits++;
+    LicmFilter::LicmFilter(LirFilter* in, Allocator& alloc)
+        : LirFilter(in), _alloc(alloc)
+    {
+        _insns = readAll(alloc, _next);
+        analyze(_insns, _next);
+    }
+
+    LIns* LicmFilter::read()
+    {
+        return _insns[_next > 1 ? --_next : 0];
+    }
+
+    // LIR_allocp areas whose address is only used directly by loads, stores
+    // and LIR_lives can only be read by the loads from them and changed by
+    // the stores to them.  Puts these areas in 'isPrivate'.
+    static void findPrivateAreas(LIns** insns, uint32_t n, HashMap<LIns*, bool>& isPrivate,
+                                 Allocator& alloc)
+    {
+        HashMap<LIns*, bool> escapes(alloc);
+        for (uint32_t i = 0; i < n; i++) {
+            LIns* ins = insns[i];
+            if (isLiveOpcode(ins->opcode()))
+                continue;
+            for (uint32_t k = 0, nops = ins->numOperands(); k < nops; k++) {
+                LIns* v = ins->operand(k);
+                if (v && v->isop(LIR_allocp) &&
+                    !(ins->isLoad() && k == 0) && !(ins->isStore() && k == 1))
+                    escapes.put(v, true);
             }
+        }
+        for (uint32_t i = 0; i < n; i++) {
+            if (insns[i]->isop(LIR_allocp) && !escapes.containsKey(insns[i]))
+                isPrivate.put(insns[i], true);
+        }
+    }
 
-            // now propagate liveness
-            if (live.contains(ins))
-            {
-                live.retire(ins);
+    // The number of bytes a load or store accesses.
+    static int32_t accessSize(LOpcode op)
+    {
+        switch (op) {
+        case LIR_ldc2i: case LIR_lduc2ui: case LIR_sti2c:
+            return 1;
+        case LIR_lds2i: case LIR_ldus2ui: case LIR_sti2s:
+            return 2;
+        case LIR_ldi: case LIR_ldf: case LIR_ldf2d: case LIR_sti: case LIR_stf: case LIR_std2f:
+            return 4;
+        CASE64(LIR_ldq:) CASE64(LIR_stq:)
+        case LIR_ldd: case LIR_std:
+            return 8;
+        CASEAVX(LIR_ldf8:) CASEAVX(LIR_ldd4:) CASEAVX(LIR_ldi8:)
+        CASEAVX(LIR_stf8:) CASEAVX(LIR_std4:) CASEAVX(LIR_sti8:)
+            return 32;
+        default:
+            NanoAssert(op == LIR_ldf4 || op == LIR_stf4);
+            return 16;
+        }
+    }
 
-                switch (ins->opcode()) {
-                case LIR_skip:
-                    NanoAssertMsg(0, "Shouldn't see LIR_skip");
-                    break;
+    // Can anything in a loop that does 'stores' and calls storing to
+    // 'callAccSet' change the value 'load' reads?  'isPrivate' tells which
+    // LIR_allocp areas are only used directly by loads and stores; nothing
+    // else can reach them.
+    static bool mayClobber(LIns* load, Seq<LIns*>* stores, AccSet callAccSet,
+                           HashMap<LIns*, bool>& isPrivate)
+    {
+        if (load->loadQual() == LOAD_CONST)
+            return false;
+        LIns* base = load->oprnd1();
+        bool priv = isPrivate.containsKey(base);
+        if (!priv && (callAccSet & load->accSet()))
+            return true;
+        for (Seq<LIns*>* s = stores; s; s = s->tail) {
+            LIns* st = s->head;
+            if (priv) {
+                if (st->oprnd2() == base &&
+                    st->disp() < load->disp() + accessSize(load->opcode()) &&
+                    load->disp() < st->disp() + accessSize(st->opcode()))
+                    return true;
+            } else if (!isPrivate.containsKey(st->oprnd2()) && (st->accSet() & load->accSet())) {
+                return true;
+            }
+        }
+        return false;
+    }
 
-                case LIR_start:
-                case LIR_regfence:
-                case LIR_pushstate:
-                case LIR_popstate:
-                case LIR_memfence:
-                case LIR_restorepc:
-                case LIR_paramp:
-                case LIR_x:
-                case LIR_xbarrier:
-                case LIR_j:
-                case LIR_label:
-                case LIR_immi:
-                CASE64(LIR_immq:)
-                case LIR_immd:
-                case LIR_immf:
-                case LIR_immf4:
-                case LIR_allocp:
-                case LIR_comment:
-                    // No operands, do nothing.
-                    break;
+    void LicmFilter::analyze(LIns** insns, uint32_t n)
+    {
+        // Find the loops: last[l] is the last branch back to label l, or 0
+        // if there is none.
+        HashMap<LIns*, uint32_t> index(_alloc, n / 4 + 16);
+        uint32_t* last = new (_alloc) uint32_t[n];
+        VMPI_memset(last, 0, n * sizeof(uint32_t));
+        uint32_t nloops = 0;
+        for (uint32_t i = 0; i < n; i++) {
+            LIns* ins = insns[i];
+            uint32_t ntargets = ins->isop(LIR_jtbl) ? ins->getTableSize() : ins->isBranch() ? 1 : 0;
+            for (uint32_t t = 0; t < ntargets; t++) {
+                LIns* target = ins->isop(LIR_jtbl) ? ins->getTarget(t) : ins->getTarget();
+                if (index.containsKey(target)) {
+                    uint32_t l = index.get(target);
+                    if (!last[l])
+                        nloops++;
+                    last[l] = i;
+                }
+            }
+            index.put(ins, i);
+        }
+        if (!nloops)
+            return;
 
-                case LIR_ldi:
-                CASE64(LIR_ldq:)
-                case LIR_ldd:
-                case LIR_ldf:
-                case LIR_ldf4:
-                case LIR_lduc2ui:
-                case LIR_ldus2ui:
-                case LIR_ldc2i:
-                case LIR_lds2i:
-                case LIR_ldf2d:
-                case LIR_reti:
-                CASE64(LIR_retq:)
-                case LIR_retd:
-                case LIR_retf:
-                case LIR_retf4:
-                case LIR_livei:
-                CASE64(LIR_liveq:)
-                case LIR_lived:
-                case LIR_livef:
-                case LIR_livef4:
-                case LIR_xt:
-                case LIR_xf:
-                case LIR_jt:
-                case LIR_jf:
-				case LIR_brsavpc:
-                case LIR_jtbl:
-                case LIR_negi:
-                CASE86(LIR_negq:)
-                case LIR_noti:
-                CASE86(LIR_notq:)
-                case LIR_negd:
-                case LIR_negf:
-                case LIR_negf4:
-                case LIR_absd:
-                case LIR_absf:
-                case LIR_absf4:
-                case LIR_recipf:
-                case LIR_recipf4:
-                case LIR_rsqrtf:
-                case LIR_rsqrtf4:
-                case LIR_sqrtf:
-                case LIR_sqrtf4:
-                case LIR_sqrtd:
-                CASESF(LIR_dlo2i:)
-                CASESF(LIR_dhi2i:)
-                CASESF(LIR_hcalli:)
-                CASE64(LIR_i2q:)
-                CASE64(LIR_ui2uq:)
-                case LIR_i2d:
-                CASE64(LIR_q2d:)
-                case LIR_ui2d:
-                case LIR_i2f:
-                case LIR_ui2f:
-                case LIR_d2f:
-                case LIR_f2d:
-                case LIR_f2f4:
-                case LIR_f4x:
-                case LIR_f4y:
-                case LIR_f4z:
-                case LIR_f4w:
-                case LIR_swzf4:
-                CASE64(LIR_q2i:)
-                case LIR_d2i:
-                CASE64(LIR_dasq:)
-                CASE64(LIR_qasd:)
-                CASE86(LIR_modi:)
-                CASE86(LIR_modq:)
-                    live.add(ins->oprnd1(), 0);
-                    break;
-
-                case LIR_sti:
-                CASE64(LIR_stq:)
-                case LIR_std:
-                case LIR_stf:
-                case LIR_stf4:
-                case LIR_sti2c:
-                case LIR_sti2s:
-                case LIR_std2f:
-                case LIR_eqi:
-                case LIR_lti:
-                case LIR_gti:
-                case LIR_lei:
-                case LIR_gei:
-                case LIR_ltui:
-                case LIR_gtui:
-                case LIR_leui:
-                case LIR_geui:
-                case LIR_eqd:
-                case LIR_ltd:
-                case LIR_gtd:
-                case LIR_led:
-                case LIR_ged:
-                case LIR_eqf:
-                case LIR_ltf:
-                case LIR_gtf:
-                case LIR_lef:
-                case LIR_gef:
-                case LIR_eqf4:
-                CASE64(LIR_eqq:)
-                CASE64(LIR_ltq:)
-                CASE64(LIR_gtq:)
-                CASE64(LIR_leq:)
-                CASE64(LIR_geq:)
-                CASE64(LIR_ltuq:)
-                CASE64(LIR_gtuq:)
-                CASE64(LIR_leuq:)
-                CASE64(LIR_geuq:)
-                case LIR_lshi:
-                case LIR_rshi:
-                case LIR_rshui:
-                CASE64(LIR_lshq:)
-                CASE64(LIR_rshq:)
-                CASE64(LIR_rshuq:)
-                case LIR_addi:
-                case LIR_subi:
-                case LIR_muli:
-                case LIR_addxovi:
-                case LIR_subxovi:
-                case LIR_mulxovi:
-                case LIR_addjovi:
-                case LIR_subjovi:
-                case LIR_muljovi:
-                CASE86(LIR_divi:)
-                case LIR_addd:
-                case LIR_subd:
-                case LIR_muld:
-                case LIR_divd:
-                case LIR_addf:
-                case LIR_subf:
-                case LIR_mulf:
-                case LIR_divf:
-                case LIR_addf4:
-                case LIR_subf4:
-                case LIR_mulf4:
-                case LIR_divf4:
-                case LIR_dotf4:
-                case LIR_dotf3:
-                case LIR_dotf2:
-                case LIR_minf4:
-                case LIR_maxf4:
-                case LIR_cmpgtf4:
-                case LIR_cmpgef4:
-                case LIR_cmpltf4:
-                case LIR_cmplef4:
-                case LIR_cmpeqf4:
-                case LIR_cmpnef4:
-                CASE64(LIR_addq:)
-                CASE64(LIR_subq:)
-                CASE86(LIR_mulq:)
-                CASE64(LIR_addjovq:)
-                CASE64(LIR_subjovq:)
-                CASE86(LIR_divq:)
-                case LIR_andi:
-                case LIR_ori:
-                case LIR_xori:
-                CASE64(LIR_andq:)
-                CASE64(LIR_orq:)
-                CASE64(LIR_xorq:)
-                CASESF(LIR_ii2d:)
-                case LIR_file:
-                case LIR_line:
-                    live.add(ins->oprnd1(), 0);
-                    live.add(ins->oprnd2(), 0);
-                    break;
-
-                case LIR_cmovi:
-                CASE64(LIR_cmovq:)
-                case LIR_cmovd:
-                case LIR_cmovf:
-                case LIR_cmovf4:
-                    live.add(ins->oprnd1(), 0);
-                    live.add(ins->oprnd2(), 0);
-                    live.add(ins->oprnd3(), 0);
-                    break;
-                case LIR_ffff2f4:
-                    live.add(ins->oprnd1(), 0);
-                    live.add(ins->oprnd2(), 0);
-                    live.add(ins->oprnd3(), 0);
-                    live.add(ins->oprnd4(), 0);
-                    break;
-                        
-                case LIR_callv:
-                case LIR_calli:
-                CASE64(LIR_callq:)
-                case LIR_calld:
-                case LIR_callf:
-                case LIR_callf4:
-                    for (int i = 0, argc = ins->argc(); i < argc; i++)
-                        live.add(ins->arg(i), 0);
-                    break;
+        uint32_t* heads = new (_alloc) uint32_t[nloops];
+        nloops = 0;
+        for (uint32_t l = 0; l < n; l++) {
+            if (last[l])
+                heads[nloops++] = l;
+        }
 
-                default:
-                    NanoAssertMsgf(0, "unhandled opcode: %d", ins->opcode());
-                    break;
+        // Only move code out of loops that can be entered solely by falling
+        // into the label; anything else would skip the moved code.
+        bool* entered = new (_alloc) bool[n];
+        VMPI_memset(entered, 0, n * sizeof(bool));
+        for (uint32_t k = 0; k < nloops; k++) {
+            uint32_t l = heads[k];
+            uint32_t p = l - 1;
+            while (p > 0 && (isLiveOpcode(insns[p]->opcode()) || insns[p]->isop(LIR_comment)))
+                p--;
+            LIns* prev = insns[p];
+            if (prev->isUnConditionalBranch() || prev->isRet() || prev->isop(LIR_x))
+                entered[l] = true;
+        }
+        for (uint32_t i = 0; i < n; i++) {
+            LIns* ins = insns[i];
+            uint32_t ntargets = ins->isop(LIR_jtbl) ? ins->getTableSize() : ins->isBranch() ? 1 : 0;
+            for (uint32_t t = 0; t < ntargets; t++) {
+                uint32_t target = index.get(ins->isop(LIR_jtbl) ? ins->getTarget(t) : ins->getTarget());
+                for (uint32_t k = 0; k < nloops; k++) {
+                    uint32_t l = heads[k];
+                    if ((target == l && i < l) ||
+                        (target > l && target <= last[l] && (i < l || i > last[l])))
+                        entered[l] = true;
                 }
             }
         }
 
-        logc->printf("  Live instruction count %d, total %u, max pressure %d\n",
-                     live.retiredCount, total, live.maxlive);
-        if (exits > 0)
-            logc->printf("  Side exits %u\n", exits);
-        logc->printf("  Showing LIR instructions with live-after variables\n");
-        logc->printf("\n");
+        HashMap<LIns*, bool> isPrivate(_alloc);
+        findPrivateAreas(insns, n, isPrivate, _alloc);
 
-        // print live exprs, going forwards
-        LInsPrinter *printer = frag->lirbuf->printer;
-        bool newblock = true;
-        for (Seq<RetiredEntry*>* p = live.retired.get(); p != NULL; p = p->tail) {
-            RetiredEntry* e = p->head;
-            InsBuf ib;
-            RefBuf rb;
-            char livebuf[4000], *s=livebuf;
-            *s = 0;
-            if (!newblock && e->i->isop(LIR_label)) {
-                logc->printf("\n");
-            }
-            newblock = false;
-            for (Seq<LIns*>* p = e->live; p != NULL; p = p->tail) {
-                VMPI_strcpy(s, printer->formatRef(&rb, p->head));
-                s += VMPI_strlen(s);
-                *s++ = ' '; *s = 0;
-                NanoAssert(s < livebuf+sizeof(livebuf));
+        // Innermost loops first, so that what is moved out of an inner loop
+        // can be moved out of the loops around it as well.
+        for (uint32_t k = 1; k < nloops; k++) {
+            uint32_t l = heads[k], j = k;
+            for (; j > 0 && last[heads[j - 1]] - heads[j - 1] > last[l] - l; j--)
+                heads[j] = heads[j - 1];
+            heads[j] = l;
+        }
+
+        // Code is moved around on a list threaded through the buffer order.
+        uint32_t* next = new (_alloc) uint32_t[n];
+        uint32_t* prev = new (_alloc) uint32_t[n];
+        for (uint32_t i = 0; i < n; i++) {
+            next[i] = i + 1;
+            prev[i] = i - 1;
+        }
+        // inLoop[i] and invariant[i] are k + 1 while looking at loop k.
+        uint32_t* inLoop = new (_alloc) uint32_t[n];
+        uint32_t* invariant = new (_alloc) uint32_t[n];
+        VMPI_memset(inLoop, 0, n * sizeof(uint32_t));
+        VMPI_memset(invariant, 0, n * sizeof(uint32_t));
+
+        for (uint32_t k = 0; k < nloops; k++) {
+            uint32_t l = heads[k], e = last[l], mark = k + 1;
+            if (entered[l])
+                continue;
+
+            Seq<LIns*>* stores = NULL;
+            AccSet callAccSet = ACCSET_NONE;
+            for (uint32_t i = next[l]; i != e; i = next[i]) {
+                LIns* ins = insns[i];
+                inLoop[i] = mark;
+                if (ins->isStore())
+                    stores = new (_alloc) Seq<LIns*>(ins, stores);
+                else if (ins->isCall() && !ins->callInfo()->_isPure)
+                    callAccSet |= ins->callInfo()->_storeAccSet;
             }
-            /* If the LIR insn is pretty short, print it and its
-               live-after set on the same line.  If not, put
-               live-after set on a new line, suitably indented. */
-            const char* insn_text = printer->formatIns(&ib, e->i);
-            if (VMPI_strlen(insn_text) >= 30-2) {
-                logc->printf("  %-30s\n  %-30s %s\n", insn_text, "", livebuf);
-            } else {
-                logc->printf("  %-30s %s\n", insn_text, livebuf);
+
+            // Until the first exit, everything runs whenever the loop is
+            // entered, so faulting is no worse there.
+            bool always = true;
+            for (uint32_t i = next[l]; i != e; i = next[i]) {
+                LIns* ins = insns[i];
+                LOpcode op = ins->opcode();
+                bool ok = true;
+                for (uint32_t o = 0, nops = ins->numOperands(); ok && o < nops; o++) {
+                    LIns* v = ins->operand(o);
+                    if (v) {
+                        uint32_t d = index.get(v);
+                        ok = inLoop[d] != mark || invariant[d] == mark;
+                    }
+                }
+                if (!ok) {
+                    // not invariant
+                } else if (ins->isLoad()) {
+                    ok = ins->loadQual() != LOAD_VOLATILE &&
+                         (always || isPrivate.containsKey(ins->oprnd1())) &&
+                         !mayClobber(ins, stores, callAccSet, isPrivate);
+                } else if (ins->isCall()) {
+                    ok = always && ins->callInfo()->_isPure;
+                } else {
+                    // Integer division can fault, and LIR_modi must stay
+                    // with its LIR_divi.
+                    ok = !ins->isV() && !ins->isGuard() && isCseOpcode(op);
+                    switch (op) {
+                    CASE86(LIR_divi:) CASE86(LIR_modi:)
+                    CASE86(LIR_divq:) CASE86(LIR_modq:)
+                        ok = false;
+                        break;
+                    default:
+                        break;
+                    }
+                }
+                if (ok)
+                    invariant[i] = mark;
+                if (ins->isBranch() || ins->isGuard() || ins->isRet() ||
+                    (ins->isCall() && !ins->callInfo()->_isPure))
+                    always = false;
             }
 
-            if (e->i->isGuard() || e->i->isBranch() || e->i->isRet()) {
-                logc->printf("\n");
-                newblock = true;
+            // Move the invariant code to just before the label, keeping its
+            // order.  Constants are only moved when something moved uses
+            // them.
+            for (uint32_t i = next[l], nexti; i != e; i = nexti) {
+                nexti = next[i];
+                LIns* ins = insns[i];
+                if (invariant[i] != mark || ins->isImmAny())
+                    continue;
+                for (uint32_t o = 0, nops = ins->numOperands(); o <= nops; o++) {
+                    uint32_t m;
+                    if (o < nops) {
+                        LIns* v = ins->operand(o);
+                        if (!v || !v->isImmAny())
+                            continue;
+                        m = index.get(v);
+                        if (inLoop[m] != mark)
+                            continue;
+                    } else {
+                        m = i;
+                    }
+                    next[prev[m]] = next[m];
+                    prev[next[m]] = prev[m];
+                    next[prev[l]] = m;
+                    prev[m] = prev[l];
+                    next[m] = l;
+                    prev[l] = m;
+                    inLoop[m] = 0;
+                }
             }
         }
-    }
 
-    void LirNameMap::addNameWithSuffix(LIns* ins, const char *name, int suffix,
-                                       bool ignoreOneSuffix) {
-        NanoAssert(!names.containsKey(ins));
-        const int N = 100;
-        char name2[N];
-        if (suffix == 1 && ignoreOneSuffix) {
-            VMPI_snprintf(name2, N, "%s", name);                // don't add '1' suffix
-        } else if (VMPI_isdigit(name[VMPI_strlen(name)-1])) {
-            VMPI_snprintf(name2, N, "%s_%d", name, suffix);     // use '_' to avoid confusion
-        } else {
-            VMPI_snprintf(name2, N, "%s%d", name, suffix);      // normal case
+        LIns** moved = new (_alloc) LIns*[n];
+        for (uint32_t i = 0, j = 0; j < n; i = next[i], j++)
+            moved[j] = insns[i];
+        _insns = moved;
+    }
+
+    // The serialized form starts with a header: the bytes of
+    // LIR_SERIAL_MAGIC, the format version, the word size and LIR_sentinel,
+    // which together reject LIR from an incompatible build, followed by the
+    // number of instructions.  Unsigned values are LEB128 encoded and signed
+    // ones are zigzag encoded first.  Operands are encoded as the distance
+    // back to the instruction they refer to, 0 meaning NULL; branch targets
+    // may also refer forwards, so they are signed.
+    static const uint8_t LIR_SERIAL_MAGIC[4] = { 'N', 'J', 'L', 'R' };
+    static const uint8_t LIR_SERIAL_VERSION = 2;
+
+    LirSerializer::LirSerializer(LirFilter* in, Allocator& alloc, LirSymbols& symbols)
+        : LirFilter(in), alloc(alloc), symbols(symbols),
+          insns(NULL), nInsns(0), capInsns(0),
+          buf(NULL), bufSize(0), bufCap(0), done(false), ok(true)
+    {}
+
+    LIns* LirSerializer::read()
+    {
+        LIns* ins = in->read();
+        if (done)
+            return ins;
+        if (nInsns == capInsns) {
+            capInsns = capInsns ? capInsns * 2 : 256;
+            LIns** insns2 = new (alloc) LIns*[capInsns];
+            if (nInsns)
+                memcpy(insns2, insns, nInsns * sizeof(LIns*));
+            insns = insns2;
+        }
+        insns[nInsns++] = ins;
+        if (ins->isop(LIR_start)) {
+            encode();
+            done = true;
         }
+        return ins;
+    }
 
-        char *copy = new (alloc) char[VMPI_strlen(name2)+1];
-        VMPI_strcpy(copy, name2);
-        Entry *e = new (alloc) Entry(copy);
-        names.put(ins, e);
+    void LirSerializer::grow(size_t n)
+    {
+        if (bufSize + n <= bufCap)
+            return;
+        size_t cap = bufCap ? bufCap * 2 : 4096;
+        while (cap < bufSize + n)
+            cap *= 2;
+        uint8_t* buf2 = (uint8_t*)alloc.alloc(cap);
+        if (bufSize)
+            memcpy(buf2, buf, bufSize);
+        buf = buf2;
+        bufCap = cap;
     }
 
-    void LirNameMap::addName(LIns* ins, const char* name) {
-        // The lookup may succeed, ie. we may already have a name for this
-        // instruction.  This can happen because of CSE.  Eg. if we have this:
-        //
-        //   ins = addName("foo", insImmI(0))
-        //
-        // that assigns the name "foo1" to 'ins'.  If we later do this:
-        //
-        //   ins2 = addName("foo", insImmI(0))
-        //
-        // then CSE will cause 'ins' and 'ins2' to be equal.  So 'ins2'
-        // already has a name ("foo1") and there's no need to generate a new
-        // name "foo2".
-        //
-        if (!names.containsKey(ins)) {
-            Str* str = new (alloc) Str(alloc, name);
-            int suffix = namecounts.add(*str);
-            addNameWithSuffix(ins, name, suffix, /*ignoreOneSuffix*/true);
-        }
-    }
-
-    const char* LirNameMap::createName(LIns* ins) {
-        if (ins->isCall()) {
-#if NJ_SOFTFLOAT_SUPPORTED
-            if (ins->isop(LIR_hcalli)) {
-                ins = ins->oprnd1();    // we've presumably seen the other half already
-            } else
-#endif
-            {
-                if (!names.containsKey(ins))
-                    addNameWithSuffix(ins, ins->callInfo()->_name, funccounts.add(ins->callInfo()),
-                                      /*ignoreOneSuffix*/false);
-            }
-        } else {
-            if (!names.containsKey(ins))
-                addNameWithSuffix(ins, lirNames[ins->opcode()], lircounts.add(ins->opcode()),
-                                  /*ignoreOneSuffix*/false);
-
-        }
-        return names.get(ins)->name;
+    void LirSerializer::putByte(uint8_t b)
+    {
+        grow(1);
+        buf[bufSize++] = b;
     }
 
-    const char* LirNameMap::lookupName(LIns* ins)
+    void LirSerializer::putBytes(const void* p, size_t n)
     {
-        Entry* e = names.get(ins);
-        return e ? e->name : NULL;
+        grow(n);
+        memcpy(buf + bufSize, p, n);
+        bufSize += n;
     }
 
-    char* LInsPrinter::formatAccSet(RefBuf* buf, AccSet accSet) {
-        if (accSet == ACCSET_NONE) {
-            VMPI_sprintf(buf->buf, ".none");
-        } else if (accSet == ACCSET_ALL) {
-            VMPI_sprintf(buf->buf, ".all");
-        } else {
-            char* b = buf->buf;
-            b[0] = 0;
-            // The AccSet may contain bits set for regions not used by the
-            // embedding, if any have been specified via
-            // (ACCSET_ALL & ~ACCSET_XYZ).  So only print those that are
-            // relevant.
-            for (int i = 0; i < EMB_NUM_USED_ACCS; i++) {
-                if (accSet & (1 << i)) {
-					VMPI_strcat(b, buf->len, ".");
-					VMPI_strcat(b, buf->len, accNames[i]);
-                    accSet &= ~(1 << i);
-                }
-            }
-            NanoAssert(VMPI_strlen(b) < buf->len);
+    void LirSerializer::putU(uint64_t v)
+    {
+        grow(10);
+        while (v >= 0x80) {
+            buf[bufSize++] = uint8_t(v | 0x80);
+            v >>= 7;
         }
-        return buf->buf;
+        buf[bufSize++] = uint8_t(v);
     }
 
-    char* LInsPrinter::formatImmI(RefBuf* buf, int32_t c) {
-        if (-10000 < c && c < 10000) {
-            VMPI_snprintf(buf->buf, buf->len, "%d", c);
-        } else {
-#if !defined NANOJIT_64BIT
-            formatAddr(buf, (void*)c);
-#else
-            VMPI_snprintf(buf->buf, buf->len, "0x%x", (unsigned int)c);
-#endif
-        }
-        return buf->buf;
+    void LirSerializer::putS(int64_t v)
+    {
+        putU((uint64_t(v) << 1) ^ uint64_t(v >> 63));
     }
 
-#if defined NANOJIT_64BIT
-    char* LInsPrinter::formatImmQ(RefBuf* buf, uint64_t c) {
-        if (-10000 < (int64_t)c && c < 10000) {
-            VMPI_snprintf(buf->buf, buf->len, "%dLL", (int)c);
+    void LirSerializer::putRef(HashMap<LIns*, uint32_t>& index, uint32_t cur, LIns* ins)
+    {
+        if (!ins) {
+            putU(0);
+        } else if (index.containsKey(ins)) {
+            putU(cur - index.get(ins));
         } else {
-            formatAddr(buf, (void*)c);
+            // not part of the stream being serialized
+            ok = false;
+            putU(0);
         }
-        return buf->buf;
-    }
-#endif
-
-    char* LInsPrinter::formatImmD(RefBuf* buf, double c) {
-        VMPI_snprintf(buf->buf, buf->len, "%g", c);
-        return buf->buf;
     }
 
-    char* LInsPrinter::formatAddr(RefBuf* buf, void* p)
+    void LirSerializer::putTarget(HashMap<LIns*, uint32_t>& index, uint32_t cur, LIns* label)
     {
-        char*   name;
-        int32_t offset;
-        addrNameMap->lookupAddr(p, name, offset);
-
-        if (name) {
-            if (offset != 0) {
-                VMPI_snprintf(buf->buf, buf->len, "%p %s+%d", p, name, offset);
-            } else {
-                VMPI_snprintf(buf->buf, buf->len, "%p %s", p, name);
-            }
+        if (!label) {
+            putS(0);
+        } else if (index.containsKey(label)) {
+            putS(int64_t(cur) - int64_t(index.get(label)));
         } else {
-            VMPI_snprintf(buf->buf, buf->len, "%p", p);
+            ok = false;
+            putS(0);
         }
-
-        return buf->buf;
     }
 
-    const char* LInsPrinter::formatTaint(LIns* ref)
-    {
-        return ref->isTainted() ? " !" : "";
-    }
-
-    char* LInsPrinter::formatRef(RefBuf* buf, LIns *ref, bool showImmValue)
+    void LirSerializer::encode()
     {
-        // Give 'ref' a name if it doesn't have one.
-        const char* name = lirNameMap->lookupName(ref);
-        if (!name) {
-            name = lirNameMap->createName(ref);
-        }
+        HashMap<LIns*, uint32_t> index(alloc, nInsns < 64 ? 64 : nInsns);
+        for (uint32_t i = 0; i < nInsns; i++)
+            index.put(insns[nInsns - 1 - i], i);
+        HashMap<const CallInfo*, uint32_t> calls(alloc);
+        uint32_t nCalls = 0;
 
-        // Put it in the buffer.  If it's an immediate, show the value if
-        // showImmValue==true.  (This facility allows us to print immediate
-        // values when they're used but not when they're def'd, ie. we don't
-        // want "immi1/*1*/ = immi 1".)
-        RefBuf buf2;
-        if (ref->isImmI() && showImmValue) {
-            VMPI_snprintf(buf->buf, buf->len, "%s/*%s*/%s", name, formatImmI(&buf2, ref->immI()), formatTaint(ref));
-        }
-#ifdef NANOJIT_64BIT
-        else if (ref->isImmQ() && showImmValue) {
-            VMPI_snprintf(buf->buf, buf->len, "%s/*%s*/%s", name, formatImmQ(&buf2, ref->immQ()), formatTaint(ref));
-        }
-#endif
-        else if (ref->isImmD() && showImmValue) {
-            VMPI_snprintf(buf->buf, buf->len, "%s/*%s*/%s", name, formatImmD(&buf2, ref->immD()), formatTaint(ref));
-        } 
-        else if (ref->isImmF() && showImmValue) { // float is printed as a double
-            VMPI_snprintf(buf->buf, buf->len, "%s/*%s*/%s", name, formatImmD(&buf2, ref->immF()), formatTaint(ref));
-        }
-        else if (ref->isImmF4() && showImmValue) { // float4 is printed as an array of 4 double values
-            RefBuf bufx, bufy, bufz, bufw;
-            float4_t v = ref->immF4();
-            VMPI_snprintf(buf->buf, buf->len, "%s/*%s,%s,%s,%s*/%s", name, formatImmD(&bufx,f4_x(v)),
-                          formatImmD(&bufy,f4_y(v)), formatImmD(&bufz,f4_z(v)), formatImmD(&bufw,f4_w(v)), formatTaint(ref));
-        }
-        else {
-            VMPI_snprintf(buf->buf, buf->len, "%s", name);
-        }
+        putBytes(LIR_SERIAL_MAGIC, sizeof(LIR_SERIAL_MAGIC));
+        putByte(LIR_SERIAL_VERSION);
+        putByte(uint8_t(sizeof(void*)));
+        putU(LIR_sentinel);
+        putU(nInsns);
 
-        return buf->buf;
-    }
+        for (uint32_t cur = 0; cur < nInsns && ok; cur++) {
+            LIns* ins = insns[nInsns - 1 - cur];
+            LOpcode op = ins->opcode();
+            putU(op);
+            switch (repKinds[op]) {
+            case LRK_Op0:
+                break;
 
-    char* LInsPrinter::formatIns(InsBuf* buf, LIns* i)
-    {
-        char *s = buf->buf;
-        size_t n = buf->len;
-        RefBuf b1, b2, b3, b4, b5;
-        LOpcode op = i->opcode();
-        switch (op)
-        {
-            case LIR_immi:
-                VMPI_snprintf(s, n, "%s = %s %s%s", formatRef(&b1, i, /*showImmValue*/false),
-                              lirNames[op], formatImmI(&b2, i->immI()), formatTaint(i));
+            case LRK_Op1:
+                if (op == LIR_comment) {
+                    const char* str = (const char*)ins->oprnd1();
+                    size_t len = VMPI_strlen(str);
+                    putU(len);
+                    putBytes(str, len);
+                } else {
+                    putRef(index, cur, ins->oprnd1());
+                }
                 break;
 
-#ifdef NANOJIT_64BIT
-            case LIR_immq:
-                VMPI_snprintf(s, n, "%s = %s %s%s", formatRef(&b1, i, /*showImmValue*/false),
-                              lirNames[op], formatImmQ(&b2, i->immQ()), formatTaint(i));
+            case LRK_Op1b:
+                putRef(index, cur, ins->oprnd1());
+                putByte(ins->mask());
                 break;
-#endif
 
-            case LIR_immf:
-                VMPI_snprintf(s, n, "%s = %s %s%s", formatRef(&b1, i, /*showImmValue*/false),
-                              lirNames[op], formatImmD(&b2, i->immF()), formatTaint(i));
+            case LRK_Op2:
+                putRef(index, cur, ins->oprnd1());
+                if (ins->isGuard())
+                    putU(symbols.guardId(ins->record()));
+                else if (ins->isBranch())
+                    putTarget(index, cur, ins->getTarget());
+                else
+                    putRef(index, cur, ins->oprnd2());
                 break;
 
-            case LIR_immf4:{
-                RefBuf b5;
-                float4_t v = i->immF4();
-                VMPI_snprintf(s, n, "%s = %s %s,%s,%s,%s%s", formatRef(&b1, i, /*showImmValue*/false),
-                              lirNames[op], formatImmD(&b2, f4_x(v)), formatImmD(&b3, f4_y(v)),
-                              formatImmD(&b4, f4_z(v)), formatImmD(&b5, f4_w(v)), formatTaint(i));
+            case LRK_Op3:
+                putRef(index, cur, ins->oprnd1());
+                putRef(index, cur, ins->oprnd2());
+                if (ins->isGuard())
+                    putU(symbols.guardId(ins->record()));
+                else if (ins->isJov())
+                    putTarget(index, cur, ins->getTarget());
+                else
+                    putRef(index, cur, ins->oprnd3());
                 break;
-            }
 
-            case LIR_immd:
-                VMPI_snprintf(s, n, "%s = %s %s%s", formatRef(&b1, i, /*showImmValue*/false),
-                              lirNames[op], formatImmD(&b2, i->immD()), formatTaint(i));
+            case LRK_Op4:
+                putRef(index, cur, ins->oprnd1());
+                putRef(index, cur, ins->oprnd2());
+                putRef(index, cur, ins->oprnd3());
+                putRef(index, cur, ins->oprnd4());
                 break;
-                
-            case LIR_allocp:
-                VMPI_snprintf(s, n, "%s = %s %d", formatRef(&b1, i), lirNames[op], i->size());
+
+            case LRK_Ld:
+                putRef(index, cur, ins->oprnd1());
+                putS(ins->disp());
+                putU(ins->accSet());
+                putByte(uint8_t(ins->loadQual()));
+                putByte(ins->isTainted());
                 break;
 
-            case LIR_start:
-            case LIR_regfence:
-	        case LIR_pushstate:
-	        case LIR_popstate:
-            case LIR_memfence:
-            case LIR_restorepc:
-                VMPI_snprintf(s, n, "%s", lirNames[op]);
+            case LRK_St:
+                putRef(index, cur, ins->oprnd1());
+                putRef(index, cur, ins->oprnd2());
+                putS(ins->disp());
+                putU(ins->accSet());
+                putByte(ins->isTainted());
                 break;
 
-            case LIR_callv:
-            case LIR_calli:
-            CASE64(LIR_callq:)
-            case LIR_calld: 
-            case LIR_callf:
-            case LIR_callf4:
-            {
-                const CallInfo* call = i->callInfo();
-                int32_t argc = i->argc();
-                int32_t m = int32_t(n);     // Windows doesn't have 'ssize_t'
-                if (call->isIndirect())
-                    m -= VMPI_snprintf(s, m, "%s = %s%s [%s] ( ", formatRef(&b1, i), lirNames[op],
-                                       formatAccSet(&b2, call->_storeAccSet),
-                                       formatRef(&b3, i->arg(--argc)));
-                else
-                    m -= VMPI_snprintf(s, m, "%s = %s%s #%s ( ", formatRef(&b1, i), lirNames[op],
-                                       formatAccSet(&b2, call->_storeAccSet), call->_name);
-                if (m < 0) break;
-                for (int32_t j = argc - 1; j >= 0; j--) {
-                    s += VMPI_strlen(s);
-                    m -= VMPI_snprintf(s, m, "%s ",formatRef(&b2, i->arg(j)));
-                    if (m < 0) break;
+            case LRK_C: {
+                const CallInfo* ci = ins->callInfo();
+                if (calls.containsKey(ci)) {
+                    putU(calls.get(ci));
+                } else {
+                    // the first call to a function also describes it
+                    const char* name = symbols.callName(ci);
+                    if (!name) {
+                        ok = false;
+                        break;
+                    }
+                    calls.put(ci, nCalls);
+                    putU(nCalls++);
+                    size_t len = VMPI_strlen(name);
+                    putU(len);
+                    putBytes(name, len);
+                    putU(ci->_typesig);
+                    putByte(uint8_t(ci->_abi));
+                    putByte(uint8_t(ci->_isPure));
+                    putU(ci->_storeAccSet);
                 }
-                s += VMPI_strlen(s);
-                m -= VMPI_snprintf(s, m, ")");
+                for (uint32_t i = 0; i < ins->argc(); i++)
+                    putRef(index, cur, ins->arg(i));
                 break;
             }
 
-            case LIR_jtbl: {
-                int32_t m = int32_t(n);     // Windows doesn't have 'ssize_t'
-                m -= VMPI_snprintf(s, m, "%s %s [ ", lirNames[op], formatRef(&b1, i->oprnd1()));
-                if (m < 0) break;
-                for (uint32_t j = 0, sz = i->getTableSize(); j < sz; j++) {
-                    LIns* target = i->getTarget(j);
-                    s += VMPI_strlen(s);
-                    m -= VMPI_snprintf(s, m, "%s ", target ? formatRef(&b2, target) : "unpatched");
-                    if (m < 0) break;
-                }
-                s += VMPI_strlen(s);
-                m -= VMPI_snprintf(s, m, "]");
+            case LRK_P:
+                putByte(ins->paramArg());
+                putByte(ins->paramKind());
                 break;
-            }
 
-            case LIR_paramp: {
-                uint32_t arg = i->paramArg();
-                if (!i->paramKind()) {
-                    if (arg < sizeof(RegAlloc::argRegs)/sizeof(RegAlloc::argRegs[0])) {
-                        VMPI_snprintf(s, n, "%s = %s %d %s", formatRef(&b1, i), lirNames[op],
-                            arg, gpn(RegAlloc::argRegs[arg]));
-                    } else {
-                        VMPI_snprintf(s, n, "%s = %s %d", formatRef(&b1, i), lirNames[op], arg);
-                    }
+            case LRK_IorF:
+                if (op == LIR_allocp) {
+                    putU(ins->size());
                 } else {
-                    VMPI_snprintf(s, n, "%s = %s %d %s", formatRef(&b1, i), lirNames[op],
-                        arg, gpn(RegAlloc::savedRegs[arg]));
+                    putS(op == LIR_immf ? ins->immFasI() : ins->immI());
+                    putByte(ins->isTainted());
                 }
                 break;
+
+            case LRK_QorD: {
+#ifdef NANOJIT_64BIT
+                uint64_t q = op == LIR_immq ? ins->immQ() : ins->immDasQ();
+#else
+                uint64_t q = ins->immDasQ();
+#endif
+                for (int i = 0; i < 8; i++)
+                    putByte(uint8_t(q >> (i * 8)));
+                putByte(ins->isTainted());
+                break;
             }
 
-            case LIR_label:
-                VMPI_snprintf(s, n, "%s:", formatRef(&b1, i));
+            case LRK_F4: {
+                float4_t f4 = ins->immF4();
+                float f[4] = { f4_x(f4), f4_y(f4), f4_z(f4), f4_w(f4) };
+                for (int i = 0; i < 4; i++) {
+                    uint32_t bits;
+                    memcpy(&bits, &f[i], sizeof(bits));
+                    for (int j = 0; j < 4; j++)
+                        putByte(uint8_t(bits >> (j * 8)));
+                }
+                putByte(ins->isTainted());
                 break;
+            }
 
-            case LIR_jt:
-            case LIR_jf:
-			case LIR_brsavpc:
-                VMPI_snprintf(s, n, "%s %s -> %s", lirNames[op], formatRef(&b1, i->oprnd1()),
-                    i->oprnd2() ? formatRef(&b2, i->oprnd2()) : "unpatched");
+            case LRK_Jtbl:
+                putRef(index, cur, ins->oprnd1());
+                putU(ins->getTableSize());
+                for (uint32_t i = 0; i < ins->getTableSize(); i++)
+                    putTarget(index, cur, ins->getTarget(i));
                 break;
 
-            case LIR_j:
-                VMPI_snprintf(s, n, "%s -> %s", lirNames[op],
-                    i->oprnd2() ? formatRef(&b1, i->oprnd2()) : "unpatched");
+            default:
+                // LRK_Safe payloads belong to the embedder and cannot be
+                // serialized; LRK_Sk is never returned by a LirReader.
+                ok = false;
                 break;
+            }
+        }
+    }
 
-            case LIR_livei:
-            case LIR_lived:
-            case LIR_livef:
-            case LIR_livef4:
-            CASE64(LIR_liveq:)
-            case LIR_reti:
-            CASE64(LIR_retq:)
-            case LIR_retd:
-            case LIR_retf:
-            case LIR_retf4:
-                VMPI_snprintf(s, n, "%s %s", lirNames[op], formatRef(&b1, i->oprnd1()));
+    // Decodes the fields written by LirSerializer.  Reading past the end of
+    // the data sets 'ok' to false and returns zeros.
+    class LirSerialReader
+    {
+        const uint8_t* p;
+        const uint8_t* end;
+    public:
+        bool ok;
+
+        LirSerialReader(const uint8_t* data, size_t size)
+            : p(data), end(data + size), ok(true)
+        {}
+
+        bool atEnd() const { return p == end; }
+
+        uint8_t getByte() {
+            if (p == end) {
+                ok = false;
+                return 0;
+            }
+            return *p++;
+        }
+
+        const uint8_t* getBytes(size_t n) {
+            if (size_t(end - p) < n) {
+                ok = false;
+                return NULL;
+            }
+            const uint8_t* q = p;
+            p += n;
+            return q;
+        }
+
+        uint64_t getU() {
+            uint64_t v = 0;
+            for (int shift = 0; shift < 64; shift += 7) {
+                uint8_t b = getByte();
+                v |= uint64_t(b & 0x7f) << shift;
+                if (!(b & 0x80))
+                    return v;
+            }
+            ok = false;
+            return 0;
+        }
+
+        int64_t getS() {
+            uint64_t v = getU();
+            return int64_t(v >> 1) ^ -int64_t(v & 1);
+        }
+
+        uint64_t getU64() {
+            uint64_t v = 0;
+            for (int i = 0; i < 8; i++)
+                v |= uint64_t(getByte()) << (i * 8);
+            return v;
+        }
+
+        uint32_t getU32() {
+            uint32_t v = 0;
+            for (int i = 0; i < 4; i++)
+                v |= uint32_t(getByte()) << (i * 8);
+            return v;
+        }
+
+        // Returns a NUL-terminated copy of a length-prefixed string.
+        const char* getString(Allocator& alloc) {
+            uint64_t len = getU();
+            const uint8_t* s = getBytes(size_t(len));
+            if (!s)
+                return NULL;
+            char* str = (char*)alloc.alloc(size_t(len) + 1);
+            memcpy(str, s, size_t(len));
+            str[len] = '\0';
+            return str;
+        }
+    };
+
+    // Reads an operand: the distance back to an earlier instruction, whose
+    // output is in insns[index + 1]; 0 is NULL.
+    static LIns* readRef(LirSerialReader& r, LIns** insns, uint64_t cur)
+    {
+        uint64_t d = r.getU();
+        if (!r.ok || d > cur) {
+            r.ok = false;
+            return NULL;
+        }
+        return d ? insns[cur - d + 1] : NULL;
+    }
+
+    static bool isJovOp(LOpcode op)
+    {
+        return
+#ifdef NANOJIT_64BIT
+            op == LIR_addjovq || op == LIR_subjovq ||
+#endif
+            op == LIR_addjovi || op == LIR_subjovi || op == LIR_muljovi;
+    }
+
+    LirLoader::LirLoader(Allocator& alloc, LirSymbols& symbols)
+        : alloc(alloc), symbols(symbols)
+    {}
+
+    bool LirLoader::load(const uint8_t* data, size_t size, LirWriter* out,
+                         LIns* const* bound, uint32_t nbound)
+    {
+        LirSerialReader r(data, size);
+        const uint8_t* magic = r.getBytes(sizeof(LIR_SERIAL_MAGIC));
+        if (!magic || VMPI_memcmp(magic, LIR_SERIAL_MAGIC, sizeof(LIR_SERIAL_MAGIC)) != 0 ||
+            r.getByte() != LIR_SERIAL_VERSION || r.getByte() != sizeof(void*) ||
+            r.getU() != LIR_sentinel)
+            return false;
+        uint64_t n = r.getU();
+        // Every instruction takes at least one byte.
+        if (!r.ok || n > size || n < nbound)
+            return false;
+
+        LIns** insns = new (alloc) LIns*[size_t(n) + 1];
+        insns[0] = NULL;    // operand 0 is NULL
+        const CallInfo** calls = NULL;
+        uint32_t nCalls = 0;
+        uint32_t capCalls = 0;
+
+        // Forward branches are patched once all labels have been written.
+        struct Fixup {
+            LIns* branch;
+            int32_t slot;       // jump table entry, or -1
+            uint64_t target;
+        };
+        SeqBuilder<Fixup> fixups(alloc);
+
+        for (uint64_t cur = 0; cur < n; cur++) {
+            LOpcode op = LOpcode(r.getU());
+            if (!r.ok || op >= LIR_sentinel || repKinds[op] == LRK_None ||
+                repKinds[op] == LRK_Sk || repKinds[op] == LRK_Safe)
+                return false;
+            if (op == LIR_start && cur != 0)
+                return false;
+
+            LIns* ins = NULL;
+            switch (repKinds[op]) {
+            case LRK_Op0:
+                if (cur < nbound) {
+                    ins = bound[cur];
+                    if (!ins->isop(op))
+                        return false;
+                } else {
+                    ins = out->ins0(op);
+                }
                 break;
 
-            CASESF(LIR_hcalli:)
-            case LIR_negi:
-            CASE86(LIR_negq:)
-            case LIR_negd:
-            case LIR_negf:
-            case LIR_negf4:
-            case LIR_absd:
-            case LIR_absf:
-            case LIR_absf4:
-            case LIR_sqrtd:
-            case LIR_sqrtf:
-            case LIR_sqrtf4:
-            case LIR_rsqrtf:
-            case LIR_rsqrtf4:
-            case LIR_recipf:
-            case LIR_recipf4:
-            case LIR_i2d:
-            CASE64(LIR_q2d:)
-            case LIR_ui2d:
-            case LIR_i2f:
-            case LIR_ui2f:
-            case LIR_f4x:
-            case LIR_f4y:
-            case LIR_f4z:
-            case LIR_f4w:
-            case LIR_f2f4:
-            CASESF(LIR_dlo2i:)
-            CASESF(LIR_dhi2i:)
-            case LIR_noti:
-            CASE86(LIR_notq:)
-            CASE86(LIR_modi:)
-            CASE86(LIR_modq:)
-            CASE64(LIR_i2q:)
-            CASE64(LIR_ui2uq:)
-            CASE64(LIR_q2i:)
-            case LIR_d2i:
-            case LIR_d2f:
-            case LIR_f2d:
-            case LIR_f2i:
-            CASE86(LIR_d2q:)
-            CASE64(LIR_dasq:)
-            CASE64(LIR_qasd:)
-                VMPI_snprintf(s, n, "%s = %s %s", formatRef(&b1, i), lirNames[op],
-                             formatRef(&b2, i->oprnd1()));
+            case LRK_Op1:
+                if (op == LIR_comment) {
+                    const char* str = r.getString(alloc);
+                    if (!str)
+                        return false;
+                    ins = out->insComment(str);
+                } else {
+                    LIns* a = readRef(r, insns, cur);
+                    if (!a)
+                        return false;
+                    ins = out->ins1(op, a);
+                }
                 break;
 
-            case LIR_x:
-            case LIR_xt:
-            case LIR_xf:
-            case LIR_xbarrier:
-                formatGuard(buf, i);
+            case LRK_Op1b: {
+                LIns* a = readRef(r, insns, cur);
+                uint8_t mask = r.getByte();
+                if (!a)
+                    return false;
+                ins = out->insSwz(a, mask);
                 break;
+            }
 
-            case LIR_addxovi:
-            case LIR_subxovi:
-            case LIR_mulxovi:
-                formatGuardXov(buf, i);
+            case LRK_Op2: {
+                LIns* a = readRef(r, insns, cur);
+                if (op == LIR_x || op == LIR_xt || op == LIR_xf || op == LIR_xbarrier) {
+                    uint64_t id = r.getU();
+                    if (!r.ok || (!a != (op == LIR_x || op == LIR_xbarrier)))
+                        return false;
+                    ins = out->insGuard(op, a, symbols.guardRecord(uint32_t(id)));
+                } else if (op == LIR_j || op == LIR_jt || op == LIR_jf || op == LIR_brsavpc) {
+                    int64_t delta = r.getS();
+                    if (!r.ok || (!a != (op == LIR_j)) || delta == 0 ||
+                        int64_t(cur) - delta < 0 || int64_t(cur) - delta >= int64_t(n))
+                        return false;
+                    uint64_t target = uint64_t(int64_t(cur) - delta);
+                    LIns* label = target < cur ? insns[target + 1] : NULL;
+                    if (target < cur && (!label || !label->isop(LIR_label)))
+                        return false;
+                    ins = out->insBranch(op, a, label);
+                    if (ins && target > cur) {
+                        Fixup f = { ins, -1, target };
+                        fixups.add(f);
+                    }
+                } else {
+                    LIns* b = readRef(r, insns, cur);
+                    if (!a || !b)
+                        return false;
+                    ins = out->ins2(op, a, b);
+                }
                 break;
+            }
 
-            case LIR_addjovi:
-            case LIR_subjovi:
-            case LIR_muljovi:
-            CASE64(LIR_addjovq:)
-            CASE64(LIR_subjovq:)
-                VMPI_snprintf(s, n, "%s = %s %s, %s ; ovf -> %s", formatRef(&b1, i), lirNames[op],
-                    formatRef(&b2, i->oprnd1()),
-                    formatRef(&b3, i->oprnd2()),
-                    i->oprnd3() ? formatRef(&b4, i->oprnd3()) : "unpatched");
+            case LRK_Op3: {
+                LIns* a = readRef(r, insns, cur);
+                LIns* b = readRef(r, insns, cur);
+                if (!a || !b)
+                    return false;
+                if (op == LIR_addxovi || op == LIR_subxovi || op == LIR_mulxovi) {
+                    uint64_t id = r.getU();
+                    if (!r.ok)
+                        return false;
+                    ins = out->insGuardXov(op, a, b, symbols.guardRecord(uint32_t(id)));
+                } else if (isJovOp(op)) {
+                    int64_t delta = r.getS();
+                    if (!r.ok || delta == 0 ||
+                        int64_t(cur) - delta < 0 || int64_t(cur) - delta >= int64_t(n))
+                        return false;
+                    uint64_t target = uint64_t(int64_t(cur) - delta);
+                    LIns* label = target < cur ? insns[target + 1] : NULL;
+                    if (target < cur && (!label || !label->isop(LIR_label)))
+                        return false;
+                    ins = out->insBranchJov(op, a, b, label);
+                    if (ins && target > cur) {
+                        Fixup f = { ins, -1, target };
+                        fixups.add(f);
+                    }
+                } else {
+                    LIns* c = readRef(r, insns, cur);
+                    if (!c)
+                        return false;
+                    ins = out->ins3(op, a, b, c);
+                }
                 break;
+            }
 
-            case LIR_addi:       CASE64(LIR_addq:)
-            case LIR_subi:       CASE64(LIR_subq:)
-            case LIR_muli:       CASE86(LIR_mulq:)
-            CASE86(LIR_divi:)    CASE86(LIR_divq:)
-            case LIR_addd:
-            case LIR_subd:
-            case LIR_muld:
-            case LIR_divd:
-            case LIR_addf:
-            case LIR_subf:
-            case LIR_mulf:
-            case LIR_divf:
-            case LIR_addf4:
-            case LIR_subf4:
-            case LIR_mulf4:
-            case LIR_divf4:
-            case LIR_dotf4:
-            case LIR_dotf3:
-            case LIR_dotf2:
-            case LIR_minf4:
-            case LIR_maxf4:
-            case LIR_cmpgtf4:
-            case LIR_cmpgef4:
-            case LIR_cmpltf4:
-            case LIR_cmplef4:
-            case LIR_cmpeqf4:
-            case LIR_cmpnef4:
-            case LIR_andi:       CASE64(LIR_andq:)
-            case LIR_ori:        CASE64(LIR_orq:)
-            case LIR_xori:       CASE64(LIR_xorq:)
-            case LIR_lshi:       CASE64(LIR_lshq:)
-            case LIR_rshi:       CASE64(LIR_rshq:)
-            case LIR_rshui:      CASE64(LIR_rshuq:)
-            case LIR_eqi:        CASE64(LIR_eqq:)
-            case LIR_lti:        CASE64(LIR_ltq:)
-            case LIR_lei:        CASE64(LIR_leq:)
-            case LIR_gti:        CASE64(LIR_gtq:)
-            case LIR_gei:        CASE64(LIR_geq:)
-            case LIR_ltui:       CASE64(LIR_ltuq:)
-            case LIR_leui:       CASE64(LIR_leuq:)
-            case LIR_gtui:       CASE64(LIR_gtuq:)
-            case LIR_geui:       CASE64(LIR_geuq:)
-            case LIR_eqd:
-            case LIR_ltd:
-            case LIR_led:
-            case LIR_gtd:
-            case LIR_ged:
-            case LIR_eqf4:
-            case LIR_eqf:
-            case LIR_ltf:
-            case LIR_lef:
-            case LIR_gtf:
-            case LIR_gef:
-#if NJ_SOFTFLOAT_SUPPORTED
-            case LIR_ii2d:
+            case LRK_Op4: {
+                LIns* a = readRef(r, insns, cur);
+                LIns* b = readRef(r, insns, cur);
+                LIns* c = readRef(r, insns, cur);
+                LIns* d = readRef(r, insns, cur);
+                if (!a || !b || !c || !d)
+                    return false;
+                ins = out->ins4(op, a, b, c, d);
+                break;
+            }
+
+            case LRK_Ld: {
+                LIns* base = readRef(r, insns, cur);
+                int64_t disp = r.getS();
+                AccSet accSet = AccSet(r.getU());
+                LoadQual loadQual = LoadQual(r.getByte());
+                bool tainted = r.getByte() != 0;
+                if (!r.ok || !base || disp != int64_t(int32_t(disp)))
+                    return false;
+                ins = out->insLoad(op, base, int32_t(disp), accSet, loadQual);
+                if (ins)
+                    ins->setLoadTainted(tainted);
+                break;
+            }
+
+            case LRK_St: {
+                LIns* value = readRef(r, insns, cur);
+                LIns* base = readRef(r, insns, cur);
+                int64_t disp = r.getS();
+                AccSet accSet = AccSet(r.getU());
+                bool tainted = r.getByte() != 0;
+                if (!r.ok || !value || !base || disp != int64_t(int32_t(disp)))
+                    return false;
+                ins = out->insStore(op, value, base, int32_t(disp), accSet);
+                if (ins)
+                    ins->setStoreTainted(tainted);
+                break;
+            }
+
+            case LRK_C: {
+                uint64_t id = r.getU();
+                if (!r.ok || id > nCalls)
+                    return false;
+                if (id == nCalls) {
+                    const char* name = r.getString(alloc);
+                    CallInfo desc;
+                    VMPI_memset(&desc, 0, sizeof(desc));
+                    desc._typesig = uint32_t(r.getU());
+                    desc._abi = AbiKind(r.getByte());
+                    desc._isPure = r.getByte();
+                    desc._storeAccSet = AccSet(r.getU());
+                    verbose_only( desc._name = name; )
+                    if (!r.ok || !name)
+                        return false;
+                    const CallInfo* ci = symbols.lookupCall(name, desc);
+                    if (!ci || ci->_typesig != desc._typesig)
+                        return false;
+                    if (nCalls == capCalls) {
+                        capCalls = capCalls ? capCalls * 2 : 16;
+                        const CallInfo** calls2 = new (alloc) const CallInfo*[capCalls];
+                        if (nCalls)
+                            memcpy(calls2, calls, nCalls * sizeof(const CallInfo*));
+                        calls = calls2;
+                    }
+                    calls[nCalls++] = ci;
+                }
+                const CallInfo* ci = calls[id];
+                uint32_t argc = ci->count_args();
+                if (argc > MAXARGS)
+                    return false;
+                LIns* args[MAXARGS];
+                for (uint32_t i = 0; i < argc; i++) {
+                    args[i] = readRef(r, insns, cur);
+                    if (!args[i])
+                        return false;
+                }
+                ins = out->insCall(ci, args);
+                break;
+            }
+
+            case LRK_P: {
+                uint8_t arg = r.getByte();
+                uint8_t kind = r.getByte();
+                if (!r.ok)
+                    return false;
+                if (cur < nbound) {
+                    ins = bound[cur];
+                    if (!ins->isop(op) || ins->paramArg() != arg || ins->paramKind() != kind)
+                        return false;
+                } else {
+                    ins = out->insParam(arg, kind, op);
+                }
+                break;
+            }
+
+            case LRK_IorF:
+                if (op == LIR_allocp) {
+                    uint64_t sz = r.getU();
+                    if (!r.ok || sz == 0 || sz > 0x7fffffff)
+                        return false;
+                    ins = out->insAlloc(int32_t(sz));
+                } else {
+                    int64_t v = r.getS();
+                    bool tainted = r.getByte() != 0;
+                    if (!r.ok || v != int64_t(int32_t(v)))
+                        return false;
+                    if (op == LIR_immf) {
+                        union { int32_t i; float f; } u;
+                        u.i = int32_t(v);
+                        ins = out->insImmF(u.f, tainted);
+                    } else {
+                        ins = out->insImmI(int32_t(v), tainted);
+                    }
+                }
+                break;
+
+            case LRK_QorD: {
+                uint64_t q = r.getU64();
+                bool tainted = r.getByte() != 0;
+                if (!r.ok)
+                    return false;
+#ifdef NANOJIT_64BIT
+                if (op == LIR_immq) {
+                    ins = out->insImmQ(q, tainted);
+                    break;
+                }
 #endif
-                VMPI_snprintf(s, n, "%s = %s %s, %s", formatRef(&b1, i), lirNames[op],
-                    formatRef(&b2, i->oprnd1()),
-                    formatRef(&b3, i->oprnd2()));
+                union { uint64_t q; double d; } u;
+                u.q = q;
+                ins = out->insImmD(u.d, tainted);
+                break;
+            }
+
+            case LRK_F4: {
+                float f[4];
+                for (int i = 0; i < 4; i++) {
+                    uint32_t bits = r.getU32();
+                    memcpy(&f[i], &bits, sizeof(bits));
+                }
+                bool tainted = r.getByte() != 0;
+                if (!r.ok)
+                    return false;
+                float4_t f4 = { f[0], f[1], f[2], f[3] };
+                ins = out->insImmF4(f4, tainted);
+                break;
+            }
+
+            case LRK_Jtbl: {
+                LIns* index = readRef(r, insns, cur);
+                uint64_t tsize = r.getU();
+                if (!r.ok || !index || tsize == 0 || tsize > size)
+                    return false;
+                ins = out->insJtbl(index, uint32_t(tsize));
+                for (uint32_t i = 0; i < tsize; i++) {
+                    int64_t delta = r.getS();
+                    if (!r.ok || delta == 0 ||
+                        int64_t(cur) - delta < 0 || int64_t(cur) - delta >= int64_t(n))
+                        return false;
+                    uint64_t target = uint64_t(int64_t(cur) - delta);
+                    if (target < cur) {
+                        LIns* label = insns[target + 1];
+                        if (!label || !label->isop(LIR_label))
+                            return false;
+                        ins->setTarget(i, label);
+                    } else {
+                        Fixup f = { ins, int32_t(i), target };
+                        fixups.add(f);
+                    }
+                }
                 break;
+            }
+
+            default:
+                return false;
+            }
+            if (!r.ok)
+                return false;
+            insns[cur + 1] = ins;
+        }
+        if (!r.atEnd())
+            return false;
+
+        for (Seq<Fixup>* p = fixups.get(); p; p = p->tail) {
+            const Fixup& f = p->head;
+            LIns* label = insns[f.target + 1];
+            if (!label || !label->isop(LIR_label))
+                return false;
+            if (f.slot < 0)
+                f.branch->setTarget(label);
+            else
+                f.branch->setTarget(uint32_t(f.slot), label);
+        }
+        return true;
+    }
+
+#ifdef NJ_VERBOSE
+    class RetiredEntry
+    {
+    public:
+        Seq<LIns*>* live;
+        LIns* i;
+        RetiredEntry(): live(NULL), i(NULL) {}
+    };
+
+    class LiveTable
+    {
+        Allocator& alloc;
+    public:
+        HashMap<LIns*, LIns*> live;
+        SeqBuilder<RetiredEntry*> retired;
+        int retiredCount;
+        int maxlive;
+        LiveTable(Allocator& alloc)
+            : alloc(alloc)
+            , live(alloc)
+            , retired(alloc)
+            , retiredCount(0)
+            , maxlive(0)
+        { }
+
+        void add(LIns* ins, LIns* use) {
+            if (!ins->isImmAny() && !live.containsKey(ins)) {
+                NanoAssert(size_t(ins->opcode()) < sizeof(lirNames) / sizeof(lirNames[0]));
+                live.put(ins,use);
+            }
+        }
+
+        void retire(LIns* i) {
+            RetiredEntry *e = new (alloc) RetiredEntry();
+            e->i = i;
+            InsList livelist(alloc);
+            HashMap<LIns*, LIns*>::Iter iter(live);
+            int live_count = 0;
+            while (iter.next()) {
+                LIns* ins = iter.key();
+                if (!ins->isV()) {
+                    live_count++;
+                    livelist.insert(ins);
+                }
+            }
+            e->live = livelist.get();
+            if (live_count > maxlive)
+                maxlive = live_count;
+
+            live.remove(i);
+            retired.insert(e);
+            retiredCount++;
+        }
+
+        bool contains(LIns* i) {
+            return live.containsKey(i);
+        }
+    };
+
+    /*
+     * traverse the LIR buffer and discover which instructions are live
+     * by starting from instructions with side effects (stores, calls, branches)
+     * and marking instructions used by them.  Works bottom-up, in one pass.
+     * if showLiveRefs == true, also print the set of live expressions next to
+     * each instruction
+     */
+    void live(LirFilter* in, Allocator& alloc, Fragment *frag, LogControl *logc)
+    {
+        // traverse backwards to find live exprs and a few other stats.
+
+        LiveTable live(alloc);
+        uint32_t exits = 0;
+        int total = 0;
+        if (frag->lirbuf->state)
+            live.add(frag->lirbuf->state, 0);
+        for (LIns* ins = in->read(); !ins->isop(LIR_start); ins = in->read())
+        {
+            total++;
+
+            // First handle instructions that are always live (ie. those that
+            // don't require being marked as live), eg. those with
+            // side-effects.  We ignore parameters.
+            if (ins->isLive() && !ins->isParam())
+            {
+                live.add(ins, 0);
+                if (ins->isGuard())
+                    exits++;
+            }
+
+            // now propagate liveness
+            if (live.contains(ins))
+            {
+                live.retire(ins);
+
+                switch (ins->opcode()) {
+                case LIR_skip:
+                    NanoAssertMsg(0, "Shouldn't see LIR_skip");
+                    break;
+
+                case LIR_start:
+                case LIR_regfence:
+                case LIR_likely:
+                case LIR_unlikely:
+                case LIR_pushstate:
+                case LIR_popstate:
+                case LIR_memfence:
+                case LIR_restorepc:
+                case LIR_paramp:
+                CASE86(LIR_paramd:)
+                CASE86(LIR_paramf:)
+                CASE86(LIR_paramf4:)
+                case LIR_x:
+                case LIR_xbarrier:
+                case LIR_j:
+                case LIR_label:
+                case LIR_immi:
+                CASE64(LIR_immq:)
+                case LIR_immd:
+                case LIR_immf:
+                case LIR_immf4:
+                case LIR_allocp:
+                case LIR_comment:
+                    // No operands, do nothing.
+                    break;
+
+                case LIR_ldi:
+                CASE64(LIR_ldq:)
+                case LIR_ldd:
+                case LIR_ldf:
+                case LIR_ldf4:
+                case LIR_lduc2ui:
+                case LIR_ldus2ui:
+                case LIR_ldc2i:
+                case LIR_lds2i:
+                case LIR_ldf2d:
+                case LIR_reti:
+                CASE64(LIR_retq:)
+                case LIR_retd:
+                case LIR_retf:
+                case LIR_retf4:
+                case LIR_livei:
+                CASE64(LIR_liveq:)
+                case LIR_lived:
+                case LIR_livef:
+                case LIR_livef4:
+                CASE86(LIR_count:)
+                case LIR_xt:
+                case LIR_xf:
+                case LIR_jt:
+                case LIR_jf:
+				case LIR_brsavpc:
+                case LIR_jtbl:
+                case LIR_negi:
+                CASE86(LIR_negq:)
+                case LIR_noti:
+                CASE86(LIR_notq:)
+                CASEBIT(LIR_popcnti:)
+                CASEBIT(LIR_lzcnti:)
+                CASEBIT(LIR_tzcnti:)
+                CASEBIT(LIR_bswapi:)
+                CASEBIT(LIR_popcntq:)
+                CASEBIT(LIR_lzcntq:)
+                CASEBIT(LIR_tzcntq:)
+                CASEBIT(LIR_bswapq:)
+                case LIR_negd:
+                case LIR_negf:
+                case LIR_negf4:
+                case LIR_absd:
+                case LIR_absf:
+                case LIR_absf4:
+                case LIR_recipf:
+                case LIR_recipf4:
+                case LIR_rsqrtf:
+                case LIR_rsqrtf4:
+                case LIR_sqrtf:
+                case LIR_sqrtf4:
+                case LIR_sqrtd:
+                CASEFPX(LIR_floord:)
+                CASEFPX(LIR_ceild:)
+                CASEFPX(LIR_truncd:)
+                CASEFPX(LIR_roundd:)
+                CASEFPX(LIR_floorf:)
+                CASEFPX(LIR_ceilf:)
+                CASEFPX(LIR_truncf:)
+                CASEFPX(LIR_roundf:)
+                CASEFPX(LIR_d2ui:)
+                CASEFPX(LIR_f2ui:)
+                CASEFPX(LIR_f2q:)
+                CASEFPX(LIR_q2f:)
+                CASEFPX(LIR_uq2d:)
+                CASEFPX(LIR_uq2f:)
+                CASESF(LIR_dlo2i:)
+                CASESF(LIR_dhi2i:)
+                CASESF(LIR_hcalli:)
+                CASE64(LIR_i2q:)
+                CASE64(LIR_ui2uq:)
+                case LIR_i2d:
+                CASE64(LIR_q2d:)
+                case LIR_ui2d:
+                case LIR_i2f:
+                case LIR_ui2f:
+                case LIR_d2f:
+                case LIR_f2d:
+                case LIR_f2f4:
+                case LIR_f4x:
+                case LIR_f4y:
+                case LIR_f4z:
+                case LIR_f4w:
+                case LIR_swzf4:
+                CASE64(LIR_q2i:)
+                case LIR_d2i:
+                CASE64(LIR_dasq:)
+                CASE64(LIR_qasd:)
+                CASE86(LIR_modi:)
+                CASE86(LIR_modq:)
+                CASEAVX(LIR_ldf8:) CASEAVX(LIR_ldd4:) CASEAVX(LIR_ldi8:)
+                CASEAVX(LIR_livef8:) CASEAVX(LIR_lived4:) CASEAVX(LIR_livei8:)
+                CASEAVX(LIR_f2f8:) CASEAVX(LIR_f8x:) CASEAVX(LIR_d2d4:)
+                CASEAVX(LIR_d4x:) CASEAVX(LIR_i2i8:) CASEAVX(LIR_i8x:)
+                    live.add(ins->oprnd1(), 0);
+                    break;
+
+                case LIR_sti:
+                CASE64(LIR_stq:)
+                case LIR_std:
+                case LIR_stf:
+                case LIR_stf4:
+                case LIR_sti2c:
+                case LIR_sti2s:
+                case LIR_std2f:
+                case LIR_eqi:
+                case LIR_lti:
+                case LIR_gti:
+                case LIR_lei:
+                case LIR_gei:
+                case LIR_ltui:
+                case LIR_gtui:
+                case LIR_leui:
+                case LIR_geui:
+                case LIR_eqd:
+                case LIR_ltd:
+                case LIR_gtd:
+                case LIR_led:
+                case LIR_ged:
+                case LIR_eqf:
+                case LIR_ltf:
+                case LIR_gtf:
+                case LIR_lef:
+                case LIR_gef:
+                case LIR_eqf4:
+                CASE64(LIR_eqq:)
+                CASE64(LIR_ltq:)
+                CASE64(LIR_gtq:)
+                CASE64(LIR_leq:)
+                CASE64(LIR_geq:)
+                CASE64(LIR_ltuq:)
+                CASE64(LIR_gtuq:)
+                CASE64(LIR_leuq:)
+                CASE64(LIR_geuq:)
+                case LIR_lshi:
+                case LIR_rshi:
+                case LIR_rshui:
+                CASE64(LIR_lshq:)
+                CASE64(LIR_rshq:)
+                CASE64(LIR_rshuq:)
+                CASEBIT(LIR_roli:)
+                CASEBIT(LIR_rori:)
+                CASEBIT(LIR_rolq:)
+                CASEBIT(LIR_rorq:)
+                case LIR_addi:
+                case LIR_subi:
+                case LIR_muli:
+                case LIR_addxovi:
+                case LIR_subxovi:
+                case LIR_mulxovi:
+                case LIR_addjovi:
+                case LIR_subjovi:
+                case LIR_muljovi:
+                CASE86(LIR_divi:)
+                case LIR_addd:
+                case LIR_subd:
+                case LIR_muld:
+                case LIR_divd:
+                case LIR_addf:
+                case LIR_subf:
+                case LIR_mulf:
+                case LIR_divf:
+                case LIR_addf4:
+                case LIR_subf4:
+                case LIR_mulf4:
+                case LIR_divf4:
+                case LIR_dotf4:
+                case LIR_dotf3:
+                case LIR_dotf2:
+                case LIR_minf4:
+                case LIR_maxf4:
+                case LIR_minf:
+                case LIR_maxf:
+                CASEFPX(LIR_mind:)
+                CASEFPX(LIR_maxd:)
+                case LIR_cmpgtf4:
+                case LIR_cmpgef4:
+                case LIR_cmpltf4:
+                case LIR_cmplef4:
+                case LIR_cmpeqf4:
+                case LIR_cmpnef4:
+                CASE64(LIR_addq:)
+                CASE64(LIR_subq:)
+                CASE86(LIR_mulq:)
+                CASE86(LIR_mulhq:)
+                CASE64(LIR_addjovq:)
+                CASE64(LIR_subjovq:)
+                CASE86(LIR_divq:)
+                case LIR_andi:
+                case LIR_ori:
+                case LIR_xori:
+                CASE64(LIR_andq:)
+                CASE64(LIR_orq:)
+                CASE64(LIR_xorq:)
+                CASESF(LIR_ii2d:)
+                CASEAVX(LIR_stf8:) CASEAVX(LIR_std4:) CASEAVX(LIR_sti8:)
+                CASEAVX(LIR_addf8:) CASEAVX(LIR_subf8:) CASEAVX(LIR_mulf8:)
+                CASEAVX(LIR_divf8:) CASEAVX(LIR_minf8:) CASEAVX(LIR_maxf8:)
+                CASEAVX(LIR_cmpeqf8:) CASEAVX(LIR_cmpltf8:) CASEAVX(LIR_cmplef8:)
+                CASEAVX(LIR_addd4:) CASEAVX(LIR_subd4:) CASEAVX(LIR_muld4:)
+                CASEAVX(LIR_divd4:) CASEAVX(LIR_mind4:) CASEAVX(LIR_maxd4:)
+                CASEAVX(LIR_cmpeqd4:) CASEAVX(LIR_cmpltd4:) CASEAVX(LIR_cmpled4:)
+                CASEAVX(LIR_addi8:) CASEAVX(LIR_subi8:) CASEAVX(LIR_muli8:)
+                CASEAVX(LIR_andi8:) CASEAVX(LIR_ori8:) CASEAVX(LIR_xori8:)
+                CASEAVX(LIR_cmpeqi8:) CASEAVX(LIR_cmpgti8:)
+                case LIR_file:
+                case LIR_line:
+                    live.add(ins->oprnd1(), 0);
+                    live.add(ins->oprnd2(), 0);
+                    break;
+
+                case LIR_cmovi:
+                CASE64(LIR_cmovq:)
+                case LIR_cmovd:
+                case LIR_cmovf:
+                case LIR_cmovf4:
+                CASEAVX(LIR_blendf8:) CASEAVX(LIR_blendd4:) CASEAVX(LIR_blendi8:)
+                CASEFMA(LIR_fmad:) CASEFMA(LIR_fmaf:) CASEFMA(LIR_fmaf4:)
+                    live.add(ins->oprnd1(), 0);
+                    live.add(ins->oprnd2(), 0);
+                    live.add(ins->oprnd3(), 0);
+                    break;
+                case LIR_ffff2f4:
+                    live.add(ins->oprnd1(), 0);
+                    live.add(ins->oprnd2(), 0);
+                    live.add(ins->oprnd3(), 0);
+                    live.add(ins->oprnd4(), 0);
+                    break;
+                        
+                case LIR_callv:
+                case LIR_calli:
+                CASE64(LIR_callq:)
+                case LIR_calld:
+                case LIR_callf:
+                case LIR_callf4:
+                    for (int i = 0, argc = ins->argc(); i < argc; i++)
+                        live.add(ins->arg(i), 0);
+                    break;
+
+                default:
+                    NanoAssertMsgf(0, "unhandled opcode: %d", ins->opcode());
+                    break;
+                }
+            }
+        }
+
+        logc->printf("  Live instruction count %d, total %u, max pressure %d\n",
+                     live.retiredCount, total, live.maxlive);
+        if (exits > 0)
+            logc->printf("  Side exits %u\n", exits);
+        logc->printf("  Showing LIR instructions with live-after variables\n");
+        logc->printf("\n");
+
+        // print live exprs, going forwards
+        LInsPrinter *printer = frag->lirbuf->printer;
+        bool newblock = true;
+        for (Seq<RetiredEntry*>* p = live.retired.get(); p != NULL; p = p->tail) {
+            RetiredEntry* e = p->head;
+            InsBuf ib;
+            RefBuf rb;
+            char livebuf[4000], *s=livebuf;
+            *s = 0;
+            if (!newblock && e->i->isop(LIR_label)) {
+                logc->printf("\n");
+            }
+            newblock = false;
+            for (Seq<LIns*>* p = e->live; p != NULL; p = p->tail) {
+                VMPI_strcpy(s, printer->formatRef(&rb, p->head));
+                s += VMPI_strlen(s);
+                *s++ = ' '; *s = 0;
+                NanoAssert(s < livebuf+sizeof(livebuf));
+            }
+            /* If the LIR insn is pretty short, print it and its
+               live-after set on the same line.  If not, put
+               live-after set on a new line, suitably indented. */
+            const char* insn_text = printer->formatIns(&ib, e->i);
+            if (VMPI_strlen(insn_text) >= 30-2) {
+                logc->printf("  %-30s\n  %-30s %s\n", insn_text, "", livebuf);
+            } else {
+                logc->printf("  %-30s %s\n", insn_text, livebuf);
+            }
+
+            if (e->i->isGuard() || e->i->isBranch() || e->i->isRet()) {
+                logc->printf("\n");
+                newblock = true;
+            }
+        }
+    }
+
+    void LirNameMap::addNameWithSuffix(LIns* ins, const char *name, int suffix,
+                                       bool ignoreOneSuffix) {
+        NanoAssert(!names.containsKey(ins));
+        const int N = 100;
+        char name2[N];
+        if (suffix == 1 && ignoreOneSuffix) {
+            VMPI_snprintf(name2, N, "%s", name);                // don't add '1' suffix
+        } else if (VMPI_isdigit(name[VMPI_strlen(name)-1])) {
+            VMPI_snprintf(name2, N, "%s_%d", name, suffix);     // use '_' to avoid confusion
+        } else {
+            VMPI_snprintf(name2, N, "%s%d", name, suffix);      // normal case
+        }
+
+        char *copy = new (alloc) char[VMPI_strlen(name2)+1];
+        VMPI_strcpy(copy, name2);
+        Entry *e = new (alloc) Entry(copy);
+        names.put(ins, e);
+    }
+
+    void LirNameMap::addName(LIns* ins, const char* name) {
+        // The lookup may succeed, ie. we may already have a name for this
+        // instruction.  This can happen because of CSE.  Eg. if we have this:
+        //
+        //   ins = addName("foo", insImmI(0))
+        //
+        // that assigns the name "foo1" to 'ins'.  If we later do this:
+        //
+        //   ins2 = addName("foo", insImmI(0))
+        //
+        // then CSE will cause 'ins' and 'ins2' to be equal.  So 'ins2'
+        // already has a name ("foo1") and there's no need to generate a new
+        // name "foo2".
+        //
+        if (!names.containsKey(ins)) {
+            Str* str = new (alloc) Str(alloc, name);
+            int suffix = namecounts.add(*str);
+            addNameWithSuffix(ins, name, suffix, /*ignoreOneSuffix*/true);
+        }
+    }
+
+    const char* LirNameMap::createName(LIns* ins) {
+        if (ins->isCall()) {
+#if NJ_SOFTFLOAT_SUPPORTED
+            if (ins->isop(LIR_hcalli)) {
+                ins = ins->oprnd1();    // we've presumably seen the other half already
+            } else
+#endif
+            {
+                if (!names.containsKey(ins))
+                    addNameWithSuffix(ins, ins->callInfo()->_name, funccounts.add(ins->callInfo()),
+                                      /*ignoreOneSuffix*/false);
+            }
+        } else {
+            if (!names.containsKey(ins))
+                addNameWithSuffix(ins, lirNames[ins->opcode()], lircounts.add(ins->opcode()),
+                                  /*ignoreOneSuffix*/false);
+
+        }
+        return names.get(ins)->name;
+    }
+
+    const char* LirNameMap::lookupName(LIns* ins)
+    {
+        Entry* e = names.get(ins);
+        return e ? e->name : NULL;
+    }
+
+    char* LInsPrinter::formatAccSet(RefBuf* buf, AccSet accSet) {
+        if (accSet == ACCSET_NONE) {
+            VMPI_sprintf(buf->buf, ".none");
+        } else if (accSet == ACCSET_ALL) {
+            VMPI_sprintf(buf->buf, ".all");
+        } else {
+            char* b = buf->buf;
+            b[0] = 0;
+            // The AccSet may contain bits set for regions not used by the
+            // embedding, if any have been specified via
+            // (ACCSET_ALL & ~ACCSET_XYZ).  So only print those that are
+            // relevant.
+            for (int i = 0; i < EMB_NUM_USED_ACCS; i++) {
+                if (accSet & (1 << i)) {
+					VMPI_strcat(b, buf->len, ".");
+					VMPI_strcat(b, buf->len, accNames[i]);
+                    accSet &= ~(1 << i);
+                }
+            }
+            NanoAssert(VMPI_strlen(b) < buf->len);
+        }
+        return buf->buf;
+    }
+
+    char* LInsPrinter::formatImmI(RefBuf* buf, int32_t c) {
+        if (-10000 < c && c < 10000) {
+            VMPI_snprintf(buf->buf, buf->len, "%d", c);
+        } else {
+#if !defined NANOJIT_64BIT
+            formatAddr(buf, (void*)c);
+#else
+            VMPI_snprintf(buf->buf, buf->len, "0x%x", (unsigned int)c);
+#endif
+        }
+        return buf->buf;
+    }
+
+#if defined NANOJIT_64BIT
+    char* LInsPrinter::formatImmQ(RefBuf* buf, uint64_t c) {
+        if (-10000 < (int64_t)c && c < 10000) {
+            VMPI_snprintf(buf->buf, buf->len, "%dLL", (int)c);
+        } else {
+            formatAddr(buf, (void*)c);
+        }
+        return buf->buf;
+    }
+#endif
+
+    char* LInsPrinter::formatImmD(RefBuf* buf, double c) {
+        VMPI_snprintf(buf->buf, buf->len, "%g", c);
+        return buf->buf;
+    }
+
+    char* LInsPrinter::formatAddr(RefBuf* buf, void* p)
+    {
+        char*   name;
+        int32_t offset;
+        addrNameMap->lookupAddr(p, name, offset);
+
+        if (name) {
+            if (offset != 0) {
+                VMPI_snprintf(buf->buf, buf->len, "%p %s+%d", p, name, offset);
+            } else {
+                VMPI_snprintf(buf->buf, buf->len, "%p %s", p, name);
+            }
+        } else {
+            VMPI_snprintf(buf->buf, buf->len, "%p", p);
+        }
+
+        return buf->buf;
+    }
+
+    const char* LInsPrinter::formatTaint(LIns* ref)
+    {
+        return ref->isTainted() ? " !" : "";
+    }
+
+    char* LInsPrinter::formatRef(RefBuf* buf, LIns *ref, bool showImmValue)
+    {
+        // Give 'ref' a name if it doesn't have one.
+        const char* name = lirNameMap->lookupName(ref);
+        if (!name) {
+            name = lirNameMap->createName(ref);
+        }
+
+        // Put it in the buffer.  If it's an immediate, show the value if
+        // showImmValue==true.  (This facility allows us to print immediate
+        // values when they're used but not when they're def'd, ie. we don't
+        // want "immi1/*1*/ = immi 1".)
+        RefBuf buf2;
+        if (ref->isImmI() && showImmValue) {
+            VMPI_snprintf(buf->buf, buf->len, "%s/*%s*/%s", name, formatImmI(&buf2, ref->immI()), formatTaint(ref));
+        }
+#ifdef NANOJIT_64BIT
+        else if (ref->isImmQ() && showImmValue) {
+            VMPI_snprintf(buf->buf, buf->len, "%s/*%s*/%s", name, formatImmQ(&buf2, ref->immQ()), formatTaint(ref));
+        }
+#endif
+        else if (ref->isImmD() && showImmValue) {
+            VMPI_snprintf(buf->buf, buf->len, "%s/*%s*/%s", name, formatImmD(&buf2, ref->immD()), formatTaint(ref));
+        } 
+        else if (ref->isImmF() && showImmValue) { // float is printed as a double
+            VMPI_snprintf(buf->buf, buf->len, "%s/*%s*/%s", name, formatImmD(&buf2, ref->immF()), formatTaint(ref));
+        }
+        else if (ref->isImmF4() && showImmValue) { // float4 is printed as an array of 4 double values
+            RefBuf bufx, bufy, bufz, bufw;
+            float4_t v = ref->immF4();
+            VMPI_snprintf(buf->buf, buf->len, "%s/*%s,%s,%s,%s*/%s", name, formatImmD(&bufx,f4_x(v)),
+                          formatImmD(&bufy,f4_y(v)), formatImmD(&bufz,f4_z(v)), formatImmD(&bufw,f4_w(v)), formatTaint(ref));
+        }
+        else {
+            VMPI_snprintf(buf->buf, buf->len, "%s", name);
+        }
+
+        return buf->buf;
+    }
+
+    char* LInsPrinter::formatIns(InsBuf* buf, LIns* i)
+    {
+        char *s = buf->buf;
+        size_t n = buf->len;
+        RefBuf b1, b2, b3, b4, b5;
+        LOpcode op = i->opcode();
+        switch (op)
+        {
+            case LIR_immi:
+                VMPI_snprintf(s, n, "%s = %s %s%s", formatRef(&b1, i, /*showImmValue*/false),
+                              lirNames[op], formatImmI(&b2, i->immI()), formatTaint(i));
+                break;
+
+#ifdef NANOJIT_64BIT
+            case LIR_immq:
+                VMPI_snprintf(s, n, "%s = %s %s%s", formatRef(&b1, i, /*showImmValue*/false),
+                              lirNames[op], formatImmQ(&b2, i->immQ()), formatTaint(i));
+                break;
+#endif
+
+            case LIR_immf:
+                VMPI_snprintf(s, n, "%s = %s %s%s", formatRef(&b1, i, /*showImmValue*/false),
+                              lirNames[op], formatImmD(&b2, i->immF()), formatTaint(i));
+                break;
+
+            case LIR_immf4:{
+                RefBuf b5;
+                float4_t v = i->immF4();
+                VMPI_snprintf(s, n, "%s = %s %s,%s,%s,%s%s", formatRef(&b1, i, /*showImmValue*/false),
+                              lirNames[op], formatImmD(&b2, f4_x(v)), formatImmD(&b3, f4_y(v)),
+                              formatImmD(&b4, f4_z(v)), formatImmD(&b5, f4_w(v)), formatTaint(i));
+                break;
+            }
+
+            case LIR_immd:
+                VMPI_snprintf(s, n, "%s = %s %s%s", formatRef(&b1, i, /*showImmValue*/false),
+                              lirNames[op], formatImmD(&b2, i->immD()), formatTaint(i));
+                break;
+                
+            case LIR_allocp:
+                VMPI_snprintf(s, n, "%s = %s %d", formatRef(&b1, i), lirNames[op], i->size());
+                break;
+
+            case LIR_start:
+            case LIR_regfence:
+            case LIR_likely:
+            case LIR_unlikely:
+	        case LIR_pushstate:
+	        case LIR_popstate:
+            case LIR_memfence:
+            case LIR_restorepc:
+                VMPI_snprintf(s, n, "%s", lirNames[op]);
+                break;
+
+            case LIR_callv:
+            case LIR_calli:
+            CASE64(LIR_callq:)
+            case LIR_calld: 
+            case LIR_callf:
+            case LIR_callf4:
+            {
+                const CallInfo* call = i->callInfo();
+                int32_t argc = i->argc();
+                int32_t m = int32_t(n);     // Windows doesn't have 'ssize_t'
+                if (call->isIndirect())
+                    m -= VMPI_snprintf(s, m, "%s = %s%s [%s] ( ", formatRef(&b1, i), lirNames[op],
+                                       formatAccSet(&b2, call->_storeAccSet),
+                                       formatRef(&b3, i->arg(--argc)));
+                else
+                    m -= VMPI_snprintf(s, m, "%s = %s%s #%s ( ", formatRef(&b1, i), lirNames[op],
+                                       formatAccSet(&b2, call->_storeAccSet), call->_name);
+                if (m < 0) break;
+                for (int32_t j = argc - 1; j >= 0; j--) {
+                    s += VMPI_strlen(s);
+                    m -= VMPI_snprintf(s, m, "%s ",formatRef(&b2, i->arg(j)));
+                    if (m < 0) break;
+                }
+                s += VMPI_strlen(s);
+                m -= VMPI_snprintf(s, m, ")");
+                break;
+            }
+
+            case LIR_jtbl: {
+                int32_t m = int32_t(n);     // Windows doesn't have 'ssize_t'
+                m -= VMPI_snprintf(s, m, "%s %s [ ", lirNames[op], formatRef(&b1, i->oprnd1()));
+                if (m < 0) break;
+                for (uint32_t j = 0, sz = i->getTableSize(); j < sz; j++) {
+                    LIns* target = i->getTarget(j);
+                    s += VMPI_strlen(s);
+                    m -= VMPI_snprintf(s, m, "%s ", target ? formatRef(&b2, target) : "unpatched");
+                    if (m < 0) break;
+                }
+                s += VMPI_strlen(s);
+                m -= VMPI_snprintf(s, m, "]");
+                break;
+            }
+
+            case LIR_paramp: {
+                uint32_t arg = i->paramArg();
+                if (!i->paramKind()) {
+                    if (arg < sizeof(RegAlloc::argRegs)/sizeof(RegAlloc::argRegs[0])) {
+                        VMPI_snprintf(s, n, "%s = %s %d %s", formatRef(&b1, i), lirNames[op],
+                            arg, gpn(RegAlloc::argRegs[arg]));
+                    } else {
+                        VMPI_snprintf(s, n, "%s = %s %d", formatRef(&b1, i), lirNames[op], arg);
+                    }
+                } else {
+                    VMPI_snprintf(s, n, "%s = %s %d %s", formatRef(&b1, i), lirNames[op],
+                        arg, gpn(RegAlloc::savedRegs[arg]));
+                }
+                break;
+            }
+
+            CASE86(LIR_paramd:)
+            CASE86(LIR_paramf:)
+            CASE86(LIR_paramf4:)
+                VMPI_snprintf(s, n, "%s = %s %d", formatRef(&b1, i), lirNames[op], i->paramArg());
+                break;
+
+            case LIR_label:
+                VMPI_snprintf(s, n, "%s:", formatRef(&b1, i));
+                break;
+
+            case LIR_jt:
+            case LIR_jf:
+			case LIR_brsavpc:
+                VMPI_snprintf(s, n, "%s %s -> %s", lirNames[op], formatRef(&b1, i->oprnd1()),
+                    i->oprnd2() ? formatRef(&b2, i->oprnd2()) : "unpatched");
+                break;
+
+            case LIR_j:
+                VMPI_snprintf(s, n, "%s -> %s", lirNames[op],
+                    i->oprnd2() ? formatRef(&b1, i->oprnd2()) : "unpatched");
+                break;
+
+            case LIR_livei:
+            case LIR_lived:
+            case LIR_livef:
+            case LIR_livef4:
+            CASE64(LIR_liveq:)
+            case LIR_reti:
+            CASE64(LIR_retq:)
+            case LIR_retd:
+            case LIR_retf:
+            case LIR_retf4:
+            CASEAVX(LIR_livef8:) CASEAVX(LIR_lived4:) CASEAVX(LIR_livei8:)
+            CASE86(LIR_count:)
+                VMPI_snprintf(s, n, "%s %s", lirNames[op], formatRef(&b1, i->oprnd1()));
+                break;
+
+            CASESF(LIR_hcalli:)
+            case LIR_negi:
+            CASE86(LIR_negq:)
+            case LIR_negd:
+            case LIR_negf:
+            case LIR_negf4:
+            case LIR_absd:
+            case LIR_absf:
+            case LIR_absf4:
+            case LIR_sqrtd:
+            case LIR_sqrtf:
+            case LIR_sqrtf4:
+            case LIR_rsqrtf:
+            case LIR_rsqrtf4:
+            case LIR_recipf:
+            case LIR_recipf4:
+            CASEFPX(LIR_floord:)
+            CASEFPX(LIR_ceild:)
+            CASEFPX(LIR_truncd:)
+            CASEFPX(LIR_roundd:)
+            CASEFPX(LIR_floorf:)
+            CASEFPX(LIR_ceilf:)
+            CASEFPX(LIR_truncf:)
+            CASEFPX(LIR_roundf:)
+            CASEFPX(LIR_d2ui:)
+            CASEFPX(LIR_f2ui:)
+            CASEFPX(LIR_f2q:)
+            CASEFPX(LIR_q2f:)
+            CASEFPX(LIR_uq2d:)
+            CASEFPX(LIR_uq2f:)
+            case LIR_i2d:
+            CASE64(LIR_q2d:)
+            case LIR_ui2d:
+            case LIR_i2f:
+            case LIR_ui2f:
+            case LIR_f4x:
+            case LIR_f4y:
+            case LIR_f4z:
+            case LIR_f4w:
+            case LIR_f2f4:
+            CASESF(LIR_dlo2i:)
+            CASESF(LIR_dhi2i:)
+            case LIR_noti:
+            CASE86(LIR_notq:)
+            CASEBIT(LIR_popcnti:)
+            CASEBIT(LIR_lzcnti:)
+            CASEBIT(LIR_tzcnti:)
+            CASEBIT(LIR_bswapi:)
+            CASEBIT(LIR_popcntq:)
+            CASEBIT(LIR_lzcntq:)
+            CASEBIT(LIR_tzcntq:)
+            CASEBIT(LIR_bswapq:)
+            CASE86(LIR_modi:)
+            CASE86(LIR_modq:)
+            CASE64(LIR_i2q:)
+            CASE64(LIR_ui2uq:)
+            CASE64(LIR_q2i:)
+            case LIR_d2i:
+            case LIR_d2f:
+            case LIR_f2d:
+            case LIR_f2i:
+            CASE86(LIR_d2q:)
+            CASE64(LIR_dasq:)
+            CASE64(LIR_qasd:)
+            CASEAVX(LIR_f2f8:) CASEAVX(LIR_f8x:) CASEAVX(LIR_d2d4:)
+            CASEAVX(LIR_d4x:) CASEAVX(LIR_i2i8:) CASEAVX(LIR_i8x:)
+                VMPI_snprintf(s, n, "%s = %s %s", formatRef(&b1, i), lirNames[op],
+                             formatRef(&b2, i->oprnd1()));
+                break;
+
+            case LIR_x:
+            case LIR_xt:
+            case LIR_xf:
+            case LIR_xbarrier:
+                formatGuard(buf, i);
+                break;
+
+            case LIR_addxovi:
+            case LIR_subxovi:
+            case LIR_mulxovi:
+                formatGuardXov(buf, i);
+                break;
+
+            case LIR_addjovi:
+            case LIR_subjovi:
+            case LIR_muljovi:
+            CASE64(LIR_addjovq:)
+            CASE64(LIR_subjovq:)
+                VMPI_snprintf(s, n, "%s = %s %s, %s ; ovf -> %s", formatRef(&b1, i), lirNames[op],
+                    formatRef(&b2, i->oprnd1()),
+                    formatRef(&b3, i->oprnd2()),
+                    i->oprnd3() ? formatRef(&b4, i->oprnd3()) : "unpatched");
+                break;
+
+            case LIR_addi:       CASE64(LIR_addq:)
+            case LIR_subi:       CASE64(LIR_subq:)
+            case LIR_muli:       CASE86(LIR_mulq:)
+            CASE86(LIR_mulhq:)
+            CASE86(LIR_divi:)    CASE86(LIR_divq:)
+            case LIR_addd:
+            case LIR_subd:
+            case LIR_muld:
+            case LIR_divd:
+            case LIR_addf:
+            case LIR_subf:
+            case LIR_mulf:
+            case LIR_divf:
+            case LIR_addf4:
+            case LIR_subf4:
+            case LIR_mulf4:
+            case LIR_divf4:
+            case LIR_dotf4:
+            case LIR_dotf3:
+            case LIR_dotf2:
+            case LIR_minf4:
+            case LIR_maxf4:
+            case LIR_minf:
+            case LIR_maxf:
+            CASEFPX(LIR_mind:)
+            CASEFPX(LIR_maxd:)
+            case LIR_cmpgtf4:
+            case LIR_cmpgef4:
+            case LIR_cmpltf4:
+            case LIR_cmplef4:
+            case LIR_cmpeqf4:
+            case LIR_cmpnef4:
+            case LIR_andi:       CASE64(LIR_andq:)
+            case LIR_ori:        CASE64(LIR_orq:)
+            case LIR_xori:       CASE64(LIR_xorq:)
+            case LIR_lshi:       CASE64(LIR_lshq:)
+            case LIR_rshi:       CASE64(LIR_rshq:)
+            case LIR_rshui:      CASE64(LIR_rshuq:)
+            CASEBIT(LIR_roli:)   CASEBIT(LIR_rolq:)
+            CASEBIT(LIR_rori:)   CASEBIT(LIR_rorq:)
+            case LIR_eqi:        CASE64(LIR_eqq:)
+            case LIR_lti:        CASE64(LIR_ltq:)
+            case LIR_lei:        CASE64(LIR_leq:)
+            case LIR_gti:        CASE64(LIR_gtq:)
+            case LIR_gei:        CASE64(LIR_geq:)
+            case LIR_ltui:       CASE64(LIR_ltuq:)
+            case LIR_leui:       CASE64(LIR_leuq:)
+            case LIR_gtui:       CASE64(LIR_gtuq:)
+            case LIR_geui:       CASE64(LIR_geuq:)
+            case LIR_eqd:
+            case LIR_ltd:
+            case LIR_led:
+            case LIR_gtd:
+            case LIR_ged:
+            case LIR_eqf4:
+            case LIR_eqf:
+            case LIR_ltf:
+            case LIR_lef:
+            case LIR_gtf:
+            case LIR_gef:
+#if NJ_SOFTFLOAT_SUPPORTED
+            case LIR_ii2d:
+#endif
+            CASEAVX(LIR_addf8:) CASEAVX(LIR_subf8:) CASEAVX(LIR_mulf8:)
+            CASEAVX(LIR_divf8:) CASEAVX(LIR_minf8:) CASEAVX(LIR_maxf8:)
+            CASEAVX(LIR_cmpeqf8:) CASEAVX(LIR_cmpltf8:) CASEAVX(LIR_cmplef8:)
+            CASEAVX(LIR_addd4:) CASEAVX(LIR_subd4:) CASEAVX(LIR_muld4:)
+            CASEAVX(LIR_divd4:) CASEAVX(LIR_mind4:) CASEAVX(LIR_maxd4:)
+            CASEAVX(LIR_cmpeqd4:) CASEAVX(LIR_cmpltd4:) CASEAVX(LIR_cmpled4:)
+            CASEAVX(LIR_addi8:) CASEAVX(LIR_subi8:) CASEAVX(LIR_muli8:)
+            CASEAVX(LIR_andi8:) CASEAVX(LIR_ori8:) CASEAVX(LIR_xori8:)
+            CASEAVX(LIR_cmpeqi8:) CASEAVX(LIR_cmpgti8:)
+                VMPI_snprintf(s, n, "%s = %s %s, %s", formatRef(&b1, i), lirNames[op],
+                    formatRef(&b2, i->oprnd1()),
+                    formatRef(&b3, i->oprnd2()));
+                break;
+
+            CASE64(LIR_cmovq:)
+            case LIR_cmovi:
+            case LIR_cmovd:
+            case LIR_cmovf:
+            case LIR_cmovf4:
+            CASEAVX(LIR_blendf8:) CASEAVX(LIR_blendd4:) CASEAVX(LIR_blendi8:)
+                VMPI_snprintf(s, n, "%s = %s %s ? %s : %s", formatRef(&b1, i), lirNames[op],
+                    formatRef(&b2, i->oprnd1()),
+                    formatRef(&b3, i->oprnd2()),
+                    formatRef(&b4, i->oprnd3()));
+                break;
+
+            CASEFMA(LIR_fmad:)
+            CASEFMA(LIR_fmaf:)
+            CASEFMA(LIR_fmaf4:)
+                VMPI_snprintf(s, n, "%s = %s %s, %s, %s", formatRef(&b1, i), lirNames[op],
+                    formatRef(&b2, i->oprnd1()),
+                    formatRef(&b3, i->oprnd2()),
+                    formatRef(&b4, i->oprnd3()));
+                break;
+
+            case LIR_ffff2f4:
+                VMPI_snprintf(s, n, "%s =(%s)= %s %s %s %s", formatRef(&b1, i), lirNames[op],
+                              formatRef(&b2, i->oprnd1()),
+                              formatRef(&b3, i->oprnd2()),
+                              formatRef(&b4, i->oprnd3()),
+                              formatRef(&b5, i->oprnd4()));
+                break;
+                
+            case LIR_ldi:
+            CASE64(LIR_ldq:)
+            case LIR_ldd:
+            case LIR_ldf:
+            case LIR_ldf4:
+            case LIR_lduc2ui:
+            case LIR_ldus2ui:
+            case LIR_ldc2i:
+            case LIR_lds2i:
+            case LIR_ldf2d:
+            CASEAVX(LIR_ldf8:) CASEAVX(LIR_ldd4:) CASEAVX(LIR_ldi8:)
+            {
+                const char* qualStr;
+                switch (i->loadQual()) {
+                case LOAD_CONST:        qualStr = "/c"; break;
+                case LOAD_NORMAL:       qualStr = "";   break;
+                case LOAD_VOLATILE:     qualStr = "/v"; break;
+                default: NanoAssert(0); qualStr = "/?"; break;
+                }
+                VMPI_snprintf(s, n, "%s = %s%s%s %s[%d]", formatRef(&b1, i), lirNames[op],
+                    formatAccSet(&b2, i->accSet()), qualStr, formatRef(&b3, i->oprnd1()),
+                    i->disp());
+                break;
+            }
+
+            case LIR_sti:
+            CASE64(LIR_stq:)
+            case LIR_std:
+            case LIR_stf:
+            case LIR_stf4:
+            case LIR_sti2c:
+            case LIR_sti2s:
+            case LIR_std2f:
+            CASEAVX(LIR_stf8:) CASEAVX(LIR_std4:) CASEAVX(LIR_sti8:)
+                VMPI_snprintf(s, n, "%s%s %s[%d] = %s", lirNames[op],
+                    formatAccSet(&b1, i->accSet()),
+                    formatRef(&b2, i->oprnd2()),
+                    i->disp(),
+                    formatRef(&b3, i->oprnd1()));
+                break;
+
+            case LIR_comment:
+                VMPI_snprintf(s, n, "------------------------------ # %s", (char*)i->oprnd1());
+                break;
+
+            case LIR_swzf4:
+                VMPI_snprintf(s, n, "%s %s, %d|%d|%d|%d", lirNames[LIR_swzf4],
+                              formatRef(&b1, i->oprnd1()),
+                              i->mask() >> 0 & 3,
+                              i->mask() >> 2 & 3,
+                              i->mask() >> 4 & 3,
+                              i->mask() >> 6 & 3);
+                break;
+
+            case LIR_safe:
+            case LIR_endsafe:
+			case LIR_unreachable:
+                VMPI_snprintf(s, n, "%s", (char*)lirNames[op]);
+                break;
+
+            default:
+                NanoAssertMsgf(0, "Can't handle opcode %s\n", lirNames[op]);
+                break;
+        }
+        return buf->buf;
+    }
+#endif
+
+    CseFilter::CseFilter(LirWriter *out, uint8_t embNumUsedAccs, Allocator& alloc, const Config& config)
+        : LirWriter(out),
+          EMB_NUM_USED_ACCS(embNumUsedAccs),
+          CSE_NUM_USED_ACCS(EMB_NUM_USED_ACCS + 2),
+          CSE_ACC_CONST(    EMB_NUM_USED_ACCS + 0),
+          CSE_ACC_MULTIPLE( EMB_NUM_USED_ACCS + 1),
+          storesSinceLastLoad(ACCSET_NONE),
+          alloc(alloc),
+          knownCmpValues(alloc),
+          suspended(0),
+          config(config)
+    {
+        m_findNL[NLImmISmall] = &CseFilter::findImmISmall;
+        m_findNL[NLImmILarge] = &CseFilter::findImmILarge;
+        m_findNL[NLImmF]      = &CseFilter::findImmF;
+        m_findNL[NLImmQ]      = PTR_SIZE(NULL, &CseFilter::findImmQ);
+        m_findNL[NLImmD]      = &CseFilter::findImmD;
+        m_findNL[NL1]         = &CseFilter::find1;
+        m_findNL[NL2]         = &CseFilter::find2;
+        m_findNL[NL3]         = &CseFilter::find3;
+        m_findNL[NL4]         = &CseFilter::find4;
+        m_findNL[NLCall]      = &CseFilter::findCall;
+        m_findNL[NLImmF4]     = &CseFilter::findImmF4;
+
+        m_capNL[NLImmISmall]  = 2*17;   // covers 0..16, tainted/untainted (over 50% on Tracemonkey)
+        m_capNL[NLImmILarge]  = 64;
+        m_capNL[NLImmF]       = 16;
+        m_capNL[NLImmQ]       = PTR_SIZE(0, 16);
+        m_capNL[NLImmD]       = 16;
+        m_capNL[NL1]          = 256;
+        m_capNL[NL2]          = 512;
+        m_capNL[NL3]          = 16;
+        m_capNL[NL4]          = 16;
+        m_capNL[NLCall]       = 64;
+        m_capNL[NLImmF4]      = 16; 
+
+        for (NLKind nlkind = NLFirst; nlkind <= NLLast; nlkind = nextNLKind(nlkind)) {
+            m_listNL[nlkind] = (LIns**)alloc.alloc(sizeof(LIns*) * m_capNL[nlkind]);
+            NanoAssert(m_listNL[nlkind]);
+            m_usedNL[nlkind] = 1; // Force memset in clearAll().
+        }
+
+        // Note that this allocates the CONST and MULTIPLE tables as well.
+        for (CseAcc a = 0; a < CSE_NUM_USED_ACCS; a++) {
+            m_capL[a] = 16;
+            m_listL[a] = (LIns**)alloc.alloc(sizeof(LIns*) * m_capL[a]);
+            NanoAssert(m_listL[a]);
+            m_usedL[a] = 1; // Force memset(0) in first clearAll().
+        }
+
+        clearAll();
+    }
+
+    // Inlined/separated version of SuperFastHash.
+    // This content is copyrighted by Paul Hsieh.
+    // For reference see: http://www.azillionmonkeys.com/qed/hash.html
+    //
+    inline uint32_t CseFilter::hash8(uint32_t hash, const uint8_t data)
+    {
+        hash += data;
+        hash ^= hash << 10;
+        hash += hash >> 1;
+        return hash;
+    }
+
+    inline uint32_t CseFilter::hash32(uint32_t hash, const uint32_t data)
+    {
+        const uint32_t dlo = data & 0xffff;
+        const uint32_t dhi = data >> 16;
+        hash += dlo;
+        const uint32_t tmp = (dhi << 11) ^ hash;
+        hash = (hash << 16) ^ tmp;
+        hash += hash >> 11;
+        return hash;
+    }
+
+    inline uint32_t CseFilter::hashptr(uint32_t hash, const void* data)
+    {
+#ifdef NANOJIT_64BIT
+        hash = hash32(hash, uint32_t(uintptr_t(data) >> 32));
+        hash = hash32(hash, uint32_t(uintptr_t(data)));
+        return hash;
+#else
+        return hash32(hash, uint32_t(data));
+#endif
+    }
+
+    inline uint32_t CseFilter::hashfinish(uint32_t hash)
+    {
+        /* Force "avalanching" of final 127 bits */
+        hash ^= hash << 3;
+        hash += hash >> 5;
+        hash ^= hash << 4;
+        hash += hash >> 17;
+        hash ^= hash << 25;
+        hash += hash >> 6;
+        return hash;
+    }
+
+    void CseFilter::clearNL(NLKind nlkind) {
+        if (m_usedNL[nlkind] > 0) {
+            VMPI_memset(m_listNL[nlkind], 0, sizeof(LIns*)*m_capNL[nlkind]);
+            m_usedNL[nlkind] = 0;
+        }
+    }
+
+    void CseFilter::clearL(CseAcc a) {
+        if (m_usedL[a] > 0) {
+            VMPI_memset(m_listL[a], 0, sizeof(LIns*)*m_capL[a]);
+            m_usedL[a] = 0;
+        }
+    }
+
+    void CseFilter::clearAll() {
+        for (NLKind nlkind = NLFirst; nlkind <= NLLast; nlkind = nextNLKind(nlkind))
+            clearNL(nlkind);
+
+        // Note that this clears the CONST and MULTIPLE load tables as well.
+        for (CseAcc a = 0; a < CSE_NUM_USED_ACCS; a++)
+            clearL(a);
+
+        knownCmpValues.clear();
+    }
+
+    inline uint32_t CseFilter::hashImmI(int32_t a) {
+        return hashfinish(hash32(0, a));
+    }
+
+    inline uint32_t CseFilter::hashImmF4(const float4_t& a) {
+        const uint32_t* up = reinterpret_cast<const uint32_t*>(&a);
+
+        uint32_t hash = hash32(0, up[0]);
+                 hash = hash32(hash,up[1]);
+                 hash = hash32(hash,up[2]);
+                 hash = hash32(hash,up[3]);
+
+        return hashfinish(hash);
+    }
+
+    inline uint32_t CseFilter::hashImmQorD(uint64_t a) {
+        uint32_t hash = hash32(0, uint32_t(a >> 32));
+        return hashfinish(hash32(hash, uint32_t(a)));
+    }
+
+    inline uint32_t CseFilter::hash1(LOpcode op, LIns* a) {
+        uint32_t hash = hash32(0, uint32_t(op));
+        return hashfinish(hashptr(hash, a));
+    }
+
+    inline uint32_t CseFilter::hash2(LOpcode op, LIns* a, LIns* b) {
+        uint32_t hash = hash32(0, uint32_t(op));
+        hash = hashptr(hash, a);
+        return hashfinish(hashptr(hash, b));
+    }
+
+    inline uint32_t CseFilter::hash3(LOpcode op, LIns* a, LIns* b, LIns* c) {
+        uint32_t hash = hash32(0, uint32_t(op));
+        hash = hashptr(hash, a);
+        hash = hashptr(hash, b);
+        return hashfinish(hashptr(hash, c));
+    }
+
+    inline uint32_t CseFilter::hash4(LOpcode op, LIns* a, LIns* b, LIns* c, LIns* d) {
+        uint32_t hash = hash32(0, uint32_t(op));
+        hash = hashptr(hash, a);
+        hash = hashptr(hash, b);
+        hash = hashptr(hash, c);
+        return hashfinish(hashptr(hash, d));
+    }
+    
+    // Nb: no need to hash the load's MiniAccSet because each every load goes
+    // into a table where all the loads have the same MiniAccSet.
+    inline uint32_t CseFilter::hashLoad(LOpcode op, LIns* a, int32_t d) {
+        uint32_t hash = hash32(0, uint32_t(op));
+        hash = hashptr(hash, a);
+        return hashfinish(hash32(hash, d));
+    }
+
+    inline uint32_t CseFilter::hashCall(const CallInfo *ci, uint32_t argc, LIns* args[]) {
+        uint32_t hash = hashptr(0, ci);
+        for (int32_t j=argc-1; j >= 0; j--)
+            hash = hashptr(hash,args[j]);
+        return hashfinish(hash);
+    }
+
+    void CseFilter::growNL(NLKind nlkind)
+    {
+        NanoAssert(nlkind != NLImmISmall);
+        const uint32_t oldcap = m_capNL[nlkind];
+        m_capNL[nlkind] <<= 1;
+        LIns** tmp = (LIns**)alloc.alloc(sizeof(LIns*) * m_capNL[nlkind]);
+        NanoAssert(tmp);
+        LIns** oldlist = m_listNL[nlkind];
+        m_listNL[nlkind] = tmp;
+        VMPI_memset(m_listNL[nlkind], 0, m_capNL[nlkind] * sizeof(LIns*));
+        find_t find = m_findNL[nlkind];
+        for (uint32_t i = 0; i < oldcap; i++) {
+            LIns* ins = oldlist[i];
+            if (!ins) continue;
+            uint32_t j = (this->*find)(ins);
+            NanoAssert(!m_listNL[nlkind][j]);
+            m_listNL[nlkind][j] = ins;
+        }
+    }
+
+    void CseFilter::growL(CseAcc cseAcc)
+    {
+        const uint32_t oldcap = m_capL[cseAcc];
+        m_capL[cseAcc] <<= 1;
+        LIns** tmp = (LIns**)alloc.alloc(sizeof(LIns*) * m_capL[cseAcc]);
+        NanoAssert(tmp);
+        LIns** oldlist = m_listL[cseAcc];
+        m_listL[cseAcc] = tmp;
+        VMPI_memset(m_listL[cseAcc], 0, m_capL[cseAcc] * sizeof(LIns*));
+        find_t find = &CseFilter::findLoad;
+        for (uint32_t i = 0; i < oldcap; i++) {
+            LIns* ins = oldlist[i];
+            if (!ins) continue;
+            uint32_t j = (this->*find)(ins);
+            NanoAssert(!m_listL[cseAcc][j]);
+            m_listL[cseAcc][j] = ins;
+        }
+    }
+
+    void CseFilter::addNLImmISmall(LIns* ins, uint32_t k)
+    {
+        if (suspended) return;
+        NLKind nlkind = NLImmISmall;
+        NanoAssert(k < m_capNL[nlkind]);
+        NanoAssert(!m_listNL[nlkind][k]);
+        m_usedNL[nlkind]++;
+        m_listNL[nlkind][k] = ins;
+    }
+
+    void CseFilter::addNL(NLKind nlkind, LIns* ins, uint32_t k)
+    {
+        if (suspended) return;
+        NanoAssert(!m_listNL[nlkind][k]);
+        m_usedNL[nlkind]++;
+        m_listNL[nlkind][k] = ins;
+        if ((m_usedNL[nlkind] * 4) >= (m_capNL[nlkind] * 3)) {  // load factor of 0.75
+            growNL(nlkind);
+        }
+    }
+
+    void CseFilter::addL(LIns* ins, uint32_t k)
+    {
+        if (suspended) return;
+        CseAcc cseAcc = miniAccSetToCseAcc(ins->miniAccSet(), ins->loadQual());
+        NanoAssert(!m_listL[cseAcc][k]);
+        m_usedL[cseAcc]++;
+        m_listL[cseAcc][k] = ins;
+        if ((m_usedL[cseAcc] * 4) >= (m_capL[cseAcc] * 3)) {  // load factor of 0.75
+            growL(cseAcc);
+        }
+    }
+
+    inline LIns* CseFilter::findImmISmall(int32_t a, uint32_t &k, bool tainted)
+    {
+        // This one is a direct array lookup rather than a hashtable lookup.
+        NLKind nlkind = NLImmISmall;
+        k = (a * 2) + (unsigned(tainted) & 1);
+        LIns* ins = m_listNL[nlkind][k];
+        NanoAssert(!ins || ins->isImmI(a));
+        return ins;
+    }
+
+    uint32_t CseFilter::findImmISmall(LIns* ins)
+    {
+        uint32_t k;
+        findImmISmall(ins->immI(), k, ins->isTainted());
+        return k;
+    }
+
+    inline LIns* CseFilter::findImmILarge(int32_t a, uint32_t &k, bool tainted)
+    {
+        NLKind nlkind = NLImmILarge;
+        const uint32_t bitmask = m_capNL[nlkind] - 1;
+        k = (hashImmI(a) + (unsigned(tainted) & 1)) & bitmask;
+        uint32_t n = 1;
+        while (true) {
+            LIns* ins = m_listNL[nlkind][k];
+            if (!ins)
+                return NULL;
+            NanoAssert(ins->isImmI());
+            if (ins->immI() == a && ins->isTainted() == tainted)
+                return ins;
+            // Quadratic probe:  h(k,i) = h(k) + 0.5i + 0.5i^2, which gives the
+            // sequence h(k), h(k)+1, h(k)+3, h(k)+6, h+10, ...  This is a
+            // good sequence for 2^n-sized tables as the values h(k,i) for i
+            // in [0,m - 1] are all distinct so termination is guaranteed.
+            // See http://portal.acm.org/citation.cfm?id=360737 and
+            // http://en.wikipedia.org/wiki/Quadratic_probing (fetched
+            // 06-Nov-2009) for more details.
+            k = (k + n) & bitmask;
+            n += 1;
+        }
+    }
+
+    uint32_t CseFilter::findImmILarge(LIns* ins)
+    {
+        uint32_t k;
+        findImmILarge(ins->immI(), k, ins->isTainted());
+        return k;
+    }
+
+#ifdef NANOJIT_64BIT
+    inline LIns* CseFilter::findImmQ(uint64_t a, uint32_t &k, bool tainted)
+    {
+        NLKind nlkind = NLImmQ;
+        const uint32_t bitmask = m_capNL[nlkind] - 1;
+        k = (hashImmQorD(a) + (unsigned(tainted) & 1)) & bitmask;
+        uint32_t n = 1;
+        while (true) {
+            LIns* ins = m_listNL[nlkind][k];
+            if (!ins)
+                return NULL;
+            NanoAssert(ins->isImmQ());
+            if (ins->immQ() == a && ins->isTainted() == tainted)
+                return ins;
+            k = (k + n) & bitmask;
+            n += 1;
+        }
+    }
+
+    uint32_t CseFilter::findImmQ(LIns* ins)
+    {
+        uint32_t k;
+        findImmQ(ins->immQ(), k, ins->isTainted());
+        return k;
+    }
+#endif
+
+    inline LIns* CseFilter::findImmD(uint64_t a, uint32_t &k, bool tainted)
+    {
+        NLKind nlkind = NLImmD;
+        const uint32_t bitmask = m_capNL[nlkind] - 1;
+        k = (hashImmQorD(a) + (unsigned(tainted) & 1)) & bitmask;
+        uint32_t n = 1;
+        while (true) {
+            LIns* ins = m_listNL[nlkind][k];
+            if (!ins)
+                return NULL;
+            NanoAssert(ins->isImmD());
+            if (ins->immDasQ() == a && ins->isTainted() == tainted)
+                return ins;
+            k = (k + n) & bitmask;
+            n += 1;
+        }
+    }
+
+    uint32_t CseFilter::findImmD(LIns* ins)
+    {
+        // Use bitwise (integer) comparison.
+        uint32_t k;
+        findImmD(ins->immDasQ(), k, ins->isTainted());
+        return k;
+    }
+
+    inline LIns* CseFilter::findImmF(int32_t a, uint32_t &k, bool tainted)
+    {
+        NLKind nlkind = NLImmF;
+        const uint32_t bitmask = m_capNL[nlkind] - 1;
+        uint32_t n = 1;
+        k = (hashImmI(a) + (unsigned(tainted) & 1)) & bitmask;
+        while (true) {
+            LIns* ins = m_listNL[nlkind][k];
+            if (!ins)
+                return NULL;
+            NanoAssert(ins->isImmF());
+            if (ins->immFasI() == a && ins->isTainted() == tainted)
+                return ins;
+            k = (k + n) & bitmask;
+            n += 1;
+        }
+    }
+
+    uint32_t CseFilter::findImmF(LIns* ins)
+    {
+        NanoAssert(ins->isImmF());
+
+        // Use bitwise (integer) comparison.
+        uint32_t k;
+        findImmF(ins->immFasI(), k, ins->isTainted());
+        return k;
+    }
+    
+    inline LIns* CseFilter::findImmF4(const float4_t& a, uint32_t &k, bool tainted)
+    {
+        NLKind nlkind = NLImmF4;
+        const uint32_t bitmask = m_capNL[nlkind] - 1;
+        uint32_t n = 1;
+        k = (hashImmF4(a) + (unsigned(tainted) & 1)) & bitmask;
+        while (true) {
+            LIns* ins = m_listNL[nlkind][k];
+            if (!ins)
+                return NULL;
+            NanoAssert(ins->isImmF4());
+            float4_t b = ins->immF4();
+            // Use bitwise comparison, as we do for floats and doubles.
+            if (VMPI_memcmp(&a, &b, sizeof(float4_t)) == 0 && ins->isTainted() == tainted)
+                return ins;
+            k = (k + n) & bitmask;
+            n += 1;
+        }
+    }
+
+    uint32_t CseFilter::findImmF4(LIns* ins)
+    {
+        NanoAssert(ins->isImmF4());
+
+        uint32_t k;
+        findImmF4(ins->immF4(), k, ins->isTainted());
+        return k;
+    }
+
+    inline LIns* CseFilter::find1(LOpcode op, LIns* a, uint32_t &k)
+    {
+        NLKind nlkind = NL1;
+        const uint32_t bitmask = m_capNL[nlkind] - 1;
+        k = hash1(op, a) & bitmask;
+        uint32_t n = 1;
+        while (true) {
+            LIns* ins = m_listNL[nlkind][k];
+            if (!ins)
+                return NULL;
+            if (ins->isop(op) && ins->oprnd1() == a)
+                return ins;
+            k = (k + n) & bitmask;
+            n += 1;
+        }
+    }
+
+    uint32_t CseFilter::find1(LIns* ins)
+    {
+        uint32_t k;
+        find1(ins->opcode(), ins->oprnd1(), k);
+        return k;
+    }
+
+    inline LIns* CseFilter::find2(LOpcode op, LIns* a, LIns* b, uint32_t &k)
+    {
+        NLKind nlkind = NL2;
+        const uint32_t bitmask = m_capNL[nlkind] - 1;
+        k = hash2(op, a, b) & bitmask;
+        uint32_t n = 1;
+        while (true) {
+            LIns* ins = m_listNL[nlkind][k];
+            if (!ins)
+                return NULL;
+            if (ins->isop(op) && ins->oprnd1() == a && ins->oprnd2() == b)
+                return ins;
+            k = (k + n) & bitmask;
+            n += 1;
+        }
+    }
+
+    uint32_t CseFilter::find2(LIns* ins)
+    {
+        uint32_t k;
+        find2(ins->opcode(), ins->oprnd1(), ins->oprnd2(), k);
+        return k;
+    }
+
+    inline LIns* CseFilter::find3(LOpcode op, LIns* a, LIns* b, LIns* c, uint32_t &k)
+    {
+        NLKind nlkind = NL3;
+        const uint32_t bitmask = m_capNL[nlkind] - 1;
+        k = hash3(op, a, b, c) & bitmask;
+        uint32_t n = 1;
+        while (true) {
+            LIns* ins = m_listNL[nlkind][k];
+            if (!ins)
+                return NULL;
+            if (ins->isop(op) && ins->oprnd1() == a && ins->oprnd2() == b && ins->oprnd3() == c)
+                return ins;
+            k = (k + n) & bitmask;
+            n += 1;
+        }
+    }
+
+    uint32_t CseFilter::find3(LIns* ins)
+    {
+        uint32_t k;
+        find3(ins->opcode(), ins->oprnd1(), ins->oprnd2(), ins->oprnd3(), k);
+        return k;
+    }
+
+    inline LIns* CseFilter::find4(LOpcode op, LIns* a, LIns* b, LIns* c, LIns* d, uint32_t &k)
+    {
+        NLKind nlkind = NL4;
+        const uint32_t bitmask = m_capNL[nlkind] - 1;
+        k = hash4(op, a, b, c, d) & bitmask;
+        uint32_t n = 1;
+        while (true) {
+            LIns* ins = m_listNL[nlkind][k];
+            if (!ins)
+                return NULL;
+            if (ins->isop(op) && ins->oprnd1() == a && ins->oprnd2() == b && ins->oprnd3() == c && ins->oprnd4() == d)
+                return ins;
+            k = (k + n) & bitmask;
+            n += 1;
+        }
+    }
+    
+    uint32_t CseFilter::find4(LIns* ins)
+    {
+        uint32_t k;
+        find4(ins->opcode(), ins->oprnd1(), ins->oprnd2(), ins->oprnd3(), ins->oprnd4(), k);
+        return k;
+    }
+        
+    inline LIns* CseFilter::findLoad(LOpcode op, LIns* a, int32_t d, MiniAccSet miniAccSet,
+                                     LoadQual loadQual, uint32_t &k)
+    {
+        CseAcc cseAcc = miniAccSetToCseAcc(miniAccSet, loadQual);
+        const uint32_t bitmask = m_capL[cseAcc] - 1;
+        k = hashLoad(op, a, d) & bitmask;
+        uint32_t n = 1;
+        while (true) {
+            LIns* ins = m_listL[cseAcc][k];
+            if (!ins)
+                return NULL;
+            // All the loads in this table should have the same miniAccSet and
+            // loadQual.
+            NanoAssert(miniAccSetToCseAcc(ins->miniAccSet(), ins->loadQual()) == cseAcc &&
+                       ins->loadQual() == loadQual);
+            if (ins->isop(op) && ins->oprnd1() == a && ins->disp() == d)
+                return ins;
+            k = (k + n) & bitmask;
+            n += 1;
+        }
+    }
+
+    uint32_t CseFilter::findLoad(LIns* ins)
+    {
+        uint32_t k;
+        findLoad(ins->opcode(), ins->oprnd1(), ins->disp(), ins->miniAccSet(), ins->loadQual(), k);
+        return k;
+    }
+
+    bool argsmatch(LIns* ins, uint32_t argc, LIns* args[])
+    {
+        for (uint32_t j=0; j < argc; j++)
+            if (ins->arg(j) != args[j])
+                return false;
+        return true;
+    }
+
+    inline LIns* CseFilter::findCall(const CallInfo *ci, uint32_t argc, LIns* args[], uint32_t &k)
+    {
+        NLKind nlkind = NLCall;
+        const uint32_t bitmask = m_capNL[nlkind] - 1;
+        k = hashCall(ci, argc, args) & bitmask;
+        uint32_t n = 1;
+        while (true) {
+            LIns* ins = m_listNL[nlkind][k];
+            if (!ins)
+                return NULL;
+            if (ins->isCall() && ins->callInfo() == ci && argsmatch(ins, argc, args))
+                return ins;
+            k = (k + n) & bitmask;
+            n += 1;
+        }
+    }
+
+    uint32_t CseFilter::findCall(LIns* ins)
+    {
+        LIns* args[MAXARGS];
+        uint32_t argc = ins->argc();
+        NanoAssert(argc < MAXARGS);
+        for (uint32_t j=0; j < argc; j++)
+            args[j] = ins->arg(j);
+        uint32_t k;
+        findCall(ins->callInfo(), argc, args, k);
+        return k;
+    }
+
+    // Tainted and non-tainted constants of equal value are treated
+    // as distinct by CSE, thus preserving the taint status.  We might
+    // like to share small constants that will not be blinded anyhow,
+    // but this would allow synthesis of arbitrary untainted constants
+    // through constant folding.  We could avoid this hazard by
+    // rewriting CSEs after all constant folding has been performed, but
+    // such a strategy is incompatible with our one-pass optimizer
+    // architecture, thus we sacrifice some CSE opportunities when
+    // constant blinding is enabled.
+    //
+    // In practice, we expect sharing between tainted and untainted
+    // expressions to be confined mostly to leaf constants, which we
+    // tend to rematerialize frequently in preference to long-term
+    // register residency.  In fact, the loss of leaf constant sharing
+    // may reduce register pressure, due to pragmatic restrictions on
+    // rematerialization of tainted constants that can force spills.
+
+    LIns* CseFilter::insImmI(int32_t imm, bool tainted)
+    {
+        uint32_t k;
+        LIns* ins;
+        const bool blind = tainted && config.harden_blind_constants;
+        // Each value gets two slots in m_capNL: one for tainted and another for untainted.
+        if (0 <= imm && imm < int32_t(m_capNL[NLImmISmall])/2) {
+            ins = findImmISmall(imm, k, blind);
+            if (!ins) {
+                ins = out->insImmI(imm, blind);
+                addNLImmISmall(ins, k);
+            }
+        } else {
+            ins = findImmILarge(imm, k, blind);
+            if (!ins) {
+                ins = out->insImmI(imm, blind);
+                addNL(NLImmILarge, ins, k);
+            }
+        }
+        // We assume that downstream stages do not modify the instruction, so
+        // that we can insert 'ins' into slot 'k'.  Check this.
+        NanoAssert(ins->isop(LIR_immi) && ins->immI() == imm);
+        return ins;
+    }
+
+    LIns* CseFilter::insSafe(LOpcode op, void *payload) {
+        return out->insSafe(op, payload);
+    }
+
+#ifdef NANOJIT_64BIT
+    LIns* CseFilter::insImmQ(uint64_t q, bool tainted)
+    {
+        uint32_t k;
+        const bool blind = tainted && config.harden_blind_constants;
+        LIns* ins = findImmQ(q, k, blind);
+        if (!ins) {
+            ins = out->insImmQ(q, blind);
+            addNL(NLImmQ, ins, k);
+        }
+        NanoAssert(ins->isop(LIR_immq) && ins->immQ() == q);
+        return ins;
+    }
+#endif
+
+    LIns* CseFilter::insImmD(double d, bool tainted)
+    {
+        uint32_t k;
+        // Doubles must be compared bitwise in order to correctly
+        // distinguish 0 and -0.  See bug 527288.
+        union {
+            double d;
+            uint64_t u64;
+        } u;
+        u.d = d;
+        const bool blind = tainted && config.harden_blind_constants;
+        LIns* ins = findImmD(u.u64, k, blind);
+        if (!ins) {
+            ins = out->insImmD(d, blind);
+            addNL(NLImmD, ins, k);
+        }
+        NanoAssert(ins->isop(LIR_immd) && ins->immDasQ() == u.u64);
+        return ins;
+    }
+
+    LIns* CseFilter::insImmF(float f, bool tainted)
+    {
+        uint32_t k;
+        // Floats must be compared bitwise in order to correctly
+        // distinguish 0 and -0.  Also, we wish for NaNs to compare
+        // as equal, though we may in some cases distinguish different
+        // NaN values unnecessarily.
+        union {
+            float flt;
+            int32_t i;
+        } u;
+        u.flt = f;
+        const bool blind = tainted && config.harden_blind_constants;
+        LIns* ins = findImmF(u.i, k, blind);
+        if (!ins) {
+            ins = out->insImmF(f, blind);
+            addNL(NLImmF, ins, k);
+        }
+        NanoAssert(ins->isop(LIR_immf) && ins->immFasI() == u.i);
+        return ins;
+    }
+    
+    LIns* CseFilter::insImmF4(const float4_t& f4, bool tainted)
+    {
+        uint32_t k;
+        const bool blind = tainted && config.harden_blind_constants;
+        LIns* ins = findImmF4(f4, k, blind);
+        if (!ins) {
+            ins = out->insImmF4(f4, blind);
+            addNL(NLImmF4, ins, k);
+        }
+#ifdef DEBUG
+        NanoAssert(ins->isop(LIR_immf4));
+        // We must use bitwise comparision here in order
+        // to correctly distinguish 0 and -0.  See also the
+        // remarks for Float.
+        float4_t other = ins->immF4();
+        NanoAssert(VMPI_memcmp( &f4, &other, sizeof(float4_t)) == 0);
+#endif
+        return ins;
+    }
+
+    LIns* CseFilter::ins0(LOpcode op)
+    {
+        if (op == LIR_label && !suspended)
+            clearAll();
+        return out->ins0(op);
+    }
+
+    LIns* CseFilter::ins1(LOpcode op, LIns* a)
+    {
+        LIns* ins;
+        if (isCseOpcode(op)) {
+            uint32_t k;
+            ins = find1(op, a, k);
+            if (!ins) {
+                ins = out->ins1(op, a);
+                addNL(NL1, ins, k);
+            }
+        } else {
+            ins = out->ins1(op, a);
+        }
+        NanoAssert(ins->isop(op) && ins->oprnd1() == a);
+        return ins;
+    }
+
+    LIns* CseFilter::ins2(LOpcode op, LIns* a, LIns* b)
+    {
+        LIns* ins;
+        NanoAssert(isCseOpcode(op));
+        uint32_t k;
+        ins = find2(op, a, b, k);
+        if (!ins) {
+            ins = out->ins2(op, a, b);
+            addNL(NL2, ins, k);
+        } else if (ins->isCmp()) {
+            if (knownCmpValues.containsKey(ins)) {
+                // We've seen this comparison before, and it was previously
+                // used in a guard, so we know what its value must be at this
+                // point.  Replace it with a constant.
+                NanoAssert(ins->isCmp());
+                bool cmpValue = knownCmpValues.get(ins);
+                return insImmI((cmpValue ? 1 : 0), /*tainted*/false);
+            }
+        }
+        NanoAssert(ins->isop(op) && ins->oprnd1() == a && ins->oprnd2() == b);
+        return ins;
+    }
+
+    LIns* CseFilter::ins3(LOpcode op, LIns* a, LIns* b, LIns* c)
+    {
+        NanoAssert(isCseOpcode(op));
+        uint32_t k;
+        LIns* ins = find3(op, a, b, c, k);
+        if (!ins) {
+            ins = out->ins3(op, a, b, c);
+            addNL(NL3, ins, k);
+        }
+        NanoAssert(ins->isop(op) && ins->oprnd1() == a && ins->oprnd2() == b && ins->oprnd3() == c);
+        return ins;
+    }
+
+    LIns* CseFilter::ins4(LOpcode op, LIns* a, LIns* b, LIns* c, LIns* d)
+    {
+        NanoAssert(isCseOpcode(op));
+        uint32_t k;
+        LIns* ins = find4(op, a, b, c, d, k);
+        if (!ins) {
+            ins = out->ins4(op, a, b, c, d);
+            addNL(NL4, ins, k);
+        }
+        NanoAssert(ins->isop(op) && ins->oprnd1() == a && ins->oprnd2() == b && ins->oprnd3() == c && ins->oprnd4() == d);
+        return ins;
+    }
+    
+    LIns* CseFilter::insLoad(LOpcode op, LIns* base, int32_t disp, AccSet accSet, LoadQual loadQual)
+    {
+        LIns* ins;
+        if (isS16(disp)) {
+            if (storesSinceLastLoad != ACCSET_NONE) {
+                // Clear all normal (excludes CONST and MULTIPLE) loads
+                // aliased by stores and calls since the last time we were in
+                // this function.  Aliased loads must be cleared even when CSE
+                // is suspended.
+                AccSet a = storesSinceLastLoad & ((1 << EMB_NUM_USED_ACCS) - 1);
+                while (a) {
+                    int acc = msbSet32(a);
+                    clearL((CseAcc)acc);
+                    a &= ~(1 << acc);
+                }
+
+                // No need to clear CONST loads (those in the CSE_ACC_CONST table).
+
+                // Multi-region loads must be treated conservatively -- we
+                // always clear all of them.
+                clearL(CSE_ACC_MULTIPLE);
+
+                storesSinceLastLoad = ACCSET_NONE;
+            }
+
+            if (loadQual == LOAD_VOLATILE) {
+                // Volatile loads are never CSE'd, don't bother looking for
+                // them or inserting them in the table.
+                ins = out->insLoad(op, base, disp, accSet, loadQual);
+            } else {
+                uint32_t k;
+                ins = findLoad(op, base, disp, compressAccSet(accSet), loadQual, k);
+                if (!ins) {
+                    ins = out->insLoad(op, base, disp, accSet, loadQual);
+                    addL(ins, k);
+                }
+            }
+            // Nb: must compare miniAccSets, not AccSets, because the AccSet
+            // stored in the load may have lost info if it's multi-region.
+            NanoAssert(ins->isop(op) && ins->oprnd1() == base && ins->disp() == disp &&
+                       ins->miniAccSet().val == compressAccSet(accSet).val &&
+                       ins->loadQual() == loadQual);
+        } else {
+            // If the displacement is more than 16 bits, put it in a separate
+            // instruction.  Nb: LirBufWriter also does this, we do it here
+            // too because CseFilter relies on LirBufWriter not changing code.
+            ins = insLoad(op, ins2(LIR_addp, base, insImmWord(disp)), 0, accSet, loadQual);
+        }
+        return ins;
+    }
+
+    LIns* CseFilter::insStore(LOpcode op, LIns* value, LIns* base, int32_t disp, AccSet accSet)
+    {
+        LIns* ins;
+        if (isS16(disp)) {
+            storesSinceLastLoad |= accSet;
+            ins = out->insStore(op, value, base, disp, accSet);
+            NanoAssert(ins->isop(op) && ins->oprnd1() == value && ins->oprnd2() == base &&
+                       ins->disp() == disp && ins->accSet() == accSet);
+        } else {
+            // If the displacement is more than 16 bits, put it in a separate
+            // instruction.  Nb: LirBufWriter also does this, we do it here
+            // too because CseFilter relies on LirBufWriter not changing code.
+            ins = insStore(op, value, ins2(LIR_addp, base, insImmWord(disp)), 0, accSet);
+        }
+        return ins;
+    }
+
+    LIns* CseFilter::insGuard(LOpcode op, LIns* c, GuardRecord *gr)
+    {
+        // LIR_xt and LIR_xf guards are CSEable.  Note that we compare the
+        // opcode and condition when determining if two guards are equivalent
+        // -- in find1() and hash1() -- but we do *not* compare the
+        // GuardRecord.  This works because:
+        // - If guard 1 is taken (exits) then guard 2 is never reached, so
+        //   guard 2 can be removed.
+        // - If guard 1 is not taken then neither is guard 2, so guard 2 can
+        //   be removed.
+        //
+        // The underlying assumptions that are required for this to be safe:
+        // - There's never a path from the side exit of guard 1 back to guard
+        //   2;  for tree-shaped fragments this should be true.
+        // - GuardRecords do not contain information other than what is needed
+        //   to execute a successful exit.  That is currently true.
+        // - The CSE algorithm will always keep guard 1 and remove guard 2
+        //   (not vice versa).  The current algorithm does this.
+        //
+        LIns* ins;
+        if (isCseOpcode(op)) {
+            // conditional guard
+            uint32_t k;
+            ins = find1(op, c, k);
+            if (!ins) {
+                ins = out->insGuard(op, c, gr);
+                addNL(NL1, ins, k);
+            }
+            // After this guard, we know that 'c's result was true (if
+            // op==LIR_xf) or false (if op==LIR_xt), else we would have
+            // exited.  Record this fact in case 'c' occurs again.
+            if (!suspended) {
+                bool c_value = (op == LIR_xt ? false : true);
+                knownCmpValues.put(c, c_value);
+            }
+        } else {
+            ins = out->insGuard(op, c, gr);
+        }
+        NanoAssert(ins->isop(op) && ins->oprnd1() == c);
+        return ins;
+    }
+
+    LIns* CseFilter::insGuardXov(LOpcode op, LIns* a, LIns* b, GuardRecord *gr)
+    {
+        // LIR_*xov are CSEable.  See CseFilter::insGuard() for details.
+        NanoAssert(isCseOpcode(op));
+        // conditional guard
+        uint32_t k;
+        LIns* ins = find2(op, a, b, k);
+        if (!ins) {
+            ins = out->insGuardXov(op, a, b, gr);
+            addNL(NL2, ins, k);
+        }
+        NanoAssert(ins->isop(op) && ins->oprnd1() == a && ins->oprnd2() == b);
+        return ins;
+    }
+
+    // There is no CseFilter::insBranchJov(), as LIR_*jov* are not CSEable.
+
+    LIns* CseFilter::insCall(const CallInfo *ci, LIns* args[])
+    {
+        LIns* ins;
+        uint32_t argc = ci->count_args();
+        if (ci->_isPure) {
+            NanoAssert(ci->_storeAccSet == ACCSET_NONE);
+            uint32_t k;
+            ins = findCall(ci, argc, args, k);
+            if (!ins) {
+                ins = out->insCall(ci, args);
+                addNL(NLCall, ins, k);
+            }
+        } else {
+            // We only need to worry about aliasing if !ci->_isPure.
+            storesSinceLastLoad |= ci->_storeAccSet;
+            ins = out->insCall(ci, args);
+        }
+        NanoAssert(ins->isCall() && ins->callInfo() == ci && argsmatch(ins, argc, args));
+        NanoAssert(!ins->isInReg());
+        return ins;
+    }
 
-            CASE64(LIR_cmovq:)
-            case LIR_cmovi:
-            case LIR_cmovd:
-            case LIR_cmovf:
-            case LIR_cmovf4:
-                VMPI_snprintf(s, n, "%s = %s %s ? %s : %s", formatRef(&b1, i), lirNames[op],
-                    formatRef(&b2, i->oprnd1()),
-                    formatRef(&b3, i->oprnd2()),
-                    formatRef(&b4, i->oprnd3()));
-                break;
+    LIns* CseFilter::insSwz(LIns* a, uint8_t mask) {
+        NanoAssert(isCseOpcode(LIR_swzf4));
+        // todo: add hashtable for swizzle ops.
+        return out->insSwz(a, mask);
+    }
 
-            case LIR_ffff2f4:
-                VMPI_snprintf(s, n, "%s =(%s)= %s %s %s %s", formatRef(&b1, i), lirNames[op],
-                              formatRef(&b2, i->oprnd1()),
-                              formatRef(&b3, i->oprnd2()),
-                              formatRef(&b4, i->oprnd3()),
-                              formatRef(&b5, i->oprnd4()));
-                break;
-                
-            case LIR_ldi:
-            CASE64(LIR_ldq:)
-            case LIR_ldd:
-            case LIR_ldf:
-            case LIR_ldf4:
-            case LIR_lduc2ui:
-            case LIR_ldus2ui:
-            case LIR_ldc2i:
-            case LIR_lds2i:
-            case LIR_ldf2d: {
-                const char* qualStr;
-                switch (i->loadQual()) {
-                case LOAD_CONST:        qualStr = "/c"; break;
-                case LOAD_NORMAL:       qualStr = "";   break;
-                case LOAD_VOLATILE:     qualStr = "/v"; break;
-                default: NanoAssert(0); qualStr = "/?"; break;
+    FlowGraph::FlowGraph(Allocator& alloc, LIns** insns, uint32_t n)
+        : index(alloc, n / 4 + 16)
+    {
+        for (uint32_t i = 0; i < n; i++)
+            index.put(insns[i], i);
+
+        blockOf = new (alloc) uint32_t[n];
+        nblocks = 0;
+        for (uint32_t i = 0; i < n; i++) {
+            if (i > 0 && (insns[i]->isop(LIR_label) || insns[i - 1]->isBranch()))
+                nblocks++;
+            blockOf[i] = nblocks;
+        }
+        nblocks++;
+
+        // Control falls into the next block unless the block ends with a
+        // jump, return or exit.  backFrom[i] is the earliest target of a
+        // backward branch at or after i, or n if there is none.
+        Seq<uint32_t>** preds = new (alloc) Seq<uint32_t>*[nblocks];
+        succs = new (alloc) Seq<uint32_t>*[nblocks];
+        VMPI_memset(preds, 0, nblocks * sizeof(Seq<uint32_t>*));
+        VMPI_memset(succs, 0, nblocks * sizeof(Seq<uint32_t>*));
+        backFrom = new (alloc) uint32_t[n + 1];
+        backFrom[n] = n;
+        for (uint32_t i = n; i-- > 0; ) {
+            LIns* ins = insns[i];
+            uint32_t b = blockOf[i];
+            backFrom[i] = backFrom[i + 1];
+            uint32_t ntargets = ins->isop(LIR_jtbl) ? ins->getTableSize() : ins->isBranch() ? 1 : 0;
+            for (uint32_t t = 0; t < ntargets; t++) {
+                uint32_t l = index.get(ins->isop(LIR_jtbl) ? ins->getTarget(t) : ins->getTarget());
+                preds[blockOf[l]] = new (alloc) Seq<uint32_t>(b, preds[blockOf[l]]);
+                succs[b] = new (alloc) Seq<uint32_t>(blockOf[l], succs[b]);
+                if (l < i && l < backFrom[i])
+                    backFrom[i] = l;
+            }
+            if (i + 1 < n && blockOf[i + 1] != b &&
+                !(ins->isUnConditionalBranch() || ins->isRet() || ins->isop(LIR_x))) {
+                preds[b + 1] = new (alloc) Seq<uint32_t>(b, preds[b + 1]);
+                succs[b] = new (alloc) Seq<uint32_t>(b + 1, succs[b]);
+            }
+        }
+
+        reachable = new (alloc) bool[nblocks];
+        VMPI_memset(reachable, 0, nblocks * sizeof(bool));
+        uint32_t* stack = new (alloc) uint32_t[nblocks];
+        uint32_t sp = 0;
+        reachable[0] = true;
+        stack[sp++] = 0;
+        while (sp > 0) {
+            for (Seq<uint32_t>* s = succs[stack[--sp]]; s; s = s->tail) {
+                if (!reachable[s->head]) {
+                    reachable[s->head] = true;
+                    stack[sp++] = s->head;
                 }
-                VMPI_snprintf(s, n, "%s = %s%s%s %s[%d]", formatRef(&b1, i), lirNames[op],
-                    formatAccSet(&b2, i->accSet()), qualStr, formatRef(&b3, i->oprnd1()),
-                    i->disp());
-                break;
             }
+        }
 
-            case LIR_sti:
-            CASE64(LIR_stq:)
-            case LIR_std:
-            case LIR_stf:
-            case LIR_stf4:
-            case LIR_sti2c:
-            case LIR_sti2s:
-            case LIR_std2f:
-                VMPI_snprintf(s, n, "%s%s %s[%d] = %s", lirNames[op],
-                    formatAccSet(&b1, i->accSet()),
-                    formatRef(&b2, i->oprnd2()),
-                    i->disp(),
-                    formatRef(&b3, i->oprnd1()));
-                break;
+        // Iterate to a fixed point from "every block dominates every block".
+        nwords = (nblocks + 63) / 64;
+        dom = new (alloc) uint64_t[nblocks * nwords];
+        VMPI_memset(dom, 0xff, nblocks * nwords * sizeof(uint64_t));
+        VMPI_memset(dom, 0, nwords * sizeof(uint64_t));
+        setBit(dom, 0);
+        uint64_t* tmp = new (alloc) uint64_t[nwords];
+        for (bool changed = true; changed; ) {
+            changed = false;
+            for (uint32_t b = 1; b < nblocks; b++) {
+                if (!reachable[b])
+                    continue;
+                VMPI_memset(tmp, 0xff, nwords * sizeof(uint64_t));
+                for (Seq<uint32_t>* p = preds[b]; p; p = p->tail) {
+                    if (!reachable[p->head])
+                        continue;
+                    for (uint32_t w = 0; w < nwords; w++)
+                        tmp[w] &= dom[p->head * nwords + w];
+                }
+                setBit(tmp, b);
+                for (uint32_t w = 0; w < nwords; w++) {
+                    if (tmp[w] != dom[b * nwords + w]) {
+                        dom[b * nwords + w] = tmp[w];
+                        changed = true;
+                    }
+                }
+            }
+        }
+    }
 
-            case LIR_comment:
-                VMPI_snprintf(s, n, "------------------------------ # %s", (char*)i->oprnd1());
-                break;
+    bool FlowGraph::dominates(uint32_t a, uint32_t b) const
+    {
+        return a == b || testBit(&dom[b * nwords], a);
+    }
 
-            case LIR_swzf4:
-                VMPI_snprintf(s, n, "%s %s, %d|%d|%d|%d", lirNames[LIR_swzf4],
-                              formatRef(&b1, i->oprnd1()),
-                              i->mask() >> 0 & 3,
-                              i->mask() >> 2 & 3,
-                              i->mask() >> 4 & 3,
-                              i->mask() >> 6 & 3);
-                break;
+    bool FlowGraph::reachesDirectly(uint32_t i, uint32_t j) const
+    {
+        return i < j && dominates(blockOf[i], blockOf[j]) && backFrom[i + 1] > j;
+    }
 
-            case LIR_safe:
-            case LIR_endsafe:
-			case LIR_unreachable:
-                VMPI_snprintf(s, n, "%s", (char*)lirNames[op]);
-                break;
+    GvnFilter::GvnFilter(LirFilter* in, Allocator& alloc)
+        : LirFilter(in), _alloc(alloc), _replaced(alloc)
+    {
+        _insns = readAll(alloc, _next);
+        analyze(_insns, _next);
+    }
 
-            default:
-                NanoAssertMsgf(0, "Can't handle opcode %s\n", lirNames[op]);
-                break;
+    LIns* GvnFilter::read()
+    {
+        for (;;) {
+            // Keep returning LIR_start once everything else has gone.
+            LIns* ins = _insns[_next > 1 ? --_next : 0];
+            if (!_replaced.containsKey(ins))
+                return ins;
         }
-        return buf->buf;
     }
-#endif
 
-    CseFilter::CseFilter(LirWriter *out, uint8_t embNumUsedAccs, Allocator& alloc, const Config& config)
-        : LirWriter(out),
-          EMB_NUM_USED_ACCS(embNumUsedAccs),
-          CSE_NUM_USED_ACCS(EMB_NUM_USED_ACCS + 2),
-          CSE_ACC_CONST(    EMB_NUM_USED_ACCS + 0),
-          CSE_ACC_MULTIPLE( EMB_NUM_USED_ACCS + 1),
-          storesSinceLastLoad(ACCSET_NONE),
-          alloc(alloc),
-          knownCmpValues(alloc),
-          suspended(0),
-          config(config)
+    uint32_t GvnFilter::hash(LIns* ins)
     {
-        m_findNL[NLImmISmall] = &CseFilter::findImmISmall;
-        m_findNL[NLImmILarge] = &CseFilter::findImmILarge;
-        m_findNL[NLImmF]      = &CseFilter::findImmF;
-        m_findNL[NLImmQ]      = PTR_SIZE(NULL, &CseFilter::findImmQ);
-        m_findNL[NLImmD]      = &CseFilter::findImmD;
-        m_findNL[NL1]         = &CseFilter::find1;
-        m_findNL[NL2]         = &CseFilter::find2;
-        m_findNL[NL3]         = &CseFilter::find3;
-        m_findNL[NL4]         = &CseFilter::find4;
-        m_findNL[NLCall]      = &CseFilter::findCall;
-        m_findNL[NLImmF4]     = &CseFilter::findImmF4;
+        LOpcode op = ins->opcode();
+        if (ins->isLoad())
+            return CseFilter::hashLoad(op, ins->oprnd1(), ins->disp());
+        if (ins->isCall()) {
+            LIns* args[MAXARGS];
+            uint32_t argc = ins->argc();
+            NanoAssert(argc < MAXARGS);
+            for (uint32_t j = 0; j < argc; j++)
+                args[j] = ins->arg(j);
+            return CseFilter::hashCall(ins->callInfo(), argc, args);
+        }
+        switch (ins->numOperands()) {
+        case 1:     return CseFilter::hash1(op, ins->oprnd1());
+        case 2:     return CseFilter::hash2(op, ins->oprnd1(), ins->oprnd2());
+        case 3:     return CseFilter::hash3(op, ins->oprnd1(), ins->oprnd2(), ins->oprnd3());
+        default:    return CseFilter::hash4(op, ins->oprnd1(), ins->oprnd2(), ins->oprnd3(),
+                                            ins->oprnd4());
+        }
+    }
 
-        m_capNL[NLImmISmall]  = 2*17;   // covers 0..16, tainted/untainted (over 50% on Tracemonkey)
-        m_capNL[NLImmILarge]  = 64;
-        m_capNL[NLImmF]       = 16;
-        m_capNL[NLImmQ]       = PTR_SIZE(0, 16);
-        m_capNL[NLImmD]       = 16;
-        m_capNL[NL1]          = 256;
-        m_capNL[NL2]          = 512;
-        m_capNL[NL3]          = 16;
-        m_capNL[NL4]          = 16;
-        m_capNL[NLCall]       = 64;
-        m_capNL[NLImmF4]      = 16; 
+    bool GvnFilter::same(LIns* a, LIns* b)
+    {
+        if (a->opcode() != b->opcode())
+            return false;
+        if (a->isLoad())
+            return a->oprnd1() == b->oprnd1() && a->disp() == b->disp() &&
+                   a->miniAccSet().val == b->miniAccSet().val && a->loadQual() == b->loadQual();
+        if (a->isCall() && a->callInfo() != b->callInfo())
+            return false;
+        for (uint32_t k = 0, nops = a->numOperands(); k < nops; k++) {
+            if (a->operand(k) != b->operand(k))
+                return false;
+        }
+        return true;
+    }
 
-        for (NLKind nlkind = NLFirst; nlkind <= NLLast; nlkind = nextNLKind(nlkind)) {
-            m_listNL[nlkind] = (LIns**)alloc.alloc(sizeof(LIns*) * m_capNL[nlkind]);
-            NanoAssert(m_listNL[nlkind]);
-            m_usedNL[nlkind] = 1; // Force memset in clearAll().
+    // Can 'ins' be replaced by an equal instruction?
+    static bool isGvnCandidate(LIns* ins)
+    {
+        if (ins->isImmAny())
+            return false;
+        if (ins->isLoad())
+            return ins->loadQual() != LOAD_VOLATILE;
+        if (ins->isCall())
+            return ins->callInfo()->_isPure;
+        LOpcode op = ins->opcode();
+        switch (op) {
+        CASE86(LIR_divi:) CASE86(LIR_modi:)
+        CASE86(LIR_divq:) CASE86(LIR_modq:)
+        case LIR_swzf4:
+            return false;
+        default:
+            return !ins->isV() && !ins->isGuard() && !ins->isBranch() && isCseOpcode(op);
         }
+    }
 
-        // Note that this allocates the CONST and MULTIPLE tables as well.
-        for (CseAcc a = 0; a < CSE_NUM_USED_ACCS; a++) {
-            m_capL[a] = 16;
-            m_listL[a] = (LIns**)alloc.alloc(sizeof(LIns*) * m_capL[a]);
-            NanoAssert(m_listL[a]);
-            m_usedL[a] = 1; // Force memset(0) in first clearAll().
+    void GvnFilter::analyze(LIns** insns, uint32_t n)
+    {
+        FlowGraph g(_alloc, insns, n);
+
+        // stores[r][i] counts the instructions before i that may store to
+        // access region r, for the regions that anything stores to.
+        uint32_t* stores[NUM_ACCS];
+        VMPI_memset(stores, 0, sizeof(stores));
+        for (uint32_t i = 0; i < n; i++) {
+            LIns* ins = insns[i];
+            AccSet a = ins->isStore() ? ins->accSet() :
+                       (ins->isCall() && !ins->callInfo()->_isPure) ? ins->callInfo()->_storeAccSet :
+                       ACCSET_NONE;
+            for (int r = 0; r < NUM_ACCS; r++) {
+                if ((a & (AccSet(1) << r)) && !stores[r]) {
+                    stores[r] = new (_alloc) uint32_t[n + 1];
+                    VMPI_memset(stores[r], 0, (n + 1) * sizeof(uint32_t));
+                }
+                if (stores[r])
+                    stores[r][i + 1] = stores[r][i] + ((a & (AccSet(1) << r)) ? 1 : 0);
+            }
         }
 
-        clearAll();
+        uint32_t cap = 16;
+        while (cap < 2 * n)
+            cap *= 2;
+        LIns** table = new (_alloc) LIns*[cap];
+        VMPI_memset(table, 0, cap * sizeof(LIns*));
+
+        for (uint32_t i = 0; i < n; i++) {
+            LIns* ins = insns[i];
+            for (uint32_t k = 0, nops = ins->numOperands(); k < nops; k++) {
+                LIns* v = ins->operand(k);
+                if (v && _replaced.containsKey(v))
+                    ins->setOperand(k, _replaced.get(v));
+            }
+            if (!g.reachable[g.blockOf[i]] || !isGvnCandidate(ins))
+                continue;
+
+            uint32_t k = hash(ins) & (cap - 1);
+            for (uint32_t step = 1; table[k]; k = (k + step++) & (cap - 1)) {
+                LIns* other = table[k];
+                uint32_t j = g.index.get(other);
+                if (!same(other, ins) || !g.dominates(g.blockOf[j], g.blockOf[i]))
+                    continue;
+                if (ins->isLoad() && ins->loadQual() != LOAD_CONST) {
+                    bool clobbered = !g.reachesDirectly(j, i);
+                    for (int r = 0; r < NUM_ACCS && !clobbered; r++) {
+                        if ((ins->accSet() & (AccSet(1) << r)) && stores[r])
+                            clobbered = stores[r][i] != stores[r][j + 1];
+                    }
+                    if (clobbered)
+                        continue;
+                }
+                _replaced.put(ins, other);
+                break;
+            }
+            if (!table[k])
+                table[k] = ins;
+        }
     }
 
-    // Inlined/separated version of SuperFastHash.
-    // This content is copyrighted by Paul Hsieh.
-    // For reference see: http://www.azillionmonkeys.com/qed/hash.html
-    //
-    inline uint32_t CseFilter::hash8(uint32_t hash, const uint8_t data)
-    {
-        hash += data;
-        hash ^= hash << 10;
-        hash += hash >> 1;
-        return hash;
+    MemFilter::MemFilter(LirFilter* in, Allocator& alloc)
+        : LirFilter(in), _alloc(alloc), _replaced(alloc), _dead(alloc),
+          _nForwarded(0), _nRemoved(0)
+    {
+        uint32_t n;
+        _insns = readAll(alloc, n);
+        _next = n;
+        FlowGraph g(alloc, _insns, n);
+        HashMap<LIns*, bool> isPrivate(alloc);
+        findPrivateAreas(_insns, n, isPrivate, alloc);
+        forwardValues(_insns, n, g, isPrivate);
+        removeDeadStores(_insns, n, g, isPrivate);
+        for (uint32_t i = 0; i < n; i++) {
+            if (_replaced.containsKey(_insns[i]))
+                _nForwarded++;
+            else if (_dead.containsKey(_insns[i]))
+                _nRemoved++;
+        }
     }
 
-    inline uint32_t CseFilter::hash32(uint32_t hash, const uint32_t data)
+    LIns* MemFilter::read()
     {
-        const uint32_t dlo = data & 0xffff;
-        const uint32_t dhi = data >> 16;
-        hash += dlo;
-        const uint32_t tmp = (dhi << 11) ^ hash;
-        hash = (hash << 16) ^ tmp;
-        hash += hash >> 11;
-        return hash;
+        for (;;) {
+            // Keep returning LIR_start once everything else has gone.
+            LIns* ins = _insns[_next > 1 ? --_next : 0];
+            if (!_replaced.containsKey(ins) && !_dead.containsKey(ins))
+                return ins;
+        }
     }
 
-    inline uint32_t CseFilter::hashptr(uint32_t hash, const void* data)
-    {
-#ifdef NANOJIT_64BIT
-        hash = hash32(hash, uint32_t(uintptr_t(data) >> 32));
-        hash = hash32(hash, uint32_t(uintptr_t(data)));
-        return hash;
-#else
-        return hash32(hash, uint32_t(data));
-#endif
+    // Does a load with opcode 'ld' read back exactly what a store with
+    // opcode 'st' writes?
+    static bool loadsStoredValue(LOpcode ld, LOpcode st)
+    {
+        switch (st) {
+        case LIR_sti:       return ld == LIR_ldi;
+        CASE64(LIR_stq:)    return ld == LIR_ldq;
+        case LIR_std:       return ld == LIR_ldd;
+        case LIR_stf:       return ld == LIR_ldf;
+        case LIR_stf4:      return ld == LIR_ldf4;
+        CASEAVX(LIR_stf8:)  return ld == LIR_ldf8;
+        CASEAVX(LIR_std4:)  return ld == LIR_ldd4;
+        CASEAVX(LIR_sti8:)  return ld == LIR_ldi8;
+        default:            return false;
+        }
     }
 
-    inline uint32_t CseFilter::hashfinish(uint32_t hash)
+    static inline bool overlaps(LIns* a, LIns* b)
     {
-        /* Force "avalanching" of final 127 bits */
-        hash ^= hash << 3;
-        hash += hash >> 5;
-        hash ^= hash << 4;
-        hash += hash >> 17;
-        hash ^= hash << 25;
-        hash += hash >> 6;
-        return hash;
+        return a->disp() < b->disp() + accessSize(b->opcode()) &&
+               b->disp() < a->disp() + accessSize(a->opcode());
     }
 
-    void CseFilter::clearNL(NLKind nlkind) {
-        if (m_usedNL[nlkind] > 0) {
-            VMPI_memset(m_listNL[nlkind], 0, sizeof(LIns*)*m_capNL[nlkind]);
-            m_usedNL[nlkind] = 0;
-        }
+    static inline uint32_t hashAddress(LIns* base, int32_t disp)
+    {
+        uint32_t h = uint32_t(uintptr_t(base) >> 3) * 2654435761u;
+        return h ^ (uint32_t(disp) * 40503u);
     }
 
-    void CseFilter::clearL(CseAcc a) {
-        if (m_usedL[a] > 0) {
-            VMPI_memset(m_listL[a], 0, sizeof(LIns*)*m_capL[a]);
-            m_usedL[a] = 0;
+    void MemFilter::forwardValues(LIns** insns, uint32_t n, FlowGraph& g,
+                                  HashMap<LIns*, bool>& isPrivate)
+    {
+        // stores[r][i] counts the instructions before i that may store to
+        // access region r outside the private areas, for the regions that
+        // anything stores to; areaStores lists the positions of the stores
+        // to each private area, latest first.
+        uint32_t* stores[NUM_ACCS];
+        VMPI_memset(stores, 0, sizeof(stores));
+        HashMap<LIns*, Seq<uint32_t>*> areaStores(_alloc);
+        for (uint32_t i = 0; i < n; i++) {
+            LIns* ins = insns[i];
+            AccSet a = ACCSET_NONE;
+            if (ins->isStore()) {
+                if (isPrivate.containsKey(ins->oprnd2()))
+                    areaStores.put(ins->oprnd2(),
+                                   new (_alloc) Seq<uint32_t>(i, areaStores.get(ins->oprnd2())));
+                else
+                    a = ins->accSet();
+            } else if (ins->isCall() && !ins->callInfo()->_isPure) {
+                a = ins->callInfo()->_storeAccSet;
+            }
+            for (int r = 0; r < NUM_ACCS; r++) {
+                if ((a & (AccSet(1) << r)) && !stores[r]) {
+                    stores[r] = new (_alloc) uint32_t[n + 1];
+                    VMPI_memset(stores[r], 0, (n + 1) * sizeof(uint32_t));
+                }
+                if (stores[r])
+                    stores[r][i + 1] = stores[r][i] + ((a & (AccSet(1) << r)) ? 1 : 0);
+            }
         }
-    }
 
-    void CseFilter::clearAll() {
-        for (NLKind nlkind = NLFirst; nlkind <= NLLast; nlkind = nextNLKind(nlkind))
-            clearNL(nlkind);
+        // The loads and stores seen so far, by address.
+        uint32_t cap = 16;
+        while (cap < 2 * n)
+            cap *= 2;
+        LIns** table = new (_alloc) LIns*[cap];
+        VMPI_memset(table, 0, cap * sizeof(LIns*));
+
+        for (uint32_t i = 0; i < n; i++) {
+            LIns* ins = insns[i];
+            for (uint32_t k = 0, nops = ins->numOperands(); k < nops; k++) {
+                LIns* v = ins->operand(k);
+                if (v && _replaced.containsKey(v))
+                    ins->setOperand(k, _replaced.get(v));
+            }
+            if (!g.reachable[g.blockOf[i]])
+                continue;
+            bool isLoad = ins->isLoad() && ins->loadQual() != LOAD_VOLATILE;
+            if (!isLoad && !ins->isStore())
+                continue;
+
+            LIns* base = ins->isLoad() ? ins->oprnd1() : ins->oprnd2();
+            uint32_t k = hashAddress(base, ins->disp()) & (cap - 1);
+            for (uint32_t step = 1; table[k]; k = (k + step++) & (cap - 1)) {
+                LIns* other = table[k];
+                if (!isLoad)
+                    continue;
+                LIns* otherBase = other->isLoad() ? other->oprnd1() : other->oprnd2();
+                if (otherBase != base || other->disp() != ins->disp())
+                    continue;
+                if (other->isLoad() ? !other->isop(ins->opcode())
+                                    : !loadsStoredValue(ins->opcode(), other->opcode()))
+                    continue;
+                uint32_t j = g.index.get(other);
+                if (!g.reachesDirectly(j, i))
+                    continue;
 
-        // Note that this clears the CONST and MULTIPLE load tables as well.
-        for (CseAcc a = 0; a < CSE_NUM_USED_ACCS; a++)
-            clearL(a);
+                bool clobbered = false;
+                if (isPrivate.containsKey(base)) {
+                    for (Seq<uint32_t>* s = areaStores.get(base); s && s->head > j; s = s->tail) {
+                        if (s->head < i && overlaps(insns[s->head], ins)) {
+                            clobbered = true;
+                            break;
+                        }
+                    }
+                } else if (ins->loadQual() != LOAD_CONST) {
+                    for (int r = 0; r < NUM_ACCS && !clobbered; r++) {
+                        if ((ins->accSet() & (AccSet(1) << r)) && stores[r])
+                            clobbered = stores[r][i] != stores[r][j + 1];
+                    }
+                }
+                if (clobbered)
+                    continue;
 
-        knownCmpValues.clear();
+                _replaced.put(ins, other->isLoad() ? other : other->oprnd1());
+                break;
+            }
+            if (!table[k])
+                table[k] = ins;
+        }
     }
 
-    inline uint32_t CseFilter::hashImmI(int32_t a) {
-        return hashfinish(hash32(0, a));
+    // Goes backwards through positions 'from' up to 'to' of a block, taking
+    // 'bits' from the set of bytes of private areas live after the block to
+    // the set live before it.  If 'dead' is given, puts the stores that write
+    // no live byte in it.
+    static void transferLiveBytes(LIns** insns, uint32_t from, uint32_t to, uint64_t* bits,
+                                  HashMap<LIns*, uint32_t>& firstBit,
+                                  HashMap<LIns*, LIns*>& replaced, HashMap<LIns*, bool>* dead)
+    {
+        for (uint32_t i = to; i-- > from; ) {
+            LIns* ins = insns[i];
+            if (!(ins->isLoad() || ins->isStore()) || replaced.containsKey(ins))
+                continue;
+            LIns* base = ins->isLoad() ? ins->oprnd1() : ins->oprnd2();
+            if (!firstBit.containsKey(base))
+                continue;
+            int32_t lo = ins->disp() < 0 ? 0 : ins->disp();
+            int32_t hi = ins->disp() + accessSize(ins->opcode());
+            if (hi > base->size())
+                hi = base->size();
+            uint32_t first = firstBit.get(base);
+            if (ins->isLoad()) {
+                for (int32_t b = lo; b < hi; b++)
+                    setBit(bits, first + b);
+            } else {
+                bool read = false;
+                for (int32_t b = lo; b < hi; b++) {
+                    read |= testBit(bits, first + b);
+                    bits[(first + b) / 64] &= ~(uint64_t(1) << ((first + b) % 64));
+                }
+                if (!read && dead)
+                    dead->put(ins, true);
+            }
+        }
     }
 
-    inline uint32_t CseFilter::hashImmF4(const float4_t& a) {
-        const uint32_t* up = reinterpret_cast<const uint32_t*>(&a);
+    void MemFilter::removeDeadStores(LIns** insns, uint32_t n, FlowGraph& g,
+                                     HashMap<LIns*, bool>& isPrivate)
+    {
+        // Give a bit to each byte of the private areas that aren't too big.
+        // Nothing outside the fragment can read them, so no byte is live at
+        // its end or at its exits.
+        static const int32_t MAX_AREA_SIZE = 4096;
+        HashMap<LIns*, uint32_t> firstBit(_alloc);
+        uint32_t nbits = 0;
+        for (uint32_t i = 0; i < n; i++) {
+            LIns* ins = insns[i];
+            if (isPrivate.containsKey(ins) && ins->size() <= MAX_AREA_SIZE) {
+                firstBit.put(ins, nbits);
+                nbits += ins->size();
+            }
+        }
 
-        uint32_t hash = hash32(0, up[0]);
-                 hash = hash32(hash,up[1]);
-                 hash = hash32(hash,up[2]);
-                 hash = hash32(hash,up[3]);
+        if (nbits > 0) {
+            uint32_t* start = new (_alloc) uint32_t[g.nblocks + 1];
+            for (uint32_t i = n; i-- > 0; )
+                start[g.blockOf[i]] = i;
+            start[g.nblocks] = n;
+
+            // liveIn[b] is the set of bytes that may be read from the start
+            // of block b on, found by iterating to a fixed point.
+            uint32_t nwords = (nbits + 63) / 64;
+            uint64_t* liveIn = new (_alloc) uint64_t[g.nblocks * nwords];
+            VMPI_memset(liveIn, 0, g.nblocks * nwords * sizeof(uint64_t));
+            uint64_t* cur = new (_alloc) uint64_t[nwords];
+            for (bool changed = true, done = false; !done; ) {
+                // Once nothing changes, one more pass finds the dead stores.
+                done = !changed;
+                changed = false;
+                for (uint32_t b = g.nblocks; b-- > 0; ) {
+                    VMPI_memset(cur, 0, nwords * sizeof(uint64_t));
+                    for (Seq<uint32_t>* s = g.succs[b]; s; s = s->tail) {
+                        for (uint32_t w = 0; w < nwords; w++)
+                            cur[w] |= liveIn[s->head * nwords + w];
+                    }
+                    transferLiveBytes(insns, start[b], start[b + 1], cur, firstBit, _replaced,
+                                      done ? &_dead : NULL);
+                    for (uint32_t w = 0; w < nwords; w++) {
+                        if (cur[w] != liveIn[b * nwords + w]) {
+                            liveIn[b * nwords + w] = cur[w];
+                            changed = true;
+                        }
+                    }
+                }
+            }
+        }
 
-        return hashfinish(hash);
-    }
+        // Other stores are dead if a later one to the same address in the
+        // same block overwrites them before anything may read them.  Give up
+        // after a while, as this is quadratic.
+        static const uint32_t MAX_SCAN = 32;
+        for (uint32_t i = 0; i < n; i++) {
+            LIns* st = insns[i];
+            if (!st->isStore() || isPrivate.containsKey(st->oprnd2()))
+                continue;
+            for (uint32_t j = i + 1; j < n && j <= i + MAX_SCAN; j++) {
+                LIns* ins = insns[j];
+                if (ins->isStore()) {
+                    if (ins->oprnd2() == st->oprnd2() && ins->disp() <= st->disp() &&
+                        ins->disp() + accessSize(ins->opcode()) >=
+                        st->disp() + accessSize(st->opcode())) {
+                        _dead.put(st, true);
+                        break;
+                    }
+                } else if (ins->isLoad()) {
+                    if (!_replaced.containsKey(ins) && !isPrivate.containsKey(ins->oprnd1()) &&
+                        (ins->oprnd1() == st->oprnd2() || (ins->accSet() & st->accSet())))
+                        break;
+                } else if ((ins->isCall() && !ins->callInfo()->_isPure) ||
+                           ins->isGuard() || ins->isBranch() || ins->isRet() ||
+                           ins->isop(LIR_label)) {
+                    break;
+                }
+            }
+        }
 
-    inline uint32_t CseFilter::hashImmQorD(uint64_t a) {
-        uint32_t hash = hash32(0, uint32_t(a >> 32));
-        return hashfinish(hash32(hash, uint32_t(a)));
+        // The Assembler drops overflow checks whose result isn't used, so a
+        // store may be all that keeps one alive; keep such stores.
+        HashMap<LIns*, bool> checked(_alloc);
+        for (uint32_t i = 0; i < n; i++) {
+            LIns* ins = insns[i];
+            if (ins->isStore()) {
+                if (_dead.containsKey(ins) && checked.containsKey(ins->oprnd1()))
+                    _dead.remove(ins);
+                continue;
+            }
+            bool c = (ins->isGuard() || ins->isBranch()) && !ins->isV();
+            for (uint32_t k = 0, nops = ins->numOperands(); k < nops && !c; k++) {
+                LIns* v = ins->operand(k);
+                c = v && checked.containsKey(v);
+            }
+            if (c)
+                checked.put(ins, true);
+        }
     }
 
-    inline uint32_t CseFilter::hash1(LOpcode op, LIns* a) {
-        uint32_t hash = hash8(0, uint8_t(op));
-        return hashfinish(hashptr(hash, a));
-    }
+    // A set of int or quad values, from 'lo' to 'hi'; empty if lo > hi.
+    struct ValueRange
+    {
+        int64_t lo;
+        int64_t hi;
+    };
 
-    inline uint32_t CseFilter::hash2(LOpcode op, LIns* a, LIns* b) {
-        uint32_t hash = hash8(0, uint8_t(op));
-        hash = hashptr(hash, a);
-        return hashfinish(hashptr(hash, b));
-    }
+    static const int64_t Q_MIN = int64_t(uint64_t(1) << 63);
+    static const int64_t Q_MAX = int64_t(~(uint64_t(1) << 63));
+    static const int64_t UI32_MAX = int64_t(0xffffffff);
 
-    inline uint32_t CseFilter::hash3(LOpcode op, LIns* a, LIns* b, LIns* c) {
-        uint32_t hash = hash8(0, uint8_t(op));
-        hash = hashptr(hash, a);
-        hash = hashptr(hash, b);
-        return hashfinish(hashptr(hash, c));
+    static inline ValueRange valueRange(int64_t lo, int64_t hi)
+    {
+        ValueRange r = { lo, hi };
+        return r;
     }
 
-    inline uint32_t CseFilter::hash4(LOpcode op, LIns* a, LIns* b, LIns* c, LIns* d) {
-        uint32_t hash = hash8(0, uint8_t(op));
-        hash = hashptr(hash, a);
-        hash = hashptr(hash, b);
-        hash = hashptr(hash, c);
-        return hashfinish(hashptr(hash, d));
+    // The range of all values of the type of 'ins'.
+    static inline ValueRange typeRange(LIns* ins)
+    {
+        return ins->isQ() ? valueRange(Q_MIN, Q_MAX)
+                          : valueRange(Interval::I32_MIN, Interval::I32_MAX);
     }
-    
-    // Nb: no need to hash the load's MiniAccSet because each every load goes
-    // into a table where all the loads have the same MiniAccSet.
-    inline uint32_t CseFilter::hashLoad(LOpcode op, LIns* a, int32_t d) {
-        uint32_t hash = hash8(0, uint8_t(op));
-        hash = hashptr(hash, a);
-        return hashfinish(hash32(hash, d));
+
+    static inline bool within(ValueRange r, int64_t lo, int64_t hi)
+    {
+        return lo <= r.lo && r.hi <= hi;
     }
 
-    inline uint32_t CseFilter::hashCall(const CallInfo *ci, uint32_t argc, LIns* args[]) {
-        uint32_t hash = hashptr(0, ci);
-        for (int32_t j=argc-1; j >= 0; j--)
-            hash = hashptr(hash,args[j]);
-        return hashfinish(hash);
+    static inline bool fitsInt(ValueRange r)
+    {
+        return within(r, Interval::I32_MIN, Interval::I32_MAX);
     }
 
-    void CseFilter::growNL(NLKind nlkind)
+    static inline bool sameRange(ValueRange a, ValueRange b)
     {
-        NanoAssert(nlkind != NLImmISmall);
-        const uint32_t oldcap = m_capNL[nlkind];
-        m_capNL[nlkind] <<= 1;
-        LIns** tmp = (LIns**)alloc.alloc(sizeof(LIns*) * m_capNL[nlkind]);
-        NanoAssert(tmp);
-        LIns** oldlist = m_listNL[nlkind];
-        m_listNL[nlkind] = tmp;
-        VMPI_memset(m_listNL[nlkind], 0, m_capNL[nlkind] * sizeof(LIns*));
-        find_t find = m_findNL[nlkind];
-        for (uint32_t i = 0; i < oldcap; i++) {
-            LIns* ins = oldlist[i];
-            if (!ins) continue;
-            uint32_t j = (this->*find)(ins);
-            NanoAssert(!m_listNL[nlkind][j]);
-            m_listNL[nlkind][j] = ins;
-        }
+        return a.lo == b.lo && a.hi == b.hi;
     }
 
-    void CseFilter::growL(CseAcc cseAcc)
+    static inline ValueRange meetRanges(ValueRange a, ValueRange b)
     {
-        const uint32_t oldcap = m_capL[cseAcc];
-        m_capL[cseAcc] <<= 1;
-        LIns** tmp = (LIns**)alloc.alloc(sizeof(LIns*) * m_capL[cseAcc]);
-        NanoAssert(tmp);
-        LIns** oldlist = m_listL[cseAcc];
-        m_listL[cseAcc] = tmp;
-        VMPI_memset(m_listL[cseAcc], 0, m_capL[cseAcc] * sizeof(LIns*));
-        find_t find = &CseFilter::findLoad;
-        for (uint32_t i = 0; i < oldcap; i++) {
-            LIns* ins = oldlist[i];
-            if (!ins) continue;
-            uint32_t j = (this->*find)(ins);
-            NanoAssert(!m_listL[cseAcc][j]);
-            m_listL[cseAcc][j] = ins;
-        }
+        return valueRange(a.lo > b.lo ? a.lo : b.lo, a.hi < b.hi ? a.hi : b.hi);
     }
 
-    void CseFilter::addNLImmISmall(LIns* ins, uint32_t k)
+    static inline ValueRange joinRanges(ValueRange a, ValueRange b)
     {
-        if (suspended) return;
-        NLKind nlkind = NLImmISmall;
-        NanoAssert(k < m_capNL[nlkind]);
-        NanoAssert(!m_listNL[nlkind][k]);
-        m_usedNL[nlkind]++;
-        m_listNL[nlkind][k] = ins;
+        return valueRange(a.lo < b.lo ? a.lo : b.lo, a.hi > b.hi ? a.hi : b.hi);
     }
 
-    void CseFilter::addNL(NLKind nlkind, LIns* ins, uint32_t k)
+    // Sets 'r' to the sums of any value in 'a' and any in 'b'.  Returns false
+    // if these may not fit in 64 bits.
+    static bool addRanges(ValueRange a, ValueRange b, ValueRange& r)
     {
-        if (suspended) return;
-        NanoAssert(!m_listNL[nlkind][k]);
-        m_usedNL[nlkind]++;
-        m_listNL[nlkind][k] = ins;
-        if ((m_usedNL[nlkind] * 4) >= (m_capNL[nlkind] * 3)) {  // load factor of 0.75
-            growNL(nlkind);
-        }
+        if ((b.hi > 0 && a.hi > Q_MAX - b.hi) || (b.lo < 0 && a.lo < Q_MIN - b.lo))
+            return false;
+        r = valueRange(a.lo + b.lo, a.hi + b.hi);
+        return true;
     }
 
-    void CseFilter::addL(LIns* ins, uint32_t k)
+    static bool subRanges(ValueRange a, ValueRange b, ValueRange& r)
     {
-        if (suspended) return;
-        CseAcc cseAcc = miniAccSetToCseAcc(ins->miniAccSet(), ins->loadQual());
-        NanoAssert(!m_listL[cseAcc][k]);
-        m_usedL[cseAcc]++;
-        m_listL[cseAcc][k] = ins;
-        if ((m_usedL[cseAcc] * 4) >= (m_capL[cseAcc] * 3)) {  // load factor of 0.75
-            growL(cseAcc);
-        }
+        if ((b.lo < 0 && a.hi > Q_MAX + b.lo) || (b.hi > 0 && a.lo < Q_MIN + b.hi))
+            return false;
+        r = valueRange(a.lo - b.hi, a.hi - b.lo);
+        return true;
     }
 
-    inline LIns* CseFilter::findImmISmall(int32_t a, uint32_t &k, bool tainted)
+    // Only done for factors of at most 2^31, whose products always fit.
+    static bool mulRanges(ValueRange a, ValueRange b, ValueRange& r)
     {
-        // This one is a direct array lookup rather than a hashtable lookup.
-        NLKind nlkind = NLImmISmall;
-        k = (a * 2) + (unsigned(tainted) & 1);
-        LIns* ins = m_listNL[nlkind][k];
-        NanoAssert(!ins || ins->isImmI(a));
-        return ins;
+        const int64_t lim = int64_t(1) << 31;
+        if (!within(a, -lim, lim) || !within(b, -lim, lim))
+            return false;
+        int64_t p[4] = { a.lo * b.lo, a.lo * b.hi, a.hi * b.lo, a.hi * b.hi };
+        r = valueRange(p[0], p[0]);
+        for (int k = 1; k < 4; k++)
+            r = joinRanges(r, valueRange(p[k], p[k]));
+        return true;
     }
 
-    uint32_t CseFilter::findImmISmall(LIns* ins)
+    // What RangeFilter knows at some point of the code: the ranges of the
+    // tracked values, as narrowed by the branches and guards passed so far,
+    // followed by those of the tracked words of private areas, and the value
+    // each of these words is known to hold, if any.
+    struct RangeState
     {
-        uint32_t k;
-        findImmISmall(ins->immI(), k, ins->isTainted());
-        return k;
+        bool        reached;    // can the code get here at all?
+        ValueRange* ranges;
+        LIns**      holders;
+    };
+
+    class RangeAnalysis
+    {
+    public:
+        RangeAnalysis(Allocator& alloc, LIns** insns, uint32_t n, FlowGraph& g);
+        bool run();
+
+        // What the last pass found, by position.
+        bool*       visited;        // was the instruction reached?
+        bool*       canOverflow;    // for overflow checks
+        bool*       neverFires;     // for conditional branches and guards
+        LIns**      roundTrip;      // the value a conversion gives back, if any
+
+    private:
+        static const uint32_t MAX_STATE = 1 << 16;  // blocks times tracked ranges
+        static const uint32_t MAX_PASSES = 64;
+        static const uint32_t NARROWING_PASSES = 2;
+        static const uint32_t WIDEN_AFTER = 2;
+
+        void findTracked(HashMap<LIns*, bool>& isPrivate);
+        int32_t slotOf(LIns* ins);
+        bool iterate(bool widen);
+        bool edgeState(uint32_t p, uint32_t b, RangeState& s);
+        void newState(RangeState& s);
+        void copyState(RangeState& to, RangeState& from);
+        void joinState(RangeState& to, RangeState& from);
+        void widenState(RangeState& to, RangeState& from);
+        bool sameState(RangeState& a, RangeState& b);
+        void step(uint32_t i, RangeState& s);
+        ValueRange eval(uint32_t i, RangeState& s);
+        ValueRange rangeAt(LIns* v, RangeState& s);
+        void narrow(LIns* v, ValueRange r, RangeState& s);
+        bool refine(LIns* cond, bool truth, RangeState& s, bool apply);
+
+        Allocator&                  _alloc;
+        LIns**                      _insns;
+        uint32_t                    _n;
+        FlowGraph&                  _g;
+        uint32_t*                   _start;     // block -> its first position
+        Seq<uint32_t>**             _preds;     // block -> its predecessors
+        uint32_t*                   _visits;    // block -> how often its entry state grew
+
+        HashMap<LIns*, uint32_t>    _tracked;   // value -> its index in a state
+        LIns**                      _values;    // ... and back
+        uint32_t                    _nvalues;
+        HashMap<LIns*, Seq<uint32_t>*> _slots;  // private area -> its tracked words
+        int32_t*                    _slotDisp;
+        bool*                       _slotQ;     // is the word a quad or an int?
+        uint32_t                    _nslots;
+        HashMap<LIns*, bool>        _mayHold;   // values that tracked words may hold
+
+        ValueRange*                 _rangeOf;   // position -> range of its value
+        ValueRange*                 _noOverflow;// position -> range of a jov's value if it doesn't jump
+        RangeState*                 _in;        // block -> state at its start
+        RangeState*                 _fall;      // block -> state falling out of its end
+        RangeState*                 _taken;     // block -> state along its last branch
+        RangeState                  _cur;
+        RangeState                  _edge;
+    };
+
+    RangeAnalysis::RangeAnalysis(Allocator& alloc, LIns** insns, uint32_t n, FlowGraph& g)
+        : _alloc(alloc), _insns(insns), _n(n), _g(g), _tracked(alloc), _slots(alloc),
+          _mayHold(alloc)
+    {
+        _start = new (alloc) uint32_t[g.nblocks + 1];
+        for (uint32_t i = n; i-- > 0; )
+            _start[g.blockOf[i]] = i;
+        _start[g.nblocks] = n;
+        _preds = new (alloc) Seq<uint32_t>*[g.nblocks];
+        VMPI_memset(_preds, 0, g.nblocks * sizeof(Seq<uint32_t>*));
+        for (uint32_t b = 0; b < g.nblocks; b++) {
+            for (Seq<uint32_t>* s = g.succs[b]; s; s = s->tail)
+                _preds[s->head] = new (alloc) Seq<uint32_t>(b, _preds[s->head]);
+        }
+        _visits = new (alloc) uint32_t[g.nblocks];
+
+        HashMap<LIns*, bool> isPrivate(alloc);
+        findPrivateAreas(insns, n, isPrivate, alloc);
+        findTracked(isPrivate);
+
+        visited = new (alloc) bool[n];
+        canOverflow = new (alloc) bool[n];
+        neverFires = new (alloc) bool[n];
+        roundTrip = new (alloc) LIns*[n];
+        _rangeOf = new (alloc) ValueRange[n];
+        _noOverflow = new (alloc) ValueRange[n];
+        for (uint32_t i = 0; i < n; i++)
+            _rangeOf[i] = typeRange(insns[i]);
+    }
+
+    // Tracks the operands of the comparisons that branches and guards test,
+    // the results of jov instructions, and the int and quad words that are
+    // stored to private areas.
+    void RangeAnalysis::findTracked(HashMap<LIns*, bool>& isPrivate)
+    {
+        uint32_t maxSlots = 0;
+        for (uint32_t i = 0; i < _n; i++) {
+            if (_insns[i]->isStore())
+                maxSlots++;
+        }
+        _slotDisp = new (_alloc) int32_t[maxSlots];
+        _slotQ = new (_alloc) bool[maxSlots];
+        _values = new (_alloc) LIns*[2 * _n];
+        _nvalues = 0;
+        _nslots = 0;
+
+        for (uint32_t i = 0; i < _n; i++) {
+            LIns* ins = _insns[i];
+            LIns* track[2] = { NULL, NULL };
+            if (ins->isop(LIR_jt) || ins->isop(LIR_jf) || ins->isop(LIR_xt) ||
+                ins->isop(LIR_xf)) {
+                LIns* c = ins->oprnd1();
+                if (isCmpIOpcode(c->opcode()) IF_64BIT(|| isCmpQOpcode(c->opcode()))) {
+                    track[0] = c->oprnd1();
+                    track[1] = c->oprnd2();
+                } else if (c->isI()) {
+                    track[0] = c;
+                }
+            } else if (ins->isJov()) {
+                track[0] = ins;
+            } else if ((ins->isop(LIR_sti) IF_64BIT(|| ins->isop(LIR_stq))) &&
+                       isPrivate.containsKey(ins->oprnd2())) {
+                if (slotOf(ins) < 0) {
+                    LIns* base = ins->oprnd2();
+                    _slotDisp[_nslots] = ins->disp();
+                    _slotQ[_nslots] = !ins->isop(LIR_sti);
+                    _slots.put(base, new (_alloc) Seq<uint32_t>(_nslots, _slots.get(base)));
+                    _nslots++;
+                }
+                _mayHold.put(ins->oprnd1(), true);
+            }
+            for (int k = 0; k < 2; k++) {
+                LIns* v = track[k];
+                if (v && !v->isImmAny() && !_tracked.containsKey(v)) {
+                    _tracked.put(v, _nvalues);
+                    _values[_nvalues++] = v;
+                }
+            }
+        }
+        for (uint32_t i = 0; i < _n; i++) {
+            if (_insns[i]->isLoad() && slotOf(_insns[i]) >= 0)
+                _mayHold.put(_insns[i], true);
+        }
     }
 
-    inline LIns* CseFilter::findImmILarge(int32_t a, uint32_t &k, bool tainted)
+    // The tracked word that the int or quad load or store 'ins' accesses as
+    // a whole, or -1.
+    int32_t RangeAnalysis::slotOf(LIns* ins)
     {
-        NLKind nlkind = NLImmILarge;
-        const uint32_t bitmask = m_capNL[nlkind] - 1;
-        k = (hashImmI(a) + (unsigned(tainted) & 1)) & bitmask;
-        uint32_t n = 1;
-        while (true) {
-            LIns* ins = m_listNL[nlkind][k];
-            if (!ins)
-                return NULL;
-            NanoAssert(ins->isImmI());
-            if (ins->immI() == a && ins->isTainted() == tainted)
-                return ins;
-            // Quadratic probe:  h(k,i) = h(k) + 0.5i + 0.5i^2, which gives the
-            // sequence h(k), h(k)+1, h(k)+3, h(k)+6, h+10, ...  This is a
-            // good sequence for 2^n-sized tables as the values h(k,i) for i
-            // in [0,m - 1] are all distinct so termination is guaranteed.
-            // See http://portal.acm.org/citation.cfm?id=360737 and
-            // http://en.wikipedia.org/wiki/Quadratic_probing (fetched
-            // 06-Nov-2009) for more details.
-            k = (k + n) & bitmask;
-            n += 1;
+        bool q;
+        switch (ins->opcode()) {
+        case LIR_ldi: case LIR_sti:         q = false;  break;
+        CASE64(LIR_ldq:) CASE64(LIR_stq:)   q = true;   break;
+        default:                            return -1;
+        }
+        LIns* base = ins->isLoad() ? ins->oprnd1() : ins->oprnd2();
+        for (Seq<uint32_t>* s = _slots.get(base); s; s = s->tail) {
+            if (_slotDisp[s->head] == ins->disp() && _slotQ[s->head] == q)
+                return int32_t(s->head);
         }
+        return -1;
     }
 
-    uint32_t CseFilter::findImmILarge(LIns* ins)
+    void RangeAnalysis::newState(RangeState& s)
     {
-        uint32_t k;
-        findImmILarge(ins->immI(), k, ins->isTainted());
-        return k;
+        s.reached = false;
+        s.ranges = new (_alloc) ValueRange[_nvalues + _nslots];
+        s.holders = new (_alloc) LIns*[_nslots];
     }
 
-#ifdef NANOJIT_64BIT
-    inline LIns* CseFilter::findImmQ(uint64_t a, uint32_t &k, bool tainted)
+    void RangeAnalysis::copyState(RangeState& to, RangeState& from)
     {
-        NLKind nlkind = NLImmQ;
-        const uint32_t bitmask = m_capNL[nlkind] - 1;
-        k = (hashImmQorD(a) + (unsigned(tainted) & 1)) & bitmask;
-        uint32_t n = 1;
-        while (true) {
-            LIns* ins = m_listNL[nlkind][k];
-            if (!ins)
-                return NULL;
-            NanoAssert(ins->isImmQ());
-            if (ins->immQ() == a && ins->isTainted() == tainted)
-                return ins;
-            k = (k + n) & bitmask;
-            n += 1;
+        to.reached = from.reached;
+        if (from.reached) {
+            memcpy(to.ranges, from.ranges, (_nvalues + _nslots) * sizeof(ValueRange));
+            memcpy(to.holders, from.holders, _nslots * sizeof(LIns*));
         }
     }
 
-    uint32_t CseFilter::findImmQ(LIns* ins)
+    void RangeAnalysis::joinState(RangeState& to, RangeState& from)
     {
-        uint32_t k;
-        findImmQ(ins->immQ(), k, ins->isTainted());
-        return k;
+        if (!from.reached)
+            return;
+        if (!to.reached) {
+            copyState(to, from);
+            return;
+        }
+        for (uint32_t k = 0; k < _nvalues + _nslots; k++)
+            to.ranges[k] = joinRanges(to.ranges[k], from.ranges[k]);
+        for (uint32_t k = 0; k < _nslots; k++) {
+            if (to.holders[k] != from.holders[k])
+                to.holders[k] = NULL;
+        }
     }
-#endif
 
-    inline LIns* CseFilter::findImmD(uint64_t a, uint32_t &k, bool tainted)
+    // Joins 'from' into 'to', except that any bound that 'from' extends goes
+    // straight to the end of its type, so that loops are done with quickly.
+    void RangeAnalysis::widenState(RangeState& to, RangeState& from)
     {
-        NLKind nlkind = NLImmD;
-        const uint32_t bitmask = m_capNL[nlkind] - 1;
-        k = (hashImmQorD(a) + (unsigned(tainted) & 1)) & bitmask;
-        uint32_t n = 1;
-        while (true) {
-            LIns* ins = m_listNL[nlkind][k];
-            if (!ins)
-                return NULL;
-            NanoAssert(ins->isImmD());
-            if (ins->immDasQ() == a && ins->isTainted() == tainted)
-                return ins;
-            k = (k + n) & bitmask;
-            n += 1;
+        if (!from.reached || !to.reached) {
+            joinState(to, from);
+            return;
+        }
+        for (uint32_t k = 0; k < _nvalues + _nslots; k++) {
+            ValueRange top = k < _nvalues ? typeRange(_values[k])
+                           : _slotQ[k - _nvalues] ? valueRange(Q_MIN, Q_MAX)
+                           : valueRange(Interval::I32_MIN, Interval::I32_MAX);
+            if (from.ranges[k].lo < to.ranges[k].lo)
+                to.ranges[k].lo = top.lo;
+            if (from.ranges[k].hi > to.ranges[k].hi)
+                to.ranges[k].hi = top.hi;
+        }
+        for (uint32_t k = 0; k < _nslots; k++) {
+            if (to.holders[k] != from.holders[k])
+                to.holders[k] = NULL;
         }
     }
 
-    uint32_t CseFilter::findImmD(LIns* ins)
+    bool RangeAnalysis::sameState(RangeState& a, RangeState& b)
     {
-        // Use bitwise (integer) comparison.
-        uint32_t k;
-        findImmD(ins->immDasQ(), k, ins->isTainted());
-        return k;
+        if (a.reached != b.reached)
+            return false;
+        if (!a.reached)
+            return true;
+        for (uint32_t k = 0; k < _nvalues + _nslots; k++) {
+            if (!sameRange(a.ranges[k], b.ranges[k]))
+                return false;
+        }
+        return VMPI_memcmp(a.holders, b.holders, _nslots * sizeof(LIns*)) == 0;
     }
 
-    inline LIns* CseFilter::findImmF(int32_t a, uint32_t &k, bool tainted)
+    // Puts the state along the edge from block 'p' to block 'b' in 's'.
+    bool RangeAnalysis::edgeState(uint32_t p, uint32_t b, RangeState& s)
     {
-        NLKind nlkind = NLImmF;
-        const uint32_t bitmask = m_capNL[nlkind] - 1;
-        uint32_t n = 1;
-        k = (hashImmI(a) + (unsigned(tainted) & 1)) & bitmask;
-        while (true) {
-            LIns* ins = m_listNL[nlkind][k];
-            if (!ins)
-                return NULL;
-            NanoAssert(ins->isImmF());
-            if (ins->immFasI() == a && ins->isTainted() == tainted)
-                return ins;
-            k = (k + n) & bitmask;
-            n += 1;
+        LIns* last = _insns[_start[p + 1] - 1];
+        if (last->isop(LIR_jt) || last->isop(LIR_jf) || last->isJov()) {
+            s.reached = false;
+            if (_g.blockOf[_g.index.get(last->getTarget())] == b)
+                joinState(s, _taken[p]);
+            if (b == p + 1)
+                joinState(s, _fall[p]);
+        } else {
+            copyState(s, _fall[p]);
+        }
+        return s.reached;
+    }
+
+    // Runs through the blocks once, in buffer order.  Returns true if the
+    // state at the start of any of them changed.
+    bool RangeAnalysis::iterate(bool widen)
+    {
+        bool changed = false;
+        VMPI_memset(visited, 0, _n * sizeof(bool));
+        for (uint32_t b = 0; b < _g.nblocks; b++) {
+            _cur.reached = false;
+            if (b == 0) {
+                _cur.reached = true;
+                for (uint32_t k = 0; k < _nvalues; k++)
+                    _cur.ranges[k] = typeRange(_values[k]);
+                for (uint32_t k = 0; k < _nslots; k++) {
+                    _cur.ranges[_nvalues + k] = _slotQ[k] ? valueRange(Q_MIN, Q_MAX)
+                                              : valueRange(Interval::I32_MIN, Interval::I32_MAX);
+                    _cur.holders[k] = NULL;
+                }
+            } else if (_g.reachable[b]) {
+                bool header = false;
+                for (Seq<uint32_t>* s = _preds[b]; s; s = s->tail) {
+                    if (edgeState(s->head, b, _edge))
+                        joinState(_cur, _edge);
+                    header |= s->head >= b;
+                }
+                if (header && widen && _in[b].reached && _visits[b] >= WIDEN_AFTER) {
+                    copyState(_edge, _in[b]);
+                    widenState(_edge, _cur);
+                    copyState(_cur, _edge);
+                }
+            }
+            if (!sameState(_cur, _in[b])) {
+                copyState(_in[b], _cur);
+                _visits[b]++;
+                changed = true;
+            }
+
+            for (uint32_t i = _start[b]; i < _start[b + 1] && _cur.reached; i++)
+                step(i, _cur);
+
+            copyState(_fall[b], _cur);
+            copyState(_taken[b], _cur);
+            LIns* last = _insns[_start[b + 1] - 1];
+            if (_cur.reached && (last->isop(LIR_jt) || last->isop(LIR_jf))) {
+                bool jumpIf = last->isop(LIR_jt);
+                uint32_t i = _start[b + 1] - 1;
+                neverFires[i] = !refine(last->oprnd1(), jumpIf, _taken[b], true);
+                if (neverFires[i])
+                    _taken[b].reached = false;
+                if (!refine(last->oprnd1(), !jumpIf, _fall[b], true))
+                    _fall[b].reached = false;
+            } else if (_cur.reached && last->isJov() && _tracked.containsKey(last)) {
+                _fall[b].ranges[_tracked.get(last)] = _noOverflow[_start[b + 1] - 1];
+            }
+        }
+        return changed;
+    }
+
+    // Iterates to a fixed point, widening, then narrows the ranges found a
+    // few times.  Returns false if the code is too big or doesn't settle.
+    bool RangeAnalysis::run()
+    {
+        if (uint64_t(_g.nblocks) * (_nvalues + _nslots) > MAX_STATE)
+            return false;
+        _in = new (_alloc) RangeState[_g.nblocks];
+        _fall = new (_alloc) RangeState[_g.nblocks];
+        _taken = new (_alloc) RangeState[_g.nblocks];
+        for (uint32_t b = 0; b < _g.nblocks; b++) {
+            newState(_in[b]);
+            newState(_fall[b]);
+            newState(_taken[b]);
+        }
+        newState(_cur);
+        newState(_edge);
+        VMPI_memset(_visits, 0, _g.nblocks * sizeof(uint32_t));
+
+        uint32_t pass = 0;
+        while (iterate(true)) {
+            if (++pass == MAX_PASSES)
+                return false;
         }
+        for (uint32_t k = 0; k < NARROWING_PASSES; k++)
+            iterate(false);
+        return true;
     }
 
-    uint32_t CseFilter::findImmF(LIns* ins)
+    // The range of 'v' at a point where the state is 's'.
+    ValueRange RangeAnalysis::rangeAt(LIns* v, RangeState& s)
     {
-        NanoAssert(ins->isImmF());
-
-        // Use bitwise (integer) comparison.
-        uint32_t k;
-        findImmF(ins->immFasI(), k, ins->isTainted());
-        return k;
+        if (v->isImmI())
+            return valueRange(v->immI(), v->immI());
+#ifdef NANOJIT_64BIT
+        if (v->isImmQ())
+            return valueRange(int64_t(v->immQ()), int64_t(v->immQ()));
+#endif
+        ValueRange r = typeRange(v);
+        if (_g.index.containsKey(v))
+            r = _rangeOf[_g.index.get(v)];
+        if (_tracked.containsKey(v))
+            r = meetRanges(r, s.ranges[_tracked.get(v)]);
+        return r;
     }
-    
-    inline LIns* CseFilter::findImmF4(const float4_t& a, uint32_t &k, bool tainted)
+
+    // Narrows 'v' to 'r', along with the words known to hold it.
+    void RangeAnalysis::narrow(LIns* v, ValueRange r, RangeState& s)
     {
-        NLKind nlkind = NLImmF4;
-        const uint32_t bitmask = m_capNL[nlkind] - 1;
-        uint32_t n = 1;
-        k = (hashImmF4(a) + (unsigned(tainted) & 1)) & bitmask;
-        while (true) {
-            LIns* ins = m_listNL[nlkind][k];
-            if (!ins)
-                return NULL;
-            NanoAssert(ins->isImmF4());
-            float4_t b = ins->immF4();
-            // Use bitwise comparison, as we do for floats and doubles.
-            if (VMPI_memcmp(&a, &b, sizeof(float4_t)) == 0 && ins->isTainted() == tainted)
-                return ins;
-            k = (k + n) & bitmask;
-            n += 1;
+        if (_tracked.containsKey(v)) {
+            uint32_t k = _tracked.get(v);
+            s.ranges[k] = meetRanges(s.ranges[k], r);
+        }
+        if (_mayHold.containsKey(v)) {
+            for (uint32_t k = 0; k < _nslots; k++) {
+                if (s.holders[k] == v)
+                    s.ranges[_nvalues + k] = meetRanges(s.ranges[_nvalues + k], r);
+            }
         }
     }
 
-    uint32_t CseFilter::findImmF4(LIns* ins)
+    // Returns false if 'cond' can't be 'truth' in state 's'.  Otherwise, if
+    // 'apply' is set, narrows the ranges in 's' to those for which it is.
+    bool RangeAnalysis::refine(LIns* cond, bool truth, RangeState& s, bool apply)
     {
-        NanoAssert(ins->isImmF4());
+        LOpcode op = cond->opcode();
+        int k;
+        if (isCmpIOpcode(op)) {
+            k = op - LIR_eqi;
+#ifdef NANOJIT_64BIT
+        } else if (isCmpQOpcode(op)) {
+            k = op - LIR_eqq;
+#endif
+        } else if (isCmpOpcode(op)) {
+            return true;
+        } else if (cond->isI()) {
+            ValueRange r = rangeAt(cond, s);
+            if (truth)
+                return !(r.lo == 0 && r.hi == 0);
+            if (r.lo > 0 || r.hi < 0)
+                return false;
+            if (apply)
+                narrow(cond, valueRange(0, 0), s);
+            return true;
+        } else {
+            return true;
+        }
 
-        uint32_t k;
-        findImmF4(ins->immF4(), k, ins->isTainted());
-        return k;
-    }
+        // Turn the comparison into a == b, a != b, a < b or a <= b.
+        enum { EQ, NE, LT, LE } rel;
+        LIns* a = cond->oprnd1();
+        LIns* b = cond->oprnd2();
+        bool isUnsigned = k >= 5;
+        if (isUnsigned)
+            k -= 4;
+        if (k == 2 || k == 4) {         // gt, ge
+            LIns* t = a; a = b; b = t;
+            k--;
+        }
+        rel = k == 0 ? EQ : k == 1 ? LT : LE;
+        if (!truth) {
+            if (rel == EQ) {
+                rel = NE;
+            } else {
+                LIns* t = a; a = b; b = t;
+                rel = rel == LT ? LE : LT;
+            }
+        }
 
-    inline LIns* CseFilter::find1(LOpcode op, LIns* a, uint32_t &k)
-    {
-        NLKind nlkind = NL1;
-        const uint32_t bitmask = m_capNL[nlkind] - 1;
-        k = hash1(op, a) & bitmask;
-        uint32_t n = 1;
-        while (true) {
-            LIns* ins = m_listNL[nlkind][k];
-            if (!ins)
-                return NULL;
-            if (ins->isop(op) && ins->oprnd1() == a)
-                return ins;
-            k = (k + n) & bitmask;
-            n += 1;
+        ValueRange x = rangeAt(a, s);
+        ValueRange y = rangeAt(b, s);
+        if (isUnsigned && (rel == LT || rel == LE) && (x.lo < 0 || y.lo < 0)) {
+            // Negative values are big unsigned ones, but if 'b' isn't, 'a'
+            // must be less than it as a signed value too.
+            if (y.lo < 0)
+                return true;
+            x = meetRanges(x, valueRange(0, rel == LT ? y.hi - 1 : y.hi));
+        } else if (rel == LT) {
+            if (y.hi == Q_MIN || x.lo == Q_MAX)
+                return false;
+            x = meetRanges(x, valueRange(x.lo, y.hi - 1));
+            y = meetRanges(y, valueRange(x.lo + 1, y.hi));
+        } else if (rel == LE) {
+            x = meetRanges(x, valueRange(x.lo, y.hi));
+            y = meetRanges(y, valueRange(x.lo, y.hi));
+        } else if (rel == EQ) {
+            x = y = meetRanges(x, y);
+        } else {
+            if (x.lo == x.hi && y.lo == y.hi && x.lo == y.lo)
+                return false;
+            if (y.lo == y.hi) {
+                if (x.lo == y.lo)
+                    x.lo++;
+                else if (x.hi == y.lo)
+                    x.hi--;
+            }
+            if (x.lo == x.hi) {
+                if (y.lo == x.lo)
+                    y.lo++;
+                else if (y.hi == x.lo)
+                    y.hi--;
+            }
+        }
+        if (x.lo > x.hi || y.lo > y.hi)
+            return false;
+        if (apply) {
+            narrow(a, x, s);
+            narrow(b, y, s);
         }
+        return true;
     }
 
-    uint32_t CseFilter::find1(LIns* ins)
+    // Updates 's' for instruction 'i'.
+    void RangeAnalysis::step(uint32_t i, RangeState& s)
     {
-        uint32_t k;
-        find1(ins->opcode(), ins->oprnd1(), k);
-        return k;
+        LIns* ins = _insns[i];
+        visited[i] = true;
+        if (ins->isI() || ins->isQ()) {
+            // Anything known about the value this instruction gave when it
+            // last ran, eg. in the last loop iteration, no longer holds.
+            if (_mayHold.containsKey(ins)) {
+                for (uint32_t k = 0; k < _nslots; k++) {
+                    if (s.holders[k] == ins)
+                        s.holders[k] = NULL;
+                }
+            }
+            if (_tracked.containsKey(ins))
+                s.ranges[_tracked.get(ins)] = typeRange(ins);
+            _rangeOf[i] = eval(i, s);
+            if (ins->isLoad()) {
+                int32_t k = slotOf(ins);
+                if (k >= 0 && !s.holders[k])
+                    s.holders[k] = ins;
+            }
+            return;
+        }
+
+        if (ins->isStore()) {
+            LIns* base = ins->oprnd2();
+            int32_t slot = slotOf(ins);
+            for (Seq<uint32_t>* q = _slots.get(base); q; q = q->tail) {
+                uint32_t k = q->head;
+                if (int32_t(k) == slot) {
+                    s.ranges[_nvalues + k] = rangeAt(ins->oprnd1(), s);
+                    s.holders[k] = ins->oprnd1();
+                } else if (_slotDisp[k] < ins->disp() + accessSize(ins->opcode()) &&
+                           ins->disp() < _slotDisp[k] + (_slotQ[k] ? 8 : 4)) {
+                    s.ranges[_nvalues + k] = _slotQ[k] ? valueRange(Q_MIN, Q_MAX)
+                                           : valueRange(Interval::I32_MIN, Interval::I32_MAX);
+                    s.holders[k] = NULL;
+                }
+            }
+            return;
+        }
+
+        switch (ins->opcode()) {
+        case LIR_xt:
+        case LIR_xf: {
+            // Execution only goes on if the guard doesn't exit.
+            bool exitIf = ins->isop(LIR_xt);
+            neverFires[i] = !refine(ins->oprnd1(), exitIf, s, false);
+            if (!refine(ins->oprnd1(), !exitIf, s, true))
+                s.reached = false;
+            break;
+        }
+        case LIR_x:
+            s.reached = false;
+            break;
+        default:
+            break;
+        }
     }
 
-    inline LIns* CseFilter::find2(LOpcode op, LIns* a, LIns* b, uint32_t &k)
+    // The range of the int or quad value of instruction 'i', in state 's'.
+    ValueRange RangeAnalysis::eval(uint32_t i, RangeState& s)
     {
-        NLKind nlkind = NL2;
-        const uint32_t bitmask = m_capNL[nlkind] - 1;
-        k = hash2(op, a, b) & bitmask;
-        uint32_t n = 1;
-        while (true) {
-            LIns* ins = m_listNL[nlkind][k];
-            if (!ins)
-                return NULL;
-            if (ins->isop(op) && ins->oprnd1() == a && ins->oprnd2() == b)
-                return ins;
-            k = (k + n) & bitmask;
-            n += 1;
+        LIns* ins = _insns[i];
+        LOpcode op = ins->opcode();
+        ValueRange top = typeRange(ins);
+        ValueRange a, b, r;
+        switch (op) {
+        case LIR_immi:
+        CASE64(LIR_immq:)
+            return rangeAt(ins, s);
+
+        case LIR_ldc2i:     return valueRange(-128, 127);
+        case LIR_lduc2ui:   return valueRange(0, 255);
+        case LIR_lds2i:     return valueRange(-32768, 32767);
+        case LIR_ldus2ui:   return valueRange(0, 65535);
+
+        case LIR_ldi:
+        CASE64(LIR_ldq:) {
+            int32_t k = slotOf(ins);
+            return k >= 0 ? s.ranges[_nvalues + k] : top;
+        }
+
+        case LIR_addi: case LIR_addxovi: case LIR_addjovi:
+        case LIR_subi: case LIR_subxovi: case LIR_subjovi:
+        case LIR_muli: case LIR_mulxovi: case LIR_muljovi: {
+            a = rangeAt(ins->oprnd1(), s);
+            b = rangeAt(ins->oprnd2(), s);
+            bool exact;
+            switch (op) {
+            case LIR_addi: case LIR_addxovi: case LIR_addjovi:
+                exact = addRanges(a, b, r);
+                break;
+            case LIR_subi: case LIR_subxovi: case LIR_subjovi:
+                exact = subRanges(a, b, r);
+                break;
+            default:
+                exact = mulRanges(a, b, r);
+                break;
+            }
+            bool fits = exact && fitsInt(r);
+            if (ins->isGuard() || ins->isJov()) {
+                canOverflow[i] = !fits;
+                // If it doesn't jump, a jov gives a value that fits.
+                _noOverflow[i] = exact ? meetRanges(r, top) : top;
+                if (_noOverflow[i].lo > _noOverflow[i].hi)
+                    _noOverflow[i] = top;
+                if (ins->isGuard())
+                    return _noOverflow[i];
+            }
+            return fits ? r : top;
+        }
+
+#ifdef NANOJIT_64BIT
+        case LIR_addq: case LIR_addjovq:
+        case LIR_subq: case LIR_subjovq:
+        CASE86(LIR_mulq:) {
+            a = rangeAt(ins->oprnd1(), s);
+            b = rangeAt(ins->oprnd2(), s);
+            bool exact = op == LIR_addq || op == LIR_addjovq ? addRanges(a, b, r)
+                       : op == LIR_subq || op == LIR_subjovq ? subRanges(a, b, r)
+                       : mulRanges(a, b, r);
+            if (ins->isJov()) {
+                canOverflow[i] = !exact;
+                _noOverflow[i] = exact ? r : top;
+            }
+            return exact ? r : top;
+        }
+#endif
+
+        case LIR_negi:
+        CASE86(LIR_negq:)
+            a = rangeAt(ins->oprnd1(), s);
+            if (subRanges(valueRange(0, 0), a, r) && within(r, top.lo, top.hi))
+                return r;
+            return top;
+
+        case LIR_noti:
+        CASE86(LIR_notq:)
+            a = rangeAt(ins->oprnd1(), s);
+            return valueRange(~a.hi, ~a.lo);
+
+        case LIR_andi:
+        CASE64(LIR_andq:)
+            // Anding with a non-negative value can't give anything bigger.
+            a = rangeAt(ins->oprnd1(), s);
+            b = rangeAt(ins->oprnd2(), s);
+            if (a.lo >= 0 && b.lo >= 0)
+                return valueRange(0, a.hi < b.hi ? a.hi : b.hi);
+            if (a.lo >= 0)
+                return valueRange(0, a.hi);
+            if (b.lo >= 0)
+                return valueRange(0, b.hi);
+            return top;
+
+        case LIR_ori:
+        case LIR_xori:
+        CASE64(LIR_orq:)
+        CASE64(LIR_xorq:) {
+            // Non-negative values give one with no higher bit set.
+            a = rangeAt(ins->oprnd1(), s);
+            b = rangeAt(ins->oprnd2(), s);
+            if (a.lo < 0 || b.lo < 0)
+                return top;
+            uint64_t m = uint64_t(a.hi > b.hi ? a.hi : b.hi);
+            for (int k = 1; k < 64; k *= 2)
+                m |= m >> k;
+            return valueRange(0, int64_t(m));
+        }
+
+        case LIR_lshi:
+        CASE64(LIR_lshq:)
+        case LIR_rshi:
+        CASE64(LIR_rshq:)
+        case LIR_rshui:
+        CASE64(LIR_rshuq:) {
+            if (!ins->oprnd2()->isImmI())
+                return top;
+            bool q = ins->isQ();
+            int sh = ins->oprnd2()->immI() & (q ? 63 : 31);
+            a = rangeAt(ins->oprnd1(), s);
+            switch (op) {
+            case LIR_lshi:
+            CASE64(LIR_lshq:)
+                if (sh < 63 && within(a, top.lo >> sh, top.hi >> sh))
+                    return valueRange(a.lo * (int64_t(1) << sh), a.hi * (int64_t(1) << sh));
+                return top;
+            case LIR_rshi:
+            CASE64(LIR_rshq:)
+                return valueRange(a.lo >> sh, a.hi >> sh);
+            default:
+                if (a.lo >= 0)
+                    return valueRange(a.lo >> sh, a.hi >> sh);
+                if (sh == 0)
+                    return a;
+                return valueRange(0, (q ? Q_MAX : UI32_MAX) >> (q ? sh - 1 : sh));
+            }
+        }
+
+#if defined NANOJIT_IA32 || defined NANOJIT_X64
+        case LIR_divi: {
+            if (!ins->oprnd2()->isImmI())
+                return top;
+            int64_t c = ins->oprnd2()->immI();
+            a = rangeAt(ins->oprnd1(), s);
+            if (c > 0)
+                return valueRange(a.lo / c, a.hi / c);
+            if (c < -1)
+                return valueRange(a.hi / c, a.lo / c);
+            return top;
+        }
+
+        case LIR_modi: {
+            // The remainder has the sign of the dividend and is smaller
+            // than the divisor.
+            LIns* div = ins->oprnd1();
+            if (!div->oprnd2()->isImmI() || div->oprnd2()->immI() == 0)
+                return top;
+            int64_t c = div->oprnd2()->immI();
+            int64_t m = (c < 0 ? -c : c) - 1;
+            a = rangeAt(div->oprnd1(), s);
+            if (a.lo >= 0)
+                return valueRange(0, a.hi < m ? a.hi : m);
+            if (a.hi <= 0)
+                return valueRange(a.lo > -m ? a.lo : -m, 0);
+            return valueRange(-m, m);
+        }
+#endif
+
+        case LIR_cmovi:
+        CASE64(LIR_cmovq:)
+            return joinRanges(rangeAt(ins->oprnd2(), s), rangeAt(ins->oprnd3(), s));
+
+#ifdef NANOJIT_64BIT
+        case LIR_i2q: {
+            LIns* v = ins->oprnd1();
+            roundTrip[i] = NULL;
+            if (v->isop(LIR_q2i) && fitsInt(rangeAt(v->oprnd1(), s)))
+                roundTrip[i] = v->oprnd1();
+            return rangeAt(v, s);
+        }
+
+        case LIR_ui2uq: {
+            LIns* v = ins->oprnd1();
+            roundTrip[i] = NULL;
+            if (v->isop(LIR_q2i) && within(rangeAt(v->oprnd1(), s), 0, UI32_MAX))
+                roundTrip[i] = v->oprnd1();
+            a = rangeAt(v, s);
+            if (a.lo >= 0)
+                return a;
+            if (a.hi < 0)
+                return valueRange(a.lo + UI32_MAX + 1, a.hi + UI32_MAX + 1);
+            return valueRange(0, UI32_MAX);
+        }
+
+        case LIR_q2i: {
+            LIns* v = ins->oprnd1();
+            roundTrip[i] = NULL;
+            if (v->isop(LIR_i2q) || v->isop(LIR_ui2uq))
+                roundTrip[i] = v->oprnd1();
+            a = rangeAt(v, s);
+            return fitsInt(a) ? a : top;
+        }
+#endif
+
+#if NJ_BITOPS_SUPPORTED
+        case LIR_popcnti: case LIR_lzcnti: case LIR_tzcnti:
+            return valueRange(0, 32);
+        CASE64(LIR_popcntq:) CASE64(LIR_lzcntq:) CASE64(LIR_tzcntq:)
+            return valueRange(0, 64);
+#endif
+
+        default:
+            // Comparisons give 0 or 1, unless the ranges of their operands
+            // say which.
+            if (isCmpOpcode(op)) {
+                bool t = refine(ins, true, s, false);
+                bool f = refine(ins, false, s, false);
+                return valueRange(t && !f ? 1 : 0, f && !t ? 0 : 1);
+            }
+            return top;
         }
     }
 
-    uint32_t CseFilter::find2(LIns* ins)
+    RangeFilter::RangeFilter(LirFilter* in, Allocator& alloc)
+        : LirFilter(in), _alloc(alloc), _replaced(alloc), _rewritten(alloc), _dead(alloc)
     {
-        uint32_t k;
-        find2(ins->opcode(), ins->oprnd1(), ins->oprnd2(), k);
-        return k;
+        _insns = readAll(alloc, _next);
+        analyze(_insns, _next);
     }
 
-    inline LIns* CseFilter::find3(LOpcode op, LIns* a, LIns* b, LIns* c, uint32_t &k)
+    LIns* RangeFilter::read()
     {
-        NLKind nlkind = NL3;
-        const uint32_t bitmask = m_capNL[nlkind] - 1;
-        k = hash3(op, a, b, c) & bitmask;
-        uint32_t n = 1;
-        while (true) {
-            LIns* ins = m_listNL[nlkind][k];
-            if (!ins)
-                return NULL;
-            if (ins->isop(op) && ins->oprnd1() == a && ins->oprnd2() == b && ins->oprnd3() == c)
-                return ins;
-            k = (k + n) & bitmask;
-            n += 1;
+        for (;;) {
+            // Keep returning LIR_start once everything else has gone.
+            LIns* ins = _insns[_next > 1 ? --_next : 0];
+            if (_replaced.containsKey(ins) || _dead.containsKey(ins))
+                continue;
+            if (_rewritten.containsKey(ins))
+                return _rewritten.get(ins);
+            return ins;
         }
     }
 
-    uint32_t CseFilter::find3(LIns* ins)
+    void RangeFilter::analyze(LIns** insns, uint32_t n)
     {
-        uint32_t k;
-        find3(ins->opcode(), ins->oprnd1(), ins->oprnd2(), ins->oprnd3(), k);
-        return k;
-    }
+        FlowGraph g(_alloc, insns, n);
+        RangeAnalysis ra(_alloc, insns, n, g);
+        if (!ra.run())
+            return;
 
-    inline LIns* CseFilter::find4(LOpcode op, LIns* a, LIns* b, LIns* c, LIns* d, uint32_t &k)
-    {
-        NLKind nlkind = NL4;
-        const uint32_t bitmask = m_capNL[nlkind] - 1;
-        k = hash4(op, a, b, c, d) & bitmask;
-        uint32_t n = 1;
-        while (true) {
-            LIns* ins = m_listNL[nlkind][k];
-            if (!ins)
-                return NULL;
-            if (ins->isop(op) && ins->oprnd1() == a && ins->oprnd2() == b && ins->oprnd3() == c && ins->oprnd4() == d)
-                return ins;
-            k = (k + n) & bitmask;
-            n += 1;
+        for (uint32_t i = 0; i < n; i++) {
+            LIns* ins = insns[i];
+            for (uint32_t k = 0, nops = ins->numOperands(); k < nops; k++) {
+                LIns* v = ins->operand(k);
+                if (v && _replaced.containsKey(v))
+                    ins->setOperand(k, _replaced.get(v));
+                else if (v && _rewritten.containsKey(v))
+                    ins->setOperand(k, _rewritten.get(v));
+            }
+            if (!ra.visited[i])
+                continue;
+
+            LOpcode op = ins->opcode();
+            switch (op) {
+            case LIR_addxovi: case LIR_addjovi: op = LIR_addi;  break;
+            case LIR_subxovi: case LIR_subjovi: op = LIR_subi;  break;
+            case LIR_mulxovi: case LIR_muljovi: op = LIR_muli;  break;
+            CASE64(LIR_addjovq:)                op = LIR_addq;  break;
+            CASE64(LIR_subjovq:)                op = LIR_subq;  break;
+
+            case LIR_jt: case LIR_jf: case LIR_xt: case LIR_xf:
+                if (ra.neverFires[i])
+                    _dead.put(ins, true);
+                continue;
+
+            CASE64(LIR_i2q:) CASE64(LIR_ui2uq:) CASE64(LIR_q2i:)
+                if (LIns* v = ra.roundTrip[i]) {
+                    if (_replaced.containsKey(v))
+                        v = _replaced.get(v);
+                    else if (_rewritten.containsKey(v))
+                        v = _rewritten.get(v);
+                    _replaced.put(ins, v);
+                }
+                continue;
+
+            default:
+                continue;
+            }
+            if (!ra.canOverflow[i]) {
+                LIns* plain = (new (_alloc) LInsOp2())->getLIns();
+                plain->initLInsOp2(op, ins->oprnd1(), ins->oprnd2());
+                _rewritten.put(ins, plain);
+            }
         }
     }
-    
-    uint32_t CseFilter::find4(LIns* ins)
-    {
-        uint32_t k;
-        find4(ins->opcode(), ins->oprnd1(), ins->oprnd2(), ins->oprnd3(), ins->oprnd4(), k);
-        return k;
+
+#if defined NANOJIT_IA32 || defined NANOJIT_X64
+    // floor(2^p / d), which must fit in 64 bits, by long division.
+    static uint64_t divPow2(int p, uint64_t d)
+    {
+        uint64_t q = 0;
+        uint64_t r = 0;
+        for (int i = p; i >= 0; i--) {
+            r = r * 2 + (i == p ? 1 : 0);
+            if (r >= d) {
+                r -= d;
+                NanoAssert(i < 64);
+                q |= uint64_t(1) << i;
+            }
+        }
+        return q;
     }
-        
-    inline LIns* CseFilter::findLoad(LOpcode op, LIns* a, int32_t d, MiniAccSet miniAccSet,
-                                     LoadQual loadQual, uint32_t &k)
+
+    DivFilter::DivFilter(LirFilter* in, Allocator& alloc)
+        : LirFilter(in), _alloc(alloc)
     {
-        CseAcc cseAcc = miniAccSetToCseAcc(miniAccSet, loadQual);
-        const uint32_t bitmask = m_capL[cseAcc] - 1;
-        k = hashLoad(op, a, d) & bitmask;
-        uint32_t n = 1;
-        while (true) {
-            LIns* ins = m_listL[cseAcc][k];
-            if (!ins)
-                return NULL;
-            // All the loads in this table should have the same miniAccSet and
-            // loadQual.
-            NanoAssert(miniAccSetToCseAcc(ins->miniAccSet(), ins->loadQual()) == cseAcc &&
-                       ins->loadQual() == loadQual);
-            if (ins->isop(op) && ins->oprnd1() == a && ins->disp() == d)
-                return ins;
-            k = (k + n) & bitmask;
-            n += 1;
+        uint32_t n;
+        LIns** insns = readAll(alloc, n);
+        uint32_t ndivs = 0;
+        for (uint32_t i = 0; i < n; i++) {
+            if (isDivOrMod(insns[i]))
+                ndivs++;
+        }
+        _insns = new (alloc) LIns*[n + ndivs * MAX_EXPANSION];
+        _next = 0;
+
+        HashMap<LIns*, LIns*> replaced(alloc);
+        for (uint32_t i = 0; i < n; i++) {
+            LIns* ins = insns[i];
+            LIns* r = NULL;
+            if ((ins->isop(LIR_modi) IF_64BIT(|| ins->isop(LIR_modq))) &&
+                replaced.containsKey(ins->oprnd1())) {
+                // The division it goes with has been lowered, so this has to
+                // be too.
+                r = lowerMod(ins->oprnd1(), replaced.get(ins->oprnd1()));
+            } else {
+                for (uint32_t k = 0, nops = ins->numOperands(); k < nops; k++) {
+                    LIns* v = ins->operand(k);
+                    if (v && replaced.containsKey(v))
+                        ins->setOperand(k, replaced.get(v));
+                }
+                if (ins->isop(LIR_divi) IF_64BIT(|| ins->isop(LIR_divq)))
+                    r = lowerDiv(ins);
+            }
+            if (r)
+                replaced.put(ins, r);
+            else
+                _insns[_next++] = ins;
         }
     }
 
-    uint32_t CseFilter::findLoad(LIns* ins)
+    LIns* DivFilter::read()
     {
-        uint32_t k;
-        findLoad(ins->opcode(), ins->oprnd1(), ins->disp(), ins->miniAccSet(), ins->loadQual(), k);
-        return k;
+        // Keep returning LIR_start once everything else has gone.
+        return _insns[_next > 1 ? --_next : 0];
     }
 
-    bool argsmatch(LIns* ins, uint32_t argc, LIns* args[])
+    bool DivFilter::isDivOrMod(LIns* ins)
     {
-        for (uint32_t j=0; j < argc; j++)
-            if (ins->arg(j) != args[j])
-                return false;
-        return true;
+        switch (ins->opcode()) {
+        case LIR_divi: case LIR_modi:
+        CASE64(LIR_divq:) CASE64(LIR_modq:)
+            return true;
+        default:
+            return false;
+        }
     }
 
-    inline LIns* CseFilter::findCall(const CallInfo *ci, uint32_t argc, LIns* args[], uint32_t &k)
+    LIns* DivFilter::emit1(LOpcode op, LIns* a)
     {
-        NLKind nlkind = NLCall;
-        const uint32_t bitmask = m_capNL[nlkind] - 1;
-        k = hashCall(ci, argc, args) & bitmask;
-        uint32_t n = 1;
-        while (true) {
-            LIns* ins = m_listNL[nlkind][k];
-            if (!ins)
-                return NULL;
-            if (ins->isCall() && ins->callInfo() == ci && argsmatch(ins, argc, args))
-                return ins;
-            k = (k + n) & bitmask;
-            n += 1;
-        }
+        LIns* ins = (new (_alloc) LInsOp1())->getLIns();
+        ins->initLInsOp1(op, a);
+        _insns[_next++] = ins;
+        return ins;
     }
 
-    uint32_t CseFilter::findCall(LIns* ins)
+    LIns* DivFilter::emit2(LOpcode op, LIns* a, LIns* b)
     {
-        LIns* args[MAXARGS];
-        uint32_t argc = ins->argc();
-        NanoAssert(argc < MAXARGS);
-        for (uint32_t j=0; j < argc; j++)
-            args[j] = ins->arg(j);
-        uint32_t k;
-        findCall(ins->callInfo(), argc, args, k);
-        return k;
+        LIns* ins = (new (_alloc) LInsOp2())->getLIns();
+        ins->initLInsOp2(op, a, b);
+        _insns[_next++] = ins;
+        return ins;
     }
 
-    // Tainted and non-tainted constants of equal value are treated
-    // as distinct by CSE, thus preserving the taint status.  We might
-    // like to share small constants that will not be blinded anyhow,
-    // but this would allow synthesis of arbitrary untainted constants
-    // through constant folding.  We could avoid this hazard by
-    // rewriting CSEs after all constant folding has been performed, but
-    // such a strategy is incompatible with our one-pass optimizer
-    // architecture, thus we sacrifice some CSE opportunities when
-    // constant blinding is enabled.
-    //
-    // In practice, we expect sharing between tainted and untainted
-    // expressions to be confined mostly to leaf constants, which we
-    // tend to rematerialize frequently in preference to long-term
-    // register residency.  In fact, the loss of leaf constant sharing
-    // may reduce register pressure, due to pragmatic restrictions on
-    // rematerialization of tainted constants that can force spills.
+    LIns* DivFilter::emitImmI(int32_t imm)
+    {
+        LIns* ins = (new (_alloc) LInsIorF())->getLIns();
+        ins->initLInsIorF(LIR_immi, imm);
+        _insns[_next++] = ins;
+        return ins;
+    }
 
-    LIns* CseFilter::insImmI(int32_t imm, bool tainted)
+#ifdef NANOJIT_64BIT
+    LIns* DivFilter::emitImmQ(uint64_t imm)
     {
-        uint32_t k;
-        LIns* ins;
-        const bool blind = tainted && config.harden_blind_constants;
-        // Each value gets two slots in m_capNL: one for tainted and another for untainted.
-        if (0 <= imm && imm < int32_t(m_capNL[NLImmISmall])/2) {
-            ins = findImmISmall(imm, k, blind);
-            if (!ins) {
-                ins = out->insImmI(imm, blind);
-                addNLImmISmall(ins, k);
-            }
+        LIns* ins = (new (_alloc) LInsQorD())->getLIns();
+        ins->initLInsQorD(LIR_immq, imm);
+        _insns[_next++] = ins;
+        return ins;
+    }
+#endif
+
+    // Emits the instructions computing 'div', if its divisor is a constant
+    // that they can handle, and returns the last one, or NULL.
+    LIns* DivFilter::lowerDiv(LIns* div)
+    {
+        bool q = !div->isop(LIR_divi);
+        LIns* x = div->oprnd1();
+        LIns* c = div->oprnd2();
+        int64_t d;
+        if (c->isImmI())
+            d = c->immI();
+#ifdef NANOJIT_64BIT
+        else if (c->isImmQ())
+            d = int64_t(c->immQ());
+#endif
+        else
+            return NULL;
+
+        // Division by -1 is left alone, as it faults on the smallest value.
+        int bits = q ? 64 : 32;
+        int64_t minValue = q ? Q_MIN : Interval::I32_MIN;
+        if (d == 0 || d == -1)
+            return NULL;
+        if (d == 1)
+            return x;
+#ifdef NANOJIT_64BIT
+        if (d == minValue)
+            return q ? emit1(LIR_ui2uq, emit2(LIR_eqq, x, c)) : emit2(LIR_eqi, x, c);
+#else
+        if (d == minValue)
+            return emit2(LIR_eqi, x, c);
+#endif
+
+        LOpcode rsh = q ? LIR_rshq : LIR_rshi;
+        LOpcode add = q ? LIR_addq : LIR_addi;
+        LOpcode sub = q ? LIR_subq : LIR_subi;
+        uint64_t ad = uint64_t(d < 0 ? -d : d);
+        int lg = 0;                         // ceil(log2(ad))
+        while ((uint64_t(1) << lg) < ad)
+            lg++;
+        LIns* r;
+        if ((ad & (ad - 1)) == 0) {
+            // Shifting right rounds down, so add ad - 1 first if x is
+            // negative, taking it from the low bits of its sign.
+            LIns* sign = emit2(rsh, x, emitImmI(bits - 1));
+            LIns* bias = emit2(q ? LIR_rshuq : LIR_rshui, sign, emitImmI(bits - lg));
+            r = emit2(rsh, emit2(add, x, bias), emitImmI(lg));
         } else {
-            ins = findImmILarge(imm, k, blind);
-            if (!ins) {
-                ins = out->insImmI(imm, blind);
-                addNL(NLImmILarge, ins, k);
+#ifdef NANOJIT_64BIT
+            // With m = 2^(bits+lg-1) / ad + 1, x / ad is the floor of x * m /
+            // 2^(bits+lg-1), plus 1 if x is negative (Granlund and
+            // Montgomery, "Division by Invariant Integers using
+            // Multiplication").  For an int the product fits in a quad;
+            // for a quad, m doesn't, so m - 2^64 is used and x added back.
+            LIns* t;
+            if (q) {
+                uint64_t m = divPow2(63 + lg, ad) + 1;
+                LIns* h = emit2(LIR_mulhq, x, emitImmQ(m));
+                t = emit2(LIR_rshq, emit2(LIR_addq, h, x), emitImmI(lg - 1));
+            } else {
+                uint64_t m = (uint64_t(1) << (31 + lg)) / ad + 1;
+                LIns* p = emit2(LIR_mulq, emit1(LIR_i2q, x), emitImmQ(m));
+                t = emit1(LIR_q2i, emit2(LIR_rshq, p, emitImmI(31 + lg)));
             }
+            r = emit2(sub, t, emit2(rsh, x, emitImmI(bits - 1)));
+#else
+            return NULL;
+#endif
         }
-        // We assume that downstream stages do not modify the instruction, so
-        // that we can insert 'ins' into slot 'k'.  Check this.
-        NanoAssert(ins->isop(LIR_immi) && ins->immI() == imm);
-        return ins;
+        if (d < 0)
+            r = emit1(q ? LIR_negq : LIR_negi, r);
+        return r;
     }
 
-    LIns* CseFilter::insSafe(LOpcode op, void *payload) {
-        return out->insSafe(op, payload);
+    // Emits the instructions computing the remainder of 'div', given those
+    // computing its quotient, and returns the last one.
+    LIns* DivFilter::lowerMod(LIns* div, LIns* quotient)
+    {
+        LIns* x = div->oprnd1();
+        LIns* c = div->oprnd2();
+#ifdef NANOJIT_64BIT
+        if (div->isop(LIR_divq)) {
+            if (quotient == x)
+                return emitImmQ(0);
+            return emit2(LIR_subq, x, emit2(LIR_mulq, quotient, c));
+        }
+#endif
+        if (quotient == x)
+            return emitImmI(0);
+        return emit2(LIR_subi, x, emit2(LIR_muli, quotient, c));
     }
+#endif
 
-#ifdef NANOJIT_64BIT
-    LIns* CseFilter::insImmQ(uint64_t q, bool tainted)
+    // A counted loop found by UnrollFilter.  It runs from the label at
+    // 'head' to the branch back to it at 'back', and goes round again while
+    // 'load' + 'offset' is less than 'bound' (or greater, if !up, or equal
+    // as well, if !strict).  'load' reads the induction variable, and
+    // 'store', the only store to it, writes it back 'step' more.
+    struct UnrollFilter::Loop
+    {
+        uint32_t    head;
+        uint32_t    back;
+        uint32_t    exit;       // the branch leaving the loop, or 'back'
+        LIns*       load;
+        LIns*       store;
+        LIns*       bound;
+        int64_t     step;
+        int64_t     offset;
+        bool        quad;       // is the induction variable a quad?
+        bool        isUnsigned;
+        bool        up;
+        bool        strict;
+    };
+
+    // Sets 'v' to the value of 'ins' if it is an int or quad immediate.
+    static bool getImmIorQ(LIns* ins, int64_t& v)
     {
-        uint32_t k;
-        const bool blind = tainted && config.harden_blind_constants;
-        LIns* ins = findImmQ(q, k, blind);
-        if (!ins) {
-            ins = out->insImmQ(q, blind);
-            addNL(NLImmQ, ins, k);
+        if (ins->isImmI()) {
+            v = ins->immI();
+            return true;
         }
-        NanoAssert(ins->isop(LIR_immq) && ins->immQ() == q);
-        return ins;
+#ifdef NANOJIT_64BIT
+        if (ins->isImmQ()) {
+            v = int64_t(ins->immQ());
+            return true;
+        }
+#endif
+        return false;
     }
+
+    static bool isMulP(LIns* ins)
+    {
+#if defined NANOJIT_X64
+        return ins->isop(LIR_mulq);
+#elif defined NANOJIT_64BIT
+        (void)ins;
+        return false;
+#else
+        return ins->isop(LIR_muli);
 #endif
+    }
 
-    LIns* CseFilter::insImmD(double d, bool tainted)
+    UnrollFilter::UnrollFilter(LirFilter* in, Allocator& alloc, uint32_t factor)
+        : LirFilter(in), _alloc(alloc), _factor(factor), _index(alloc), _isPrivate(alloc)
     {
-        uint32_t k;
-        // Doubles must be compared bitwise in order to correctly
-        // distinguish 0 and -0.  See bug 527288.
-        union {
-            double d;
-            uint64_t u64;
-        } u;
-        u.d = d;
-        const bool blind = tainted && config.harden_blind_constants;
-        LIns* ins = findImmD(u.u64, k, blind);
-        if (!ins) {
-            ins = out->insImmD(d, blind);
-            addNL(NLImmD, ins, k);
-        }
-        NanoAssert(ins->isop(LIR_immd) && ins->immDasQ() == u.u64);
-        return ins;
+        uint32_t n;
+        LIns** insns = readAll(alloc, n);
+        analyze(insns, n);
     }
 
-    LIns* CseFilter::insImmF(float f, bool tainted)
+    LIns* UnrollFilter::read()
     {
-        uint32_t k;
-        // Floats must be compared bitwise in order to correctly
-        // distinguish 0 and -0.  Also, we wish for NaNs to compare
-        // as equal, though we may in some cases distinguish different
-        // NaN values unnecessarily.
-        union {
-            float flt;
-            int32_t i;
-        } u;
-        u.flt = f;
-        const bool blind = tainted && config.harden_blind_constants;
-        LIns* ins = findImmF(u.i, k, blind);
-        if (!ins) {
-            ins = out->insImmF(f, blind);
-            addNL(NLImmF, ins, k);
-        }
-        NanoAssert(ins->isop(LIR_immf) && ins->immFasI() == u.i);
-        return ins;
+        // Keep returning LIR_start once everything else has gone.
+        return _insns[_next > 1 ? --_next : 0];
     }
-    
-    LIns* CseFilter::insImmF4(const float4_t& f4, bool tainted)
+
+    void UnrollFilter::analyze(LIns** insns, uint32_t n)
     {
-        uint32_t k;
-        const bool blind = tainted && config.harden_blind_constants;
-        LIns* ins = findImmF4(f4, k, blind);
-        if (!ins) {
-            ins = out->insImmF4(f4, blind);
-            addNL(NLImmF4, ins, k);
+        _size = n + 64;
+        _insns = new (_alloc) LIns*[_size];
+        _next = 0;
+
+        // Find the loops: back[l] is the branch back to label l, and
+        // nbranches[l] the number of branches to it.
+        uint32_t* back = new (_alloc) uint32_t[n];
+        uint32_t* nbranches = new (_alloc) uint32_t[n];
+        VMPI_memset(back, 0, n * sizeof(uint32_t));
+        VMPI_memset(nbranches, 0, n * sizeof(uint32_t));
+        for (uint32_t i = 0; i < n; i++)
+            _index.put(insns[i], i);
+        bool loops = false;
+        for (uint32_t i = 0; i < n; i++) {
+            LIns* ins = insns[i];
+            uint32_t ntargets = ins->isop(LIR_jtbl) ? ins->getTableSize() : ins->isBranch() ? 1 : 0;
+            for (uint32_t t = 0; t < ntargets; t++) {
+                LIns* target = ins->isop(LIR_jtbl) ? ins->getTarget(t) : ins->getTarget();
+                if (!target)
+                    continue;
+                uint32_t l = _index.get(target);
+                nbranches[l]++;
+                if (l < i) {
+                    back[l] = i;
+                    loops = true;
+                }
+            }
         }
-#ifdef DEBUG
-        NanoAssert(ins->isop(LIR_immf4));
-        // We must use bitwise comparision here in order
-        // to correctly distinguish 0 and -0.  See also the
-        // remarks for Float.
-        float4_t other = ins->immF4();
-        NanoAssert(VMPI_memcmp( &f4, &other, sizeof(float4_t)) == 0);
+        if (loops)
+            findPrivateAreas(insns, n, _isPrivate, _alloc);
+
+        for (uint32_t i = 0; i < n; i++) {
+            Loop loop;
+            if (back[i] && nbranches[i] == 1 && findLoop(insns, i, back[i], loop))
+                unroll(insns, loop);
+            emit(insns[i]);
+        }
+    }
+
+    // Is 'ins' between the label and the back branch of 'loop'?
+    bool UnrollFilter::inLoop(LIns* ins, const Loop& loop)
+    {
+        uint32_t i = _index.get(ins);
+        return loop.head < i && i < loop.back;
+    }
+
+    // Fills in 'loop' if the loop from 'head' to 'back' is a counted loop
+    // UnrollFilter can unroll.
+    bool UnrollFilter::findLoop(LIns** insns, uint32_t head, uint32_t back, Loop& loop)
+    {
+        loop.head = head;
+        loop.back = back;
+        loop.exit = back;
+        LIns* br = insns[back];
+        if (!br->isop(LIR_j) && !br->isop(LIR_jt) && !br->isop(LIR_jf))
+            return false;
+        for (uint32_t i = head + 1; i < back; i++) {
+            LIns* ins = insns[i];
+            if (ins->isop(LIR_jt) || ins->isop(LIR_jf)) {
+                // The only way out, other than the test at the bottom.
+                if (!ins->getTarget())
+                    return false;
+                uint32_t t = _index.get(ins->getTarget());
+                if (loop.exit != back || !br->isop(LIR_j) || (head <= t && t <= back))
+                    return false;
+                loop.exit = i;
+            } else if (ins->isV() ? !(ins->isStore() || ins->isop(LIR_callv) || ins->isop(LIR_comment))
+                                  : (ins->isBranch() || ins->isGuard() || ins->isParam() ||
+                                     ins->isop(LIR_allocp))) {
+#if defined NANOJIT_IA32 || defined NANOJIT_X64
+                // Profiling counters are bumped once per copy, which keeps
+                // the count per trip of the original loop.
+                if (ins->isop(LIR_count))
+                    continue;
 #endif
-        return ins;
+                return false;
+            }
+        }
+        if (loop.exit == back && br->isop(LIR_j))
+            return false;
+
+        LIns* cond = insns[loop.exit]->oprnd1();
+        LOpcode op = cond->opcode();
+        int k;
+        if (isCmpIOpcode(op)) {
+            k = op - LIR_eqi;
+            loop.quad = false;
+#ifdef NANOJIT_64BIT
+        } else if (isCmpQOpcode(op)) {
+            k = op - LIR_eqq;
+            loop.quad = true;
+#endif
+        } else {
+            return false;
+        }
+        if (k == 0)
+            return false;
+        loop.isUnsigned = k >= 5;
+        if (loop.isUnsigned)
+            k -= 4;
+
+        // Turn the test into 'tested' < 'bound', > , <= or >= (1 to 4),
+        // which is true when the loop goes round again.
+        bool again = (loop.exit == back) == insns[loop.exit]->isop(LIR_jt);
+        for (int side = 0; side < 2; side++) {
+            int rel = k;
+            if (side == 1)
+                rel = rel == 1 ? 2 : rel == 2 ? 1 : rel == 3 ? 4 : 3;
+            if (!again)
+                rel = 5 - rel;
+            loop.up = rel == 1 || rel == 3;
+            loop.strict = rel <= 2;
+            if (findInduction(insns, cond->operand(side), cond->operand(1 - side), loop))
+                return true;
+        }
+        return false;
     }
 
-    LIns* CseFilter::ins0(LOpcode op)
+    // Fills in the rest of 'loop' if 'tested' is an induction variable
+    // loaded in the loop, plus a constant, and 'bound' doesn't change in it.
+    bool UnrollFilter::findInduction(LIns** insns, LIns* tested, LIns* bound, Loop& loop)
     {
-        if (op == LIR_label && !suspended)
-            clearAll();
-        return out->ins0(op);
+#ifdef NANOJIT_64BIT
+        LOpcode add = loop.quad ? LIR_addq : LIR_addi;
+        LOpcode sub = loop.quad ? LIR_subq : LIR_subi;
+        LOpcode ld = loop.quad ? LIR_ldq : LIR_ldi;
+        LOpcode st = loop.quad ? LIR_stq : LIR_sti;
+#else
+        LOpcode add = LIR_addi, sub = LIR_subi, ld = LIR_ldi, st = LIR_sti;
+#endif
+        int64_t c;
+        LIns* load = tested;
+        loop.offset = 0;
+        if (tested->isop(add) && getImmIorQ(tested->oprnd2(), c)) {
+            load = tested->oprnd1();
+            loop.offset = c;
+        } else if (tested->isop(add) && getImmIorQ(tested->oprnd1(), c)) {
+            load = tested->oprnd2();
+            loop.offset = c;
+        } else if (tested->isop(sub) && getImmIorQ(tested->oprnd2(), c)) {
+            load = tested->oprnd1();
+            loop.offset = -c;
+        }
+        if (!load->isop(ld) || load->loadQual() == LOAD_VOLATILE || !inLoop(load, loop) ||
+            !_isPrivate.containsKey(load->oprnd1()))
+            return false;
+        if (!bound->isImmAny() && _index.get(bound) > loop.head)
+            return false;
+
+        // Nothing else in the loop may read or write the induction variable.
+        LIns* base = load->oprnd1();
+        int32_t disp = load->disp();
+        int32_t size = accessSize(ld);
+        loop.store = NULL;
+        for (uint32_t i = loop.head + 1; i < loop.back; i++) {
+            LIns* ins = insns[i];
+            if (!(ins->isLoad() && ins->oprnd1() == base) && !(ins->isStore() && ins->oprnd2() == base))
+                continue;
+            if (ins->disp() >= disp + size || disp >= ins->disp() + accessSize(ins->opcode()))
+                continue;
+            if (ins->isLoad() ? ins != load
+                              : loop.store || !ins->isop(st) || ins->disp() != disp ||
+                                i < _index.get(load))
+                return false;
+            if (ins->isStore())
+                loop.store = ins;
+        }
+        if (!loop.store)
+            return false;
+
+        LIns* v = loop.store->oprnd1();
+        if (v->isop(add) && v->oprnd1() == load && getImmIorQ(v->oprnd2(), c))
+            loop.step = c;
+        else if (v->isop(add) && v->oprnd2() == load && getImmIorQ(v->oprnd1(), c))
+            loop.step = c;
+        else if (v->isop(sub) && v->oprnd1() == load && getImmIorQ(v->oprnd2(), c))
+            loop.step = -c;
+        else
+            return false;
+
+        // The step and offset must go towards the bound, and be small enough
+        // that the sums in unroll() can't overflow.
+        const int64_t MAX_STEP = 0x7fffffff;
+        if (loop.step == 0 || loop.step > MAX_STEP || loop.step < -MAX_STEP ||
+            loop.offset > MAX_STEP || loop.offset < -MAX_STEP)
+            return false;
+        if (loop.up ? (loop.step < 0 || loop.offset < 0) : (loop.step > 0 || loop.offset > 0))
+            return false;
+        loop.load = load;
+        loop.bound = bound;
+        return true;
     }
 
-    LIns* CseFilter::ins1(LOpcode op, LIns* a)
+    // If 'x' is the induction variable of 'loop' times a constant, as a
+    // pointer-sized integer, returns the constant, else 0.
+    int64_t UnrollFilter::scaleOf(LIns* x, const Loop& loop)
     {
-        LIns* ins;
-        if (isCseOpcode(op)) {
-            uint32_t k;
-            ins = find1(op, a, k);
-            if (!ins) {
-                ins = out->ins1(op, a);
-                addNL(NL1, ins, k);
+        const int64_t MAX_SCALE = 1 << 20;
+        if (x == loop.load)
+            return x->retType() == LTy_P ? 1 : 0;
+#ifdef NANOJIT_64BIT
+        // An int that stays between its first value and the bound doesn't
+        // wrap around, so its extension grows by the step too.
+        if (x->isop(LIR_i2q) && x->oprnd1() == loop.load && !loop.isUnsigned)
+            return 1;
+        if (x->isop(LIR_ui2uq) && x->oprnd1() == loop.load && loop.isUnsigned)
+            return 1;
+#endif
+        if (x->isop(LIR_lshp) && x->oprnd2()->isImmI() &&
+            x->oprnd2()->immI() >= 0 && x->oprnd2()->immI() < 20) {
+            int64_t s = scaleOf(x->oprnd1(), loop) * (int64_t(1) << x->oprnd2()->immI());
+            return s > -MAX_SCALE && s < MAX_SCALE ? s : 0;
+        }
+        if (isMulP(x)) {
+            for (int side = 0; side < 2; side++) {
+                int64_t c;
+                if (getImmIorQ(x->operand(side), c) && c > -MAX_SCALE && c < MAX_SCALE) {
+                    int64_t s = scaleOf(x->operand(1 - side), loop) * c;
+                    return s > -MAX_SCALE && s < MAX_SCALE ? s : 0;
+                }
             }
+        }
+        return 0;
+    }
+
+    // Puts an unrolled copy of 'loop' in the output.
+    void UnrollFilter::unroll(LIns** insns, Loop& loop)
+    {
+        uint32_t head = loop.head, back = loop.back;
+        uint32_t size = 0;
+        for (uint32_t i = head + 1; i < back; i++) {
+            if (i != loop.exit && !insns[i]->isop(LIR_comment))
+                size++;
+        }
+        uint32_t factor = _factor;
+        while (factor > 1 && factor * size > MAX_UNROLLED_SIZE)
+            factor--;
+        if (factor < 2)
+            return;
+
+        // Every test in 'factor' iterations passes if the first value of
+        // the induction variable is less than 'bound' - 'dist' (or greater
+        // than 'bound' + 'dist', for a loop going down).
+        bool quad = loop.quad, up = loop.up, isUnsigned = loop.isUnsigned;
+        int64_t reach = int64_t(factor - 1) * loop.step + loop.offset;
+        int64_t dist = (up ? reach : -reach) - (loop.strict ? 0 : 1);
+        NanoAssert(dist >= 0);
+        int64_t lo, hi;
+        if (quad) {
+            lo = isUnsigned ? 0 : Q_MIN;
+            hi = isUnsigned ? -1 : Q_MAX;
         } else {
-            ins = out->ins1(op, a);
+            lo = isUnsigned ? 0 : int64_t(int32_t(0x80000000));
+            hi = isUnsigned ? UI32_MAX : int64_t(0x7fffffff);
+            if (dist > int64_t(0x7fffffff))
+                return;
+        }
+        LOpcode eq = LIR_eqi, move = up ? LIR_subi : LIR_addi, cmov = LIR_cmovi;
+#ifdef NANOJIT_64BIT
+        if (quad) {
+            eq = LIR_eqq;
+            move = up ? LIR_subq : LIR_addq;
+            cmov = LIR_cmovq;
+        }
+#endif
+        LOpcode cmp = LOpcode(eq + (up ? 1 : 2) + (isUnsigned ? 4 : 0));
+
+        LIns* lim;
+        int64_t b;
+        if (getImmIorQ(loop.bound, b)) {
+            // Where 'bound' is too close to the end of the range, the
+            // unrolled loop would never run.
+            if (!quad && isUnsigned)
+                b = int64_t(uint32_t(b));
+            bool never;
+            if (quad && isUnsigned)
+                never = up ? uint64_t(b) < uint64_t(dist) : uint64_t(b) > ~uint64_t(0) - uint64_t(dist);
+            else
+                never = up ? b < lo + dist : b > hi - dist;
+            if (never)
+                return;
+            lim = emitImm(quad, int64_t(up ? uint64_t(b) - uint64_t(dist) : uint64_t(b) + uint64_t(dist)));
+        } else if (dist == 0) {
+            lim = loop.bound;
+        } else {
+            // Where 'bound' - 'dist' would overflow, use a limit that nothing
+            // passes instead.
+            int64_t edge = int64_t(up ? uint64_t(lo) + uint64_t(dist) : uint64_t(hi) - uint64_t(dist));
+            LIns* over = emit2(cmp, loop.bound, emitImm(quad, edge));
+            LIns* moved = emit2(move, loop.bound, emitImm(quad, dist));
+            lim = emit3(cmov, over, emitImm(quad, up ? lo : hi), moved);
+        }
+
+        // The unrolled loop, which leaves for the original one when fewer
+        // than 'factor' iterations are left.
+        LIns* top = (new (_alloc) LInsOp0())->getLIns();
+        top->initLInsOp0(LIR_label);
+        emit(top);
+        LIns* first = copyIns(loop.load);
+        emit(first);
+        emit2(LIR_jf, emit2(cmp, first, lim), insns[head]);
+
+        // copyOf[i - head] is the copy of insns[i] in the current copy of
+        // the body.  Addresses stepping by a constant are worked out from
+        // the first value of the induction variable, here.
+        LIns** copyOf = new (_alloc) LIns*[back - head];
+        VMPI_memset(copyOf, 0, (back - head) * sizeof(LIns*));
+        copyOf[_index.get(loop.load) - head] = first;
+        HashMap<LIns*, int64_t> stride(_alloc);
+        HashMap<LIns*, LIns*> start(_alloc);
+        for (uint32_t i = head + 1; i < back; i++) {
+            LIns* ins = insns[i];
+            if (!ins->isop(LIR_addp))
+                continue;
+            for (int side = 0; side < 2; side++) {
+                LIns* base = ins->operand(side);
+                int64_t s;
+                if ((base->isImmAny() || !inLoop(base, loop)) &&
+                    (s = scaleOf(ins->operand(1 - side), loop)) != 0) {
+                    stride.put(ins, s * loop.step);
+                    start.put(ins, copyExpr(ins, copyOf, loop));
+                    break;
+                }
+            }
+        }
+
+        for (uint32_t j = 0; j < factor; j++) {
+            VMPI_memset(copyOf, 0, (back - head) * sizeof(LIns*));
+            for (uint32_t i = head + 1; i < back; i++) {
+                LIns* ins = insns[i];
+                if (i == loop.exit || ins->isop(LIR_comment) || stride.containsKey(ins))
+                    continue;
+                LIns* copy = copyIns(ins);
+                LIns* rebase = NULL;
+                int64_t disp = 0;
+                for (uint32_t k = 0, nops = ins->numOperands(); k < nops; k++) {
+                    LIns* v = ins->operand(k);
+                    if (!v || !inLoop(v, loop))
+                        continue;
+                    uint32_t p = _index.get(v) - head;
+                    if (stride.containsKey(v)) {
+                        // Use the address worked out before the copies,
+                        // moved on by this copy's share of the steps.
+                        int64_t delta = int64_t(j) * stride.get(v);
+                        disp = delta + ((ins->isLoad() || ins->isStore()) ? ins->disp() : 0);
+                        if (((ins->isLoad() && k == 0) || (ins->isStore() && k == 1)) &&
+                            disp == int16_t(disp)) {
+                            rebase = start.get(v);
+                            continue;
+                        }
+                        if (!copyOf[p])
+                            copyOf[p] = delta ? emit2(LIR_addp, start.get(v), emitImm(PTR_SIZE(false, true), delta))
+                                              : start.get(v);
+                    }
+                    NanoAssert(copyOf[p]);
+                    copy->setOperand(k, copyOf[p]);
+                }
+                if (rebase && ins->isLoad()) {
+                    copy->initLInsLd(ins->opcode(), rebase, int32_t(disp), ins->accSet(), ins->loadQual());
+                    copy->setLoadTainted(ins->isTainted());
+                } else if (rebase) {
+                    copy->initLInsSt(ins->opcode(), copy->oprnd1(), rebase, int32_t(disp), ins->accSet());
+                    copy->setStoreTainted(ins->isTainted());
+                }
+                emit(copy);
+                copyOf[i - head] = copy;
+            }
+        }
+        emit2(LIR_j, NULL, top);
+    }
+
+    // Copies 'ins', if it is in 'loop', and what it depends on in the loop,
+    // unless copyOf[] already has them.
+    LIns* UnrollFilter::copyExpr(LIns* ins, LIns** copyOf, const Loop& loop)
+    {
+        if (!inLoop(ins, loop))
+            return ins;
+        uint32_t p = _index.get(ins) - loop.head;
+        if (!copyOf[p]) {
+            LIns* copy = copyIns(ins);
+            for (uint32_t k = 0, nops = ins->numOperands(); k < nops; k++) {
+                if (ins->operand(k))
+                    copy->setOperand(k, copyExpr(ins->operand(k), copyOf, loop));
+            }
+            emit(copy);
+            copyOf[p] = copy;
         }
-        NanoAssert(ins->isop(op) && ins->oprnd1() == a);
-        return ins;
+        return copyOf[p];
     }
 
-    LIns* CseFilter::ins2(LOpcode op, LIns* a, LIns* b)
+    // Returns a copy of 'ins', not yet in the output, with the same operands.
+    LIns* UnrollFilter::copyIns(LIns* ins)
     {
-        LIns* ins;
-        NanoAssert(isCseOpcode(op));
-        uint32_t k;
-        ins = find2(op, a, b, k);
-        if (!ins) {
-            ins = out->ins2(op, a, b);
-            addNL(NL2, ins, k);
-        } else if (ins->isCmp()) {
-            if (knownCmpValues.containsKey(ins)) {
-                // We've seen this comparison before, and it was previously
-                // used in a guard, so we know what its value must be at this
-                // point.  Replace it with a constant.
-                NanoAssert(ins->isCmp());
-                bool cmpValue = knownCmpValues.get(ins);
-                return insImmI((cmpValue ? 1 : 0), /*tainted*/false);
-            }
+        LOpcode op = ins->opcode();
+        size_t size = insSizes[op];
+        char* mem = (char*)_alloc.alloc(size);
+        memcpy(mem, (char*)(ins + 1) - size, size);
+        LIns* copy = (LIns*)(mem + size) - 1;
+        if (ins->isCall()) {
+            // The arguments are in an array of their own.
+            uint32_t argc = ins->argc();
+            LIns** args = new (_alloc) LIns*[argc];
+            for (uint32_t k = 0; k < argc; k++)
+                args[k] = ins->arg(k);
+            copy->initLInsC(op, args, ins->callInfo());
         }
-        NanoAssert(ins->isop(op) && ins->oprnd1() == a && ins->oprnd2() == b);
-        return ins;
+        return copy;
     }
 
-    LIns* CseFilter::ins3(LOpcode op, LIns* a, LIns* b, LIns* c)
+    void UnrollFilter::emit(LIns* ins)
     {
-        NanoAssert(isCseOpcode(op));
-        uint32_t k;
-        LIns* ins = find3(op, a, b, c, k);
-        if (!ins) {
-            ins = out->ins3(op, a, b, c);
-            addNL(NL3, ins, k);
+        if (_next == _size) {
+            _size *= 2;
+            LIns** insns = new (_alloc) LIns*[_size];
+            memcpy(insns, _insns, _next * sizeof(LIns*));
+            _insns = insns;
         }
-        NanoAssert(ins->isop(op) && ins->oprnd1() == a && ins->oprnd2() == b && ins->oprnd3() == c);
+        _insns[_next++] = ins;
+    }
+
+    LIns* UnrollFilter::emit2(LOpcode op, LIns* a, LIns* b)
+    {
+        LIns* ins = (new (_alloc) LInsOp2())->getLIns();
+        ins->initLInsOp2(op, a, b);
+        emit(ins);
         return ins;
     }
 
-    LIns* CseFilter::ins4(LOpcode op, LIns* a, LIns* b, LIns* c, LIns* d)
+    LIns* UnrollFilter::emit3(LOpcode op, LIns* a, LIns* b, LIns* c)
     {
-        NanoAssert(isCseOpcode(op));
-        uint32_t k;
-        LIns* ins = find4(op, a, b, c, d, k);
-        if (!ins) {
-            ins = out->ins4(op, a, b, c, d);
-            addNL(NL4, ins, k);
-        }
-        NanoAssert(ins->isop(op) && ins->oprnd1() == a && ins->oprnd2() == b && ins->oprnd3() == c && ins->oprnd4() == d);
+        LIns* ins = (new (_alloc) LInsOp3())->getLIns();
+        ins->initLInsOp3(op, a, b, c);
+        emit(ins);
         return ins;
     }
-    
-    LIns* CseFilter::insLoad(LOpcode op, LIns* base, int32_t disp, AccSet accSet, LoadQual loadQual)
+
+    LIns* UnrollFilter::emitImm(bool quad, int64_t imm)
     {
         LIns* ins;
-        if (isS16(disp)) {
-            if (storesSinceLastLoad != ACCSET_NONE) {
-                // Clear all normal (excludes CONST and MULTIPLE) loads
-                // aliased by stores and calls since the last time we were in
-                // this function.  Aliased loads must be cleared even when CSE
-                // is suspended.
-                AccSet a = storesSinceLastLoad & ((1 << EMB_NUM_USED_ACCS) - 1);
-                while (a) {
-                    int acc = msbSet32(a);
-                    clearL((CseAcc)acc);
-                    a &= ~(1 << acc);
-                }
+#ifdef NANOJIT_64BIT
+        if (quad) {
+            ins = (new (_alloc) LInsQorD())->getLIns();
+            ins->initLInsQorD(LIR_immq, uint64_t(imm));
+            emit(ins);
+            return ins;
+        }
+#else
+        NanoAssert(!quad);
+#endif
+        ins = (new (_alloc) LInsIorF())->getLIns();
+        ins->initLInsIorF(LIR_immi, int32_t(imm));
+        emit(ins);
+        return ins;
+    }
 
-                // No need to clear CONST loads (those in the CSE_ACC_CONST table).
+    // Does control never fall through 'ins'?
+    static bool endsBlock(LIns* ins)
+    {
+        return ins->isUnConditionalBranch() || ins->isRet() || ins->isop(LIR_x);
+    }
 
-                // Multi-region loads must be treated conservatively -- we
-                // always clear all of them.
-                clearL(CSE_ACC_MULTIPLE);
+    // LIR_lives and comments that may follow the end of a block.
+    static bool isTrailer(LIns* ins)
+    {
+        return isLiveOpcode(ins->opcode()) || ins->isop(LIR_comment);
+    }
 
-                storesSinceLastLoad = ACCSET_NONE;
-            }
+    static bool isBranchHint(LIns* ins)
+    {
+        return ins->isop(LIR_likely) || ins->isop(LIR_unlikely);
+    }
 
-            if (loadQual == LOAD_VOLATILE) {
-                // Volatile loads are never CSE'd, don't bother looking for
-                // them or inserting them in the table.
-                ins = out->insLoad(op, base, disp, accSet, loadQual);
-            } else {
-                uint32_t k;
-                ins = findLoad(op, base, disp, compressAccSet(accSet), loadQual, k);
-                if (!ins) {
-                    ins = out->insLoad(op, base, disp, accSet, loadQual);
-                    addL(ins, k);
-                }
-            }
-            // Nb: must compare miniAccSets, not AccSets, because the AccSet
-            // stored in the load may have lost info if it's multi-region.
-            NanoAssert(ins->isop(op) && ins->oprnd1() == base && ins->disp() == disp &&
-                       ins->miniAccSet().val == compressAccSet(accSet).val &&
-                       ins->loadQual() == loadQual);
-        } else {
-            // If the displacement is more than 16 bits, put it in a separate
-            // instruction.  Nb: LirBufWriter also does this, we do it here
-            // too because CseFilter relies on LirBufWriter not changing code.
-            ins = insLoad(op, ins2(LIR_addp, base, insImmWord(disp)), 0, accSet, loadQual);
-        }
-        return ins;
+    ColdFilter::ColdFilter(LirFilter* in, Allocator& alloc)
+        : LirFilter(in), _alloc(alloc)
+    {
+        uint32_t n;
+        LIns** insns = readAll(alloc, n);
+        analyze(insns, n);
     }
 
-    LIns* CseFilter::insStore(LOpcode op, LIns* value, LIns* base, int32_t disp, AccSet accSet)
+    LIns* ColdFilter::read()
     {
-        LIns* ins;
-        if (isS16(disp)) {
-            storesSinceLastLoad |= accSet;
-            ins = out->insStore(op, value, base, disp, accSet);
-            NanoAssert(ins->isop(op) && ins->oprnd1() == value && ins->oprnd2() == base &&
-                       ins->disp() == disp && ins->accSet() == accSet);
-        } else {
-            // If the displacement is more than 16 bits, put it in a separate
-            // instruction.  Nb: LirBufWriter also does this, we do it here
-            // too because CseFilter relies on LirBufWriter not changing code.
-            ins = insStore(op, value, ins2(LIR_addp, base, insImmWord(disp)), 0, accSet);
-        }
-        return ins;
+        // Keep returning LIR_start once everything else has gone.
+        return _insns[_next > 1 ? --_next : 0];
     }
 
-    LIns* CseFilter::insGuard(LOpcode op, LIns* c, GuardRecord *gr)
+    void ColdFilter::analyze(LIns** insns, uint32_t n)
     {
-        // LIR_xt and LIR_xf guards are CSEable.  Note that we compare the
-        // opcode and condition when determining if two guards are equivalent
-        // -- in find1() and hash1() -- but we do *not* compare the
-        // GuardRecord.  This works because:
-        // - If guard 1 is taken (exits) then guard 2 is never reached, so
-        //   guard 2 can be removed.
-        // - If guard 1 is not taken then neither is guard 2, so guard 2 can
-        //   be removed.
-        //
-        // The underlying assumptions that are required for this to be safe:
-        // - There's never a path from the side exit of guard 1 back to guard
-        //   2;  for tree-shaped fragments this should be true.
-        // - GuardRecords do not contain information other than what is needed
-        //   to execute a successful exit.  That is currently true.
-        // - The CSE algorithm will always keep guard 1 and remove guard 2
-        //   (not vice versa).  The current algorithm does this.
-        //
-        LIns* ins;
-        if (isCseOpcode(op)) {
-            // conditional guard
-            uint32_t k;
-            ins = find1(op, c, k);
-            if (!ins) {
-                ins = out->insGuard(op, c, gr);
-                addNL(NL1, ins, k);
+        // Each hint adds at most a label and two jumps, and takes itself out.
+        HashMap<LIns*, uint32_t> index(_alloc, n / 4 + 16);
+        uint32_t* lastUse = new (_alloc) uint32_t[n];
+        uint32_t nhints = 0;
+        for (uint32_t i = 0; i < n; i++) {
+            LIns* ins = insns[i];
+            index.put(ins, i);
+            lastUse[i] = i;
+            if (isBranchHint(ins))
+                nhints++;
+            for (uint32_t k = 0, nops = ins->numOperands(); k < nops; k++) {
+                LIns* v = ins->operand(k);
+                if (v && index.containsKey(v))
+                    lastUse[index.get(v)] = i;
             }
-            // After this guard, we know that 'c's result was true (if
-            // op==LIR_xf) or false (if op==LIR_xt), else we would have
-            // exited.  Record this fact in case 'c' occurs again.
-            if (!suspended) {
-                bool c_value = (op == LIR_xt ? false : true);
-                knownCmpValues.put(c, c_value);
+        }
+        _insns = new (_alloc) LIns*[n + 3 * nhints + 1];
+        _next = 0;
+
+        // coldEnd[s] is one past the end of the cold block starting at s, or
+        // 0, and coldLabel[s] the label it is entered by.
+        bool* isCold = new (_alloc) bool[n];
+        uint32_t* coldEnd = new (_alloc) uint32_t[n];
+        LIns** coldLabel = new (_alloc) LIns*[n];
+        VMPI_memset(isCold, 0, n * sizeof(bool));
+        VMPI_memset(coldEnd, 0, n * sizeof(uint32_t));
+        HashMap<LIns*, LIns*> retarget(_alloc);    // likely branch -> label of the code it falls into
+
+        for (uint32_t i = 0; i + 2 < n; i++) {
+            LIns* br = insns[i];
+            LIns* hint = insns[i + 1];
+            if (!(br->isop(LIR_jt) || br->isop(LIR_jf)) || !isBranchHint(hint))
+                continue;
+            // Backward branches are left alone: the block would not be after
+            // the branch, and loops are usually entered again anyway.
+            LIns* target = br->getTarget();
+            if (!target || !index.containsKey(target) || index.get(target) <= i)
+                continue;
+
+            uint32_t start;
+            if (hint->isop(LIR_unlikely)) {
+                start = index.get(target);
+                uint32_t p = start;
+                while (p > 0 && isTrailer(insns[p - 1]))
+                    p--;
+                if (p == 0 || !endsBlock(insns[p - 1]))
+                    continue;
+            } else {
+                start = i + 2;
             }
-        } else {
-            ins = out->insGuard(op, c, gr);
+            uint32_t end = coldBlockEnd(insns, n, start, lastUse, isCold);
+            if (end == 0)
+                continue;
+
+            for (uint32_t k = start; k < end; k++)
+                isCold[k] = true;
+            coldEnd[start] = end;
+            if (insns[start]->isop(LIR_label)) {
+                coldLabel[start] = insns[start];
+            } else {
+                coldLabel[start] = (new (_alloc) LInsOp0())->getLIns();
+                coldLabel[start]->initLInsOp0(LIR_label);
+            }
+            if (hint->isop(LIR_likely))
+                retarget.put(br, coldLabel[start]);
         }
-        NanoAssert(ins->isop(op) && ins->oprnd1() == c);
-        return ins;
-    }
 
-    LIns* CseFilter::insGuardXov(LOpcode op, LIns* a, LIns* b, GuardRecord *gr)
-    {
-        // LIR_*xov are CSEable.  See CseFilter::insGuard() for details.
-        NanoAssert(isCseOpcode(op));
-        // conditional guard
-        uint32_t k;
-        LIns* ins = find2(op, a, b, k);
-        if (!ins) {
-            ins = out->insGuardXov(op, a, b, gr);
-            addNL(NL2, ins, k);
+        // The hot path, then the cold blocks.
+        for (uint32_t i = 0; i < n; i++) {
+            LIns* ins = insns[i];
+            if (isCold[i] || isBranchHint(ins))
+                continue;
+            if (retarget.containsKey(ins)) {
+                emitBranch(invertCondJmpOpcode(ins->opcode()), ins->oprnd1(), retarget.get(ins));
+                emitBranch(LIR_j, NULL, ins->getTarget());
+            } else {
+                emit(ins);
+            }
+        }
+        for (uint32_t s = 0; s < n; s++) {
+            if (!coldEnd[s])
+                continue;
+            if (coldLabel[s] != insns[s])
+                emit(coldLabel[s]);
+            for (uint32_t k = s; k < coldEnd[s]; k++) {
+                if (!isBranchHint(insns[k]))
+                    emit(insns[k]);
+            }
+            uint32_t last = coldEnd[s];
+            while (last > s && isTrailer(insns[last - 1]))
+                last--;
+            if (!endsBlock(insns[last - 1]))
+                emitBranch(LIR_j, NULL, insns[coldEnd[s]]);
         }
-        NanoAssert(ins->isop(op) && ins->oprnd1() == a && ins->oprnd2() == b);
-        return ins;
     }
 
-    // There is no CseFilter::insBranchJov(), as LIR_*jov* are not CSEable.
+    // Returns one past the end of the cold block starting at 'start', or 0 if
+    // it can't be moved.
+    uint32_t ColdFilter::coldBlockEnd(LIns** insns, uint32_t n, uint32_t start,
+                                      const uint32_t* lastUse, const bool* isCold)
+    {
+        uint32_t end = start;
+        do {
+            LIns* ins = insns[end];
+            if (isCold[end] || ins->isop(LIR_start) || ins->isParam() || ins->isop(LIR_allocp))
+                return 0;
+            end++;
+        } while (end < n && !endsBlock(insns[end - 1]) && !insns[end]->isop(LIR_label));
+        if (end == n && !endsBlock(insns[end - 1]))
+            return 0;
+        if (endsBlock(insns[end - 1])) {
+            while (end < n && isTrailer(insns[end]) && !isCold[end])
+                end++;
+        }
+        for (uint32_t k = start; k < end; k++) {
+            if (lastUse[k] >= end)
+                return 0;
+        }
+        return end;
+    }
 
-    LIns* CseFilter::insCall(const CallInfo *ci, LIns* args[])
+    void ColdFilter::emit(LIns* ins)
     {
-        LIns* ins;
-        uint32_t argc = ci->count_args();
-        if (ci->_isPure) {
-            NanoAssert(ci->_storeAccSet == ACCSET_NONE);
-            uint32_t k;
-            ins = findCall(ci, argc, args, k);
-            if (!ins) {
-                ins = out->insCall(ci, args);
-                addNL(NLCall, ins, k);
-            }
-        } else {
-            // We only need to worry about aliasing if !ci->_isPure.
-            storesSinceLastLoad |= ci->_storeAccSet;
-            ins = out->insCall(ci, args);
-        }
-        NanoAssert(ins->isCall() && ins->callInfo() == ci && argsmatch(ins, argc, args));
-        NanoAssert(!ins->isInReg());
-        return ins;
+        // A jump to the label straight after it is left out.
+        if (ins->isop(LIR_label) && _next > 0 && _insns[_next - 1]->isop(LIR_j) &&
+            _insns[_next - 1]->getTarget() == ins)
+            _next--;
+        _insns[_next++] = ins;
     }
 
-    LIns* CseFilter::insSwz(LIns* a, uint8_t mask) {
-        NanoAssert(isCseOpcode(LIR_swzf4));
-        // todo: add hashtable for swizzle ops.
-        return out->insSwz(a, mask);
+    LIns* ColdFilter::emitBranch(LOpcode op, LIns* cond, LIns* target)
+    {
+        LIns* ins = (new (_alloc) LInsOp2())->getLIns();
+        ins->initLInsOp2(op, cond, target);
+        emit(ins);
+        return ins;
     }
 
     // Interval analysis can be done much more accurately than we do here.
@@ -3868,6 +7748,18 @@ namespace nanojit
         case LIR_gef:
             return Interval(0, 1);
 
+#if NJ_BITOPS_SUPPORTED
+        case LIR_popcnti:
+        case LIR_lzcnti:
+        case LIR_tzcnti:
+            return Interval(0, 32);
+
+        case LIR_popcntq:
+        case LIR_lzcntq:
+        case LIR_tzcntq:
+            return Interval(0, 64);
+#endif
+
         CASE32(LIR_paramp:)
         case LIR_ldi:
         case LIR_noti:
@@ -3875,6 +7767,9 @@ namespace nanojit
         case LIR_ori:
         case LIR_xori:
         case LIR_lshi:
+        CASEBIT(LIR_bswapi:)
+        CASEBIT(LIR_roli:)
+        CASEBIT(LIR_rori:)
         CASE86(LIR_divi:)
         CASE86(LIR_divq:)
         case LIR_calli:
@@ -3883,6 +7778,8 @@ namespace nanojit
         case LIR_d2i:
         case LIR_f2i:
         CASE86(LIR_d2q:)
+        CASEFPX(LIR_d2ui:)
+        CASEFPX(LIR_f2ui:)
         CASESF(LIR_dlo2i:)
         CASESF(LIR_dhi2i:)
         CASESF(LIR_hcalli:)
@@ -4147,6 +8044,9 @@ namespace nanojit
 #endif
         case LTy_F:                     return "float";
         case LTy_F4:                    return "float4";
+        case LTy_F8:                    return "float8";
+        case LTy_D4:                    return "double4";
+        case LTy_I8:                    return "int8";
         case LTy_D:                     return "double";
         default:       NanoAssert(0);   return "???";
         }
@@ -4259,6 +8159,7 @@ namespace nanojit
         case LIR_ldf:
         case LIR_ldf4:
         CASE64(LIR_ldq:)
+        CASEAVX(LIR_ldf8:) CASEAVX(LIR_ldd4:) CASEAVX(LIR_ldi8:)
             break;
         default:
             NanoAssert(0);
@@ -4297,6 +8198,20 @@ namespace nanojit
             formals[0] = LTy_F4;
             break;
 
+#ifdef NANOJIT_X64
+        case LIR_stf8:
+            formals[0] = LTy_F8;
+            break;
+
+        case LIR_std4:
+            formals[0] = LTy_D4;
+            break;
+
+        case LIR_sti8:
+            formals[0] = LTy_I8;
+            break;
+#endif
+
         case LIR_std:
         case LIR_std2f:
             formals[0] = LTy_D;
@@ -4317,6 +8232,8 @@ namespace nanojit
         case LIR_start:
         case LIR_regfence:
         case LIR_label:
+        case LIR_likely:
+        case LIR_unlikely:
         case LIR_pushstate:
         case LIR_popstate:
         case LIR_memfence:
@@ -4347,6 +8264,10 @@ namespace nanojit
         case LIR_ui2f:
         case LIR_livei:
         case LIR_reti:
+        CASEBIT(LIR_popcnti:)
+        CASEBIT(LIR_lzcnti:)
+        CASEBIT(LIR_tzcnti:)
+        CASEBIT(LIR_bswapi:)
             formals[0] = LTy_I;
             break;
 
@@ -4360,8 +8281,15 @@ namespace nanojit
         case LIR_q2i:
         case LIR_qasd:
         case LIR_retq:
+        CASEFPX(LIR_q2f:)
+        CASEFPX(LIR_uq2d:)
+        CASEFPX(LIR_uq2f:)
         CASE86(LIR_negq:)
         CASE86(LIR_notq:)
+        CASEBIT(LIR_popcntq:)
+        CASEBIT(LIR_lzcntq:)
+        CASEBIT(LIR_tzcntq:)
+        CASEBIT(LIR_bswapq:)
         case LIR_liveq:
             formals[0] = LTy_Q;
             break;
@@ -4372,6 +8300,10 @@ namespace nanojit
             checkLInsHasOpcode(op, 1, a, LIR_divi);
             formals[0] = LTy_I;
             break;
+
+        case LIR_count:
+            formals[0] = LTy_P;
+            break;
         case LIR_modq:       // see LIRopcode.tbl for why 'mod' is unary
             checkLInsHasOpcode(op, 1, a, LIR_divq);
             formals[0] = LTy_Q;
@@ -4401,6 +8333,11 @@ namespace nanojit
         case LIR_d2f:
         CASE86(LIR_d2q:)
         CASE64(LIR_dasq:)
+        CASEFPX(LIR_floord:)
+        CASEFPX(LIR_ceild:)
+        CASEFPX(LIR_truncd:)
+        CASEFPX(LIR_roundd:)
+        CASEFPX(LIR_d2ui:)
             formals[0] = LTy_D;
             break;
 
@@ -4428,8 +8365,43 @@ namespace nanojit
         case LIR_f2i:
         case LIR_f2d:
         case LIR_f2f4:
+        CASEFPX(LIR_floorf:)
+        CASEFPX(LIR_ceilf:)
+        CASEFPX(LIR_truncf:)
+        CASEFPX(LIR_roundf:)
+        CASEFPX(LIR_f2ui:)
+        CASEFPX(LIR_f2q:)
             formals[0] = LTy_F;
             break;
+
+#ifdef NANOJIT_X64
+        case LIR_f2f8:
+            formals[0] = LTy_F;
+            break;
+
+        case LIR_d2d4:
+            formals[0] = LTy_D;
+            break;
+
+        case LIR_i2i8:
+            formals[0] = LTy_I;
+            break;
+
+        case LIR_livef8:
+        case LIR_f8x:
+            formals[0] = LTy_F8;
+            break;
+
+        case LIR_lived4:
+        case LIR_d4x:
+            formals[0] = LTy_D4;
+            break;
+
+        case LIR_livei8:
+        case LIR_i8x:
+            formals[0] = LTy_I8;
+            break;
+#endif
                 
         case LIR_file:
         case LIR_line:
@@ -4464,6 +8436,8 @@ namespace nanojit
         case LIR_lshi:
         case LIR_rshi:
         case LIR_rshui:
+        CASEBIT(LIR_roli:)
+        CASEBIT(LIR_rori:)
         case LIR_eqi:
         case LIR_lti:
         case LIR_gti:
@@ -4500,6 +8474,7 @@ namespace nanojit
         case LIR_leuq:
         case LIR_geuq:
         CASE86(LIR_mulq:)
+        CASE86(LIR_mulhq:)
         CASE86(LIR_divq:)
             formals[0] = LTy_Q;
             formals[1] = LTy_Q;
@@ -4508,6 +8483,8 @@ namespace nanojit
         case LIR_lshq:
         case LIR_rshq:
         case LIR_rshuq:
+        CASEBIT(LIR_rolq:)
+        CASEBIT(LIR_rorq:)
             formals[0] = LTy_Q;
             formals[1] = LTy_I;
             break;
@@ -4522,6 +8499,8 @@ namespace nanojit
         case LIR_ltd:
         case LIR_led:
         case LIR_ged:
+        CASEFPX(LIR_mind:)
+        CASEFPX(LIR_maxd:)
             formals[0] = LTy_D;
             formals[1] = LTy_D;
             break;
@@ -4535,6 +8514,8 @@ namespace nanojit
         case LIR_ltf:
         case LIR_lef:
         case LIR_gef:
+        case LIR_minf:
+        case LIR_maxf:
             formals[0] = LTy_F;
             formals[1] = LTy_F;
             break;
@@ -4558,6 +8539,46 @@ namespace nanojit
             formals[0] = LTy_F4;
             formals[1] = LTy_F4;
             break;
+
+#ifdef NANOJIT_X64
+        case LIR_addf8:
+        case LIR_subf8:
+        case LIR_mulf8:
+        case LIR_divf8:
+        case LIR_minf8:
+        case LIR_maxf8:
+        case LIR_cmpeqf8:
+        case LIR_cmpltf8:
+        case LIR_cmplef8:
+            formals[0] = LTy_F8;
+            formals[1] = LTy_F8;
+            break;
+
+        case LIR_addd4:
+        case LIR_subd4:
+        case LIR_muld4:
+        case LIR_divd4:
+        case LIR_mind4:
+        case LIR_maxd4:
+        case LIR_cmpeqd4:
+        case LIR_cmpltd4:
+        case LIR_cmpled4:
+            formals[0] = LTy_D4;
+            formals[1] = LTy_D4;
+            break;
+
+        case LIR_addi8:
+        case LIR_subi8:
+        case LIR_muli8:
+        case LIR_andi8:
+        case LIR_ori8:
+        case LIR_xori8:
+        case LIR_cmpeqi8:
+        case LIR_cmpgti8:
+            formals[0] = LTy_I8;
+            formals[1] = LTy_I8;
+            break;
+#endif
                 
         default:
             NanoAssert(0);
@@ -4607,6 +8628,34 @@ namespace nanojit
             formals[2] = LTy_F4;
             break;
 
+#ifdef NANOJIT_X64
+        case LIR_blendf8:
+            formals[0] = formals[1] = formals[2] = LTy_F8;
+            break;
+
+        case LIR_blendd4:
+            formals[0] = formals[1] = formals[2] = LTy_D4;
+            break;
+
+        case LIR_blendi8:
+            formals[0] = formals[1] = formals[2] = LTy_I8;
+            break;
+#endif
+
+#if NJ_FMA_SUPPORTED
+        case LIR_fmad:
+            formals[0] = formals[1] = formals[2] = LTy_D;
+            break;
+
+        case LIR_fmaf:
+            formals[0] = formals[1] = formals[2] = LTy_F;
+            break;
+
+        case LIR_fmaf4:
+            formals[0] = formals[1] = formals[2] = LTy_F4;
+            break;
+#endif
+
         default:
             NanoAssert(0);
         }
@@ -4626,9 +8675,11 @@ namespace nanojit
         return out->ins4(op, a, b, c, d);
     }
         
-    LIns* ValidateWriter::insParam(int32_t arg, int32_t kind)
+    LIns* ValidateWriter::insParam(int32_t arg, int32_t kind, LOpcode op)
     {
-        return out->insParam(arg, kind);
+        // Only args can be floating-point, saved registers are integers.
+        NanoAssert(repKinds[op] == LRK_P && (op == LIR_paramp || kind == 0));
+        return out->insParam(arg, kind, op);
     }
 
     LIns* ValidateWriter::insImmI(int32_t imm, bool tainted)
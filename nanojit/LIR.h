@@ -62,12 +62,12 @@ namespace nanojit
         LIR_cmovp   = PTR_SIZE(LIR_cmovi,   LIR_cmovq)
     };
 
-// Check that all opcodes are between 0 and 255.
+// Check that all opcodes are between 0 and 511.
 #define OP___(op, repKind, retType, isCse) \
-NanoStaticAssert(LIR_##op >= 0 && LIR_##op < 256);
+NanoStaticAssert(LIR_##op >= 0 && LIR_##op < 512);
 #include "LIRopcode.tbl"
 #undef OP___
-NanoStaticAssert(LIR_start == 0 && LIR_sentinel <= 256); // It's ok if LIR_sentinel is 256 since it's not actually used as opcode.
+NanoStaticAssert(LIR_start == 0 && LIR_sentinel <= 512); // It's ok if LIR_sentinel is 512 since it's not actually used as opcode.
     
     // 32-bit integer comparisons must be contiguous, as must 64-bit integer
     // comparisons and 64-bit float comparisons.
@@ -406,6 +406,9 @@ NanoStaticAssert(LIR_start == 0 && LIR_sentinel <= 256); // It's ok if LIR_senti
         return
 #if defined NANOJIT_64BIT
                op == LIR_liveq ||
+#endif
+#if defined NANOJIT_X64
+               op == LIR_livef8 || op == LIR_lived4 || op == LIR_livei8 ||
 #endif
                op == LIR_livef || op == LIR_livef4 ||
                op == LIR_livei || op == LIR_lived;
@@ -526,6 +529,9 @@ NanoStaticAssert(LIR_start == 0 && LIR_sentinel <= 256); // It's ok if LIR_senti
         LTy_D,  // double: 64-bit float
         LTy_F,  // float:  32-bit float
         LTy_F4, // float4:  128bit, four 32-bit floats
+        LTy_F8, // float8:  256bit, eight 32-bit floats
+        LTy_D4, // double4: 256bit, four 64-bit floats
+        LTy_I8, // int8:    256bit, eight 32-bit integers
 
         LTy_P  = PTR_SIZE(LTy_I, LTy_Q)   // word-sized integer
     };
@@ -670,9 +676,9 @@ NanoStaticAssert(LIR_start == 0 && LIR_sentinel <= 256); // It's ok if LIR_senti
         // tainted, and relies on the generator of the LIR code to set the the taint
         // status of each literal correctly when generating a LIR_immX instruction.
         //
-        // At present, the maximum mumber of stack frame slots is 8k (on SPARC,
-        // 4k on most platforms), so 13 bits should be enough for the arIndex.
-        // Since we don't support SPARC anymore, we could steal yet another bit.
+        // At present, the maximum mumber of stack frame slots is 4k (it was 8k
+        // on SPARC, which we don't support anymore), so 12 bits are enough for
+        // the arIndex.  The bit saved lets opcodes go beyond 255.
 
         struct SharedFields {
             uint32_t inReg:1;           // if 1, 'reg' is active
@@ -680,12 +686,12 @@ NanoStaticAssert(LIR_start == 0 && LIR_sentinel <= 256); // It's ok if LIR_senti
             uint32_t inAr:1;            // if 1, 'arIndex' is active
             uint32_t isResultLive:1;    // if 1, the instruction's result is live
             uint32_t isTainted:1;       // if 1, immX constant value is user-controlled
-            uint32_t arIndex:13;        // index into stack frame;  displ is -4*arIndex
+            uint32_t arIndex:12;        // index into stack frame;  displ is -4*arIndex
 
-            uint32_t opcode:8;          // instruction's opcode; actually a LOpcode - but since 
+            uint32_t opcode:9;          // instruction's opcode; actually a LOpcode - but since 
                                         // there is no reliable way to enforce an enum's 
                                         // underlying type to be unsigned on all compilers, we
-                                        // store it explicitly as uint8_t rather than LOpcode:8
+                                        // store it explicitly as uint32_t rather than LOpcode:9
         };
 
         union {
@@ -698,11 +704,11 @@ NanoStaticAssert(LIR_start == 0 && LIR_sentinel <= 256); // It's ok if LIR_senti
 
         inline void initSharedFields(LOpcode opcode)
         {
-            NanoAssert(((int)opcode)>=0 && opcode<=255);
+            NanoAssert(((int)opcode)>=0 && opcode<=511);
             // We must zero .inReg, .inAR and .isResultLive, but zeroing the
             // whole word is easier.  Then we set the opcode.
             wholeWord = 0;
-            sharedFields.opcode = (uint8_t)opcode;
+            sharedFields.opcode = (uint32_t)opcode;
         }
 
         // LIns-to-LInsXYZ converters.
@@ -739,7 +745,7 @@ NanoStaticAssert(LIR_start == 0 && LIR_sentinel <= 256); // It's ok if LIR_senti
         // Nb: args[] must be allocated and initialised before being passed in;
         // initLInsC() just copies the pointer into the LInsC.
         inline void initLInsC(LOpcode opcode, LIns** args, const CallInfo* ci);
-        inline void initLInsP(int32_t arg, int32_t kind);
+        inline void initLInsP(LOpcode opcode, int32_t arg, int32_t kind);
         inline void initLInsIorF(LOpcode opcode, int32_t immIorF);
         inline void initLInsQorD(LOpcode opcode, uint64_t immQorD);
         inline void initLInsJtbl(LIns* index, uint32_t size, LIns** table);
@@ -762,7 +768,7 @@ NanoStaticAssert(LIR_start == 0 && LIR_sentinel <= 256); // It's ok if LIR_senti
             return isV() ||
                    sharedFields.isResultLive ||
                    (isCall() && !callInfo()->_isPure) ||    // impure calls are always live
-                   isop(LIR_paramp);                        // LIR_paramp is always live
+                   isParam();                               // parameters are always live
         }
         void setResultLive() {
             NanoAssert(!isV());
@@ -877,6 +883,13 @@ NanoStaticAssert(LIR_start == 0 && LIR_sentinel <= 256); // It's ok if LIR_senti
         inline LIns*    oprnd3() const;
         inline LIns*    oprnd4() const;
 
+        // The values used by any instruction, ie. not including branch
+        // targets, guard records or comment strings.  operand(i) may be
+        // NULL, eg. for the condition of an unconditional jump.
+        inline uint32_t numOperands() const;
+        inline LIns*    operand(uint32_t i) const;
+        inline void     setOperand(uint32_t i, LIns* value);
+
         // For branches.
         inline LIns*    getTarget() const;
         inline void     setTarget(LIns* label);
@@ -1019,6 +1032,9 @@ NanoStaticAssert(LIR_start == 0 && LIR_sentinel <= 256); // It's ok if LIR_senti
         bool isCmp() const {
             return isCmpOpcode(opcode());
         }
+        bool isParam() const {
+            return isLInsP();
+        }
         bool isCall() const {
             return isop(LIR_callv) ||
                    isop(LIR_calli) ||
@@ -1148,6 +1164,19 @@ NanoStaticAssert(LIR_start == 0 && LIR_sentinel <= 256); // It's ok if LIR_senti
         bool isF4() const {
             return retType() == LTy_F4;
         }
+        bool isF8() const {
+            return retType() == LTy_F8;
+        }
+        bool isD4() const {
+            return retType() == LTy_D4;
+        }
+        bool isI8() const {
+            return retType() == LTy_I8;
+        }
+        // Is this a 256-bit (AVX) vector value?
+        bool isV256() const {
+            return isF8() || isD4() || isI8();
+        }
         bool isQorD() const {
             return
 #ifdef NANOJIT_64BIT
@@ -1358,7 +1387,7 @@ NanoStaticAssert(LIR_start == 0 && LIR_sentinel <= 256); // It's ok if LIR_senti
         LIns* getLIns() { return &ins; };
     };
 
-    // Used for LIR_paramp.
+    // Used for LIR_paramp, LIR_paramd, LIR_paramf and LIR_paramf4.
     class LInsP
     {
     private:
@@ -1538,8 +1567,8 @@ NanoStaticAssert(LIR_start == 0 && LIR_sentinel <= 256); // It's ok if LIR_senti
         toLInsC()->ci = ci;
         NanoAssert(isLInsC());
     }
-    void LIns::initLInsP(int32_t arg, int32_t kind) {
-        initSharedFields(LIR_paramp);
+    void LIns::initLInsP(LOpcode opcode, int32_t arg, int32_t kind) {
+        initSharedFields(opcode);
         NanoAssert(isU8(arg) && isU8(kind));
         toLInsP()->arg = arg;
         toLInsP()->kind = kind;
@@ -1679,8 +1708,8 @@ NanoStaticAssert(LIR_start == 0 && LIR_sentinel <= 256); // It's ok if LIR_senti
         return toLInsSk()->prevLIns;
     }
 
-    inline uint8_t LIns::paramArg()  const { NanoAssert(isop(LIR_paramp)); return toLInsP()->arg; }
-    inline uint8_t LIns::paramKind() const { NanoAssert(isop(LIR_paramp)); return toLInsP()->kind; }
+    inline uint8_t LIns::paramArg()  const { NanoAssert(isParam()); return toLInsP()->arg; }
+    inline uint8_t LIns::paramKind() const { NanoAssert(isParam()); return toLInsP()->kind; }
 
     inline int32_t LIns::immI()     const { NanoAssert(isImmI()); return toLInsIorF()->immIorF; }
     inline int32_t LIns::immFasI()  const { NanoAssert(isImmF()); return toLInsIorF()->immIorF; }
@@ -1753,6 +1782,47 @@ NanoStaticAssert(LIR_start == 0 && LIR_sentinel <= 256); // It's ok if LIR_senti
         return callInfo()->count_args();
     }
 
+    uint32_t LIns::numOperands() const {
+        switch (repKinds[opcode()]) {
+        case LRK_Op1:   return isop(LIR_comment) ? 0 : 1;
+        case LRK_Op1b:  return 1;
+        case LRK_Op2:   return (isGuard() || isBranch()) ? 1 : 2;
+        case LRK_Op3:   return (isGuard() || isJov()) ? 2 : 3;
+        case LRK_Op4:   return 4;
+        case LRK_Ld:    return 1;
+        case LRK_St:    return 2;
+        case LRK_C:     return argc();
+        case LRK_Jtbl:  return 1;
+        default:        return 0;
+        }
+    }
+
+    LIns* LIns::operand(uint32_t i) const {
+        NanoAssert(i < numOperands());
+        if (isCall())
+            return arg(i);
+        switch (i) {
+        case 0:     return oprnd1();
+        case 1:     return oprnd2();
+        case 2:     return oprnd3();
+        default:    return oprnd4();
+        }
+    }
+
+    void LIns::setOperand(uint32_t i, LIns* value) {
+        NanoAssert(i < numOperands());
+        if (isCall()) {
+            toLInsC()->args[i] = value;
+            return;
+        }
+        switch (i) {
+        case 0:     toLInsOp2()->oprnd_1 = value;   break;
+        case 1:     toLInsOp2()->oprnd_2 = value;   break;
+        case 2:     toLInsOp3()->oprnd_3 = value;   break;
+        default:    toLInsOp4()->oprnd_4 = value;   break;
+        }
+    }
+
     LIns* LIns::callArgN(uint32_t n) const
     {
         return arg(argc()-n-1);
@@ -1813,8 +1883,10 @@ NanoStaticAssert(LIR_start == 0 && LIR_sentinel <= 256); // It's ok if LIR_senti
         }
         // arg: 0=first, 1=second, ...
         // kind: 0=arg 1=saved-reg
-        virtual LIns* insParam(int32_t arg, int32_t kind) {
-            return out->insParam(arg, kind);
+        // op: LIR_paramp, or LIR_paramd/LIR_paramf/LIR_paramf4 for a floating-point arg
+        // (how those are numbered depends on the ABI, see asm_param())
+        virtual LIns* insParam(int32_t arg, int32_t kind, LOpcode op = LIR_paramp) {
+            return out->insParam(arg, kind, op);
         }
         virtual LIns* insImmI(int32_t imm, bool tainted) {
             return out->insImmI(imm, tainted);
@@ -2195,8 +2267,8 @@ NanoStaticAssert(LIR_start == 0 && LIR_sentinel <= 256); // It's ok if LIR_senti
         LIns* insCall(const CallInfo *call, LIns* args[]) {
             return add_flush(out->insCall(call, args));
         }
-        LIns* insParam(int32_t i, int32_t kind) {
-            return add(out->insParam(i, kind));
+        LIns* insParam(int32_t i, int32_t kind, LOpcode op = LIR_paramp) {
+            return add(out->insParam(i, kind, op));
         }
         LIns* insLoad(LOpcode v, LIns* base, int32_t disp, AccSet accSet, LoadQual loadQual) {
             return add(out->insLoad(v, base, disp, accSet, loadQual));
@@ -2238,8 +2310,14 @@ NanoStaticAssert(LIR_start == 0 && LIR_sentinel <= 256); // It's ok if LIR_senti
 
     class ExprFilter: public LirWriter
     {
+        // Whether a * b + c may be contracted into a fused multiply-add,
+        // which rounds once rather than twice and so can change results.
+        bool contractFma;
+
     public:
-        ExprFilter(LirWriter *out) : LirWriter(out) {}
+        ExprFilter(LirWriter *out, bool contractFma = false)
+            : LirWriter(out), contractFma(contractFma) {}
+        void setContractFma(bool enable) { contractFma = enable; }
         LIns* ins1(LOpcode v, LIns* a);
         LIns* ins2(LOpcode v, LIns* a, LIns* b);
         LIns* ins3(LOpcode v, LIns* a, LIns* b, LIns* c);
@@ -2255,6 +2333,8 @@ NanoStaticAssert(LIR_start == 0 && LIR_sentinel <= 256); // It's ok if LIR_senti
 
     class CseFilter: public LirWriter
     {
+        friend class GvnFilter;     // uses the hash functions
+
         enum NLKind {
             // We divide instruction kinds into groups.  LIns0 isn't present
             // because we don't need to record any 0-ary instructions.  Loads
@@ -2453,6 +2533,9 @@ NanoStaticAssert(LIR_start == 0 && LIR_sentinel <= 256); // It's ok if LIR_senti
 
             int32_t insCount();
 
+            // Returns the most recently written instruction.
+            LIns* lastIns();
+
             // stats
             struct
             {
@@ -2461,6 +2544,12 @@ NanoStaticAssert(LIR_start == 0 && LIR_sentinel <= 256); // It's ok if LIR_senti
             _stats;
 
             AbiKind abi;
+            // Set once any 256-bit vector value is written; the X64 backend
+            // then clears the upper YMM state before calls and returns.
+            bool usesV256;
+            // Set once a LIR_likely or LIR_unlikely is written; the Assembler
+            // then lays out the fragment with a ColdFilter.
+            bool hasBranchHints;
             LIns *state, *param1, *sp, *rp;
             LIns* savedRegs[NumSavedRegs+1]; // Allocate an extra element in case NumSavedRegs == 0
 
@@ -2498,7 +2587,7 @@ NanoStaticAssert(LIR_start == 0 && LIR_sentinel <= 256); // It's ok if LIR_senti
             LIns*   ins2(LOpcode op, LIns* o1, LIns* o2);
             LIns*   ins3(LOpcode op, LIns* o1, LIns* o2, LIns* o3);
             LIns*   ins4(LOpcode op, LIns* o1, LIns* o2, LIns* o3, LIns* o4);
-            LIns*   insParam(int32_t i, int32_t kind);
+            LIns*   insParam(int32_t i, int32_t kind, LOpcode op = LIR_paramp);
             LIns*   insImmI(int32_t imm, bool tainted);
             LIns*   insSafe(LOpcode op, void *payload);
 #ifdef NANOJIT_64BIT
@@ -2535,6 +2624,12 @@ NanoStaticAssert(LIR_start == 0 && LIR_sentinel <= 256); // It's ok if LIR_senti
         virtual LIns* finalIns() {
             return in->finalIns();
         }
+
+    protected:
+        // For filters that need to see the whole fragment before passing it
+        // on: reads everything 'in' has, up to and including the LIR_start,
+        // and returns it in buffer order, so the LIR_start comes first.
+        LIns** readAll(Allocator& alloc, uint32_t& n);
     };
 
     // concrete
@@ -2606,6 +2701,95 @@ NanoStaticAssert(LIR_start == 0 && LIR_sentinel <= 256); // It's ok if LIR_senti
 
     verbose_only(void live(LirFilter* in, Allocator& alloc, Fragment* frag, LogControl*);)
 
+    // Maps the CallInfos and GuardRecords embedded in LIR to and from the
+    // identifiers written by LirSerializer and read by LirLoader.  Calls are
+    // identified by name so that the LIR can be loaded into another process.
+    class LirSymbols
+    {
+    public:
+        virtual ~LirSymbols() {}
+
+        // Returns the name that identifies 'ci', or NULL if calls to it
+        // cannot be serialized.
+        virtual const char* callName(const CallInfo* ci) {
+            (void)ci;
+            return NULL;
+        }
+        // Returns the identifier written for the guard record 'gr'.
+        virtual uint32_t guardId(GuardRecord* gr) {
+            (void)gr;
+            return 0;
+        }
+        // Returns the CallInfo to use for a call to 'name'; 'desc' holds the
+        // type signature, ABI, purity and store set that were serialized, and
+        // a null address.  Returns NULL if the call cannot be bound.
+        virtual const CallInfo* lookupCall(const char* name, const CallInfo& desc) {
+            (void)name; (void)desc;
+            return NULL;
+        }
+        // Returns the guard record to use for a guard written with 'id'.
+        virtual GuardRecord* guardRecord(uint32_t id) = 0;
+    };
+
+    // A pass-through filter that records every instruction it reads and,
+    // once it has read the LIR_start, encodes them in a compact binary form
+    // that LirLoader can replay into a LirWriter pipeline.  Instructions are
+    // written in forward order, each with its operands as back references
+    // to earlier instructions, so the stream can be loaded in a single pass.
+    class LirSerializer : public LirFilter
+    {
+        Allocator& alloc;
+        LirSymbols& symbols;
+        LIns** insns;           // instructions read so far, last first
+        uint32_t nInsns;
+        uint32_t capInsns;
+        uint8_t* buf;
+        size_t bufSize;
+        size_t bufCap;
+        bool done;
+        bool ok;
+
+        void grow(size_t n);
+        void putByte(uint8_t b);
+        void putBytes(const void* p, size_t n);
+        void putU(uint64_t v);
+        void putS(int64_t v);
+        void putRef(HashMap<LIns*, uint32_t>& index, uint32_t cur, LIns* ins);
+        void putTarget(HashMap<LIns*, uint32_t>& index, uint32_t cur, LIns* label);
+        void encode();
+
+    public:
+        LirSerializer(LirFilter* in, Allocator& alloc, LirSymbols& symbols);
+        LIns* read();
+
+        // True once the LIR_start has been read and the stream encoded
+        // successfully.  Fails if the LIR holds safepoints or a call that
+        // LirSymbols cannot name.
+        bool succeeded() const { return done && ok; }
+        const uint8_t* data() const { return buf; }
+        size_t size() const { return bufSize; }
+    };
+
+    // Replays LIR encoded by LirSerializer into a LirWriter.  The first
+    // 'nbound' instructions of the stream (normally the LIR_start and the
+    // parameters) may be bound to instructions that were already written,
+    // instead of being written again.  The stream is checked for structural
+    // consistency but the instructions are not type checked; put a
+    // ValidateWriter in the pipeline if the source is not trusted.
+    class LirLoader
+    {
+        Allocator& alloc;
+        LirSymbols& symbols;
+
+    public:
+        LirLoader(Allocator& alloc, LirSymbols& symbols);
+
+        // Returns false if the stream is malformed or a call could not be
+        // bound, in which case only part of it may have been written.
+        bool load(const uint8_t* data, size_t size, LirWriter* out,
+                   LIns* const* bound = NULL, uint32_t nbound = 0);
+    };
+
     // WARNING: StackFilter assumes that all stack entries are eight bytes.
     // Some of its optimisations aren't valid if that isn't true.  See
     // StackFilter::read() for more details.
@@ -2621,6 +2805,314 @@ NanoStaticAssert(LIR_start == 0 && LIR_sentinel <= 256); // It's ok if LIR_senti
         LIns* read();
     };
 
+    // LoopLiveFilter inserts the LIR_live instructions that keep values alive
+    // around loops, so that front ends needn't write them.  At construction
+    // it computes, by dataflow over the blocks delimited by labels, the set
+    // of values live into each loop header (leaving out constants that can
+    // be rematerialized), and puts one LIR_live for each of them after every
+    // backward branch to the header; a pointer into a LIR_allocp area keeps
+    // the area alive as well.  Any LIR_live the front end already put there
+    // is dropped, except for LIR_allocp areas, as not all of their indirect
+    // uses are visible.  LIR_live instructions elsewhere are left alone but
+    // are not taken as uses.
+    class LoopLiveFilter : public LirFilter
+    {
+    public:
+        LoopLiveFilter(LirFilter* in, Allocator& alloc);
+        LIns* read();
+
+    private:
+        void analyze(LIns** insns, uint32_t n);
+        LIns* makeLive(LIns* value);
+
+        Allocator&                      _alloc;
+        LIns**                          _insns;     // the input, in buffer order
+        uint32_t                        _next;      // number of _insns not yet returned
+        HashMap<LIns*, Seq<LIns*>*>     _lives;     // backward branch -> LIR_lives then the branch
+        HashMap<LIns*, bool>            _dropped;   // front end LIR_lives replaced by ours
+        Seq<LIns*>*                     _pending;   // rest of the list being returned
+    };
+
+    // LicmFilter does loop-invariant code motion.  Loops are found from their
+    // backward branches: a loop runs from the LIR_label to the last branch
+    // back to it, and is only considered if it can be entered solely by
+    // falling into the label.  Working from the innermost loop out, pure
+    // instructions whose operands are all defined outside the loop are
+    // moved to just before the label.  Loads are moved too when nothing in
+    // the loop may store to what they read, going by their AccSet, the
+    // _storeAccSet of calls and, for LIR_allocp areas whose address is only
+    // used directly by loads and stores, their offsets.  Instructions that
+    // can fault (loads other than from such areas, and pure calls) are only
+    // moved if they precede every exit from the loop, as they must not run
+    // when the loop would not have run them; integer division never moves.
+    //
+    // The moved values are live around the loop, so LicmFilter must be
+    // followed by a LoopLiveFilter.
+    class LicmFilter : public LirFilter
+    {
+    public:
+        LicmFilter(LirFilter* in, Allocator& alloc);
+        LIns* read();
+
+    private:
+        void analyze(LIns** insns, uint32_t n);
+
+        Allocator&  _alloc;
+        LIns**      _insns;     // the output, in buffer order
+        uint32_t    _next;      // number of _insns not yet returned
+    };
+
+    // FlowGraph describes the control flow of a fragment, given as an array
+    // of its instructions in buffer order, for the filters that need more
+    // than a linear view of it.  A basic block starts at each label and after
+    // each branch; guards don't end blocks, as they leave the fragment.
+    class FlowGraph
+    {
+    public:
+        FlowGraph(Allocator& alloc, LIns** insns, uint32_t n);
+
+        // Does every path to block 'b' go through block 'a'?
+        bool dominates(uint32_t a, uint32_t b) const;
+
+        // Does instruction 'i' run before instruction 'j' on every path to
+        // 'j', and is there no way from 'i' to 'j' through code outside the
+        // buffer range between them, ie. through a backward branch?
+        bool reachesDirectly(uint32_t i, uint32_t j) const;
+
+        HashMap<LIns*, uint32_t>    index;      // instruction -> its position
+        uint32_t                    nblocks;
+        uint32_t*                   blockOf;    // position -> its block
+        Seq<uint32_t>**             succs;      // block -> its successors
+        bool*                       reachable;  // block -> can it run at all
+
+    private:
+        uint32_t*                   backFrom;   // see reachesDirectly()
+        uint64_t*                   dom;        // block -> blocks dominating it
+        uint32_t                    nwords;
+    };
+
+    // GvnFilter does global value numbering on the finished LIR, just before
+    // assembly.  Where CseFilter forgets everything at each LIR_label,
+    // GvnFilter works out which basic blocks dominate which, and replaces an
+    // instruction with an equal one, found using CseFilter's hash functions,
+    // whenever that one dominates it.  A load is only replaced if nothing
+    // that may store to what it reads lies between the two in the buffer
+    // and no backward branch can lead from one to the other.  Immediates are
+    // left to CseFilter, as they are rematerialized anyway, and so is
+    // integer division, as LIR_modi must stay with its LIR_divi.
+    //
+    // The operands of later instructions are changed in place, in the LIR
+    // buffer, and the replaced instructions are not passed on.  The values
+    // kept live longer may now be live around loops, so GvnFilter must be
+    // followed by a LoopLiveFilter.
+    class GvnFilter : public LirFilter
+    {
+    public:
+        GvnFilter(LirFilter* in, Allocator& alloc);
+        LIns* read();
+
+    private:
+        void analyze(LIns** insns, uint32_t n);
+        static uint32_t hash(LIns* ins);
+        static bool same(LIns* a, LIns* b);
+
+        Allocator&              _alloc;
+        LIns**                  _insns;     // the input, in buffer order
+        uint32_t                _next;      // number of _insns not yet returned
+        HashMap<LIns*, LIns*>   _replaced;  // replaced instruction -> its replacement
+    };
+
+    // MemFilter removes loads and stores across the whole fragment, just
+    // before assembly.  A load is replaced by the value of an earlier store
+    // to, or load from, the same address when that instruction dominates it,
+    // no backward branch can lead from one to the other, and nothing in
+    // between may store there.  Stores to LIR_allocp areas whose address is
+    // only used directly by loads and stores are dropped when, by backward
+    // dataflow over the basic blocks, no load can read them before they are
+    // overwritten or the fragment ends; other stores are only dropped when a
+    // later store in the same block overwrites them first.  Aliasing is
+    // judged by AccSet, except for such LIR_allocp areas, which nothing
+    // else can reach.
+    //
+    // An area all of whose loads are replaced has its stores dropped too,
+    // which leaves its values in registers; there being no phi nodes in LIR,
+    // this can't happen where different stores reach a load, eg. around a
+    // loop.  Like GvnFilter, MemFilter changes operands in place and must be
+    // followed by a LoopLiveFilter.
+    class MemFilter : public LirFilter
+    {
+    public:
+        MemFilter(LirFilter* in, Allocator& alloc);
+        LIns* read();
+
+        // How many loads were replaced, and how many stores removed.
+        uint32_t forwardedLoads() const { return _nForwarded; }
+        uint32_t removedStores() const  { return _nRemoved; }
+
+    private:
+        void forwardValues(LIns** insns, uint32_t n, FlowGraph& g,
+                           HashMap<LIns*, bool>& isPrivate);
+        void removeDeadStores(LIns** insns, uint32_t n, FlowGraph& g,
+                              HashMap<LIns*, bool>& isPrivate);
+
+        Allocator&              _alloc;
+        LIns**                  _insns;     // the input, in buffer order
+        uint32_t                _next;      // number of _insns not yet returned
+        HashMap<LIns*, LIns*>   _replaced;  // replaced load -> the value it reads
+        HashMap<LIns*, bool>    _dead;      // stores that are never read
+        uint32_t                _nForwarded;
+        uint32_t                _nRemoved;
+    };
+
+    // RangeFilter works out, just before assembly, the range of values each
+    // int and quad instruction can take, across the whole fragment; Interval
+    // below only looks at a few instructions around an overflow check.
+    // Ranges are propagated through arithmetic, masks and shifts, through the
+    // words of LIR_allocp areas whose address is only used directly by loads
+    // and stores, and are narrowed by the comparisons that branches and
+    // guards test.  The blocks are iterated to a fixed point, widening at
+    // loop headers so that induction variables, kept in such areas as LIR
+    // has no phi nodes, get bounded by their loop's exit test afterwards.
+    //
+    // With those ranges, overflow checks (xov and jov) that can't fire become
+    // plain arithmetic, branches and guards whose condition is known never to
+    // fire are dropped, eg. bounds tests, and sign extensions of a q2i whose
+    // operand fits in an int are replaced by the operand, as are q2i/i2q
+    // round trips.  The operands of later instructions are changed in place,
+    // so, like GvnFilter, RangeFilter must be followed by a LoopLiveFilter.
+    class RangeFilter : public LirFilter
+    {
+    public:
+        RangeFilter(LirFilter* in, Allocator& alloc);
+        LIns* read();
+
+    private:
+        void analyze(LIns** insns, uint32_t n);
+
+        Allocator&              _alloc;
+        LIns**                  _insns;     // the input, in buffer order
+        uint32_t                _next;      // number of _insns not yet returned
+        HashMap<LIns*, LIns*>   _replaced;  // dropped instruction -> the value replacing it
+        HashMap<LIns*, LIns*>   _rewritten; // instruction -> its unchecked version
+        HashMap<LIns*, bool>    _dead;      // branches and guards that never fire
+    };
+
+#if defined NANOJIT_IA32 || defined NANOJIT_X64
+    // DivFilter replaces integer divisions by constants, which take tens of
+    // cycles and tie up EAX/RAX and EDX/RDX, with shifts for powers of two
+    // and otherwise with a multiplication by a "magic" reciprocal and shifts;
+    // a quad division uses LIR_mulhq for the high half of its product.  This
+    // is only done on 64-bit platforms, except for powers of two.  The
+    // LIR_modi or LIR_modq of a replaced division becomes x - (x / c) * c.
+    // Division by 0 and -1 is left alone, so that it still faults.
+    class DivFilter : public LirFilter
+    {
+    public:
+        DivFilter(LirFilter* in, Allocator& alloc);
+        LIns* read();
+
+    private:
+        // The most instructions a division or modulus is replaced by.
+        static const uint32_t MAX_EXPANSION = 12;
+
+        static bool isDivOrMod(LIns* ins);
+        LIns* lowerDiv(LIns* div);
+        LIns* lowerMod(LIns* div, LIns* quotient);
+        LIns* emit1(LOpcode op, LIns* a);
+        LIns* emit2(LOpcode op, LIns* a, LIns* b);
+        LIns* emitImmI(int32_t imm);
+#ifdef NANOJIT_64BIT
+        LIns* emitImmQ(uint64_t imm);
+#endif
+
+        Allocator&  _alloc;
+        LIns**      _insns;     // the output, in buffer order
+        uint32_t    _next;      // number of _insns not yet returned
+    };
+#endif
+
+    // UnrollFilter unrolls counted loops, which LIR, having no phi nodes,
+    // can only express by keeping the induction variable in memory:
+    //
+    //   L:  i = ldi a[d]  ...  jf (lti i n) X  ...  sti (addi i c) a[d]  j L
+    //
+    // or with the test at the bottom, as a LIR_jt or LIR_jf back to L.  The
+    // area 'a' must be a LIR_allocp area only used directly by loads and
+    // stores, 'c' a constant and 'n' defined before the loop, and the loop
+    // must have no labels, guards or other branches in it.  A copy of the
+    // loop holding 'factor' copies of its body is put before it, tested once
+    // per trip to check that all of them would run; the original loop runs
+    // the remaining iterations.  Within the copy, addresses computed as
+    // base + i * stride are computed once per trip, and each copy of the
+    // body uses them at a constant displacement instead.
+    //
+    // The copy keeps values live around it, so UnrollFilter must be
+    // followed by a LoopLiveFilter.
+    class UnrollFilter : public LirFilter
+    {
+    public:
+        UnrollFilter(LirFilter* in, Allocator& alloc, uint32_t factor);
+        LIns* read();
+
+    private:
+        // The most instructions the copies of a body may add up to; larger
+        // loops get a lower factor.
+        static const uint32_t MAX_UNROLLED_SIZE = 400;
+
+        struct Loop;
+
+        void analyze(LIns** insns, uint32_t n);
+        bool inLoop(LIns* ins, const Loop& loop);
+        bool findLoop(LIns** insns, uint32_t head, uint32_t back, Loop& loop);
+        bool findInduction(LIns** insns, LIns* tested, LIns* bound, Loop& loop);
+        int64_t scaleOf(LIns* x, const Loop& loop);
+        void unroll(LIns** insns, Loop& loop);
+        LIns* copyExpr(LIns* ins, LIns** copyOf, const Loop& loop);
+        LIns* copyIns(LIns* ins);
+        void emit(LIns* ins);
+        LIns* emit2(LOpcode op, LIns* a, LIns* b);
+        LIns* emit3(LOpcode op, LIns* a, LIns* b, LIns* c);
+        LIns* emitImm(bool quad, int64_t imm);
+
+        Allocator&                  _alloc;
+        uint32_t                    _factor;
+        LIns**                      _insns;     // the output, in buffer order
+        uint32_t                    _next;      // number of _insns not yet returned
+        uint32_t                    _size;      // capacity of _insns
+        HashMap<LIns*, uint32_t>    _index;     // instruction -> its position in the input
+        HashMap<LIns*, bool>        _isPrivate; // LIR_allocp areas only used by loads and stores
+    };
+
+    // ColdFilter acts on the branch hints, LIR_likely and LIR_unlikely, that
+    // the front end puts after a LIR_jt or LIR_jf.  The rarely run side of a
+    // hinted branch -- its target if it is unlikely to be taken, else the
+    // code it falls into -- is moved to the end of the fragment, so that the
+    // hot path falls through the branch and stays together.  A cold block
+    // runs up to the next jump, return or exit, or up to the next label, in
+    // which case a jump to that label is added.  It is only moved if nothing
+    // else falls into it, it is after the branch, and no value it defines is
+    // used outside it.  The hints themselves are dropped.
+    //
+    // A moved block that rejoins the hot path does so with a backward branch,
+    // so ColdFilter must be followed by a LoopLiveFilter.
+    class ColdFilter : public LirFilter
+    {
+    public:
+        ColdFilter(LirFilter* in, Allocator& alloc);
+        LIns* read();
+
+    private:
+        void analyze(LIns** insns, uint32_t n);
+        uint32_t coldBlockEnd(LIns** insns, uint32_t n, uint32_t start,
+                              const uint32_t* lastUse, const bool* isCold);
+        void emit(LIns* ins);
+        LIns* emitBranch(LOpcode op, LIns* cond, LIns* target);
+
+        Allocator&  _alloc;
+        LIns**      _insns;     // the output, in buffer order
+        uint32_t    _next;      // number of _insns not yet returned
+    };
+
     // This type is used to perform a simple interval analysis of 32-bit
     // add/sub/mul.  It lets us avoid overflow checks in some cases.
     struct Interval
@@ -2765,7 +3257,7 @@ NanoStaticAssert(LIR_start == 0 && LIR_sentinel <= 256); // It's ok if LIR_senti
         LIns* ins2(LOpcode v, LIns* a, LIns* b);
         LIns* ins3(LOpcode v, LIns* a, LIns* b, LIns* c);
         LIns* ins4(LOpcode v, LIns* a, LIns* b, LIns* c, LIns* d);
-        LIns* insParam(int32_t arg, int32_t kind);
+        LIns* insParam(int32_t arg, int32_t kind, LOpcode op = LIR_paramp);
         LIns* insImmI(int32_t imm, bool tainted);
         LIns* insSafe(LOpcode op, void *payload);
 #ifdef NANOJIT_64BIT
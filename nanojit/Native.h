@@ -69,12 +69,46 @@
 #  define NJ_DIVI_SUPPORTED 0
 #endif
 
+#ifndef NJ_FMA_SUPPORTED
+#  define NJ_FMA_SUPPORTED 0
+#endif
+
+#ifndef NJ_BITOPS_SUPPORTED
+#  define NJ_BITOPS_SUPPORTED 0
+#endif
+
+#ifndef NJ_FPEXT_SUPPORTED
+#  define NJ_FPEXT_SUPPORTED 0
+#endif
+
+#ifndef NJ_RELOCATION_SUPPORTED
+#  define NJ_RELOCATION_SUPPORTED 0
+#endif
+
 #if NJ_SOFTFLOAT_SUPPORTED
     #define CASESF(x)   case x
 #else
     #define CASESF(x)
 #endif
 
+#if NJ_FMA_SUPPORTED
+    #define CASEFMA(x)  case x
+#else
+    #define CASEFMA(x)
+#endif
+
+#if NJ_BITOPS_SUPPORTED
+    #define CASEBIT(x)  case x
+#else
+    #define CASEBIT(x)
+#endif
+
+#if NJ_FPEXT_SUPPORTED
+    #define CASEFPX(x)  case x
+#else
+    #define CASEFPX(x)
+#endif
+
 namespace nanojit {
 
     class Fragment;
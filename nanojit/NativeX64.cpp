@@ -24,7 +24,6 @@ better code
 - disp64 branch/call
 - spill gp values to xmm registers?
 - prefer xmm registers for copies since gprs are in higher demand?
-- stack based LIR_paramp
 
 tracing
 - nFragExit
@@ -64,6 +63,11 @@ namespace nanojit
         "ah", "ch", "dh", "bh"
     };
 
+    const char *ymmRegNames[] = {
+        "ymm0", "ymm1", "ymm2",  "ymm3",  "ymm4",  "ymm5",  "ymm6",  "ymm7",
+        "ymm8", "ymm9", "ymm10", "ymm11", "ymm12", "ymm13", "ymm14", "ymm15"
+    };
+
     const char *gpRegNames16[] = {
         "ax",  "cx",  "dx",   "bx",   "spx",  "bpx",  "six",  "dix",
         "r8x", "r9x", "r10x", "r11x", "r12x", "r13x", "r14x", "r15x"
@@ -205,6 +209,8 @@ namespace nanojit
         underrunProtect(underrun); // must do this before calculating offset
         // Nb: at this point in time, _nIns points to the most recently
         // written instruction, ie. the jump's successor.
+        if (relocating())
+            _mdWriter->relocation(this, RELOC_CODE, (uint8_t*)_nIns, target, 0);
         ((uint64_t*)_nIns)[-1] = (uint64_t) target;
         _nIns -= 8;
         emit(op);
@@ -367,6 +373,52 @@ namespace nanojit
         emitrr(op, r, RZero);
     }
 
+    // VEX form: [C4/C5 prefix][opcode][modrm][sib][disp][imm8].  'r' goes in
+    // modrm.reg, 'v' in VEX.vvvv (XMM0 when unused) and 'b' in modrm.rm, or
+    // is the base register of [b+d] when 'mem' is set.  'l' selects 256-bit
+    // operands, and an 'imm8' >= 0 is appended.  The 2-byte C5 prefix is
+    // used when the opcode is in the 0F map and 'b' needs no REX.B bit.
+    void Assembler::emitvex(uint32_t op, bool l, Register r, Register v, Register b, bool mem,
+                            int32_t d, int imm8) {
+        uint8_t buf[16];
+        int n = 0;
+        int rn = REGNUM(r) & 15, vn = REGNUM(v) & 15, bn = REGNUM(b) & 15;
+        int map = (op >> 10) & 3, pp = (op >> 8) & 3, w = (op >> 12) & 1;
+        uint8_t vvvvlpp = uint8_t((~vn & 15) << 3 | (l ? 4 : 0) | pp);
+        if (map == 1 && bn < 8 && !w) {
+            buf[n++] = 0xC5;
+            buf[n++] = uint8_t((rn < 8 ? 0x80 : 0) | vvvvlpp);
+        } else {
+            buf[n++] = 0xC4;
+            buf[n++] = uint8_t((rn < 8 ? 0x80 : 0) | 0x40 | (bn < 8 ? 0x20 : 0) | map);
+            buf[n++] = uint8_t(w << 7 | vvvvlpp);
+        }
+        buf[n++] = uint8_t(op & 255);
+        if (!mem) {
+            buf[n++] = uint8_t(0xC0 | (rn & 7) << 3 | (bn & 7));
+        } else {
+            NanoAssert(IsGpReg(b));
+            // mode 00 with base == x101 means RIP+disp32, so use disp8 for RBP/R13
+            int mod = (d == 0 && (bn & 7) != 5) ? 0 : isS8(d) ? 1 : 2;
+            buf[n++] = uint8_t(mod << 6 | (rn & 7) << 3 | (bn & 7));
+            if ((bn & 7) == 4)
+                buf[n++] = 0x24;    // sib: no index, base = RSP/R12
+            if (mod == 1) {
+                buf[n++] = uint8_t(d);
+            } else if (mod == 2) {
+                for (int i = 0; i < 4; i++)
+                    buf[n++] = uint8_t(d >> (8*i));
+            }
+        }
+        if (imm8 >= 0)
+            buf[n++] = uint8_t(imm8);
+        underrunProtect(n);
+        _nIns -= n;
+        for (int i = 0; i < n; i++)
+            _nIns[i] = buf[i];
+        _nvprof("x64-bytes", n);
+    }
+
     // Succeeds if 'target' is within a signed 8-bit offset from the current
     // instruction's address.
     bool Assembler::isTargetWithinS8(NIns* target)
@@ -396,6 +448,7 @@ namespace nanojit
 #define RBhi(r)     gpRegNames8hi[(REGNUM(r))]
 #define RL(r)       gpRegNames32[(REGNUM(r))]
 #define RQ(r)       gpn(r)
+#define RY(r)       ymmRegNames[(REGNUM(r)&15)]
 
     typedef Register R;
     typedef int      I;
@@ -411,6 +464,7 @@ namespace nanojit
     void Assembler::NEGQ(R r)   { emitr(X64_negq, r); asm_output("negq %s", RQ(r)); }
     void Assembler::IDIV( R r)  { emitr(X64_idiv, r); asm_output("idivl edx:eax, %s",RL(r)); }
     void Assembler::IDIVQ(R r)  { emitr(X64_idivq, r); asm_output("idivq rdx:rax, %s", RQ(r)); }
+    void Assembler::IMULHQ(R r) { emitr(X64_imulhq, r); asm_output("imulq rdx:rax, %s", RQ(r)); }
 
 
     void Assembler::SHR( R r)   { emitr(X64_shr,  r); asm_output("shrl %s, ecx", RL(r)); }
@@ -427,6 +481,36 @@ namespace nanojit
     void Assembler::SARQI(R r, I i)   { emit8(rexrb(X64_sarqi | U64(REGNUM(r)&7)<<48, RZero, r), i); asm_output("sarq %s, %d", RQ(r), i); }
     void Assembler::SHLQI(R r, I i)   { emit8(rexrb(X64_shlqi | U64(REGNUM(r)&7)<<48, RZero, r), i); asm_output("shlq %s, %d", RQ(r), i); }
 
+    void Assembler::ROL( R r)   { emitr(X64_rol,  r); asm_output("roll %s, ecx", RL(r)); }
+    void Assembler::ROR( R r)   { emitr(X64_ror,  r); asm_output("rorl %s, ecx", RL(r)); }
+    void Assembler::ROLQ(R r)   { emitr(X64_rolq, r); asm_output("rolq %s, ecx", RQ(r)); }
+    void Assembler::RORQ(R r)   { emitr(X64_rorq, r); asm_output("rorq %s, ecx", RQ(r)); }
+
+    void Assembler::ROLI( R r, I i)   { emit8(rexrb(X64_roli  | U64(REGNUM(r)&7)<<48, RZero, r), i); asm_output("roll %s, %d", RL(r), i); }
+    void Assembler::RORI( R r, I i)   { emit8(rexrb(X64_rori  | U64(REGNUM(r)&7)<<48, RZero, r), i); asm_output("rorl %s, %d", RL(r), i); }
+    void Assembler::ROLQI(R r, I i)   { emit8(rexrb(X64_rolqi | U64(REGNUM(r)&7)<<48, RZero, r), i); asm_output("rolq %s, %d", RQ(r), i); }
+    void Assembler::RORQI(R r, I i)   { emit8(rexrb(X64_rorqi | U64(REGNUM(r)&7)<<48, RZero, r), i); asm_output("rorq %s, %d", RQ(r), i); }
+
+    void Assembler::SHLX( R d, R a, R n) { emitvxrr(X64_shlx,  d,n,a); asm_output("shlxl %s, %s, %s", RL(d),RL(a),RL(n)); }
+    void Assembler::SARX( R d, R a, R n) { emitvxrr(X64_sarx,  d,n,a); asm_output("sarxl %s, %s, %s", RL(d),RL(a),RL(n)); }
+    void Assembler::SHRX( R d, R a, R n) { emitvxrr(X64_shrx,  d,n,a); asm_output("shrxl %s, %s, %s", RL(d),RL(a),RL(n)); }
+    void Assembler::SHLXQ(R d, R a, R n) { emitvxrr(X64_shlxq, d,n,a); asm_output("shlxq %s, %s, %s", RQ(d),RQ(a),RQ(n)); }
+    void Assembler::SARXQ(R d, R a, R n) { emitvxrr(X64_sarxq, d,n,a); asm_output("sarxq %s, %s, %s", RQ(d),RQ(a),RQ(n)); }
+    void Assembler::SHRXQ(R d, R a, R n) { emitvxrr(X64_shrxq, d,n,a); asm_output("shrxq %s, %s, %s", RQ(d),RQ(a),RQ(n)); }
+
+    void Assembler::BSWAP( R r)        { emitr(X64_bswap,  r); asm_output("bswapl %s", RL(r)); }
+    void Assembler::BSWAPQ(R r)        { emitr(X64_bswapq, r); asm_output("bswapq %s", RQ(r)); }
+    void Assembler::BSF(    R l, R r)  { emitrr(X64_bsf,     l,r); asm_output("bsfl %s, %s",    RL(l),RL(r)); }
+    void Assembler::BSFQ(   R l, R r)  { emitrr(X64_bsfq,    l,r); asm_output("bsfq %s, %s",    RQ(l),RQ(r)); }
+    void Assembler::BSR(    R l, R r)  { emitrr(X64_bsr,     l,r); asm_output("bsrl %s, %s",    RL(l),RL(r)); }
+    void Assembler::BSRQ(   R l, R r)  { emitrr(X64_bsrq,    l,r); asm_output("bsrq %s, %s",    RQ(l),RQ(r)); }
+    void Assembler::POPCNT( R l, R r)  { emitprr(X64_popcnt, l,r); asm_output("popcntl %s, %s", RL(l),RL(r)); }
+    void Assembler::POPCNTQ(R l, R r)  { emitprr(X64_popcntq,l,r); asm_output("popcntq %s, %s", RQ(l),RQ(r)); }
+    void Assembler::LZCNT(  R l, R r)  { emitprr(X64_lzcnt,  l,r); asm_output("lzcntl %s, %s",  RL(l),RL(r)); }
+    void Assembler::LZCNTQ( R l, R r)  { emitprr(X64_lzcntq, l,r); asm_output("lzcntq %s, %s",  RQ(l),RQ(r)); }
+    void Assembler::TZCNT(  R l, R r)  { emitprr(X64_tzcnt,  l,r); asm_output("tzcntl %s, %s",  RL(l),RL(r)); }
+    void Assembler::TZCNTQ( R l, R r)  { emitprr(X64_tzcntq, l,r); asm_output("tzcntq %s, %s",  RQ(l),RQ(r)); }
+
     void Assembler::SETE( R r)  { emitr8(X64_sete, r); asm_output("sete %s", RB(r)); }
     void Assembler::SETL( R r)  { emitr8(X64_setl, r); asm_output("setl %s", RB(r)); }
     void Assembler::SETLE(R r)  { emitr8(X64_setle,r); asm_output("setle %s",RB(r)); }
@@ -457,9 +541,15 @@ namespace nanojit
     void Assembler::CMPQR(  R l, R r)   { emitrr(X64_cmpqr,  l,r); asm_output("cmpq %s, %s",  RQ(l),RQ(r)); }
     void Assembler::MOVQR(  R l, R r)   { emitrr(X64_movqr,  l,r); asm_output("movq %s, %s",  RQ(l),RQ(r)); }
     void Assembler::MOVAPSR(R l, R r)   { emitrr(X64_movapsr,l,r); asm_output("movaps %s, %s",RQ(l),RQ(r)); }
+    void Assembler::VMOVAPSR(R l, R r)  { emitvrr(X64_vmovapsr,l,XMM0,r); asm_output("vmovaps %s, %s",RY(l),RY(r)); }
+    void Assembler::VMOVAPSXR(R l, R r) { emitvex(X64_vmovapsr,false,l,XMM0,r,false,0,-1); asm_output("vmovaps %s, %s",RQ(l),RQ(r)); }
+    void Assembler::VMOVDXR(R l, R r)   { emitvex(X64_vmovdxr,false,l,XMM0,r,false,0,-1); asm_output("vmovd %s, %s",RQ(l),RL(r)); }
+    void Assembler::VMOVDRX(R l, R r)   { emitvex(X64_vmovdrx,false,r,XMM0,l,false,0,-1); asm_output("vmovd %s, %s",RL(l),RQ(r)); }
+    void Assembler::VZEROUPPER()        { emit(X64_vzeroupper); asm_output("vzeroupper"); }
     void Assembler::UNPCKLPS(R l, R r)  { emitrr(X64_unpcklps,l,r);asm_output("unpcklps %s, %s",RQ(l),RQ(r));}
 
     void Assembler::CMOVNO( R l, R r)   { emitrr(X64_cmovno, l,r); asm_output("cmovlno %s, %s",  RL(l),RL(r)); }
+    void Assembler::CMOVE(  R l, R r)   { emitrr(X64_cmove,  l,r); asm_output("cmovle %s, %s",   RL(l),RL(r)); }
     void Assembler::CMOVNE( R l, R r)   { emitrr(X64_cmovne, l,r); asm_output("cmovlne %s, %s",  RL(l),RL(r)); }
     void Assembler::CMOVNL( R l, R r)   { emitrr(X64_cmovnl, l,r); asm_output("cmovlnl %s, %s",  RL(l),RL(r)); }
     void Assembler::CMOVNLE(R l, R r)   { emitrr(X64_cmovnle,l,r); asm_output("cmovlnle %s, %s", RL(l),RL(r)); }
@@ -471,6 +561,7 @@ namespace nanojit
     void Assembler::CMOVNAE(R l, R r)   { emitrr(X64_cmovnae,l,r); asm_output("cmovlnae %s, %s", RL(l),RL(r)); }
 
     void Assembler::CMOVQNO( R l, R r)  { emitrr(X64_cmovqno, l,r); asm_output("cmovqno %s, %s",  RQ(l),RQ(r)); }
+    void Assembler::CMOVQE(  R l, R r)  { emitrr(X64_cmovqe,  l,r); asm_output("cmovqe %s, %s",   RQ(l),RQ(r)); }
     void Assembler::CMOVQNE( R l, R r)  { emitrr(X64_cmovqne, l,r); asm_output("cmovqne %s, %s",  RQ(l),RQ(r)); }
     void Assembler::CMOVQNL( R l, R r)  { emitrr(X64_cmovqnl, l,r); asm_output("cmovqnl %s, %s",  RQ(l),RQ(r)); }
     void Assembler::CMOVQNLE(R l, R r)  { emitrr(X64_cmovqnle,l,r); asm_output("cmovqnle %s, %s", RQ(l),RQ(r)); }
@@ -499,10 +590,30 @@ namespace nanojit
     void Assembler::MULSS(   R l, R r)  { emitprr(X64_mulss,   l,r); asm_output("mulss %s, %s",   RQ(l),RQ(r)); }
     void Assembler::ADDSS(   R l, R r)  { emitprr(X64_addss,   l,r); asm_output("addss %s, %s",   RQ(l),RQ(r)); }
     void Assembler::SUBSS(   R l, R r)  { emitprr(X64_subss,   l,r); asm_output("subss %s, %s",   RQ(l),RQ(r)); }
+    void Assembler::VDIVSD(R d, R a, R b) { emitvxrr(X64_vdivsd, d,a,b); asm_output("vdivsd %s, %s, %s", RQ(d),RQ(a),RQ(b)); }
+    void Assembler::VMULSD(R d, R a, R b) { emitvxrr(X64_vmulsd, d,a,b); asm_output("vmulsd %s, %s, %s", RQ(d),RQ(a),RQ(b)); }
+    void Assembler::VADDSD(R d, R a, R b) { emitvxrr(X64_vaddsd, d,a,b); asm_output("vaddsd %s, %s, %s", RQ(d),RQ(a),RQ(b)); }
+    void Assembler::VSUBSD(R d, R a, R b) { emitvxrr(X64_vsubsd, d,a,b); asm_output("vsubsd %s, %s, %s", RQ(d),RQ(a),RQ(b)); }
+    void Assembler::VDIVSS(R d, R a, R b) { emitvxrr(X64_vdivss, d,a,b); asm_output("vdivss %s, %s, %s", RQ(d),RQ(a),RQ(b)); }
+    void Assembler::VMULSS(R d, R a, R b) { emitvxrr(X64_vmulss, d,a,b); asm_output("vmulss %s, %s, %s", RQ(d),RQ(a),RQ(b)); }
+    void Assembler::VADDSS(R d, R a, R b) { emitvxrr(X64_vaddss, d,a,b); asm_output("vaddss %s, %s, %s", RQ(d),RQ(a),RQ(b)); }
+    void Assembler::VSUBSS(R d, R a, R b) { emitvxrr(X64_vsubss, d,a,b); asm_output("vsubss %s, %s, %s", RQ(d),RQ(a),RQ(b)); }
+    void Assembler::VFMADD231SD(R d, R a, R b) { emitvxrr(X64_vfmadd231sd, d,a,b); asm_output("vfmadd231sd %s, %s, %s", RQ(d),RQ(a),RQ(b)); }
+    void Assembler::VFMADD231SS(R d, R a, R b) { emitvxrr(X64_vfmadd231ss, d,a,b); asm_output("vfmadd231ss %s, %s, %s", RQ(d),RQ(a),RQ(b)); }
+    void Assembler::VFMADD231PS(R d, R a, R b) { emitvxrr(X64_vfmadd231ps, d,a,b); asm_output("vfmadd231ps %s, %s, %s", RQ(d),RQ(a),RQ(b)); }
     void Assembler::DIVPS(   R l, R r)  { emitrr(X64_divps,   l,r); asm_output("divps %s, %s",   RQ(l),RQ(r)); }
     void Assembler::MULPS(   R l, R r)  { emitrr(X64_mulps,   l,r); asm_output("mulps %s, %s",   RQ(l),RQ(r)); }
     void Assembler::ADDPS(   R l, R r)  { emitrr(X64_addps,   l,r); asm_output("addps %s, %s",   RQ(l),RQ(r)); }
     void Assembler::SUBPS(   R l, R r)  { emitrr(X64_subps,   l,r); asm_output("subps %s, %s",   RQ(l),RQ(r)); }
+    void Assembler::MINPS(   R l, R r)  { emitrr(X64_minps,   l,r); asm_output("minps %s, %s",   RQ(l),RQ(r)); }
+    void Assembler::MAXPS(   R l, R r)  { emitrr(X64_maxps,   l,r); asm_output("maxps %s, %s",   RQ(l),RQ(r)); }
+    void Assembler::ANDPS(   R l, R r)  { emitrr(X64_andps,   l,r); asm_output("andps %s, %s",   RQ(l),RQ(r)); }
+    void Assembler::SQRTPS(  R l, R r)  { emitrr(X64_sqrtps,  l,r); asm_output("sqrtps %s, %s",  RQ(l),RQ(r)); }
+    void Assembler::RCPPS(   R l, R r)  { emitrr(X64_rcpps,   l,r); asm_output("rcpps %s, %s",   RQ(l),RQ(r)); }
+    void Assembler::RSQRTPS( R l, R r)  { emitrr(X64_rsqrtps, l,r); asm_output("rsqrtps %s, %s", RQ(l),RQ(r)); }
+    void Assembler::SQRTSS(  R l, R r)  { emitprr(X64_sqrtss, l,r); asm_output("sqrtss %s, %s",  RQ(l),RQ(r)); }
+    void Assembler::RCPSS(   R l, R r)  { emitprr(X64_rcpss,  l,r); asm_output("rcpss %s, %s",   RQ(l),RQ(r)); }
+    void Assembler::RSQRTSS( R l, R r)  { emitprr(X64_rsqrtss,l,r); asm_output("rsqrtss %s, %s", RQ(l),RQ(r)); }
     void Assembler::CVTSQ2SD(R l, R r)  { emitprr(X64_cvtsq2sd,l,r); asm_output("cvtsq2sd %s, %s",RQ(l),RQ(r)); }
     void Assembler::CVTSQ2SS(R l, R r)  { emitprr(X64_cvtsq2ss,l,r); asm_output("cvtsq2ss %s, %s",RQ(l),RQ(r)); }
     void Assembler::CVTSI2SD(R l, R r)  { emitprr(X64_cvtsi2sd,l,r); asm_output("cvtsi2sd %s, %s",RQ(l),RL(r)); }
@@ -513,6 +624,16 @@ namespace nanojit
     void Assembler::CVTTSD2SQ(R l, R r)  { emitprr(X64_cvttsd2sq, l, r); asm_output("cvttsd2sq %s, %s", RQ(l), RQ(r)); }
     void Assembler::CVTTSS2SI(R l, R r) { emitprr(X64_cvttss2si,l,r);asm_output("cvttss2si %s, %s",RL(l),RQ(r));}
     void Assembler::CVTTSD2SI(R l, R r) { emitprr(X64_cvttsd2si,l,r);asm_output("cvttsd2si %s, %s",RL(l),RQ(r));}
+    void Assembler::CVTTSS2SQ(R l, R r) { emitprr(X64_cvttss2sq,l,r);asm_output("cvttss2sq %s, %s",RQ(l),RQ(r));}
+    void Assembler::MINSD(   R l, R r)  { emitprr(X64_minsd,  l,r); asm_output("minsd %s, %s",   RQ(l),RQ(r)); }
+    void Assembler::MAXSD(   R l, R r)  { emitprr(X64_maxsd,  l,r); asm_output("maxsd %s, %s",   RQ(l),RQ(r)); }
+    void Assembler::MINSS(   R l, R r)  { emitprr(X64_minss,  l,r); asm_output("minss %s, %s",   RQ(l),RQ(r)); }
+    void Assembler::MAXSS(   R l, R r)  { emitprr(X64_maxss,  l,r); asm_output("maxss %s, %s",   RQ(l),RQ(r)); }
+    void Assembler::ORPS(    R l, R r)  { emitrr(X64_orps,    l,r); asm_output("orps %s, %s",    RQ(l),RQ(r)); }
+    void Assembler::CMPSD(R l, R r, uint8_t pred) { emitprr_imm8(X64_cmpsd,l,r,pred); asm_output("cmpsd %s, %s, %d", RQ(l),RQ(r),pred); }
+    void Assembler::CMPSS(R l, R r, uint8_t pred) { emitprr_imm8(X64_cmpss,l,r,pred); asm_output("cmpss %s, %s, %d", RQ(l),RQ(r),pred); }
+    void Assembler::ROUNDSD(R l, R r, uint8_t mode) { emitprr_imm8(X64_roundsd,l,r,mode); asm_output("roundsd %s, %s, %d", RQ(l),RQ(r),mode); }
+    void Assembler::ROUNDSS(R l, R r, uint8_t mode) { emitprr_imm8(X64_roundss,l,r,mode); asm_output("roundss %s, %s, %d", RQ(l),RQ(r),mode); }
     void Assembler::UCOMISS( R l, R r)  { emitrr(X64_ucomiss, l,r);  asm_output("ucomiss %s, %s", RQ(l),RQ(r)); }
     void Assembler::UCOMISD( R l, R r)  { emitprr(X64_ucomisd, l,r); asm_output("ucomisd %s, %s", RQ(l),RQ(r)); }
     void Assembler::MOVQRX(  R l, R r)  { emitprr(X64_movqrx,  r,l); asm_output("movq %s, %s",    RQ(l),RQ(r)); } // Nb: r and l are deliberately reversed within the emitprr() call.
@@ -521,6 +642,7 @@ namespace nanojit
     void Assembler::MOVLHPS( R l, R r)  { emitrr(X64_movlhps, l,r);  asm_output("movlhps %s, %s", RQ(l),RQ(r)); }
     void Assembler::PMOVMSKB(R l, R r)  { emitprr(X64_pmovmskb,l,r); asm_output("pmovmskb %s, %s",RQ(l),RQ(r)); }
     void Assembler::CMPNEQPS(R l, R r)  { emitrr_imm8(X64_cmppsr,l,r,4); asm_output("cmpneqps %s, %s", RL(l),RL(r)); }
+    void Assembler::CMPPS(R l, R r, uint8_t pred) { emitrr_imm8(X64_cmppsr,l,r,pred); asm_output("cmpps %s, %s, %d", RQ(l),RQ(r),pred); }
 
     inline uint8_t PSHUFD_MASK(int x, int y, int z, int w) { 
         NanoAssert(x>=0 && x<=3);
@@ -604,6 +726,8 @@ namespace nanojit
     void Assembler::MOVUPSMR(R r, I d, R b)     { emitrm_wide(X64_movupsmr,r,d,b); asm_output("movups %d(%s), %s",d,RQ(b),RQ(r)); }
     void Assembler::MOVUPSRMRIP(R r, I d)       { emitrm_wide(X64_movupsrip,r,d,RZero); asm_output("movups %s, %d(rip)",RQ(r),d); }
     void Assembler::MOVAPSRM(R r, I d, R b)     { emitrm_wide(X64_movapsrm,r,d,b); asm_output("movaps %s, %d(%s)",RQ(r),d,RQ(b)); }
+    void Assembler::VMOVUPSRM(R r, I d, R b)    { emitvrm(X64_vmovupsrm,r,d,b); asm_output("vmovups %s, %d(%s)",RY(r),d,RQ(b)); }
+    void Assembler::VMOVUPSMR(R r, I d, R b)    { emitvrm(X64_vmovupsmr,r,d,b); asm_output("vmovups %d(%s), %s",d,RQ(b),RY(r)); }
     void Assembler::MOVAPSRMRIP(R r, I d)       { emitrm_wide(X64_movapsrip,r,d,RZero); asm_output("movaps %s, %d(rip)",RQ(r),d); }
     void Assembler::MOVSSSPR(R r, I d)          { 
                                                   uint64_t op = emit_disp32_sib(X64_movssspr,d); 
@@ -698,6 +822,8 @@ namespace nanojit
 
     void Assembler::XORPSA(R r, I32 i32)    { emitxm_abs(X64_xorpsa, r, i32); asm_output("xorps %s, (0x%x)",RQ(r), i32); }
     void Assembler::XORPSM(R r, NIns* a64)  { emitxm_rel(X64_xorpsm, r, a64); asm_output("xorps %s, (%p)",  RQ(r), a64); }
+    void Assembler::ANDPSA(R r, I32 i32)    { emitxm_abs(X64_andpsa, r, i32); asm_output("andps %s, (0x%x)",RQ(r), i32); }
+    void Assembler::ANDPSM(R r, NIns* a64)  { emitxm_rel(X64_andpsm, r, a64); asm_output("andps %s, (%p)",  RQ(r), a64); }
 
     void Assembler::X86_AND8R(R r)  { emit(X86_and8r | U64(REGNUM(r)<<3|(REGNUM(r)|4))<<56); asm_output("andb %s, %s", RB(r), RBhi(r)); }
     void Assembler::X86_SETNP(R r)  { emit(X86_setnp | U64(REGNUM(r)|4)<<56); asm_output("setnp %s", RBhi(r)); }
@@ -753,6 +879,13 @@ namespace nanojit
             asm_shift_imm(ins);
             return;
         }
+        // BMI2 has 3-operand shifts that take the count in any register.
+        // There are no BMI2 rotates by a register count.
+        if (_config.x64_bmi2 && !ins->isop(LIR_roli) && !ins->isop(LIR_rori) &&
+            !ins->isop(LIR_rolq) && !ins->isop(LIR_rorq)) {
+            asm_shiftx(ins);
+            return;
+        }
 
         Register rr, ra;
         if (a != b) {
@@ -779,6 +912,12 @@ namespace nanojit
         case LIR_rshui: SHR( rr);   break;
         case LIR_rshi:  SAR( rr);   break;
         case LIR_lshi:  SHL( rr);   break;
+#if NJ_BITOPS_SUPPORTED
+        case LIR_rolq:  ROLQ(rr);   break;
+        case LIR_rorq:  RORQ(rr);   break;
+        case LIR_roli:  ROL( rr);   break;
+        case LIR_rori:  ROR( rr);   break;
+#endif
         }
         if (rr != ra)
             MR(rr, ra);
@@ -786,6 +925,28 @@ namespace nanojit
         endOpRegs(ins, rr, ra);
     }
 
+    // Shift by a register count using the BMI2 SHLX/SARX/SHRX forms, which
+    // neither pin the count to RCX nor clobber the source or the flags.
+    void Assembler::asm_shiftx(LIns *ins) {
+        LIns *a = ins->oprnd1();
+        LIns *b = ins->oprnd2();
+        Register rr = prepareResultReg(ins, GpRegs);
+        Register ra, rb;
+        findRegFor2(GpRegs, a, ra, GpRegs, b, rb);
+
+        switch (ins->opcode()) {
+        default:
+            TODO(asm_shiftx);
+        case LIR_rshuq: SHRXQ(rr, ra, rb);  break;
+        case LIR_rshq:  SARXQ(rr, ra, rb);  break;
+        case LIR_lshq:  SHLXQ(rr, ra, rb);  break;
+        case LIR_rshui: SHRX( rr, ra, rb);  break;
+        case LIR_rshi:  SARX( rr, ra, rb);  break;
+        case LIR_lshi:  SHLX( rr, ra, rb);  break;
+        }
+        freeResourcesOf(ins);
+    }
+
     void Assembler::asm_shift_imm(LIns *ins) {
         Register rr, ra;
         beginOp1Regs(ins, GpRegs, rr, ra);
@@ -799,6 +960,12 @@ namespace nanojit
         case LIR_rshui: SHRI( rr, shift);   break;
         case LIR_rshi:  SARI( rr, shift);   break;
         case LIR_lshi:  SHLI( rr, shift);   break;
+#if NJ_BITOPS_SUPPORTED
+        case LIR_rolq:  ROLQI(rr, shift);   break;
+        case LIR_rorq:  RORQI(rr, shift);   break;
+        case LIR_roli:  ROLI( rr, shift);   break;
+        case LIR_rori:  RORI( rr, shift);   break;
+#endif
         }
         if (rr != ra)
             MR(rr, ra);
@@ -1001,6 +1168,30 @@ namespace nanojit
         }
     }
 
+    // Generates code for a LIR_mulhq, whose result is the high half of the
+    // product that the one-operand IMUL leaves in RDX:RAX.
+    void Assembler::asm_mulhq(LIns *ins) {
+        NanoAssert(ins->isop(LIR_mulhq));
+        LIns *a = ins->oprnd1();
+        LIns *b = ins->oprnd2();
+
+        evictIfActive(RAX);
+        prepareResultReg(ins, rmask(RDX));
+
+        Register rb = findRegFor(b, GpRegs & ~(rmask(RAX) | rmask(RDX)));
+        Register ra = a->isInReg() ? a->getReg() : RAX;
+
+        IMULHQ(rb);
+        if (RAX != ra)
+            MR(RAX, ra);
+
+        freeResourcesOf(ins);
+        if (!a->isInReg()) {
+            NanoAssert(ra == RAX);
+            findSpecificRegForUnallocated(a, RAX);
+        }
+    }
+
     // Generates code for a LIR_modi(LIR_divi(divL, divR)) sequence.
     void Assembler::asm_div_mod(LIns *mod) {
         LIns *div = mod->oprnd1();
@@ -1069,6 +1260,10 @@ namespace nanojit
         case LIR_lshi:  case LIR_lshq:
         case LIR_rshi:  case LIR_rshq:
         case LIR_rshui: case LIR_rshuq:
+#if NJ_BITOPS_SUPPORTED
+        case LIR_roli:  case LIR_rolq:
+        case LIR_rori:  case LIR_rorq:
+#endif
             asm_shift(ins);
             return;
         case LIR_modi:
@@ -1087,6 +1282,9 @@ namespace nanojit
             // asm_divq_modq() rather than here.
             asm_divq(ins);
             return;
+        case LIR_mulhq:
+            asm_mulhq(ins);
+            return;
         default:
             break;
         }
@@ -1138,7 +1336,71 @@ namespace nanojit
     }
 
     // Binary op with fp registers.
+    // Constant masks used by asm_fop() and asm_neg_abs().
+    static const AVMPLUS_ALIGN16(int64_t) negateMaskD[]  = { 0x8000000000000000LL, 0 };
+    static const AVMPLUS_ALIGN16(int32_t) negateMaskF[]  = { 0x80000000, 0, 0, 0 };
+    static const AVMPLUS_ALIGN16(int32_t) negateMaskF4[] = { 0x80000000, 0x80000000, 0x80000000, 0x80000000 };
+    static const AVMPLUS_ALIGN16(int64_t) absMaskD[]     = { 0x7FFFFFFFFFFFFFFFLL, 0x7FFFFFFFFFFFFFFFLL };
+    static const AVMPLUS_ALIGN16(int32_t) absMaskF4[]    = { 0x7FFFFFFF, 0x7FFFFFFF, 0x7FFFFFFF, 0x7FFFFFFF };
+    static const AVMPLUS_ALIGN16(int32_t) onesMaskF4[]   = { 0x3F800000, 0x3F800000, 0x3F800000, 0x3F800000 };
+    // Used by asm_round(): 1.0, -1.0, and the largest value below 0.5.
+    static const AVMPLUS_ALIGN16(int64_t) onesMaskD[]     = { 0x3FF0000000000000LL, 0 };
+    static const AVMPLUS_ALIGN16(int64_t) minusOneMaskD[] = { (int64_t)0xBFF0000000000000LL, 0 };
+    static const AVMPLUS_ALIGN16(int32_t) minusOneMaskF[] = { (int32_t)0xBF800000, 0, 0, 0 };
+    static const AVMPLUS_ALIGN16(int64_t) halfMaskD[]     = { 0x3FDFFFFFFFFFFFFFLL, 0 };
+    static const AVMPLUS_ALIGN16(int32_t) halfMaskF[]     = { 0x3EFFFFFF, 0, 0, 0 };
+
+    // Scalar double/float arithmetic using the AVX 3-operand forms.  The
+    // result isn't tied to the left operand, so there's no copy when both
+    // operands stay live, and an operand without a register can take the
+    // result's register since the sources are read before it is written.
+    void Assembler::asm_fop_vex(LIns *ins) {
+        LIns* a = ins->oprnd1();
+        LIns* b = ins->oprnd2();
+        Register rr = prepareResultReg(ins, FpRegs);
+        Register ra = a->isInReg() ? a->getReg() : rr;
+        Register rb;
+        if (a == b)
+            rb = ra;
+        else if (b->isInReg())
+            rb = b->getReg();
+        else if (ra == rr)
+            rb = findRegFor(b, FpRegs & ~rmask(rr));
+        else
+            rb = rr;
+
+        switch (ins->opcode()) {
+        default:        NanoAssert(!"bad opcode for asm_fop_vex");
+        case LIR_divd:  VDIVSD(rr, ra, rb); break;
+        case LIR_muld:  VMULSD(rr, ra, rb); break;
+        case LIR_addd:  VADDSD(rr, ra, rb); break;
+        case LIR_subd:  VSUBSD(rr, ra, rb); break;
+        case LIR_divf:  VDIVSS(rr, ra, rb); break;
+        case LIR_mulf:  VMULSS(rr, ra, rb); break;
+        case LIR_addf:  VADDSS(rr, ra, rb); break;
+        case LIR_subf:  VSUBSS(rr, ra, rb); break;
+        }
+
+        freeResourcesOf(ins);
+        if (!a->isInReg())
+            findSpecificRegForUnallocated(a, ra);
+        if (!b->isInReg())
+            findSpecificRegForUnallocated(b, rb);
+    }
+
     void Assembler::asm_fop(LIns *ins) {
+        switch (ins->opcode()) {
+        case LIR_divd: case LIR_muld: case LIR_addd: case LIR_subd:
+        case LIR_divf: case LIR_mulf: case LIR_addf: case LIR_subf:
+            if (_config.x64_avx) {
+                asm_fop_vex(ins);
+                return;
+            }
+            break;
+        default:
+            break;
+        }
+
         Register rr, ra, rb = UnspecifiedReg;   // init to shut GCC up
         beginOp2Regs(ins, FpRegs, rr, ra, rb);
         switch (ins->opcode()) {
@@ -1155,6 +1417,50 @@ namespace nanojit
         case LIR_mulf4: MULPS(rr, rb); break;
         case LIR_addf4: ADDPS(rr, rb); break;
         case LIR_subf4: SUBPS(rr, rb); break;
+        case LIR_minf4: MINPS(rr, rb); break;
+        case LIR_maxf4: MAXPS(rr, rb); break;
+        case LIR_minf:  MINSS(rr, rb); break;
+        case LIR_maxf:  MAXSS(rr, rb); break;
+#if NJ_FPEXT_SUPPORTED
+        case LIR_mind:  MINSD(rr, rb); break;
+        case LIR_maxd:  MAXSD(rr, rb); break;
+#endif
+        case LIR_cmpltf4: asm_fpmask(rr, rmask(ra)|rmask(rb), onesMaskF4, true, false); CMPPS(rr, rb, 1); break;
+        case LIR_cmplef4: asm_fpmask(rr, rmask(ra)|rmask(rb), onesMaskF4, true, false); CMPPS(rr, rb, 2); break;
+        case LIR_cmpeqf4: asm_fpmask(rr, rmask(ra)|rmask(rb), onesMaskF4, true, false); CMPPS(rr, rb, 0); break;
+        case LIR_cmpnef4: asm_fpmask(rr, rmask(ra)|rmask(rb), onesMaskF4, true, false); CMPPS(rr, rb, 4); break;
+        case LIR_cmpgtf4:
+        case LIR_cmpgef4: {
+            // There is no "gt", compare rb < ra (or rb <= ra) in a temporary
+            // and move the mask to rr.
+            Register rt = _allocator.allocTempReg(FpRegs & ~(rmask(ra)|rmask(rb)|rmask(rr)));
+            asm_fpmask(rr, rmask(ra)|rmask(rb)|rmask(rt), onesMaskF4, true, false);
+            asm_nongp_copy(rr, rt);
+            CMPPS(rt, ra, ins->isop(LIR_cmpgtf4) ? 1 : 2);
+            asm_nongp_copy(rt, rb);
+            break;
+        }
+        case LIR_dotf4:
+        case LIR_dotf3:
+        case LIR_dotf2: {
+            // DPPS needs SSE4.1, so multiply the components and add them up
+            // in the x component:
+            //   mulps  rr, rb
+            //   pshufd rt, rr, yyyy
+            //   addss  rr, rt
+            //   pshufd rt, rr, zzzz    (dotf3 and dotf4)
+            //   addss  rr, rt
+            //   pshufd rt, rr, wwww    (dotf4)
+            //   addss  rr, rt
+            int n = ins->isop(LIR_dotf4) ? 4 : ins->isop(LIR_dotf3) ? 3 : 2;
+            Register rt = _allocator.allocTempReg(FpRegs & ~(rmask(ra)|rmask(rb)|rmask(rr)));
+            for (int i = n - 1; i > 0; i--) {
+                ADDSS(rr, rt);
+                PSHUFD(rt, rr, PSHUFD_MASK(i, i, i, i));
+            }
+            MULPS(rr, rb);
+            break;
+        }
         }
         if (rr != ra) {
             asm_nongp_copy(rr, ra);
@@ -1163,6 +1469,54 @@ namespace nanojit
         endOpRegs(ins, rr, ra);
     }
 
+    // fma a, b, c = a * b + c.  With FMA3 this is
+    //   movaps      rr, rc      (unless c is already in rr)
+    //   vfmadd231sd rr, ra, rb
+    // and otherwise
+    //   movaps      rr, ra      (unless a is already in rr)
+    //   mulsd       rr, rb
+    //   addsd       rr, rc
+    // In both cases the operand that starts out in rr is the accumulator;
+    // the other two are read after rr is written, so they need registers of
+    // their own.
+    void Assembler::asm_fma(LIns *ins) {
+        LOpcode op = ins->opcode();
+        bool fused = _config.x64_fma;
+        LIns* acc = fused ? ins->oprnd3() : ins->oprnd1();
+        LIns* x   = fused ? ins->oprnd1() : ins->oprnd2();
+        LIns* y   = fused ? ins->oprnd2() : ins->oprnd3();
+
+        Register rr = prepareResultReg(ins, FpRegs);
+        Register rx = findRegFor(x, FpRegs & ~rmask(rr));
+        Register ry = x == y ? rx : findRegFor(y, FpRegs & ~(rmask(rr) | rmask(rx)));
+
+        if (fused) {
+            switch (op) {
+            default:         NanoAssert(!"bad opcode for asm_fma");
+            case LIR_fmad:   VFMADD231SD(rr, rx, ry); break;
+            case LIR_fmaf:   VFMADD231SS(rr, rx, ry); break;
+            case LIR_fmaf4:  VFMADD231PS(rr, rx, ry); break;
+            }
+        } else {
+            switch (op) {
+            default:         NanoAssert(!"bad opcode for asm_fma");
+            case LIR_fmad:   ADDSD(rr, ry); MULSD(rr, rx); break;
+            case LIR_fmaf:   ADDSS(rr, ry); MULSS(rr, rx); break;
+            case LIR_fmaf4:  ADDPS(rr, ry); MULPS(rr, rx); break;
+            }
+        }
+
+        freeResourcesOf(ins);
+        if (acc == x)
+            asm_nongp_copy(rr, rx);
+        else if (acc == y)
+            asm_nongp_copy(rr, ry);
+        else if (acc->isInReg())
+            asm_nongp_copy(rr, acc->getReg());
+        else
+            findSpecificRegForUnallocated(acc, rr);
+    }
+
     void Assembler::asm_neg_not(LIns *ins) {
         Register rr, ra;
         beginOp1Regs(ins, GpRegs, rr, ra);
@@ -1183,6 +1537,147 @@ namespace nanojit
         endOpRegs(ins, rr, ra);
     }
 
+#if NJ_BITOPS_SUPPORTED
+    // Without POPCNT, count bits with the usual shift-and-mask reduction into
+    // per-byte counts, summed by a multiply.  'quad' masks don't fit in an
+    // imm32, so they are loaded into a second temporary.
+    void Assembler::asm_popcnt_swar(Register rr, Register ra, bool quad) {
+        Register rt = _allocator.allocTempReg(GpRegs & ~(rmask(rr)|rmask(ra)));
+        if (quad) {
+            Register rm = _allocator.allocTempReg(GpRegs & ~(rmask(rr)|rmask(ra)|rmask(rt)));
+            SHRQI(rr, 56);
+            IMULQ(rr, rm);
+            MOVQI(rm, 0x0101010101010101ULL);
+            ANDQRR(rr, rm);
+            MOVQI(rm, 0x0F0F0F0F0F0F0F0FULL);
+            ADDQRR(rr, rt);
+            SHRQI(rt, 4);
+            MOVQR(rt, rr);
+            ADDQRR(rr, rt);
+            ANDQRR(rr, rm);
+            ANDQRR(rt, rm);
+            SHRQI(rt, 2);
+            MOVQR(rt, rr);
+            MOVQI(rm, 0x3333333333333333ULL);
+            SUBQRR(rr, rt);
+            ANDQRR(rt, rm);
+            MOVQI(rm, 0x5555555555555555ULL);
+            SHRQI(rt, 1);
+            MOVQR(rt, rr);
+            if (rr != ra)
+                MOVQR(rr, ra);
+        } else {
+            SHRI(rr, 24);
+            IMULI(rr, rr, 0x01010101);
+            ANDLRI(rr, 0x0F0F0F0F);
+            ADDRR(rr, rt);
+            SHRI(rt, 4);
+            MOVLR(rt, rr);
+            ADDRR(rr, rt);
+            ANDLRI(rr, 0x33333333);
+            ANDLRI(rt, 0x33333333);
+            SHRI(rt, 2);
+            MOVLR(rt, rr);
+            SUBRR(rr, rt);
+            ANDLRI(rt, 0x55555555);
+            SHRI(rt, 1);
+            MOVLR(rt, rr);
+            if (rr != ra)
+                MOVLR(rr, ra);
+        }
+    }
+
+    // Bit counts and byte swaps.  The counts use POPCNT, LZCNT and TZCNT
+    // when the CPU has them; otherwise lzcnt and tzcnt are built from
+    // BSR/BSF, with a CMOV supplying the operand width for a zero input.
+    void Assembler::asm_bitop(LIns *ins) {
+        LOpcode op = ins->opcode();
+        bool quad = op == LIR_popcntq || op == LIR_lzcntq || op == LIR_tzcntq || op == LIR_bswapq;
+        Register rr, ra;
+        beginOp1Regs(ins, GpRegs, rr, ra);
+
+        switch (op) {
+        default:
+            TODO(asm_bitop);
+        case LIR_bswapi:
+        case LIR_bswapq:
+            if (quad)
+                BSWAPQ(rr);
+            else
+                BSWAP(rr);
+            if (rr != ra)
+                MR(rr, ra);
+            break;
+
+        case LIR_popcnti:
+        case LIR_popcntq:
+            if (!_config.x64_popcnt) {
+                asm_popcnt_swar(rr, ra, quad);
+                break;
+            }
+            if (quad)
+                POPCNTQ(rr, ra);
+            else
+                POPCNT(rr, ra);
+            // The count instructions have a false dependency on their
+            // destination on some cores; clearing it first breaks that.
+            if (rr != ra)
+                XORRR(rr, rr);
+            break;
+
+        case LIR_lzcnti:
+        case LIR_lzcntq:
+            if (_config.x64_lzcnt) {
+                if (quad)
+                    LZCNTQ(rr, ra);
+                else
+                    LZCNT(rr, ra);
+                if (rr != ra)
+                    XORRR(rr, rr);
+            } else {
+                // lzcnt(x) = msb(x) ^ (width-1); a zero input gives
+                // (2*width-1) ^ (width-1) = width.
+                Register rt = _allocator.allocTempReg(GpRegs & ~(rmask(rr)|rmask(ra)));
+                if (quad) {
+                    XORQR8(rr, 63);
+                    CMOVQE(rr, rt);
+                    BSRQ(rr, ra);
+                } else {
+                    XORLR8(rr, 31);
+                    CMOVE(rr, rt);
+                    BSR(rr, ra);
+                }
+                MOVI(rt, quad ? 127 : 63);
+            }
+            break;
+
+        case LIR_tzcnti:
+        case LIR_tzcntq:
+            if (_config.x64_bmi1) {
+                if (quad)
+                    TZCNTQ(rr, ra);
+                else
+                    TZCNT(rr, ra);
+                if (rr != ra)
+                    XORRR(rr, rr);
+            } else {
+                Register rt = _allocator.allocTempReg(GpRegs & ~(rmask(rr)|rmask(ra)));
+                if (quad) {
+                    CMOVQE(rr, rt);
+                    BSFQ(rr, ra);
+                } else {
+                    CMOVE(rr, rt);
+                    BSF(rr, ra);
+                }
+                MOVI(rt, quad ? 64 : 32);
+            }
+            break;
+        }
+
+        endOpRegs(ins, rr, ra);
+    }
+#endif
+
     void Assembler::asm_call(LIns *ins) {
         if (!ins->isop(LIR_callv)) {
             Register rr = (ins->isop(LIR_calld) || ins->isop(LIR_callf) || ins->isop(LIR_callf4)) ? XMM0 : RAX;
@@ -1201,13 +1696,16 @@ namespace nanojit
                 outputf("        %p:", _nIns);
             )
             NIns *target = (NIns*)call->_address;
-            if (isTargetWithinS32(target)) {
+            if (!relocating() && isTargetWithinS32(target)) {
                 CALL(8, target);
             } else {
                 // can't reach target from here, load imm64 and do an indirect jump
                 CALLRAX();
-                asm_immq(RAX, (uint64_t)target, /*canClobberCCs*/true, /*blind*/false);
+                asm_immq_reloc(RAX, (uint64_t)target, RELOC_CALL, call, 0);
             }
+            // Avoid AVX/SSE transition stalls in the callee.
+            if (_thisfrag->lirbuf->usesV256)
+                VZEROUPPER();
             // Call this now so that the arg setup can involve 'rr'.
             freeResourcesOf(ins);
         } else {
@@ -1215,6 +1713,8 @@ namespace nanojit
             // used for regular arguments, and is otherwise scratch since it's
             // clobberred by the call.
             CALLRAX();
+            if (_thisfrag->lirbuf->usesV256)
+                VZEROUPPER();
             // Call this now so that the arg setup can involve 'rr'.
             freeResourcesOf(ins);
 
@@ -1275,11 +1775,11 @@ namespace nanojit
         if(p->isImmF4()){
             // No need to blind constant, as we load from pool.
             const float4_t* vaddr = findImmF4FromPool(p->immF4());
-            if( isTargetWithinS32((NIns*)vaddr) ) {
+            if( !relocating() && isTargetWithinS32((NIns*)vaddr) ) {
                 int32_t d = int32_t(int64_t(vaddr)-int64_t(_nIns));
                 LEARIP(r, d);
             } else {
-                MOVQI(r, (U64) vaddr);
+                asm_immq_reloc(r, (U64) vaddr, RELOC_DATA, vaddr, sizeof(float4_t));
             }
         } else {
             int d = findMemFor(p);
@@ -1482,6 +1982,181 @@ namespace nanojit
         freeResourcesOf(ins);
     }
 
+#if NJ_FPEXT_SUPPORTED
+    // Truncates the double (or float, if !quad) in ra to an integer value in
+    // rr, without SSE4.1:
+    //   movaps    rt, ra
+    //   andps     rt, sign
+    //   cvttsd2sq gt, ra
+    //   movaps    rr, ra           (unless ra == rr)
+    //   cmpq      gt, 1
+    //   jo        skip             (NaN, or |ra| >= 2^63 which is integral)
+    //   cvtsq2sd  rr, gt
+    //   orps      rr, rt           (-0.5 truncates to -0.0)
+    // skip:
+    void Assembler::asm_trunc_sse2(Register rr, Register ra, Register rt, Register gt, bool quad) {
+        underrunProtect(16);
+        NIns* skip = _nIns;
+        ORPS(rr, rt);
+        if (quad)
+            CVTSQ2SD(rr, gt);
+        else
+            CVTSQ2SS(rr, gt);
+        JO8(8, skip);
+        CMPQR8(gt, 1);
+        if (rr != ra)
+            MOVAPSR(rr, ra);
+        if (quad)
+            CVTTSD2SQ(gt, ra);
+        else
+            CVTTSS2SQ(gt, ra);
+        asm_fpmask(rt, rmask(rr)|rmask(ra), quad ? (const void*)negateMaskD : (const void*)negateMaskF,
+                   /*andMask*/true, quad);
+        MOVAPSR(rt, ra);
+    }
+
+    // floor, ceil and trunc are a single ROUNDSD with SSE4.1.  round (halfway
+    // cases away from zero) first adds the largest value below 0.5, with the
+    // sign of the operand, and truncates the sum.  Without SSE4.1 the value is
+    // truncated with asm_trunc_sse2() and floor and ceil are then fixed up by
+    // subtracting 1 (or -1) when the truncation went the wrong way:
+    //   movaps rt, ra             movaps rt, rr
+    //   cmpsd  rt, rr, lt         cmpsd  rt, ra, lt
+    //   andps  rt, 1.0            andps  rt, -1.0
+    //   subsd  rr, rt             subsd  rr, rt
+    // (subtracting rather than adding keeps the sign of a -0.0 result.)
+    void Assembler::asm_round(LIns *ins) {
+        LOpcode op = ins->opcode();
+        LIns *a = ins->oprnd1();
+        bool quad = ins->isD();
+        NanoAssert(a->isD() == quad);
+        bool isround = op == LIR_roundd || op == LIR_roundf;
+        bool sse41 = _config.i386_sse41;
+
+        Register rr = prepareResultReg(ins, FpRegs);
+        Register ra = findRegFor(a, FpRegs & ~rmask(rr));
+        Register rt = UnspecifiedReg, gt = UnspecifiedReg;
+        if (!sse41) {
+            rt = _allocator.allocTempReg(FpRegs & ~(rmask(rr)|rmask(ra)));
+            gt = _allocator.allocTempReg(GpRegs);
+        }
+        RegisterMask keep = rmask(rr)|rmask(ra);
+
+        uint8_t mode = 0x8 | 3;    // truncate, precision exception suppressed
+        switch (op) {
+        default:
+            NanoAssert(!"bad opcode for asm_round");
+        case LIR_truncd: case LIR_truncf:
+        case LIR_roundd: case LIR_roundf:
+            break;
+        case LIR_floord: case LIR_floorf:
+            mode = 0x8 | 1;
+            if (!sse41) {
+                if (quad) SUBSD(rr, rt); else SUBSS(rr, rt);
+                asm_fpmask(rt, keep, quad ? (const void*)onesMaskD : (const void*)onesMaskF4, /*andMask*/true, quad);
+                if (quad) CMPSD(rt, rr, 1); else CMPSS(rt, rr, 1);
+                MOVAPSR(rt, ra);
+            }
+            break;
+        case LIR_ceild: case LIR_ceilf:
+            mode = 0x8 | 2;
+            if (!sse41) {
+                if (quad) SUBSD(rr, rt); else SUBSS(rr, rt);
+                asm_fpmask(rt, keep, quad ? (const void*)minusOneMaskD : (const void*)minusOneMaskF, /*andMask*/true, quad);
+                if (quad) CMPSD(rt, ra, 1); else CMPSS(rt, ra, 1);
+                MOVAPSR(rt, rr);
+            }
+            break;
+        }
+
+        Register src = isround ? rr : ra;
+        if (sse41) {
+            if (quad) ROUNDSD(rr, src, mode); else ROUNDSS(rr, src, mode);
+        } else {
+            asm_trunc_sse2(rr, src, rt, gt, quad);
+        }
+
+        if (isround) {
+            //   movaps rr, ra
+            //   andps  rr, sign
+            //   xorps  rr, 0.49999...
+            //   addsd  rr, ra
+            if (quad) ADDSD(rr, ra); else ADDSS(rr, ra);
+            asm_fpmask(rr, keep, quad ? (const void*)halfMaskD : (const void*)halfMaskF, /*andMask*/false, quad);
+            asm_fpmask(rr, keep, quad ? (const void*)negateMaskD : (const void*)negateMaskF, /*andMask*/true, quad);
+            MOVAPSR(rr, ra);
+        }
+
+        freeResourcesOf(ins);
+    }
+
+    void Assembler::asm_fpconv(LIns *ins) {
+        LIns *a = ins->oprnd1();
+        LOpcode op = ins->opcode();
+
+        if (op == LIR_uq2d || op == LIR_uq2f) {
+            // Values with the top bit set are halved, keeping the low bit so
+            // the result still rounds correctly, converted and doubled:
+            //   xorps    rr, rr
+            //   movq     t1, ra
+            //   shrq     t1, 1
+            //   movq     t2, ra
+            //   andq     t2, 1
+            //   orq      t1, t2
+            //   cmpq     ra, 0
+            //   jl       big
+            //   cvtsq2sd rr, ra
+            //   jmp      done
+            // big:
+            //   cvtsq2sd rr, t1
+            //   addsd    rr, rr
+            // done:
+            bool quad = op == LIR_uq2d;
+            Register rr = prepareResultReg(ins, FpRegs);
+            Register ra = findRegFor(a, GpRegs);
+            Register t1, t2;
+            _allocator.allocTempReg2(GpRegs & ~rmask(ra), t1, GpRegs & ~rmask(ra), t2);
+
+            underrunProtect(24);
+            NIns* done = _nIns;
+            if (quad) ADDSD(rr, rr); else ADDSS(rr, rr);
+            if (quad) CVTSQ2SD(rr, t1); else CVTSQ2SS(rr, t1);
+            NIns* big = _nIns;
+            JMP8(8, done);
+            if (quad) CVTSQ2SD(rr, ra); else CVTSQ2SS(rr, ra);
+            JL8(8, big);
+            CMPQR8(ra, 0);
+            ORQRR(t1, t2);
+            ANDQR8(t2, 1);
+            MOVQR(t2, ra);
+            SHRQI(t1, 1);
+            MOVQR(t1, ra);
+            XORPS(rr);          // xorps xmmr,xmmr to break dependency chains
+            freeResourcesOf(ins);
+            return;
+        }
+
+        if (op == LIR_q2f) {
+            Register rr = prepareResultReg(ins, FpRegs);
+            Register ra = findRegFor(a, GpRegs);
+            CVTSQ2SS(rr, ra);   // cvtsq2ss xmmr, b  only writes xmm:0:32
+            XORPS(rr);          // xorps xmmr,xmmr to break dependency chains
+            freeResourcesOf(ins);
+            return;
+        }
+
+        // d2ui, f2ui and f2q: the 64-bit truncation covers the whole uint32
+        // range, so the unsigned conversions just use its low half.
+        Register rr = prepareResultReg(ins, GpRegs);
+        Register rb = findRegFor(a, FpRegs);
+        if (op == LIR_d2ui)
+            CVTTSD2SQ(rr, rb);
+        else
+            CVTTSS2SQ(rr, rb);
+        freeResourcesOf(ins);
+    }
+#endif
+
     void Assembler::asm_f2f4(LIns *ins) {
         LIns *a = ins->oprnd1();
         NanoAssert(ins->isF4() && a->isF());
@@ -2190,6 +2865,9 @@ namespace nanojit
             } else if (ins->isF4()) {
                 NanoAssert(IsFpReg(r));
                 MOVUPSRM(r, d, FP);
+            } else if (ins->isV256()) {
+                NanoAssert(IsFpReg(r));
+                VMOVUPSRM(r, d, FP);
             } else {
                 NanoAssert(ins->isI());
                 MOVLRM(r, d, FP);
@@ -2255,8 +2933,13 @@ namespace nanojit
             // gpr <- xmm: use movq r/m64, xmm (66 REX.W 0F 7E /r)
             MOVQRX(d, s);
         } else if (IsFpReg(d) && IsFpReg(s)) {
-            // xmm <- xmm: use movaps. movsd r,r causes partial register stall
-            MOVAPSR(d, s);
+            if (isV256Reg(d) || isV256Reg(s)) {
+                // ymm <- ymm: a 256-bit value must be copied whole
+                VMOVAPSR(d, s);
+            } else {
+                // xmm <- xmm: use movaps. movsd r,r causes partial register stall
+                MOVAPSR(d, s);
+            }
         } else {
             NanoAssert(IsFpReg(d) && !IsFpReg(s));
             // xmm <- gpr: use movq xmm, r/m64 (66 REX.W 0F 6E /r)
@@ -2391,13 +3074,13 @@ namespace nanojit
                     Hence - isTargetWithinS32 has to make room for 12 bytes (not 8), because
                     emit_disp32() makes room for displacement (4 bytes) + full-size op (8 bytes)
                 */
-                if( isTargetWithinS32((NIns*)vaddr, 12 ) ) {
+                if( !relocating() && isTargetWithinS32((NIns*)vaddr, 12 ) ) {
                     int32_t d = int32_t(int64_t(vaddr)-int64_t(_nIns));
                     is_aligned? MOVAPSRMRIP(r, d):MOVUPSRMRIP(r, d);
                 } else {
                     Register gp = _allocator.allocTempReg(GpRegs);
                     is_aligned? MOVAPSRM(r, 0, gp): MOVUPSRM(r,0,gp);
-                    asm_immq(gp, (uint64_t) vaddr, canClobberCCs, /*blind*/false);
+                    asm_immq_reloc(gp, (uint64_t) vaddr, RELOC_DATA, vaddr, sizeof(float4_t));
                 }
             }
         }
@@ -2415,6 +3098,162 @@ namespace nanojit
 		adjustBaseRegForBlinding(b, ob);
     }
 
+    void Assembler::asm_load256(LIns *ins) {
+        Register rr, rb, orb;
+        int32_t dr;
+        NanoAssert(ins->isV256());
+        if (!_config.x64_avx) {
+            setError(UnsupportedOpcode);
+            return;
+        }
+
+        beginLoadRegs(ins, FpRegs, rr, dr, rb, orb);
+        VMOVUPSRM(rr, dr, rb);
+        endLoadRegs(ins, rb, orb);
+    }
+
+    void Assembler::asm_store256(LOpcode op, LIns *value, int d, LIns *base, bool tainted) {
+        NanoAssert(value->isV256()); (void) op;
+        if (!_config.x64_avx) {
+            setError(UnsupportedOpcode);
+            return;
+        }
+
+        bool force = forceDisplacementBlinding(tainted);
+        Register ob;
+        Register r = findRegFor(value, FpRegs);
+        Register b = getBaseRegWithBlinding(base, d, BaseRegs, tainted, force, &ob);
+        VMOVUPSMR(r, d, b);
+        adjustBaseRegForBlinding(b, ob);
+    }
+
+    // Is 'r' holding a 256-bit vector value?  Used to widen register copies.
+    bool Assembler::isV256Reg(Register r) {
+        LIns* ins = _allocator.getActive(r);
+        return ins && ins->isV256();
+    }
+
+    // 256-bit vector operations.  Unlike the SSE forms these are all
+    // non-destructive 3-operand instructions, so the result doesn't have to
+    // share a register with the first operand.  They need AVX, and the
+    // broadcasts and integer arithmetic need AVX2; if the Config doesn't
+    // allow them the assembly fails instead.
+    void Assembler::asm_vec256(LIns *ins) {
+        LOpcode op = ins->opcode();
+        bool avx2 = ins->isop(LIR_f2f8) || ins->isop(LIR_d2d4) || ins->isop(LIR_i2i8) ||
+                    (ins->isI8() && !ins->isop(LIR_blendi8));
+        if (!_config.x64_avx || (avx2 && !_config.x64_avx2)) {
+            setError(UnsupportedOpcode);
+            return;
+        }
+
+        switch (op) {
+        case LIR_f8x:
+        case LIR_d4x: {
+            // The low element already is the scalar; copy the low 128 bits.
+            Register rr = prepareResultReg(ins, FpRegs);
+            Register ra = findRegFor(ins->oprnd1(), FpRegs);
+            VMOVAPSXR(rr, ra);
+            freeResourcesOf(ins);
+            return;
+        }
+        case LIR_i8x: {
+            Register rr = prepareResultReg(ins, GpRegs);
+            Register ra = findRegFor(ins->oprnd1(), FpRegs);
+            VMOVDRX(rr, ra);
+            freeResourcesOf(ins);
+            return;
+        }
+        case LIR_f2f8:
+        case LIR_d2d4:
+        case LIR_i2i8: {
+            Register rr = prepareResultReg(ins, FpRegs);
+            if (op == LIR_i2i8) {
+                Register ra = findRegFor(ins->oprnd1(), GpRegs);
+                emitvrr(X64_vpbroadcastd, rr, XMM0, rr);
+                asm_output("vpbroadcastd %s, %s", RY(rr), RQ(rr));
+                VMOVDXR(rr, ra);
+            } else {
+                Register ra = findRegFor(ins->oprnd1(), FpRegs);
+                bool f = op == LIR_f2f8;
+                emitvrr(f ? X64_vbroadcastss : X64_vbroadcastsd, rr, XMM0, ra);
+                asm_output("%s %s, %s", f ? "vbroadcastss" : "vbroadcastsd", RY(rr), RQ(ra));
+            }
+            freeResourcesOf(ins);
+            return;
+        }
+        case LIR_blendf8:
+        case LIR_blendd4:
+        case LIR_blendi8: {
+            // vblendv picks its 2nd source where the mask element's top bit
+            // is set, so blend(m, a, b) is vblendv(rr, b, a, m).  The integer
+            // form uses vblendvps too; it moves bits, not values.
+            LIns* m = ins->oprnd1();
+            LIns* a = ins->oprnd2();
+            LIns* b = ins->oprnd3();
+            Register rr = prepareResultReg(ins, FpRegs);
+            Register rm = findRegFor(m, FpRegs);
+            Register ra, rb;
+            findRegFor2(FpRegs & ~rmask(rm), a, ra, FpRegs & ~rmask(rm), b, rb);
+            bool pd = op == LIR_blendd4;
+            emitvrr_imm8(pd ? X64_vblendvpd : X64_vblendvps, rr, rb, ra, uint8_t((REGNUM(rm) & 15) << 4));
+            asm_output("%s %s, %s, %s, %s", pd ? "vblendvpd" : "vblendvps",
+                       RY(rr), RY(rb), RY(ra), RY(rm));
+            freeResourcesOf(ins);
+            return;
+        }
+        default:
+            break;
+        }
+
+        uint32_t vop;
+        int pred = -1;
+        const char* name;
+        switch (op) {
+        default: NanoAssert(!"bad opcode for asm_vec256"); return;
+        case LIR_addf8:   vop = X64_vaddps;   name = "vaddps";   break;
+        case LIR_subf8:   vop = X64_vsubps;   name = "vsubps";   break;
+        case LIR_mulf8:   vop = X64_vmulps;   name = "vmulps";   break;
+        case LIR_divf8:   vop = X64_vdivps;   name = "vdivps";   break;
+        case LIR_minf8:   vop = X64_vminps;   name = "vminps";   break;
+        case LIR_maxf8:   vop = X64_vmaxps;   name = "vmaxps";   break;
+        case LIR_cmpeqf8: vop = X64_vcmpps;   name = "vcmpeqps"; pred = 0; break;
+        case LIR_cmpltf8: vop = X64_vcmpps;   name = "vcmpltps"; pred = 1; break;
+        case LIR_cmplef8: vop = X64_vcmpps;   name = "vcmpleps"; pred = 2; break;
+        case LIR_addd4:   vop = X64_vaddpd;   name = "vaddpd";   break;
+        case LIR_subd4:   vop = X64_vsubpd;   name = "vsubpd";   break;
+        case LIR_muld4:   vop = X64_vmulpd;   name = "vmulpd";   break;
+        case LIR_divd4:   vop = X64_vdivpd;   name = "vdivpd";   break;
+        case LIR_mind4:   vop = X64_vminpd;   name = "vminpd";   break;
+        case LIR_maxd4:   vop = X64_vmaxpd;   name = "vmaxpd";   break;
+        case LIR_cmpeqd4: vop = X64_vcmppd;   name = "vcmpeqpd"; pred = 0; break;
+        case LIR_cmpltd4: vop = X64_vcmppd;   name = "vcmpltpd"; pred = 1; break;
+        case LIR_cmpled4: vop = X64_vcmppd;   name = "vcmplepd"; pred = 2; break;
+        case LIR_addi8:   vop = X64_vpaddd;   name = "vpaddd";   break;
+        case LIR_subi8:   vop = X64_vpsubd;   name = "vpsubd";   break;
+        case LIR_muli8:   vop = X64_vpmulld;  name = "vpmulld";  break;
+        case LIR_andi8:   vop = X64_vpand;    name = "vpand";    break;
+        case LIR_ori8:    vop = X64_vpor;     name = "vpor";     break;
+        case LIR_xori8:   vop = X64_vpxor;    name = "vpxor";    break;
+        case LIR_cmpeqi8: vop = X64_vpcmpeqd; name = "vpcmpeqd"; break;
+        case LIR_cmpgti8: vop = X64_vpcmpgtd; name = "vpcmpgtd"; break;
+        }
+
+        LIns* a = ins->oprnd1();
+        LIns* b = ins->oprnd2();
+        Register rr = prepareResultReg(ins, FpRegs);
+        Register ra, rb;
+        findRegFor2(FpRegs, a, ra, FpRegs, b, rb);
+        if (pred >= 0) {
+            emitvrr_imm8(vop, rr, ra, rb, uint8_t(pred));
+        } else {
+            emitvrr(vop, rr, ra, rb);
+        }
+        asm_output("%s %s, %s, %s", name, RY(rr), RY(ra), RY(rb));
+        (void) name;
+        freeResourcesOf(ins);
+    }
+
     void Assembler::asm_store64(LOpcode op, LIns *value, int d, LIns *base, bool tainted) {
         // This function also handles stf (store-float-32) because its more
         // convenient to do it here than asm_store32, which only handles GP registers.
@@ -2566,7 +3405,7 @@ namespace nanojit
             } else {
                 MOVQI32(r, int32_t(v));
             }
-        } else if (isTargetWithinS32((NIns*)v) && !(blind && shouldBlind(v))) {
+        } else if (!relocating() && isTargetWithinS32((NIns*)v) && !(blind && shouldBlind(v))) {
             // Value is within +/- 2GB from RIP, thus we can use LEA with RIP-relative disp32.
             // Don't use this pattern for blinded constants, as an attacker might know where
             // the code is loaded.
@@ -2586,6 +3425,19 @@ namespace nanojit
         }
     }
 
+    // Like asm_immq(), but 'v' is an address that must be reported to the
+    // MetaDataWriter when generating relocatable code.
+    void Assembler::asm_immq_reloc(Register r, uint64_t v, RelocKind kind, const void* target, size_t size) {
+        if (!relocating()) {
+            asm_immq(r, v, /*canClobberCCs*/true, /*blind*/false);
+            return;
+        }
+        underrunProtect(8+8);
+        NIns* end = _nIns;
+        MOVQI(r, v);
+        _mdWriter->relocation(this, kind, (uint8_t*)end, target, size);
+    }
+
     void Assembler::asm_immd(Register r, uint64_t v, bool canClobberCCs, bool blind) {
         NanoAssert(IsFpReg(r));
         if (v == 0 && canClobberCCs) {
@@ -2607,15 +3459,36 @@ namespace nanojit
         uint32_t a = ins->paramArg();
         uint32_t kind = ins->paramKind();
         if (kind == 0) {
-            // Ordinary param.  First four or six args always in registers for x86_64 ABI.
-            if (a < (uint32_t)NumArgRegs) {
+            // Ordinary param.  LIR_paramd/LIR_paramf/LIR_paramf4 are numbered
+            // among the XMM arg registers, LIR_paramp among the GP ones.
+            bool fp = !ins->isop(LIR_paramp);
+            uint32_t nregs = fp ? NumFpArgRegs : NumArgRegs;
+        #ifdef _WIN64
+            // Win64 passes float4 args by reference, see asm_call().
+            NanoAssert(!ins->isop(LIR_paramf4));
+        #endif
+            if (a < nregs) {
                 // incoming arg in register
-                prepareResultReg(ins, rmask(RegAlloc::argRegs[a]));
+                prepareResultReg(ins, rmask(fp ? XMM0 + a : RegAlloc::argRegs[a]));
                 // No code to generate.
             } else {
-                // todo: support stack based args, arg 0 is at [FP+off] where off
-                // is the # of regs to be pushed in genProlog()
-                TODO(asm_param_stk);
+                // Incoming arg is on the stack, above the return address and
+                // the caller's FP pushed by genPrologue().  Float4 args
+                // are passed by reference there, see asm_call().
+                NanoAssert(!ins->isop(LIR_paramf4));
+            #ifdef _WIN64
+                // Args are numbered by position, which counts the shadow area
+                int d = 16 + a * sizeof(void*);
+            #else
+                int d = 16 + (a - nregs) * sizeof(void*);
+            #endif
+                Register r = prepareResultReg(ins, fp ? FpRegs : GpRegs);
+                if (ins->isop(LIR_paramd))
+                    MOVSDRM(r, d, FP);
+                else if (ins->isop(LIR_paramf))
+                    MOVSSRM(r, d, FP);
+                else
+                    MOVQRM(r, d, FP);
             }
         }
         else {
@@ -2677,39 +3550,28 @@ namespace nanojit
          }
     }
 
-    static const AVMPLUS_ALIGN16(int64_t) negateMaskD[]  = { 0x8000000000000000LL, 0 };
-    static const AVMPLUS_ALIGN16(int32_t) negateMaskF[]  = { 0x80000000, 0, 0, 0 };
-    static const AVMPLUS_ALIGN16(int32_t) negateMaskF4[] = { 0x80000000, 0x80000000, 0x80000000, 0x80000000 };
-
-    void Assembler::asm_neg_abs(LIns *ins) {
-        Register rr, ra;
-        NanoAssert(ins->isop(LIR_negf) || ins->isop(LIR_negf4) || ins->isop(LIR_negd));
-        beginOp1Regs(ins, FpRegs, rr, ra);
-        uintptr_t mask;
-
-        switch (ins->opcode()) {
-        default: NanoAssert(!"bad opcode for asm_neg_abs"); mask = 0; break;
-        case LIR_negf:    mask = (uintptr_t) negateMaskF;  break;
-        case LIR_negf4:   mask = (uintptr_t) negateMaskF4; break;
-        case LIR_negd:    mask = (uintptr_t) negateMaskD;     break;
-        }
-
-        if (isS32(mask)) {
+    // Applies the 128-bit constant 'mask' to rr, with ANDPS if andMask is set
+    // and XORPS otherwise.  If the mask cannot be addressed from the code it is
+    // rebuilt in a temporary register (avoiding the registers in 'keep') from
+    // its first quad (if 'quad') or its first word copied to all 4 components.
+    void Assembler::asm_fpmask(Register rr, RegisterMask keep, const void* mask, bool andMask, bool quad) {
+        uintptr_t m = (uintptr_t) mask;
+        if (!relocating() && isS32(m)) {
             // builtin code is in bottom or top 2GB addr space, use absolute addressing
-            XORPSA(rr, (int32_t)mask);
-        } else if (isTargetWithinS32((NIns*)mask)) {
+            if (andMask) ANDPSA(rr, (int32_t)m); else XORPSA(rr, (int32_t)m);
+        } else if (!relocating() && isTargetWithinS32((NIns*)m)) {
             // jit code is within +/-2GB of builtin code, use rip-relative
-            XORPSM(rr, (NIns*)mask);
+            if (andMask) ANDPSM(rr, (NIns*)m); else XORPSM(rr, (NIns*)m);
         } else {
             // This is just hideous - can't use RIP-relative load, can't use
             // absolute-address load, and cant move imm64 const to XMM.
-            // Solution: move negateMaskD into a temp GP register, then copy to
+            // Solution: move the mask into a temp GP register, then copy to
             // a temp XMM register.
             // Nb: we don't want any F64 values to end up in a GpReg, nor any
             // I64 values to end up in an FpReg.
             //
             //   # 'gt' and 'ga' are temporary GpRegs.
-            //   # ins->oprnd1() is in 'rr' (FpRegs)
+            //   # the operand is in 'rr' (FpRegs)
             //   mov   gt, 0x8000000000000000
             //   mov   rt, gt
             //   xorps rr, rt
@@ -2717,28 +3579,55 @@ namespace nanojit
             // NOTE: we can use allocTempReg, since we allocate from different classes,
             // AND all the called functions (asm_immq, asm_immi) don't alloc/inspect the regstate
             // But this is arguably dangerous (some called function may change in the future), 
-            Register rt = _allocator.allocTempReg(FpRegs & ~(rmask(ra)|rmask(rr)));
+            Register rt = _allocator.allocTempReg(FpRegs & ~(keep | rmask(rr)));
             Register gt = _allocator.allocTempReg(GpRegs);
-            XORPS(rr, rt);
+            if (andMask) ANDPS(rr, rt); else XORPS(rr, rt);
 
-            if (ins->isop(LIR_negf) || ins->isop(LIR_negf4)) {
-                if (ins->isop(LIR_negf4))
-                    PSHUFD(rt,rt,PSHUFD_MASK(0, 0, 0, 0));    // copy mask in all 4 components of the float4 vector 
+            if (!quad) {
+                PSHUFD(rt,rt,PSHUFD_MASK(0, 0, 0, 0));    // copy mask in all 4 components of the float4 vector 
                 MOVDXR(rt, gt);
-                asm_immi(gt, negateMaskF[0], /*canClobberCCs*/true, /*blind*/false); 
+                asm_immi(gt, ((const int32_t*)mask)[0], /*canClobberCCs*/true, /*blind*/false); 
             } else {
-                // LIR_negd
                 MOVQXR(rt, gt);
-                asm_immq(gt, negateMaskD[0], /*canClobberCCs*/true, /*blind*/false);
+                asm_immq(gt, ((const int64_t*)mask)[0], /*canClobberCCs*/true, /*blind*/false);
             }
         }
+    }
+
+    void Assembler::asm_neg_abs(LIns *ins) {
+        Register rr, ra;
+        beginOp1Regs(ins, FpRegs, rr, ra);
+
+        switch (ins->opcode()) {
+        default: NanoAssert(!"bad opcode for asm_neg_abs"); break;
+        case LIR_negf:  asm_fpmask(rr, rmask(ra), negateMaskF,  /*andMask*/false, /*quad*/false); break;
+        case LIR_negf4: asm_fpmask(rr, rmask(ra), negateMaskF4, /*andMask*/false, /*quad*/false); break;
+        case LIR_negd:  asm_fpmask(rr, rmask(ra), negateMaskD,  /*andMask*/false, /*quad*/true);  break;
+        case LIR_absf:
+        case LIR_absf4: asm_fpmask(rr, rmask(ra), absMaskF4,    /*andMask*/true,  /*quad*/false); break;
+        case LIR_absd:  asm_fpmask(rr, rmask(ra), absMaskD,     /*andMask*/true,  /*quad*/true);  break;
+        }
+
         if (ra != rr)
             asm_nongp_copy(rr,ra);
         endOpRegs(ins, rr, ra);
     }
 
-    void Assembler::asm_recip_sqrt(LIns*) {
-        NanoAssert(!"not implemented");
+    void Assembler::asm_recip_sqrt(LIns *ins) {
+        Register rr, ra;
+        beginOp1Regs(ins, FpRegs, rr, ra);
+
+        switch (ins->opcode()) {
+        default: NanoAssert(!"bad opcode for asm_recip_sqrt"); break;
+        case LIR_recipf:  RCPSS  (rr, ra); break;
+        case LIR_recipf4: RCPPS  (rr, ra); break;
+        case LIR_rsqrtf:  RSQRTSS(rr, ra); break;
+        case LIR_rsqrtf4: RSQRTPS(rr, ra); break;
+        case LIR_sqrtf:   SQRTSS (rr, ra); break;
+        case LIR_sqrtf4:  SQRTPS (rr, ra); break;
+        }
+
+        endOpRegs(ins, rr, ra);
     }
 
     void Assembler::asm_spill(Register rr, int d, int8_t nWords) {
@@ -2750,7 +3639,7 @@ namespace nanojit
             else
                 MOVLMR(rr, d, FP);
         } else {
-            NanoAssert(nWords == 1 || nWords == 2 || nWords == 4);
+            NanoAssert(nWords == 1 || nWords == 2 || nWords == 4 || nWords == 8);
             switch (nWords) {
             default: NanoAssert(!"bad nWords");
             case 1:  // single-precision float: store 32bits from XMM to memory
@@ -2762,6 +3651,9 @@ namespace nanojit
             case 4:  // float4: store 128bits from XMM to memory
                 MOVUPSMR(rr, d, FP);
                 break;
+            case 8:  // float8/double4/int8: store 256bits from YMM to memory
+                VMOVUPSMR(rr, d, FP);
+                break;
             }
         }
     }
@@ -2833,6 +3725,9 @@ namespace nanojit
         // ret
         RET();
         POPR(RBP);
+        // Don't leave dirty upper YMM state behind for the caller's SSE code.
+        if (_thisfrag && _thisfrag->lirbuf && _thisfrag->lirbuf->usesV256)
+            VZEROUPPER();
         return _nIns;
     }
 
@@ -2880,6 +3775,7 @@ namespace nanojit
         // Generate jump to epilog and initialize lr.
         // If the guard already exists, use a simple jump.
         if (destKnown) {
+            NanoAssert(!relocating());
             JMP(frag->fragEntry);
             lr = 0;
         } else {  // target doesn't exist. Use 0 jump offset and patch later
@@ -2900,7 +3796,10 @@ namespace nanojit
         MR(RSP, RBP);
 
         // return value is GuardRecord*
-        asm_immq(RAX, uintptr_t(lr), /*canClobberCCs*/true, /*blind*/false);
+        if (lr)
+            asm_immq_reloc(RAX, uintptr_t(lr), RELOC_GUARD, lr, 0);
+        else
+            asm_immq(RAX, 0, /*canClobberCCs*/true, /*blind*/false);
     }
 
     const RegisterMask PREFER_SPECIAL = ~ ((RegisterMask)0);
@@ -2913,6 +3812,9 @@ namespace nanojit
         Hints[LIR_callf]  = rmask(XMM0);
         Hints[LIR_callf4] = rmask(XMM0);
         Hints[LIR_paramp] = PREFER_SPECIAL;
+        Hints[LIR_paramd] = PREFER_SPECIAL;
+        Hints[LIR_paramf] = PREFER_SPECIAL;
+        Hints[LIR_paramf4] = PREFER_SPECIAL;
         return true;
     }
 
@@ -2967,12 +3869,21 @@ namespace nanojit
 
         RegisterMask prefer = Hints[ins->opcode()];
 
+        if (prefer == 0 && _ranges) {
+            // Pre-colour by whether a call will clobber the value: callee-saved
+            // registers survive it, the others needn't be saved in the prologue.
+            return _ranges->crossesCall(ins) ? SavedRegs : ~SavedRegs;
+        }
+
         if (prefer != PREFER_SPECIAL)
           return prefer;
 
-        NanoAssert(ins->isop(LIR_paramp));
+        NanoAssert(ins->isParam());
         uint8_t arg = ins->paramArg();
-        if (ins->paramKind() == 0) {
+        if (!ins->isop(LIR_paramp)) {
+            if (arg < NumFpArgRegs)
+                prefer = rmask(XMM0 + arg);
+        } else if (ins->paramKind() == 0) {
             if (arg < maxArgRegs)
                 prefer = rmask(argRegs[arg]);
         } else {
@@ -2993,6 +3904,14 @@ namespace nanojit
     void Assembler::nativePageReset()
     {}
 
+    void Assembler::asm_count(LIns* ins)
+    {
+        int d = 0;
+        Register rb = getBaseReg(ins->oprnd1(), d, BaseRegs);
+        emitrm(X64_incqm, RZero, d, rb);
+        asm_output("incq %d(%s)", d, RQ(rb));
+    }
+
     // Increment the 32-bit profiling counter at pCtr, without
     // changing any registers.
     verbose_only(
@@ -3012,7 +3931,7 @@ namespace nanojit
 
     void Assembler::asm_jtbl(NIns** table, Register indexreg)
     {
-        if (isS32((intptr_t)table)) {
+        if (!relocating() && isS32((intptr_t)table)) {
             // table is in low 2GB or high 2GB, can use absolute addressing
             // jmpq [indexreg*8 + table]
             JMPX(indexreg, table);
@@ -3022,7 +3941,8 @@ namespace nanojit
             // jmp [indexreg*8 + tablereg]
             JMPXB(indexreg, tablereg);
             // tablereg <- #table
-            asm_immq(tablereg, (uint64_t)table, /*canClobberCCs*/true, /*blind*/false);
+            uint32_t count = relocating() ? _patches.get((NIns*)table)->getTableSize() : 0;
+            asm_immq_reloc(tablereg, (uint64_t)table, RELOC_JTBL, table, count * sizeof(NIns*));
         }
     }
 
@@ -35,10 +35,14 @@ namespace nanojit
 #define NJ_F2I_SUPPORTED                1
 #define NJ_SOFTFLOAT_SUPPORTED          0
 #define NJ_DIVI_SUPPORTED               1
+#define NJ_FMA_SUPPORTED                1
+#define NJ_BITOPS_SUPPORTED             1
+#define NJ_FPEXT_SUPPORTED              1
 #define RA_PREFERS_LSREG                1
 #define NJ_USES_IMMF4_POOL              1   // Note: doesn't use IMMD pool!
 #define NJ_SAFEPOINT_POLLING_SUPPORTED  1
 #define NJ_BLIND_CONSTANTS				1
+#define NJ_RELOCATION_SUPPORTED         1
 
 // exclude R12 because ESP and R12 cannot be used as an index
 // (index=100 in SIB means "none")
@@ -180,6 +184,7 @@ register number. The register bits are added by the code.
 		X64_cmovqno = 0xC0410F4800000004LL, // 64bit conditional mov if (no overflow) r = b
         X64_cmovqnae= 0xC0420F4800000004LL, // 64bit conditional mov if (uint <)  r = b
         X64_cmovqnb = 0xC0430F4800000004LL, // 64bit conditional mov if (uint >=) r = b
+        X64_cmovqe  = 0xC0440F4800000004LL, // 64bit conditional mov if (!c)      r = b
         X64_cmovqne = 0xC0450F4800000004LL, // 64bit conditional mov if (c)       r = b
         X64_cmovqna = 0xC0460F4800000004LL, // 64bit conditional mov if (uint <=) r = b
         X64_cmovqnbe= 0xC0470F4800000004LL, // 64bit conditional mov if (uint >)  r = b
@@ -190,6 +195,7 @@ register number. The register bits are added by the code.
         X64_cmovno  = 0xC0410F4000000004LL, // 32bit conditional mov if (no overflow) r = b
         X64_cmovnae = 0xC0420F4000000004LL, // 32bit conditional mov if (uint <)  r = b
         X64_cmovnb  = 0xC0430F4000000004LL, // 32bit conditional mov if (uint >=) r = b
+        X64_cmove   = 0xC0440F4000000004LL, // 32bit conditional mov if (!c)      r = b
         X64_cmovne  = 0xC0450F4000000004LL, // 32bit conditional mov if (c)       r = b
         X64_cmovna  = 0xC0460F4000000004LL, // 32bit conditional mov if (uint <=) r = b
         X64_cmovnbe = 0xC0470F4000000004LL, // 32bit conditional mov if (uint >)  r = b
@@ -225,6 +231,7 @@ register number. The register bits are added by the code.
         X64_addps   = 0xC0580F4000000004LL, // add float4 vector single-precision r[i] += b[i]
         X64_idiv    = 0xF8F7400000000003LL, // 32bit signed div (rax = rdx:rax/r, rdx=rdx:rax%r)
         X64_idivq   = 0xF8F7480000000003LL, // 64bit signed div (rax = rdx:rax/r, rdx=rdx:rax%r)
+        X64_imulhq  = 0xE8F7480000000003LL, // 64bit signed mul (rdx:rax = rax * r)
         X64_imul    = 0xC0AF0F4000000004LL, // 32bit signed mul r *= b
         X64_imulq   = 0xC0AF0F4800000004LL, // 64bit signed mul r *= b
         X64_imuli   = 0xC069400000000003LL, // 32bit signed mul r = b * immI
@@ -346,6 +353,26 @@ register number. The register bits are added by the code.
         X64_sarqi   = 0x00F8C14800000004LL, // 64bit int right shift r >>= imm8
         X64_shri    = 0x00E8C14000000004LL, // 32bit uint right shift r >>= imm8
         X64_shrqi   = 0x00E8C14800000004LL, // 64bit uint right shift r >>= imm8
+        X64_rol     = 0xC0D3400000000003LL, // 32bit rotate left r <<<= rcx
+        X64_rolq    = 0xC0D3480000000003LL, // 64bit rotate left r <<<= rcx
+        X64_ror     = 0xC8D3400000000003LL, // 32bit rotate right r >>>= rcx
+        X64_rorq    = 0xC8D3480000000003LL, // 64bit rotate right r >>>= rcx
+        X64_roli    = 0x00C0C14000000004LL, // 32bit rotate left r <<<= imm8
+        X64_rolqi   = 0x00C0C14800000004LL, // 64bit rotate left r <<<= imm8
+        X64_rori    = 0x00C8C14000000004LL, // 32bit rotate right r >>>= imm8
+        X64_rorqi   = 0x00C8C14800000004LL, // 64bit rotate right r >>>= imm8
+        X64_bsf     = 0xC0BC0F4000000004LL, // 32bit bit scan forward r = lsb(b), ZF if b == 0
+        X64_bsfq    = 0xC0BC0F4800000004LL, // 64bit bit scan forward r = lsb(b), ZF if b == 0
+        X64_bsr     = 0xC0BD0F4000000004LL, // 32bit bit scan reverse r = msb(b), ZF if b == 0
+        X64_bsrq    = 0xC0BD0F4800000004LL, // 64bit bit scan reverse r = msb(b), ZF if b == 0
+        X64_bswap   = 0xC80F400000000003LL, // 32bit byte swap r = bswap(r)
+        X64_bswapq  = 0xC80F480000000003LL, // 64bit byte swap r = bswap(r)
+        X64_popcnt  = 0xC0B80F40F3000005LL, // 32bit population count r = popcnt(b) (POPCNT)
+        X64_popcntq = 0xC0B80F48F3000005LL, // 64bit population count r = popcnt(b) (POPCNT)
+        X64_lzcnt   = 0xC0BD0F40F3000005LL, // 32bit leading zero count r = lzcnt(b) (LZCNT)
+        X64_lzcntq  = 0xC0BD0F48F3000005LL, // 64bit leading zero count r = lzcnt(b) (LZCNT)
+        X64_tzcnt   = 0xC0BC0F40F3000005LL, // 32bit trailing zero count r = tzcnt(b) (BMI1)
+        X64_tzcntq  = 0xC0BC0F48F3000005LL, // 64bit trailing zero count r = tzcnt(b) (BMI1)
         X64_subqrr  = 0xC02B480000000003LL, // 64bit sub r -= b
         X64_subrr   = 0xC02B400000000003LL, // 32bit sub r -= b
         X64_subqri  = 0xE881480000000003LL, // 64bit sub r -= int64(immI)
@@ -358,7 +385,29 @@ register number. The register bits are added by the code.
         X64_xorps   = 0xC0570F4000000004LL, // 128bit xor xmm (four packed singles), one byte shorter
         X64_xorpsm  = 0x05570F4000000004LL, // 128bit xor xmm, [rip+disp32]
         X64_xorpsa  = 0x2504570F40000005LL, // 128bit xor xmm, [disp32]
+        X64_andps   = 0xC0540F4000000004LL, // 128bit and xmm (four packed singles)
+        X64_andpsm  = 0x05540F4000000004LL, // 128bit and xmm, [rip+disp32]
+        X64_andpsa  = 0x2504540F40000005LL, // 128bit and xmm, [disp32]
+        X64_minps   = 0xC05D0F4000000004LL, // minimum of float4 vectors r[i] = min(r[i], b[i])
+        X64_maxps   = 0xC05F0F4000000004LL, // maximum of float4 vectors r[i] = max(r[i], b[i])
+        X64_sqrtps  = 0xC0510F4000000004LL, // square root of float4 vector r[i] = sqrt(b[i])
+        X64_rcpps   = 0xC0530F4000000004LL, // approximate reciprocal of float4 vector r[i] = 1/b[i]
+        X64_rsqrtps = 0xC0520F4000000004LL, // approximate reciprocal square root of float4 vector
+        X64_sqrtss  = 0xC0510F40F3000005LL, // square root of scalar single-precision r = sqrt(b)
+        X64_rcpss   = 0xC0530F40F3000005LL, // approximate reciprocal of scalar single-precision r = 1/b
+        X64_rsqrtss = 0xC0520F40F3000005LL, // approximate reciprocal square root of scalar single-precision
+        X64_minsd   = 0xC05D0F40F2000005LL, // minimum of scalar doubles r = r < b ? r : b
+        X64_maxsd   = 0xC05F0F40F2000005LL, // maximum of scalar doubles r = r > b ? r : b
+        X64_minss   = 0xC05D0F40F3000005LL, // minimum of scalar singles r = r < b ? r : b
+        X64_maxss   = 0xC05F0F40F3000005LL, // maximum of scalar singles r = r > b ? r : b
+        X64_cmpsd   = 0xC0C20F40F2000005LL, // scalar double compare to mask, predicate in imm8
+        X64_cmpss   = 0xC0C20F40F3000005LL, // scalar single compare to mask, predicate in imm8
+        X64_orps    = 0xC0560F4000000004LL, // 128bit or xmm (four packed singles)
+        X64_roundsd = 0xC00B3A0F40660006LL, // round scalar double to integer, mode in imm8 (SSE4.1)
+        X64_roundss = 0xC00A3A0F40660006LL, // round scalar single to integer, mode in imm8 (SSE4.1)
+        X64_cvttss2sq=0xC02C0F48F3000005LL, // convert float to int64 with truncation r = (int64) b
         X64_inclmRAX= 0x00FF000000000002LL, // incl (%rax)
+        X64_incqm   = 0x0000000080FF4807LL, // 64bit increment qword ptr[b+disp32]
         X64_jmpx    = 0xC524ff4000000004LL, // jmp [d32+x*8]
         X64_jmpxb   = 0xC024ff4000000004LL, // jmp [b+x*8]
 
@@ -369,7 +418,64 @@ register number. The register bits are added by the code.
 
         X86_and8r   = 0xC022000000000002LL, // and rl,rh
         X86_sete    = 0xC0940F0000000003LL, // no-rex version of X64_sete
-        X86_setnp   = 0xC09B0F0000000003LL  // no-rex set byte if odd parity (ordered fcmp result) (PF == 0)
+        X86_setnp   = 0xC09B0F0000000003LL, // no-rex set byte if odd parity (ordered fcmp result) (PF == 0)
+        X64_vzeroupper = 0x77F8C50000000003LL  // clear the upper halves of all YMM registers
+    };
+
+    // VEX-encoded (AVX) instructions don't fit the X64Opcode layout above;
+    // they are described by their opcode byte (bits 0-7), implied mandatory
+    // prefix (bits 8-9: 0=none, 1=66, 2=F3, 3=F2), opcode map (bits 10-11:
+    // 1=0F, 2=0F38, 3=0F3A) and VEX.W (bit 12), and are emitted by emitvex().
+    enum X64VexOpcode {
+        X64_vmovupsrm    = 0x0410, // ymm <- m256, unaligned
+        X64_vmovupsmr    = 0x0411, // m256 <- ymm, unaligned
+        X64_vmovapsr     = 0x0428, // ymm <- ymm (xmm <- xmm with VEX.128)
+        X64_vaddps       = 0x0458, // float8 add
+        X64_vmulps       = 0x0459, // float8 multiply
+        X64_vsubps       = 0x045C, // float8 subtract
+        X64_vminps       = 0x045D, // float8 min
+        X64_vdivps       = 0x045E, // float8 divide
+        X64_vmaxps       = 0x045F, // float8 max
+        X64_vcmpps       = 0x04C2, // float8 compare, predicate in imm8
+        X64_vaddpd       = 0x0558, // double4 add
+        X64_vmulpd       = 0x0559, // double4 multiply
+        X64_vsubpd       = 0x055C, // double4 subtract
+        X64_vminpd       = 0x055D, // double4 min
+        X64_vdivpd       = 0x055E, // double4 divide
+        X64_vmaxpd       = 0x055F, // double4 max
+        X64_vcmppd       = 0x05C2, // double4 compare, predicate in imm8
+        X64_vaddss       = 0x0658, // scalar single add, 3-operand
+        X64_vmulss       = 0x0659, // scalar single multiply, 3-operand
+        X64_vsubss       = 0x065C, // scalar single subtract, 3-operand
+        X64_vdivss       = 0x065E, // scalar single divide, 3-operand
+        X64_vaddsd       = 0x0758, // scalar double add, 3-operand
+        X64_vmulsd       = 0x0759, // scalar double multiply, 3-operand
+        X64_vsubsd       = 0x075C, // scalar double subtract, 3-operand
+        X64_vdivsd       = 0x075E, // scalar double divide, 3-operand
+        X64_vpcmpgtd     = 0x0566, // int8 signed greater-than
+        X64_vmovdxr      = 0x056E, // xmm <- r32
+        X64_vpcmpeqd     = 0x0576, // int8 equal
+        X64_vmovdrx      = 0x057E, // r32 <- xmm
+        X64_vpand        = 0x05DB, // 256bit and
+        X64_vpor         = 0x05EB, // 256bit or
+        X64_vpxor        = 0x05EF, // 256bit xor
+        X64_vpsubd       = 0x05FA, // int8 subtract
+        X64_vpaddd       = 0x05FE, // int8 add
+        X64_vbroadcastss = 0x0918, // float8 <- xmm[0] (AVX2 for a register source)
+        X64_vbroadcastsd = 0x0919, // double4 <- xmm[0] (AVX2)
+        X64_vpmulld      = 0x0940, // int8 multiply, low 32 bits
+        X64_vfmadd231ps  = 0x09B8, // float4 fused multiply-add, r = v * rm + r
+        X64_vfmadd231ss  = 0x09B9, // scalar single fused multiply-add, r = v * rm + r
+        X64_vfmadd231sd  = 0x19B9, // scalar double fused multiply-add, r = v * rm + r
+        X64_vpbroadcastd = 0x0958, // int8 <- xmm[0] (AVX2)
+        X64_shlx         = 0x09F7, // 32bit left shift r = rm << v (BMI2)
+        X64_shlxq        = 0x19F7, // 64bit left shift r = rm << v (BMI2)
+        X64_sarx         = 0x0AF7, // 32bit int right shift r = rm >> v (BMI2)
+        X64_sarxq        = 0x1AF7, // 64bit int right shift r = rm >> v (BMI2)
+        X64_shrx         = 0x0BF7, // 32bit uint right shift r = rm >> v (BMI2)
+        X64_shrxq        = 0x1BF7, // 64bit uint right shift r = rm >> v (BMI2)
+        X64_vblendvps    = 0x0D4A, // float8 blend, mask register in imm8[7:4]
+        X64_vblendvpd    = 0x0D4B  // double4 blend, mask register in imm8[7:4]
     };
 
     typedef uint32_t RegisterMask;
@@ -386,11 +492,13 @@ register number. The register bits are added by the code.
                                           1<<REGNUM(R15);
     static const int NumSavedRegs = 7; // rbx, rsi, rdi, r12-15
     static const int NumArgRegs = 4;
+    static const int NumFpArgRegs = 4; // xmm0-3, shared with NumArgRegs by position
 #else
     static const RegisterMask SavedRegs = 1<<REGNUM(RBX) | 1<<REGNUM(R12) | 1<<REGNUM(R13) |
                                           1<<REGNUM(R14) | 1<<REGNUM(R15);
     static const int NumSavedRegs = 5; // rbx, r12-15
     static const int NumArgRegs = 6;
+    static const int NumFpArgRegs = 8; // xmm0-7
 #endif
     // Warning:  when talking about single byte registers, RSP/RBP/RSI/RDI are
     // actually synonyms for AH/CH/DH/BH.  So this value means "any
@@ -459,15 +567,23 @@ register number. The register bits are added by the code.
         void emitr_imm8(uint64_t op, Register b, int32_t imm8);\
         void emitxm_abs(uint64_t op, Register r, int32_t addr32);\
         void emitxm_rel(uint64_t op, Register r, NIns* addr64);\
+        void emitvex(uint32_t op, bool l, Register r, Register v, Register b, bool mem, int32_t d, int imm8);\
+        void emitvrr(uint32_t op, Register r, Register v, Register b) { emitvex(op, true, r, v, b, false, 0, -1); }\
+        void emitvrr_imm8(uint32_t op, Register r, Register v, Register b, uint8_t imm) { emitvex(op, true, r, v, b, false, 0, imm); }\
+        void emitvrm(uint32_t op, Register r, int32_t d, Register b) { emitvex(op, true, r, XMM0, b, true, d, -1); }\
+        void emitvxrr(uint32_t op, Register r, Register v, Register b) { emitvex(op, false, r, v, b, false, 0, -1); }\
         bool isTargetWithinS8(NIns* target);\
         bool isTargetWithinS32(NIns* target, int32_t maxInstSize=8);\
         void asm_immi(Register r, int32_t v, bool canClobberCCs, bool blind);  \
         void asm_immq(Register r, uint64_t v, bool canClobberCCs, bool blind);     \
+        void asm_immq_reloc(Register r, uint64_t v, RelocKind kind, const void* target, size_t size);\
         void asm_immd(Register r, uint64_t v, bool canClobberCCs, bool blind);     \
         void asm_regarg(ArgType, LIns*, Register);\
         void asm_stkarg(ArgType, LIns*, int);\
         void asm_shift(LIns*);\
         void asm_shift_imm(LIns*);\
+        void asm_shiftx(LIns*);\
+        void asm_popcnt_swar(Register rr, Register ra, bool quad);\
         void asm_arith_imm(LIns*);\
         bool asm_arith_imm_blind(LIns*);\
         void beginOp1Regs(LIns *ins, RegisterMask allow, Register &rr, Register &ra);\
@@ -486,6 +602,13 @@ register number. The register bits are added by the code.
         void asm_cmpi_imm(LIns*);\
         void asm_cmpd(LIns*);\
         void asm_cmpf4(LIns*);\
+        void asm_fpmask(Register rr, RegisterMask keep, const void* mask, bool andMask, bool quad);\
+        void asm_trunc_sse2(Register rr, Register ra, Register rt, Register gt, bool quad);\
+        void asm_load256(LIns *ins);\
+        void asm_store256(LOpcode op, LIns *value, int d, LIns *base, bool tainted);\
+        void asm_vec256(LIns *ins);\
+        void asm_fop_vex(LIns *ins);\
+        bool isV256Reg(Register r);\
         Branches asm_branch_helper(bool, LIns*, NIns*);\
         Branches asm_branchd_helper(bool, LIns*, NIns*);\
 		NIns* asm_branchi_S8(bool onFalse, LIns *cond, NIns *target);\
@@ -494,6 +617,7 @@ register number. The register bits are added by the code.
         void asm_div_mod(LIns *ins);\
         void asm_divq(LIns *ins);\
         void asm_divq_modq(LIns *ins);\
+        void asm_mulhq(LIns *ins);\
         int max_stk_used;\
         void PUSHR(Register r);\
         void POPR(Register r);\
@@ -503,6 +627,7 @@ register number. The register bits are added by the code.
         void NEGQ(Register r);\
         void IDIV(Register r);\
         void IDIVQ(Register r);\
+        void IMULHQ(Register r);\
         void SHR(Register r);\
         void SAR(Register r);\
         void SHL(Register r);\
@@ -515,6 +640,32 @@ register number. The register bits are added by the code.
         void SHRQI(Register r, int i);\
         void SARQI(Register r, int i);\
         void SHLQI(Register r, int i);\
+        void ROL(Register r);\
+        void ROR(Register r);\
+        void ROLQ(Register r);\
+        void RORQ(Register r);\
+        void ROLI(Register r, int i);\
+        void RORI(Register r, int i);\
+        void ROLQI(Register r, int i);\
+        void RORQI(Register r, int i);\
+        void SHLX(Register d, Register a, Register n);\
+        void SARX(Register d, Register a, Register n);\
+        void SHRX(Register d, Register a, Register n);\
+        void SHLXQ(Register d, Register a, Register n);\
+        void SARXQ(Register d, Register a, Register n);\
+        void SHRXQ(Register d, Register a, Register n);\
+        void BSWAP(Register r);\
+        void BSWAPQ(Register r);\
+        void BSF(Register l, Register r);\
+        void BSFQ(Register l, Register r);\
+        void BSR(Register l, Register r);\
+        void BSRQ(Register l, Register r);\
+        void POPCNT(Register l, Register r);\
+        void POPCNTQ(Register l, Register r);\
+        void LZCNT(Register l, Register r);\
+        void LZCNTQ(Register l, Register r);\
+        void TZCNT(Register l, Register r);\
+        void TZCNTQ(Register l, Register r);\
         void SETE(Register r);\
         void SETL(Register r);\
         void SETLE(Register r);\
@@ -534,6 +685,7 @@ register number. The register bits are added by the code.
         void IMULQ(Register l, Register r);\
         void CMPLR(Register l, Register r);\
         void CMPNEQPS(Register l, Register r);\
+        void CMPPS(Register l, Register r, uint8_t pred);\
         void MOVLR(Register l, Register r);\
         void PMOVMSKB(Register l, Register r);\
         void ADDQRR(Register l, Register r);\
@@ -544,8 +696,16 @@ register number. The register bits are added by the code.
         void CMPQR(Register l, Register r);\
         void MOVQR(Register l, Register r);\
         void MOVAPSR(Register l, Register r);\
+        void VMOVAPSR(Register l, Register r);\
+        void VMOVAPSXR(Register l, Register r);\
+        void VMOVUPSRM(Register r, int d, Register b);\
+        void VMOVUPSMR(Register r, int d, Register b);\
+        void VMOVDXR(Register l, Register r);\
+        void VMOVDRX(Register l, Register r);\
+        void VZEROUPPER();\
         void UNPCKLPS(Register l, Register r);\
         void CMOVNO(Register l, Register r);\
+        void CMOVE(Register l, Register r);\
         void CMOVNE(Register l, Register r);\
         void CMOVNL(Register l, Register r);\
         void CMOVNLE(Register l, Register r);\
@@ -556,6 +716,7 @@ register number. The register bits are added by the code.
         void CMOVNA(Register l, Register r);\
         void CMOVNAE(Register l, Register r);\
         void CMOVQNO(Register l, Register r);\
+        void CMOVQE(Register l, Register r);\
         void CMOVQNE(Register l, Register r);\
         void CMOVQNL(Register l, Register r);\
         void CMOVQNLE(Register l, Register r);\
@@ -577,10 +738,30 @@ register number. The register bits are added by the code.
         void MULSS(Register l, Register r);\
         void ADDSS(Register l, Register r);\
         void SUBSS(Register l, Register r);\
+        void VDIVSD(Register d, Register a, Register b);\
+        void VMULSD(Register d, Register a, Register b);\
+        void VADDSD(Register d, Register a, Register b);\
+        void VSUBSD(Register d, Register a, Register b);\
+        void VDIVSS(Register d, Register a, Register b);\
+        void VMULSS(Register d, Register a, Register b);\
+        void VADDSS(Register d, Register a, Register b);\
+        void VSUBSS(Register d, Register a, Register b);\
+        void VFMADD231SD(Register d, Register a, Register b);\
+        void VFMADD231SS(Register d, Register a, Register b);\
+        void VFMADD231PS(Register d, Register a, Register b);\
         void DIVPS(Register l, Register r);\
         void MULPS(Register l, Register r);\
         void ADDPS(Register l, Register r);\
         void SUBPS(Register l, Register r);\
+        void MINPS(Register l, Register r);\
+        void MAXPS(Register l, Register r);\
+        void ANDPS(Register l, Register r);\
+        void SQRTPS(Register l, Register r);\
+        void RCPPS(Register l, Register r);\
+        void RSQRTPS(Register l, Register r);\
+        void SQRTSS(Register l, Register r);\
+        void RCPSS(Register l, Register r);\
+        void RSQRTSS(Register l, Register r);\
         void CVTSQ2SD(Register l, Register r);\
         void CVTSI2SD(Register l, Register r);\
         void CVTSS2SD(Register l, Register r);\
@@ -589,6 +770,16 @@ register number. The register bits are added by the code.
         void CVTTSD2SQ(Register l, Register r);\
         void CVTTSD2SI(Register l, Register r);\
         void CVTTSS2SI(Register l, Register r);\
+        void CVTTSS2SQ(Register l, Register r);\
+        void MINSD(Register l, Register r);\
+        void MAXSD(Register l, Register r);\
+        void MINSS(Register l, Register r);\
+        void MAXSS(Register l, Register r);\
+        void CMPSD(Register l, Register r, uint8_t pred);\
+        void CMPSS(Register l, Register r, uint8_t pred);\
+        void ORPS(Register l, Register r);\
+        void ROUNDSD(Register l, Register r, uint8_t mode);\
+        void ROUNDSS(Register l, Register r, uint8_t mode);\
         void CVTSI2SS(Register l, Register r);\
         void CVTSQ2SS(Register l, Register r);\
         void UCOMISD(Register l, Register r);\
@@ -706,6 +897,8 @@ register number. The register bits are added by the code.
         void MOVQSPX(int d, Register r);\
         void XORPSA(Register r, int32_t i32);\
         void XORPSM(Register r, NIns* a64);\
+        void ANDPSA(Register r, int32_t i32);\
+        void ANDPSM(Register r, NIns* a64);\
         void X86_AND8R(Register r);\
         void X86_SETNP(Register r);\
         void X86_SETE(Register r);\
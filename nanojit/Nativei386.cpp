@@ -218,6 +218,7 @@ namespace nanojit
     inline void Assembler::XORi(R r, I32 i)   { count_alu(); ALUi(0x35, r, i);  asm_output("xor %s,%d", gpn(r), i); }
 
     inline void Assembler::ADDmi(I32 d, R b, I32 i) { count_alust(); ALUmi(0x05, d, b, i); asm_output("add %d(%s), %d", d, gpn(b), i); }
+    inline void Assembler::ADCmi(I32 d, R b, I32 i) { count_alust(); ALUmi(0x15, d, b, i); asm_output("adc %d(%s), %d", d, gpn(b), i); }
 
     inline void Assembler::TEST(R d, R s)      { count_alu(); ALU(0x85, REGNUM(d), s);  asm_output("test %s,%s", gpn(d), gpn(s)); }
     inline void Assembler::CMP(R l, R r)       { count_alu(); ALU(0x3b, REGNUM(l), r);  asm_output("cmp %s,%s", gpn(l), gpn(r)); }
@@ -2810,7 +2811,32 @@ namespace nanojit
     {
         uint32_t arg = ins->paramArg();
         uint32_t kind = ins->paramKind();
-        if (kind == 0) {
+        if (ins->isop(LIR_paramf4)) {
+            // The first float4 args are passed in registers, see asm_call().
+            NanoAssert(kind == 0 && arg < NJ_MAX_F4ARGS_IN_REGS);
+            prepareResultReg(ins, rmask(argRegsF4[arg]));
+        } else if (!ins->isop(LIR_paramp)) {
+            // Floating-point args are always passed on the stack, and are
+            // numbered by the stack word they start at.
+            NanoAssert(kind == 0);
+            int d = arg * sizeof(intptr_t) + 8;
+            if (_config.i386_sse2) {
+                Register r = prepareResultReg(ins, XmmRegs);
+                if (ins->isop(LIR_paramd)) {
+                    SSE_LDQ(r, d, FP);
+                } else {
+                    SSE_LDSS(r, d, FP);
+                    SSE_XORPDr(r, r);
+                }
+            } else {
+                debug_only( Register r = ) prepareResultReg(ins, rmask(FST0));
+                NanoAssert(r == FST0);
+                if (ins->isop(LIR_paramd))
+                    FLDQ(d, FP);
+                else
+                    FLD32(d, FP);
+            }
+        } else if (kind == 0) {
             // ordinary param
             AbiKind abi = _thisfrag->lirbuf->abi;
             uint32_t abi_regcount = max_abi_regs[abi];
@@ -4009,6 +4035,14 @@ namespace nanojit
         freeResourcesOf(ins);
     }
 
+    void Assembler::asm_count(LIns* ins)
+    {
+        int d = 0;
+        Register rb = getBaseReg(ins->oprnd1(), d, GpRegs);
+        ADCmi(d + 4, rb, 0);
+        ADDmi(d, rb, 1);
+    }
+
     // Increment the 32-bit profiling counter at pCtr, without
     // changing any registers.
     verbose_only(
@@ -316,6 +316,7 @@ namespace nanojit
         void ORi(Register r, int32_t i); \
         void XORi(Register r, int32_t i); \
         void ADDmi(int32_t d, Register b, int32_t i); \
+        void ADCmi(int32_t d, Register b, int32_t i); \
         void TEST(Register d, Register s); \
         void CMP(Register l, Register r); \
         void CMPi(Register r, int32_t i); \
@@ -23,6 +23,7 @@ namespace nanojit
     void RegAlloc::initialize(Assembler* a)
     {
         _assembler = a;
+        _ranges = NULL;
         _managed = nInitManagedRegisters(); // was nRegisterResetAll(_allocator);
         _free = _managed;
 
@@ -99,7 +100,8 @@ namespace nanojit
     }
 
     // Scan table for instruction with the lowest priority, meaning it is used
-    // furthest in the future.
+    // furthest in the future.  Without LiveRanges the priority is how recently
+    // the register was used, which approximates that.
     LIns* RegAlloc::findVictim( RegisterMask allow, LIns* forIns /*= NULL*/, Register regClass /*= UnspecifiedReg*/ )
     {
         NanoAssert(allow);
@@ -114,7 +116,13 @@ namespace nanojit
                 continue;
             }
 
-            int pri = canRemat(ins) ? 0 : getPriority(r);
+            int pri;
+            if (canRemat(ins))
+                pri = 0;
+            else if (_ranges)
+                pri = 0x7fffffff - _ranges->nextUse(ins);   // furthest next use goes first
+            else
+                pri = getPriority(r);
 #ifdef RA_REGISTERS_OVERLAP
             Register r1 = ins->getReg(); // may be wider than r
             if (forIns && firstAvailableReg(forIns, regClass, (_free | rmask(r1)) & allow) == UnspecifiedReg) {
@@ -164,5 +172,100 @@ namespace nanojit
         
         return r;
     }
+
+    LiveRanges::LiveRanges(LirFilter* in, Allocator& alloc)
+        : LirFilter(in), _alloc(alloc), _current(0), _currentCalls(0)
+    {
+        // Size the table for the fragment; HashMap never rehashes.
+        _insns = readAll(alloc, _next);
+        _ranges = new (alloc) HashMap<LIns*, Range*>(alloc, _next / 2 + 16);
+
+        // Visit the instructions in the order the Assembler will.  As there,
+        // an expression is only live if a live instruction uses it, so uses
+        // by dead code don't count.
+        int32_t pos = 0;
+        int32_t calls = 0;
+        for (uint32_t i = _next; i-- > 1; pos++) {
+            LIns* ins = _insns[i];
+            Range* r = _ranges->get(ins);
+            if (!r) {
+                if (!ins->isLive())
+                    continue;
+                r = rangeFor(ins);
+            }
+            r->pos = pos;
+            r->calls = calls;
+
+            for (uint32_t k = 0, n = ins->numOperands(); k < n; k++)
+                addUse(ins->operand(k), pos);
+            if (ins->isCall())
+                calls++;
+        }
+    }
+
+    LIns* LiveRanges::read()
+    {
+        // Keep returning LIR_start once everything else has gone.
+        return _insns[_next > 1 ? --_next : 0];
+    }
+
+    LiveRanges::Range* LiveRanges::rangeFor(LIns* ins)
+    {
+        Range* r = _ranges->get(ins);
+        if (!r) {
+            r = new (_alloc) Range();
+            r->pos = 0x7fffffff;
+            r->calls = 0;
+            r->first = r->last = NULL;
+            _ranges->put(ins, r);
+        }
+        return r;
+    }
+
+    void LiveRanges::addUse(LIns* ins, int32_t pos)
+    {
+        if (!ins)
+            return;     // eg. the missing condition of an unconditional jump
+        Range* r = rangeFor(ins);
+        if (r->last && r->last->pos == pos)
+            return;     // used twice by the same instruction
+        Use* u = new (_alloc) Use();
+        u->pos = pos;
+        u->next = NULL;
+        if (r->last)
+            r->last->next = u;
+        else
+            r->first = u;
+        r->last = u;
+    }
+
+    void LiveRanges::setCurrent(LIns* ins)
+    {
+        if (Range* r = _ranges->get(ins)) {
+            NanoAssert(r->pos >= _current);
+            _current = r->pos;
+            _currentCalls = r->calls + (ins->isCall() ? 1 : 0);
+        }
+    }
+
+    int32_t LiveRanges::nextUse(LIns* ins)
+    {
+        Range* r = _ranges->get(ins);
+        if (!r)
+            return _current;    // a temporary, needed right now
+        // The Assembler only moves forward through the positions, so uses
+        // behind the current one can be dropped for good.
+        while (r->first && r->first->pos <= _current)
+            r->first = r->first->next;
+        if (!r->first)
+            r->last = NULL;
+        return r->first ? r->first->pos : r->pos;
+    }
+
+    bool LiveRanges::crossesCall(LIns* ins)
+    {
+        Range* r = _ranges->get(ins);
+        return r && r->pos > _current && r->calls > _currentCalls;
+    }
     #endif /* FEATURE_NANOJIT */
 }
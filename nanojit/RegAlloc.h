@@ -41,6 +41,8 @@ inline Register nextMsReg(RegisterMask& mask,Register r)
     return msReg(mask);
 }
 
+    class LiveRanges;
+
     // Some basics on RegAlloc :
     //
     // - 'active' indicates which registers are active at a particular
@@ -145,6 +147,10 @@ inline Register nextMsReg(RegisterMask& mask,Register r)
         // about which values to evict will be suboptimal.
         static bool canRemat(LIns*);
 
+        // When set, victims are chosen by next use rather than by last use,
+        // and the back-end may use the ranges to pick a register class.
+        void                setLiveRanges(LiveRanges* ranges) { _ranges = ranges; }
+
         debug_only( bool    isConsistent(Register r, LIns* v) const; )
     private:
         LIns*           _active[LastRegNum + 1]; // active[REGNUM(r)] = LIns that defines r
@@ -153,6 +159,7 @@ inline Register nextMsReg(RegisterMask& mask,Register r)
         RegisterMask    _managed;                // Registers under management (invariant).
         int32_t         _priority;
         Assembler*      _assembler;              // the assembler that initialized this RegAlloc
+        LiveRanges*     _ranges;                 // use positions, if allocating with lookahead
 
         LIns* findVictim( RegisterMask allow, LIns* forIns = NULL, Register regClass = UnspecifiedReg );
 
@@ -264,5 +271,59 @@ inline Register nextMsReg(RegisterMask& mask,Register r)
         } else 
             return UnspecifiedReg;
     }     
+
+    /************** Use positions for lookahead register allocation  ********************/
+
+    // LiveRanges records where each LIR value is used, so that the register
+    // allocator can look ahead instead of relying on how recently a register
+    // was touched ("lookahead" allocation, see Config::regalloc_lookahead).
+    //
+    // It is a LirFilter that reads the whole fragment when it is constructed
+    // and then passes it on unchanged, so it sees the code just as the
+    // Assembler will.  Positions are numbered in the order the Assembler
+    // visits instructions, ie. backwards from the end of the fragment, so as
+    // generation proceeds the next use of a value is the lowest use position
+    // greater than the current one, and the value dies (at regalloc-time) at
+    // its definition.
+    class LiveRanges : public LirFilter
+    {
+    public:
+        LiveRanges(LirFilter* in, Allocator& alloc);
+        LIns*   read();
+
+        // Must be called as the Assembler moves on to each instruction.
+        void    setCurrent(LIns* ins);
+
+        // Returns the position at which 'ins' will next be needed in a
+        // register, ie. its next use or else its definition.  The larger
+        // the result, the better a candidate 'ins' is for eviction.
+        int32_t nextUse(LIns* ins);
+
+        // Returns true if a call lies between the current position and the
+        // definition of 'ins', ie. it is live across a call at run-time.
+        bool    crossesCall(LIns* ins);
+
+    private:
+        struct Use {
+            int32_t pos;
+            Use*    next;
+        };
+        struct Range {
+            int32_t pos;        // position of the defining instruction
+            int32_t calls;      // number of calls at positions before 'pos'
+            Use*    first;      // uses not yet passed, in position order
+            Use*    last;
+        };
+
+        Range*  rangeFor(LIns* ins);
+        void    addUse(LIns* ins, int32_t pos);
+
+        Allocator&              _alloc;
+        LIns**                  _insns;         // the input, in buffer order
+        uint32_t                _next;          // number of _insns not yet returned
+        HashMap<LIns*, Range*>* _ranges;
+        int32_t                 _current;
+        int32_t                 _currentCalls;  // number of calls at positions <= _current
+    };
 }
 #endif // __nanojit_RegAlloc__
@@ -56,6 +56,12 @@
     #define CASE86(x)
 #endif
 
+#if defined NANOJIT_X64
+    #define CASEAVX(x)  case x
+#else
+    #define CASEAVX(x)
+#endif
+
 // Embed no-op macros that let Valgrind work with the JIT.
 #ifdef MOZ_VALGRIND
 #  define JS_VALGRIND
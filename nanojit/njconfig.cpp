@@ -6,6 +6,10 @@
 
 #include "nanojit.h"
 
+#if defined NANOJIT_X64 && defined _MSC_VER
+#include <intrin.h>     // __cpuidex, _xgetbv
+#endif
+
 #ifdef FEATURE_NANOJIT
 
 namespace nanojit
@@ -55,11 +59,84 @@ namespace nanojit
     }
 #endif
 
+#ifdef NANOJIT_X64
+    static void cpuid(uint32_t leaf, uint32_t regs[4])
+    {
+    #if defined _MSC_VER
+        int r[4];
+        __cpuidex(r, int(leaf), 0);
+        for (int i = 0; i < 4; i++)
+            regs[i] = uint32_t(r[i]);
+    #elif defined __GNUC__
+        asm volatile("cpuid"
+                     : "=a" (regs[0]), "=b" (regs[1]), "=c" (regs[2]), "=d" (regs[3])
+                     : "a" (leaf), "c" (0));
+    #else
+        (void) leaf;
+        regs[0] = regs[1] = regs[2] = regs[3] = 0;
+    #endif
+    }
+
+    static void setCpuFeatures(Config* config)
+    {
+        uint32_t regs[4];
+        cpuid(0, regs);
+        uint32_t maxLeaf = regs[0];
+
+        cpuid(1, regs);
+        // AVX needs both CPU support and the OS saving the YMM state
+        // (OSXSAVE set, and XCR0 enabling the XMM and YMM components).
+        bool avx = false;
+        if ((regs[2] & (1 << 28)) && (regs[2] & (1 << 27))) {
+    #if defined _MSC_VER
+            uint64_t xcr0 = _xgetbv(0);
+    #elif defined __GNUC__
+            uint32_t lo, hi;
+            asm volatile("xgetbv" : "=a" (lo), "=d" (hi) : "c" (0));
+            uint64_t xcr0 = (uint64_t(hi) << 32) | lo;
+    #else
+            uint64_t xcr0 = 0;
+    #endif
+            avx = (xcr0 & 6) == 6;
+        }
+        config->x64_avx = avx;
+        // FMA3 uses the VEX encoding, so it also depends on the YMM state.
+        config->x64_fma = avx && (regs[2] & (1 << 12)) != 0;
+        config->x64_popcnt = (regs[2] & (1 << 23)) != 0;
+        config->i386_sse41 = (regs[2] & (1 << 19)) != 0;
+
+        // BMI1 and BMI2 only use general purpose registers, so unlike AVX2
+        // they don't need the OS to save the YMM state.
+        config->x64_avx2 = config->x64_bmi1 = config->x64_bmi2 = false;
+        if (maxLeaf >= 7) {
+            cpuid(7, regs);
+            config->x64_avx2 = avx && (regs[1] & (1 << 5)) != 0;
+            config->x64_bmi1 = (regs[1] & (1 << 3)) != 0;
+            config->x64_bmi2 = (regs[1] & (1 << 8)) != 0;
+        }
+
+        cpuid(0x80000000, regs);
+        config->x64_lzcnt = false;
+        if (regs[0] >= 0x80000001) {
+            cpuid(0x80000001, regs);
+            config->x64_lzcnt = (regs[2] & (1 << 5)) != 0;
+        }
+    }
+#endif
+
     Config::Config()
     {
         VMPI_memset(this, 0, sizeof(*this));
 
         cseopt = true;
+        regalloc_lookahead = false;
+        loop_lives = false;
+        licm = false;
+        gvn = false;
+        memopt = false;
+        ranges = false;
+        divconst = false;
+        unroll = 0;
         harden_function_alignment = false;
         harden_nop_insertion = false;
         harden_blind_constants = false;
@@ -71,7 +148,7 @@ namespace nanojit
         force_long_branch = false;
 #endif
 
-#ifdef NANOJIT_IA32
+#if defined NANOJIT_IA32 || defined NANOJIT_X64
         setCpuFeatures(this);
 #endif
 
@@ -40,9 +40,43 @@ namespace nanojit
         // ARM architecture to assume when generate instructions for (currently, 4 <= arm_arch <= 7)
         uint8_t arm_arch;
 
+        // Unroll counted loops this many times (see UnrollFilter); 0 or 1
+        // leaves them alone.  This implies loop_lives.
+        uint8_t unroll;
+
         // If true, use CSE.
         uint32_t cseopt:1;
 
+        // If true, compute live ranges before code generation so the register
+        // allocator can evict the value used furthest ahead and prefer
+        // registers that fit each value's range.
+        uint32_t regalloc_lookahead:1;
+
+        // If true, insert the LIR_live instructions needed on loop back edges
+        // instead of relying on the front end (see LoopLiveFilter).
+        uint32_t loop_lives:1;
+
+        // If true, move loop-invariant code out of loops (see LicmFilter).
+        // This implies loop_lives.
+        uint32_t licm:1;
+
+        // If true, do global value numbering across labels (see GvnFilter).
+        // This implies loop_lives.
+        uint32_t gvn:1;
+
+        // If true, forward stored values to loads and remove dead stores
+        // across labels (see MemFilter).  This implies loop_lives.
+        uint32_t memopt:1;
+
+        // If true, use the ranges of int and quad values to remove overflow
+        // checks, branches and conversions (see RangeFilter).  This implies
+        // loop_lives.
+        uint32_t ranges:1;
+
+        // If true, replace integer division and modulus by constants with
+        // multiplications and shifts (see DivFilter).
+        uint32_t divconst:1;
+
         // If true, use full-range addressing for branches even when a short branch will suffice (x86-64 only)
         uint32_t force_long_branch:1;
 
@@ -52,7 +86,7 @@ namespace nanojit
         // Can we use SSE3 instructions? (x86-only)
         uint32_t i386_sse3:1;
 
-        // Can we use SSE4.1 instructions? (x86 only)
+        // Can we use SSE4.1 instructions? (x86 and x64)
         uint32_t i386_sse41:1;
 
         // Can we use cmov instructions? (x86-only)
@@ -61,6 +95,27 @@ namespace nanojit
         // Should we use a virtual stack pointer? (x86-only)
         uint32_t i386_fixed_esp:1;
 
+        // Can we use AVX instructions, ie. 256-bit float8/double4 vectors? (x64-only)
+        uint32_t x64_avx:1;
+
+        // Can we use AVX2 instructions, ie. 256-bit int8 vectors and broadcasts? (x64-only)
+        uint32_t x64_avx2:1;
+
+        // Can we use FMA3 instructions for the fma* opcodes? (x64-only)
+        uint32_t x64_fma:1;
+
+        // Can we use the POPCNT instruction for popcnt*? (x64-only)
+        uint32_t x64_popcnt:1;
+
+        // Can we use the LZCNT instruction for lzcnt*? (x64-only)
+        uint32_t x64_lzcnt:1;
+
+        // Can we use BMI1 instructions, ie. TZCNT for tzcnt*? (x64-only)
+        uint32_t x64_bmi1:1;
+
+        // Can we use BMI2 instructions, ie. SHLX/SARX/SHRX for variable shifts? (x64-only)
+        uint32_t x64_bmi2:1;
+
         // Whether or not to generate VFP instructions. (ARM only)
         uint32_t arm_vfp:1;
 
@@ -1,9 +1,16 @@
 #include <nanojit.h>
 #include <nanojitextra.h>
 
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
 #include <iostream>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <vector>
 
 #ifndef NANOJIT_64BIT
@@ -17,6 +24,7 @@ enum ReturnType {
   RT_QUAD = 2,
   RT_DOUBLE = 4,
   RT_FLOAT = 8,
+  RT_FLOAT4 = 16,
 };
 
 // We lump everything into a single access region for lirasm.
@@ -27,12 +35,131 @@ typedef int32_t(FASTCALL *RetInt)();
 typedef int64_t(FASTCALL *RetQuad)();
 typedef double(FASTCALL *RetDouble)();
 typedef float(FASTCALL *RetFloat)();
+typedef float4_t(FASTCALL *RetFloat4)();
 
 struct Function {
   std::string name;
   struct nanojit::CallInfo callInfo;
 };
 
+/**
+* The param instruction that receives an argument of the given type
+*/
+static LOpcode paramOpcode(ArgType type) {
+#ifdef NANOJIT_X64
+  if (type == ARGTYPE_D)
+    return LIR_paramd;
+  if (type == ARGTYPE_F)
+    return LIR_paramf;
+  if (type == ARGTYPE_F4)
+    return LIR_paramf4;
+#endif
+  (void)type;
+  return LIR_paramp;
+}
+
+/**
+* Numbers the parameter at position pos the way asm_param() expects, given
+* the types of the parameters before it.
+*/
+static int32_t paramNumber(const ArgType *args, int pos) {
+#if defined(NANOJIT_X64) && !defined(_WIN64)
+  // Integer and floating-point args each take the next register of their
+  // class; the ones left over take the stack slots in order
+  int gp = 0, fp = 0, stack = 0;
+  for (int i = 0; i <= pos; i++) {
+    bool isFloat = args[i] == ARGTYPE_D || args[i] == ARGTYPE_F ||
+                   args[i] == ARGTYPE_F4;
+    int &regs = isFloat ? fp : gp;
+    int maxRegs = isFloat ? NumFpArgRegs : NumArgRegs;
+    if (i == pos)
+      return regs < maxRegs ? regs : maxRegs + stack;
+    if (regs < maxRegs)
+      regs++;
+    else
+      stack++;
+  }
+#else
+  // Registers and stack slots are assigned by position
+  (void)args;
+#endif
+  return pos;
+}
+
+class NanoJitContextImpl;
+struct Profile;
+
+/**
+* Shared by the two tiers of a function compiled in tiered mode. The first
+* tier decrements count on every call and, once entry holds the optimized
+* code, forwards its calls there instead. Owned by the context.
+*/
+struct TierState {
+  // Read by the first tier's code, so must stay a plain pointer in memory
+  std::atomic<void *> entry;
+  // Only touched by the first tier's code; lost updates are harmless
+  int32_t count;
+  NanoJitContextImpl *context;
+  std::string name;
+  ArgType rvalue;
+  std::vector<ArgType> args;
+  bool lookahead;
+  // The function body as encoded by LirSerializer, empty if it could not
+  // be serialized
+  std::string lir;
+  // The first tier's counters if it was profiled, which the optimized
+  // tier keeps bumping
+  const Profile *profile;
+  // Set once the recompile has been queued; guarded by the context lock
+  bool queued;
+};
+
+static_assert(sizeof(std::atomic<void *>) == sizeof(void *),
+              "tiered code loads TierState::entry directly");
+
+/**
+* A stable entry point through which jitted functions call another jitted
+* function: an indirect jump through a slot in data memory that holds the
+* address of the current code of the callee. Publishing a new function
+* under the same name repoints the slot, so callers follow without being
+* recompiled, and the code memory is never written after the stub is.
+*/
+struct EntryStub {
+  NIns *entry;
+  std::atomic<void *> *slot;
+};
+
+/**
+* The value of a patchable constant. Functions read it with a constant
+* load, so a new value is seen by every call that starts after it is set.
+*/
+struct PatchCell {
+  std::atomic<int64_t> bits;
+  ArgType type;
+};
+
+/**
+* The counters of a profiled branch: it was taken executed - notTaken
+* times. notTaken is null for a branch that cannot fall through.
+*/
+struct ProfileCounter {
+  uint64_t *executed;
+  uint64_t *notTaken;
+};
+
+/**
+* The counters bumped by the code of a profiled function. Allocated from
+* the data of the function that first placed them; an optimized tier
+* shares those of its first tier.
+*/
+struct Profile {
+  uint64_t *entries;
+  uint32_t nbranches;
+  ProfileCounter *branches;
+  uint32_t nloops;
+  ProfileCounter *loops;
+};
+
 class LirasmFragment {
 public:
   union {
@@ -40,15 +167,114 @@ public:
     RetQuad rquad;
     RetDouble rdouble;
     RetFloat rfloat;
+    RetFloat4 rfloat4;
   };
   ReturnType mReturnType;
   Fragment *fragptr;
   uint32_t typeSig;
+  // Data referenced by the generated code (constant pools, jump tables);
+  // owned by the fragment and released with it
+  Allocator *dataAlloc;
+  // The code blocks holding the generated code, handed back to the
+  // CodeAlloc when the function is freed
+  CodeList *codeList;
+  // Names of the jitted functions called by this one
+  std::vector<std::string> callees;
+  // Set if the function was compiled in tiered mode
+  TierState *tier;
+  // The LIR of the function body if it is small enough to be inlined
+  std::string *inlineBody;
+  // The execution counters if the function is profiled
+  const Profile *profile;
 };
 
 typedef std::map<std::string, LirasmFragment> Fragments;
 typedef std::vector<Function> Functions;
 
+/**
+* 64-bit FNV-1a hash, used to key the code cache
+*/
+class Hasher {
+public:
+  Hasher() : hash_(14695981039346656037ULL) {}
+
+  void add(const void *data, size_t len) {
+    const uint8_t *p = (const uint8_t *)data;
+    for (size_t i = 0; i < len; i++) {
+      hash_ ^= p[i];
+      hash_ *= 1099511628211ULL;
+    }
+  }
+  void add(uint64_t v) { add(&v, sizeof(v)); }
+  void add(const std::string &str) {
+    add(str.size());
+    add(str.data(), str.size());
+  }
+
+  uint64_t hash() const { return hash_; }
+
+private:
+  uint64_t hash_;
+};
+
+/**
+* Collects the relocations reported by the Assembler while generating
+* relocatable code for the code cache.
+*/
+class CodeCacheWriter : public MetaDataWriter {
+public:
+  struct Reloc {
+    RelocKind kind;
+    uint8_t *address; // end of the 8 byte immediate
+    const void *target;
+    size_t size;
+  };
+
+  std::vector<Reloc> relocs_;
+
+  void beginAssembly(Assembler *, uint8_t *) { relocs_.clear(); }
+  void safepointStart(Assembler *, void *, uint8_t *) {}
+  void safepointEnd(Assembler *, void *, uint8_t *) {}
+  void setNativePc(uint8_t *) {}
+  void endAssembly(Assembler *, uint8_t *) {}
+  void abandon() { relocs_.clear(); }
+  bool wantsRelocations() { return true; }
+  void relocation(Assembler *, RelocKind kind, uint8_t *address,
+                  const void *target, size_t size) {
+    Reloc r = {kind, address, target, size};
+    relocs_.push_back(r);
+  }
+};
+
+/**
+* Layout of a code cache file: a header followed by relocCount relocations,
+* each followed by size bytes of payload, followed by codeSize bytes of
+* code. Offsets are from the start of the code.
+*/
+struct CodeCacheHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t key;
+  uint32_t returnType;
+  uint32_t typeSig;
+  uint32_t codeSize;
+  uint32_t entryOffset;
+  uint32_t relocCount;
+};
+
+struct CodeCacheReloc {
+  uint32_t kind;
+  uint32_t offset; // end of the 8 byte immediate to patch
+  uint32_t size;   // payload: code offsets for RELOC_CODE and RELOC_JTBL,
+                   // the function name for RELOC_CALL, the bytes for RELOC_DATA
+};
+
+static const uint32_t CODE_CACHE_MAGIC = 0x43584a4e; // "NJXC"
+static const uint32_t CODE_CACHE_VERSION = 2;
+
+class CompileQueue;
+class CompileTicket;
+
 // Equivalent to Lirasm
 class NanoJitContextImpl {
 public:
@@ -74,16 +300,6 @@ public:
   */
   Config config_;
 
-  /**
-  * Allocator is a bump-pointer allocator with an SPI for getting more
-  * memory from embedder-implemented allocator, such as malloc()/free().
-  *
-  * alloc() never returns NULL.  The implementation of allocChunk()
-  * is expected to perform a longjmp or exception when an allocation can't
-  * proceed.
-  */
-  Allocator alloc_;
-
   /**
   * Code memory allocator is a long lived manager for many code blocks that
   * manages interaction with an underlying code memory allocator,
@@ -103,6 +319,10 @@ public:
   *
   * The allocator coalesces free blocks when it can, in free(), but never
   * coalesces chunks.
+  *
+  * The CodeAlloc is shared by all function builders of the context and
+  * serializes its own block management, so several builders may assemble
+  * into it concurrently.
   */
   CodeAlloc code_alloc_;
 
@@ -111,29 +331,183 @@ public:
   */
   Fragments fragments_;
 
-  Assembler asm_;
+  Functions external_functions_;
 
   /**
-  * LirBuffer object to hold LIR instructions
+  * Functions that have been replaced by a newer function of the same name,
+  * by name. Callers may still hold pointers to them, so they are kept
+  * alive until the name is freed, NJX_free_replaced_functions() is called,
+  * or the context is destroyed.
   */
-  LirBuffer *lirbuf_;
+  std::multimap<std::string, LirasmFragment> retired_;
 
-  // LogControl, a class for controlling and routing debug output
-  LogControl logc_;
+  /**
+  * Guards fragments_, retired_ and external_functions_. Everything else needed to
+  * build and assemble a function is owned by its FunctionBuilderImpl, so
+  * this lock is only held for lookups and to publish a finished function.
+  */
+  std::mutex lock_;
 
-  Functions external_functions_;
+  /**
+  * Number of functions, finished or still being built, that call each
+  * jitted function by name. A function cannot be freed while it has callers.
+  */
+  std::map<std::string, int> callers_;
+
+  /**
+  * Entry stubs of the jitted functions called by other jitted functions,
+  * and the code blocks holding them; guarded by lock_. Stubs and their
+  * slots live as long as the context.
+  */
+  std::map<std::string, EntryStub> stubs_;
+  CodeList *stub_code_;
+
+  /**
+  * Patchable constants by name; guarded by lock_.
+  */
+  std::map<std::string, PatchCell *> patchables_;
+
+  /**
+  * Functions of at most this many instructions are inlined into optimized
+  * callers; 0 disables inlining. Guarded by lock_.
+  */
+  int inline_limit_;
+
+  /**
+  * Loop unroll factor for optimized functions; 0 or 1 disables unrolling.
+  * Guarded by lock_.
+  */
+  int unroll_factor_;
+
+  /**
+  * Set if functions are compiled with profiling counters. Guarded by
+  * lock_.
+  */
+  bool profiling_;
+
+  /**
+  * Worker threads for NJX_finalize_async(); created on first use.
+  */
+  CompileQueue *compile_queue_;
+
+  /**
+  * Directory of the on-disk code cache, empty if disabled; guarded by lock_.
+  */
+  std::string code_cache_dir_;
+
+  std::atomic<int> code_cache_hits_;
+  std::atomic<int> code_cache_misses_;
+
+  /**
+  * Tiered compilation: the entry count at which functions are recompiled
+  * with optimization (0 if disabled), the state of every tiered function,
+  * and the recompiles queued and completed. All guarded by lock_.
+  */
+  int tier_threshold_;
+  std::vector<TierState *> tiers_;
+  int tier_pending_;
+  int tier_done_;
+  std::condition_variable tier_idle_;
 
 public:
   NanoJitContextImpl(bool verbose, Config config);
   ~NanoJitContextImpl();
 
-  LirasmFragment *get_fragment(const char *name);
+  // Copies out the function registered under name; returns false if there
+  // is none
+  bool get_fragment(const char *name, LirasmFragment &f);
+
+  // Publish a compiled function under the given name, replacing any
+  // previous function of the same name. If forward is set f is the
+  // optimized tier of the function, and is only published if its first
+  // tier is still current, which then forwards its calls to forward.
+  bool publish(const std::string &name, const LirasmFragment &f,
+               void *forward);
+
+  // Queue the ticket's builder for finalization on a worker thread
+  void enqueue(CompileTicket *ticket);
+
+  // Set the directory of the code cache; an empty name disables it
+  bool setCodeCache(const std::string &dir);
+
+  // Returns the code cache directory, or an empty string if disabled
+  std::string codeCacheDir();
+
+  // Release the code, data and registry entry of the named function and
+  // of the versions it replaced, except its first tier; fails if there is
+  // no such function or other functions still call it
+  bool freeFunction(const std::string &name);
+
+  // Release the versions of the named function that have been replaced,
+  // returning how many were freed
+  int freeReplaced(const std::string &name);
+
+  // Returns the code and data of a function to the context, adding its
+  // callees to callees; lock_ must be held
+  void release(LirasmFragment &f, std::vector<std::string> &callees);
+
+  // Releases the replaced versions of the named function other than the
+  // first tier of the given tiered function; lock_ must be held
+  int releaseReplaced(const std::string &name, TierState *tier,
+                      std::vector<std::string> &callees);
 
   // Lookup a function in fragments; populate CallInfo if found
   // Returns 0 if not found
   // Returns 1 if external
-  // Returns 2 if internal
-  int lookupFunction(const std::string &name, CallInfo *&ci);
+  // Returns 2 if internal, in which case the fragment is added to callees
+  // and cannot be freed until released via dropCallees()
+  int lookupFunction(const std::string &name, CallInfo *&ci,
+                     std::vector<std::string> &callees);
+
+  // Undo the caller counts taken by lookupFunction()
+  void dropCallees(const std::vector<std::string> &callees);
+
+  // Returns the address jitted code should call to reach the named
+  // function, creating its entry stub if needed; lock_ must be held
+  uintptr_t entryFor(const std::string &name, const LirasmFragment &f);
+
+  // Returns the named patchable constant, creating it with a value of 0 if
+  // needed; nullptr if it exists with another type
+  PatchCell *patchable(const std::string &name, ArgType type);
+
+  // Sets a patchable constant to the given bits
+  bool setPatchable(const std::string &name, ArgType type, int64_t bits);
+
+  void setInlineLimit(int instructions);
+  int inlineLimit();
+
+  void setUnrollFactor(int factor);
+  int unrollFactor();
+
+  void setProfiling(bool enabled);
+  bool profiling();
+
+  // Copies out the execution counts of the named function; returns false
+  // if there is no such function or it is not profiled
+  bool getProfile(const std::string &name, NJXProfile *profile,
+                  NJXBranchProfile *branches, int maxBranches,
+                  NJXBranchProfile *loops, int maxLoops);
+
+  // Copies out the LIR of the named function for inlining; returns false if
+  // it cannot be inlined
+  bool inlineBody(const std::string &name, std::string &body);
+
+  void setTierThreshold(int calls);
+
+  // Returns the state for a new tiered function, or nullptr if tiering is
+  // disabled
+  TierState *newTier(const std::string &name, ArgType rvalue,
+                     const ArgType *args, int argc);
+
+  // Called by the first tier of a function once its count runs out; queues
+  // the optimizing recompile
+  void tierUp(TierState *tier);
+
+  // Compiles the function again with optimization; runs on a worker thread
+  void *recompile(TierState *tier);
+
+  // Waits for all queued recompiles, returning the number that succeeded
+  int waitForTierUp();
 
   // Register an external function - assumed to be C calling
   // convention
@@ -152,9 +526,35 @@ private:
 
   const std::string fragName_;
 
+  // The context's code generation settings, adjusted for this function
+  Config config_;
+
+  /**
+  * Every builder has its own allocators, LirBuffer and Assembler so that
+  * functions can be built and compiled on different threads at the same
+  * time; only the parent's CodeAlloc and fragment registry are shared.
+  *
+  * alloc_ holds the LIR and everything that is only needed while
+  * compiling. dataAlloc_ holds data referenced by the generated code and is
+  * handed over to the parent when the function is published.
+  */
+  Allocator alloc_;
+
+  Allocator *dataAlloc_;
+
+  // LogControl, a class for controlling and routing debug output
+  LogControl logc_;
+
+  /**
+  * LirBuffer object to hold LIR instructions
+  */
+  LirBuffer *lirbuf_;
+
+  Assembler *assm_;
+
   /**
   * Once the instructions are in the LirBuffer, the application calls
-  * parent_.asm_.compile() to produce machine code, which is stored in
+  * assm_->compile() to produce machine code, which is stored in
   * the fragment. The result of compilation is a function that the
   * application can call from C via a pointer to the first instruction.
   */
@@ -179,7 +579,7 @@ private:
 
   LirWriter *cseFilter_;
 
-  LirWriter *exprFilter_;
+  ExprFilter *exprFilter_;
 
   LirWriter *verboseWriter_;
 
@@ -197,13 +597,48 @@ private:
 
   LIns *params_[MAXARGS];
 
+  // Jitted functions called by this function; they are kept from being
+  // freed while this function exists
+  std::vector<std::string> callees_;
+
+  // Name of the function called through each CallInfo
+  std::map<const CallInfo *, std::string> callNames_;
+
+  // Directory of the code cache, empty if disabled
+  std::string cacheDir_;
+
+  // Records relocations while assembling for the code cache
+  CodeCacheWriter *cacheWriter_;
+
+  // The LIR_start and parameters written by the constructor
+  std::vector<LIns *> prologue_;
+
+  // Set if the function is compiled in tiered mode; firstTier_ is true for
+  // the unoptimized tier, which counts calls from the code between
+  // tierEntry_ and tierBody_
+  TierState *tier_;
+  bool firstTier_;
+  LIns *tierEntry_;
+  LIns *tierBody_;
+
+  // Set if the code written by this builder is profiled; the counters of
+  // the conditional branches and of the branches to earlier labels are
+  // kept in the order they were written
+  bool profiling_;
+  uint64_t *entryCount_;
+  std::vector<ProfileCounter> branchCounts_;
+  std::vector<ProfileCounter> loopCounts_;
+
 private:
-  static uint32_t sProfId;
+  static std::atomic<uint32_t> sProfId;
 
 public:
+  // recompiling is the state of the tiered function being recompiled with
+  // optimization, if any
   FunctionBuilderImpl(NanoJitContextImpl &parent,
                       const std::string &fragmentName, ArgType rvalue,
-                      const ArgType *args, int argc, bool optimize);
+                      const ArgType *args, int argc, bool optimize,
+                      TierState *recompiling = nullptr);
   ~FunctionBuilderImpl();
 
   /**
@@ -226,6 +661,11 @@ public:
   */
   LIns *retq(LIns *result);
 
+  /**
+  * Adds a float4 return instruction.
+  */
+  LIns *retf4(LIns *result);
+
   /**
   * Add a void return - TODO check that LIR_x is the right instruction to emit
   */
@@ -252,14 +692,29 @@ public:
   LIns *immf(float f) { return lir_->insImmF(f); }
 
   /**
-  * Adds a function parameter - the parameter size is always the
+  * Creates a float4 constant
+  */
+  LIns *immf4(float x, float y, float z, float w) {
+    float4_t f4 = {x, y, z, w};
+    return lir_->insImmF4(f4);
+  }
+
+  /**
+  * Reads the current value of the named patchable constant
+  */
+  LIns *patchable(const char *name, ArgType type);
+
+  /**
+  * Adds a function parameter - integer parameters are always the
   * default register size I think - so on a 64-bit machine it will be
   * quads whereas on 32-bit machines it will be words. Caller must
-  * handle this and convert to type needed.
-  * This also means that only primitive values and pointers can be
-  * used as function parameters.
+  * handle this and convert to type needed. Double and float parameters
+  * arrive as such.
   */
-  LIns *insertParameter() { return lir_->insParam(paramCount_++, 0); }
+  LIns *insertParameter() {
+    int pos = paramCount_++;
+    return lir_->insParam(paramNumber(args_, pos), 0, paramOpcode(args_[pos]));
+  }
 
   LIns *getParameter(int pos);
 
@@ -276,17 +731,18 @@ public:
   /**
   * Inserts an unconditional jump - to can be NULL and set later
   */
-  LIns *br(LIns *to) { return lir_->insBranch(LIR_j, NULL, to); }
+  LIns *br(LIns *to) { return cbrHint(LIR_j, NULL, to, NJX_BRANCH_NORMAL); }
 
   /**
   * Inserts a conditional branch - jump targets can be NULL and set later
   */
   LIns *cbrTrue(LIns *cond, LIns *to) {
-    return lir_->insBranch(LIR_jt, cond, to);
+    return cbrHint(LIR_jt, cond, to, NJX_BRANCH_NORMAL);
   }
   LIns *cbrFalse(LIns *cond, LIns *to) {
-    return lir_->insBranch(LIR_jf, cond, to);
+    return cbrHint(LIR_jf, cond, to, NJX_BRANCH_NORMAL);
   }
+  LIns *cbrHint(LOpcode op, LIns *cond, LIns *to, NJXBranchHint hint);
   LIns *jmpTable(LIns *index, uint32_t size) {
     return lir_->insJtbl(index, size);
   }
@@ -321,6 +777,9 @@ public:
   LIns *loadf2d(LIns *ptr, int32_t offset) {
     return lir_->insLoad(LIR_ldf2d, ptr, offset, ACCSET_OTHER);
   }
+  LIns *loadf4(LIns *ptr, int32_t offset) {
+    return lir_->insLoad(LIR_ldf4, ptr, offset, ACCSET_OTHER);
+  }
 
   LIns *storei2c(LIns *value, LIns *ptr, int32_t offset) {
     return lir_->insStore(LIR_sti2c, value, ptr, offset, ACCSET_OTHER);
@@ -340,6 +799,9 @@ public:
   LIns *storef(LIns *value, LIns *ptr, int32_t offset) {
     return lir_->insStore(LIR_stf, value, ptr, offset, ACCSET_OTHER);
   }
+  LIns *storef4(LIns *value, LIns *ptr, int32_t offset) {
+    return lir_->insStore(LIR_stf4, value, ptr, offset, ACCSET_OTHER);
+  }
 
   LIns *addi(LIns *lhs, LIns *rhs) { return lir_->ins2(LIR_addi, lhs, rhs); }
   LIns *addq(LIns *lhs, LIns *rhs) { return lir_->ins2(LIR_addq, lhs, rhs); }
@@ -353,9 +815,20 @@ public:
 
   LIns *muli(LIns *lhs, LIns *rhs) { return lir_->ins2(LIR_muli, lhs, rhs); }
   LIns *mulq(LIns *lhs, LIns *rhs) { return lir_->ins2(LIR_mulq, lhs, rhs); }
+  LIns *mulhq(LIns *lhs, LIns *rhs) { return lir_->ins2(LIR_mulhq, lhs, rhs); }
   LIns *muld(LIns *lhs, LIns *rhs) { return lir_->ins2(LIR_muld, lhs, rhs); }
   LIns *mulf(LIns *lhs, LIns *rhs) { return lir_->ins2(LIR_mulf, lhs, rhs); }
 
+#if NJ_FMA_SUPPORTED
+  LIns *fmad(LIns *a, LIns *b, LIns *c) { return lir_->ins3(LIR_fmad, a, b, c); }
+  LIns *fmaf(LIns *a, LIns *b, LIns *c) { return lir_->ins3(LIR_fmaf, a, b, c); }
+  LIns *fmaf4(LIns *a, LIns *b, LIns *c) { return lir_->ins3(LIR_fmaf4, a, b, c); }
+#else
+  LIns *fmad(LIns *a, LIns *b, LIns *c) { return addd(muld(a, b), c); }
+  LIns *fmaf(LIns *a, LIns *b, LIns *c) { return addf(mulf(a, b), c); }
+  LIns *fmaf4(LIns *a, LIns *b, LIns *c) { return addf4(mulf4(a, b), c); }
+#endif
+
   LIns *divi(LIns *lhs, LIns *rhs) { return lir_->ins2(LIR_divi, lhs, rhs); }
   LIns *divq(LIns *lhs, LIns *rhs) { return lir_->ins2(LIR_divq, lhs, rhs); }
   LIns *divd(LIns *lhs, LIns *rhs) { return lir_->ins2(LIR_divd, lhs, rhs); }
@@ -374,6 +847,20 @@ public:
   LIns *negf(LIns *lhs) { return lir_->ins1(LIR_negf, lhs); }
   LIns *negd(LIns *lhs) { return lir_->ins1(LIR_negd, lhs); }
 
+  LIns *mind(LIns *lhs, LIns *rhs) { return lir_->ins2(LIR_mind, lhs, rhs); }
+  LIns *maxd(LIns *lhs, LIns *rhs) { return lir_->ins2(LIR_maxd, lhs, rhs); }
+  LIns *minf(LIns *lhs, LIns *rhs) { return lir_->ins2(LIR_minf, lhs, rhs); }
+  LIns *maxf(LIns *lhs, LIns *rhs) { return lir_->ins2(LIR_maxf, lhs, rhs); }
+
+  LIns *floord(LIns *q) { return lir_->ins1(LIR_floord, q); }
+  LIns *ceild(LIns *q) { return lir_->ins1(LIR_ceild, q); }
+  LIns *truncd(LIns *q) { return lir_->ins1(LIR_truncd, q); }
+  LIns *roundd(LIns *q) { return lir_->ins1(LIR_roundd, q); }
+  LIns *floorf(LIns *q) { return lir_->ins1(LIR_floorf, q); }
+  LIns *ceilf(LIns *q) { return lir_->ins1(LIR_ceilf, q); }
+  LIns *truncf(LIns *q) { return lir_->ins1(LIR_truncf, q); }
+  LIns *roundf(LIns *q) { return lir_->ins1(LIR_roundf, q); }
+
   LIns *noti(LIns *lhs) { return lir_->ins1(LIR_noti, lhs); }
   LIns *notq(LIns *lhs) { return lir_->ins1(LIR_notq, lhs); }
 
@@ -395,6 +882,20 @@ public:
   LIns *rshui(LIns *lhs, LIns *rhs) { return lir_->ins2(LIR_rshui, lhs, rhs); }
   LIns *rshuq(LIns *lhs, LIns *rhs) { return lir_->ins2(LIR_rshuq, lhs, rhs); }
 
+  LIns *popcnti(LIns *lhs) { return lir_->ins1(LIR_popcnti, lhs); }
+  LIns *popcntq(LIns *lhs) { return lir_->ins1(LIR_popcntq, lhs); }
+  LIns *lzcnti(LIns *lhs) { return lir_->ins1(LIR_lzcnti, lhs); }
+  LIns *lzcntq(LIns *lhs) { return lir_->ins1(LIR_lzcntq, lhs); }
+  LIns *tzcnti(LIns *lhs) { return lir_->ins1(LIR_tzcnti, lhs); }
+  LIns *tzcntq(LIns *lhs) { return lir_->ins1(LIR_tzcntq, lhs); }
+  LIns *bswapi(LIns *lhs) { return lir_->ins1(LIR_bswapi, lhs); }
+  LIns *bswapq(LIns *lhs) { return lir_->ins1(LIR_bswapq, lhs); }
+
+  LIns *roli(LIns *lhs, LIns *rhs) { return lir_->ins2(LIR_roli, lhs, rhs); }
+  LIns *rolq(LIns *lhs, LIns *rhs) { return lir_->ins2(LIR_rolq, lhs, rhs); }
+  LIns *rori(LIns *lhs, LIns *rhs) { return lir_->ins2(LIR_rori, lhs, rhs); }
+  LIns *rorq(LIns *lhs, LIns *rhs) { return lir_->ins2(LIR_rorq, lhs, rhs); }
+
   LIns *lti(LIns *lhs, LIns *rhs) { return lir_->ins2(LIR_lti, lhs, rhs); }
   LIns *lei(LIns *lhs, LIns *rhs) { return lir_->ins2(LIR_lei, lhs, rhs); }
   LIns *ltui(LIns *lhs, LIns *rhs) { return lir_->ins2(LIR_ltui, lhs, rhs); }
@@ -434,13 +935,51 @@ public:
   LIns *d2i(LIns *q) { return lir_->ins1(LIR_d2i, q); }
   LIns *f2i(LIns *q) { return lir_->ins1(LIR_f2i, q); }
   LIns *d2q(LIns *q) { return lir_->ins1(LIR_d2q, q); }
+  LIns *d2ui(LIns *q) { return lir_->ins1(LIR_d2ui, q); }
+  LIns *f2ui(LIns *q) { return lir_->ins1(LIR_f2ui, q); }
+  LIns *f2q(LIns *q) { return lir_->ins1(LIR_f2q, q); }
+  LIns *q2f(LIns *q) { return lir_->ins1(LIR_q2f, q); }
+  LIns *uq2d(LIns *q) { return lir_->ins1(LIR_uq2d, q); }
+  LIns *uq2f(LIns *q) { return lir_->ins1(LIR_uq2f, q); }
   LIns *qasd(LIns *q) { return lir_->ins1(LIR_qasd, q); }
   LIns *dasq(LIns *q) { return lir_->ins1(LIR_dasq, q); }
 
+  LIns *addf4(LIns *lhs, LIns *rhs) { return lir_->ins2(LIR_addf4, lhs, rhs); }
+  LIns *subf4(LIns *lhs, LIns *rhs) { return lir_->ins2(LIR_subf4, lhs, rhs); }
+  LIns *mulf4(LIns *lhs, LIns *rhs) { return lir_->ins2(LIR_mulf4, lhs, rhs); }
+  LIns *divf4(LIns *lhs, LIns *rhs) { return lir_->ins2(LIR_divf4, lhs, rhs); }
+  LIns *minf4(LIns *lhs, LIns *rhs) { return lir_->ins2(LIR_minf4, lhs, rhs); }
+  LIns *maxf4(LIns *lhs, LIns *rhs) { return lir_->ins2(LIR_maxf4, lhs, rhs); }
+  LIns *negf4(LIns *q) { return lir_->ins1(LIR_negf4, q); }
+  LIns *absf4(LIns *q) { return lir_->ins1(LIR_absf4, q); }
+  LIns *sqrtf4(LIns *q) { return lir_->ins1(LIR_sqrtf4, q); }
+  LIns *recipf4(LIns *q) { return lir_->ins1(LIR_recipf4, q); }
+  LIns *rsqrtf4(LIns *q) { return lir_->ins1(LIR_rsqrtf4, q); }
+
+  LIns *eqf4(LIns *lhs, LIns *rhs) { return lir_->ins2(LIR_eqf4, lhs, rhs); }
+  LIns *cmpf4(LOpcode op, LIns *lhs, LIns *rhs) {
+    return lir_->ins2(op, lhs, rhs);
+  }
+
+  LIns *dotf4(LIns *lhs, LIns *rhs) { return lir_->ins2(LIR_dotf4, lhs, rhs); }
+  LIns *dotf3(LIns *lhs, LIns *rhs) { return lir_->ins2(LIR_dotf3, lhs, rhs); }
+  LIns *dotf2(LIns *lhs, LIns *rhs) { return lir_->ins2(LIR_dotf2, lhs, rhs); }
+
+  LIns *f2f4(LIns *q) { return lir_->ins1(LIR_f2f4, q); }
+  LIns *ffff2f4(LIns *x, LIns *y, LIns *z, LIns *w) {
+    return lir_->ins4(LIR_ffff2f4, x, y, z, w);
+  }
+  LIns *f4x(LIns *q) { return lir_->ins1(LIR_f4x, q); }
+  LIns *f4y(LIns *q) { return lir_->ins1(LIR_f4y, q); }
+  LIns *f4z(LIns *q) { return lir_->ins1(LIR_f4z, q); }
+  LIns *f4w(LIns *q) { return lir_->ins1(LIR_f4w, q); }
+  LIns *swzf4(LIns *q, uint8_t mask) { return lir_->insSwz(q, mask); }
+
   LIns *liveq(LIns *q) { return lir_->ins1(LIR_liveq, q); }
   LIns *livei(LIns *q) { return lir_->ins1(LIR_livei, q); }
   LIns *livef(LIns *q) { return lir_->ins1(LIR_livef, q); }
   LIns *lived(LIns *q) { return lir_->ins1(LIR_lived, q); }
+  LIns *livef4(LIns *q) { return lir_->ins1(LIR_livef4, q); }
 
   LIns *comment(const char *s) { return lir_->insComment(s); }
 
@@ -459,48 +998,167 @@ public:
   SideExit *createSideExit();
   GuardRecord *createGuardRecord(SideExit *exit);
 
+  /**
+  * Selects lookahead register allocation for this function
+  */
+  void setLookaheadRegAlloc(bool enable) {
+    config_.regalloc_lookahead = enable;
+  }
+
+  /**
+  * Allows multiply-add contraction in the instructions created from now on
+  */
+  void setFpContract(bool enable) {
+    if (exprFilter_)
+      exprFilter_->setContractFma(enable);
+  }
+
+  /**
+  * Retrieves the spills and restores emitted by the last finalize()
+  */
+  void regAllocStats(int *spills, int *restores) const {
+    if (spills)
+      *spills = assm_->spillCount();
+    if (restores)
+      *restores = assm_->restoreCount();
+  }
+
+  /**
+  * Retrieves the loads forwarded and stores removed by the last finalize()
+  */
+  void memOptStats(int *loads, int *stores) const {
+    if (loads)
+      *loads = assm_->forwardedLoadCount();
+    if (stores)
+      *stores = assm_->removedStoreCount();
+  }
+
+  /**
+  * Encodes the LIR written so far with LirSerializer. Returns the number of
+  * bytes required, or 0 on failure; the data is only copied if it fits in
+  * size bytes.
+  */
+  size_t serialize(void *buffer, size_t size);
+
+  /**
+  * Replays LIR produced by serialize() for a function of the same
+  * signature through this builder's writer pipeline
+  */
+  bool deserialize(const void *data, size_t size);
+
 private:
+  friend class BuilderSymbols;
+  friend class LoadFilter;
+
+  // Writes the code that counts calls to the first tier, and forwards them
+  // once the optimized tier exists
+  void insTierEntry();
+
+  // Writes an increment of a new profiling counter, which is returned
+  uint64_t *insCount();
+
+  // Collects the profiling counters placed by this builder, or those of
+  // the first tier if this is the optimizing recompile; nullptr if the
+  // function is not profiled
+  const Profile *profile();
+
+  // Encodes the LIR of the function body into out, leaving out the tier
+  // entry code, and the profiling counters unless counters is set
+  bool serializeTo(std::string &out, bool counters = false);
+
+  // True if the body has at most limit instructions and can be inlined:
+  // it has no guards, and a single return at the end
+  bool inlinable(int limit);
+
+  // Writes the body of the called function in place of the call if it can
+  // be inlined, returning the result; nullptr if the call must be made
+  LIns *inlineCall(const CallInfo *ci, LIns *args[]);
+
+  // Computes the code cache key from the LIR and everything else that
+  // affects code generation; returns false if the code cannot be cached
+  bool cacheKey(uint64_t &key);
+
+  std::string cachePath(uint64_t key);
+
+  // Loads the code for key from the cache into fragment_ and codeList
+  bool loadCached(uint64_t key, CodeList *&codeList);
+
+  // Saves the code just assembled to the cache
+  void saveCached(uint64_t key, CodeList *codeList);
+
   // Prohibit copying.
   FunctionBuilderImpl(const FunctionBuilderImpl &) = delete;
   FunctionBuilderImpl &operator=(const FunctionBuilderImpl &) = delete;
 };
 
-uint32_t FunctionBuilderImpl::sProfId = 0;
+std::atomic<uint32_t> FunctionBuilderImpl::sProfId(0);
 
 NanoJitContextImpl::NanoJitContextImpl(bool verbose, Config config)
-    : verbose_(verbose), config_(config), code_alloc_(&config),
-      asm_(code_alloc_, alloc_, alloc_, &logc_, config_) {
-  verbose_ = verbose;
-  logc_.lcbits = 0;
-
-  lirbuf_ = new (alloc_) LirBuffer(alloc_);
-#ifdef DEBUG
-  if (verbose) {
-    logc_.lcbits = LC_ReadLIR | LC_AfterDCE | LC_Native | LC_RegAlloc |
-                   LC_Activation | LC_Bytes;
-    lirbuf_->printer = new (alloc_) LInsPrinter(alloc_, LIRASM_NUM_USED_ACCS);
+    : verbose_(verbose), config_(config), code_alloc_(&config_),
+      stub_code_(nullptr), inline_limit_(0), unroll_factor_(0),
+      profiling_(false), compile_queue_(nullptr), code_cache_hits_(0),
+      code_cache_misses_(0), tier_threshold_(0), tier_pending_(0),
+      tier_done_(0) {}
+
+bool NanoJitContextImpl::setCodeCache(const std::string &dir) {
+  if (!dir.empty()) {
+    if (!NJ_RELOCATION_SUPPORTED) {
+      fprintf(stderr, "Error: code cache is not supported on this platform\n");
+      return false;
+    }
+    if (config_.harden_nop_insertion || config_.harden_blind_constants ||
+        config_.harden_function_alignment) {
+      fprintf(stderr, "Error: code cache cannot be used with JIT hardening\n");
+      return false;
+    }
   }
-#endif
+  std::lock_guard<std::mutex> guard(lock_);
+  code_cache_dir_ = dir;
+  return true;
 }
 
-NanoJitContextImpl::~NanoJitContextImpl() {
-  Fragments::iterator i;
-  for (i = fragments_.begin(); i != fragments_.end(); ++i) {
-    delete i->second.fragptr;
-  }
+std::string NanoJitContextImpl::codeCacheDir() {
+  std::lock_guard<std::mutex> guard(lock_);
+  return code_cache_dir_;
 }
 
-LirasmFragment *NanoJitContextImpl::get_fragment(const char *name) {
+bool NanoJitContextImpl::get_fragment(const char *name, LirasmFragment &f) {
   std::string n(name);
+  std::lock_guard<std::mutex> guard(lock_);
   auto const &result = fragments_.find(n);
   if (result == fragments_.end())
-    return nullptr;
-  return &result->second;
+    return false;
+  f = result->second;
+  return true;
+}
+
+bool NanoJitContextImpl::publish(const std::string &name,
+                                 const LirasmFragment &f, void *forward) {
+  std::lock_guard<std::mutex> guard(lock_);
+  auto const &existing = fragments_.find(name);
+  if (forward) {
+    // The function may have been freed or replaced while recompiling
+    if (existing == fragments_.end() || existing->second.tier != f.tier)
+      return false;
+    f.tier->entry = forward;
+  }
+  // Calls from other jitted functions follow straight away
+  auto const &stub = stubs_.find(name);
+  if (stub != stubs_.end())
+    *stub->second.slot = (void *)f.fragptr->code();
+  if (existing != fragments_.end()) {
+    // The old code stays in the CodeAlloc until the context dies as
+    // callers may still hold pointers to it, and so must its data.
+    retired_.insert(std::make_pair(name, existing->second));
+  }
+  fragments_[name] = f;
+  return true;
 }
 
 bool NanoJitContextImpl::registerFunction(const std::string &name, void *fptr,
                                           ArgType retval, const ArgType *args,
                                           int argc) {
+  std::lock_guard<std::mutex> guard(lock_);
   for (int i = 0; i < external_functions_.size(); i++) {
     auto &function = external_functions_[i];
     if (function.name == name) {
@@ -519,14 +1177,14 @@ bool NanoJitContextImpl::registerFunction(const std::string &name, void *fptr,
     return false;
   }
   for (int i = 0; i < argc; i++) {
-    if (args[i] < ARGTYPE_I && args[i] > ARGTYPE_F) {
+    if (args[i] < ARGTYPE_I || args[i] > ARGTYPE_F4) {
       fprintf(stderr, "Error in arg[%d]: Function cannot accept this type of "
                       "argument at present\n",
               i);
       return false;
     }
   }
-  if (retval < ARGTYPE_V || retval > ARGTYPE_F) {
+  if (retval < ARGTYPE_V || retval > ARGTYPE_F4) {
     fprintf(stderr, "Error: Function must return a value\n");
     return false;
   }
@@ -548,8 +1206,10 @@ bool NanoJitContextImpl::registerFunction(const std::string &name, void *fptr,
   return true;
 }
 
-int NanoJitContextImpl::lookupFunction(const std::string &name, CallInfo *&ci) {
+int NanoJitContextImpl::lookupFunction(const std::string &name, CallInfo *&ci,
+                                       std::vector<std::string> &callees) {
 
+  std::lock_guard<std::mutex> guard(lock_);
   const size_t nfuns = external_functions_.size();
   for (size_t i = 0; i < nfuns; i++) {
     if (name == external_functions_[i].name) {
@@ -561,62 +1221,308 @@ int NanoJitContextImpl::lookupFunction(const std::string &name, CallInfo *&ci) {
   Fragments::const_iterator func = fragments_.find(name);
   if (func != fragments_.end()) {
     // The ABI, arg types and ret type will be overridden by the caller.
-    if (func->second.mReturnType == RT_DOUBLE) {
-      CallInfo target = {
-          (uintptr_t)func->second.rdouble, func->second.typeSig, ABI_FASTCALL,
-          /*isPure*/ 0, ACCSET_STORE_ANY verbose_only(, func->first.c_str())};
-      *ci = target;
-    } else if (func->second.mReturnType == RT_FLOAT) {
-      CallInfo target = {
-          (uintptr_t)func->second.rfloat, func->second.typeSig, ABI_FASTCALL,
-          /*isPure*/ 0, ACCSET_STORE_ANY verbose_only(, func->first.c_str())};
-      *ci = target;
-    } else if (func->second.mReturnType == RT_QUAD) {
-      CallInfo target = {
-          (uintptr_t)func->second.rquad, func->second.typeSig, ABI_FASTCALL,
-          /*isPure*/ 0, ACCSET_STORE_ANY verbose_only(, func->first.c_str())};
-      *ci = target;
-    } else {
-      CallInfo target = {
-          (uintptr_t)func->second.rint, func->second.typeSig, ABI_FASTCALL,
-          /*isPure*/ 0, ACCSET_STORE_ANY verbose_only(, func->first.c_str())};
-      *ci = target;
-    }
+    CallInfo target = {entryFor(name, func->second), func->second.typeSig,
+                       ABI_FASTCALL, /*isPure*/ 0,
+                       ACCSET_STORE_ANY verbose_only(, func->first.c_str())};
+    *ci = target;
+    callers_[name]++;
+    callees.push_back(name);
     return 2;
   } else {
     return 0;
   }
 }
 
-FunctionBuilderImpl::FunctionBuilderImpl(NanoJitContextImpl &parent,
-                                         const std::string &fragmentName,
-                                         ArgType rvalue, const ArgType *args,
-                                         int argc, bool optimize)
-    : parent_(parent), fragName_(fragmentName), optimize_(optimize),
-      bufWriter_(nullptr), cseFilter_(nullptr), exprFilter_(nullptr),
-      verboseWriter_(nullptr), validateWriter1_(nullptr),
-      validateWriter2_(nullptr), paramCount_(0), rvalue_(rvalue) {
-  fragment_ = new Fragment(nullptr verbose_only(
-      , (parent_.logc_.lcbits & nanojit::LC_FragProfile) ? sProfId++ : 0));
-  fragment_->lirbuf = parent_.lirbuf_;
-  parent_.fragments_[fragName_].fragptr = fragment_;
-
-  lir_ = bufWriter_ = new LirBufWriter(parent_.lirbuf_, parent_.config_);
-#ifdef DEBUG
-  if (optimize) { // don't re-validate if no optimization has taken place
-    lir_ = validateWriter2_ = new ValidateWriter(
-        lir_, fragment_->lirbuf->printer, "end of writer pipeline");
-  }
-#endif
-#ifdef DEBUG
-  if (parent_.verbose_) {
-    lir_ = verboseWriter_ = new VerboseWriter(
-        parent_.alloc_, lir_, parent_.lirbuf_->printer, &parent_.logc_);
+void NanoJitContextImpl::dropCallees(const std::vector<std::string> &callees) {
+  std::lock_guard<std::mutex> guard(lock_);
+  for (auto const &callee : callees) {
+    auto const &count = callers_.find(callee);
+    NanoAssert(count != callers_.end() && count->second > 0);
+    if (--count->second == 0)
+      callers_.erase(count);
   }
+}
+
+uintptr_t NanoJitContextImpl::entryFor(const std::string &name,
+                                       const LirasmFragment &f) {
+  auto const &existing = stubs_.find(name);
+  if (existing != stubs_.end())
+    return (uintptr_t)existing->second.entry;
+#ifdef NANOJIT_X64
+  // Each stub is mov r11, slot; jmp [r11], written like the Assembler
+  // writes code: at the end of a fresh block, the rest of which is given
+  // back, before the block is made executable. R11 is a scratch register
+  // in both calling conventions and carries no argument.
+  static const uint8_t jmp[13] = {0x49, 0xbb, 0, 0, 0, 0, 0, 0, 0, 0,
+                                  0x41, 0xff, 0x23};
+  NIns *start, *end;
+  code_alloc_.alloc(start, end, 1024);
+  uint8_t *stub = (uint8_t *)(((uintptr_t)end - sizeof jmp) & ~uintptr_t(15));
+  EntryStub e;
+  e.entry = (NIns *)stub;
+  e.slot = new std::atomic<void *>((void *)f.fragptr->code());
+  memcpy(stub, jmp, sizeof jmp);
+  memcpy(stub + 2, &e.slot, sizeof e.slot);
+  code_alloc_.addRemainder(stub_code_, start, end, start, (NIns *)stub);
+  code_alloc_.markExec(stub_code_);
+  CodeAlloc::flushICache(stub, sizeof jmp);
+  stubs_[name] = e;
+  return (uintptr_t)e.entry;
+#else
+  // Without stubs calls are bound to the code current at compile time
+  return (uintptr_t)f.fragptr->code();
 #endif
-  if (optimize) {
-    lir_ = cseFilter_ = new CseFilter(lir_, LIRASM_NUM_USED_ACCS,
-                                      parent_.alloc_, parent_.config_);
+}
+
+PatchCell *NanoJitContextImpl::patchable(const std::string &name,
+                                         ArgType type) {
+  std::lock_guard<std::mutex> guard(lock_);
+  auto const &existing = patchables_.find(name);
+  if (existing != patchables_.end()) {
+    if (existing->second->type != type) {
+      fprintf(stderr, "Error: patchable constant '%s' has another type\n",
+              name.c_str());
+      return nullptr;
+    }
+    return existing->second;
+  }
+  PatchCell *cell = new PatchCell();
+  cell->bits = 0;
+  cell->type = type;
+  patchables_[name] = cell;
+  return cell;
+}
+
+void NanoJitContextImpl::setInlineLimit(int instructions) {
+  std::lock_guard<std::mutex> guard(lock_);
+  inline_limit_ = instructions > 0 ? instructions : 0;
+}
+
+int NanoJitContextImpl::inlineLimit() {
+  std::lock_guard<std::mutex> guard(lock_);
+  return inline_limit_;
+}
+
+void NanoJitContextImpl::setUnrollFactor(int factor) {
+  std::lock_guard<std::mutex> guard(lock_);
+  unroll_factor_ = factor < 0 ? 0 : factor > 16 ? 16 : factor;
+}
+
+int NanoJitContextImpl::unrollFactor() {
+  std::lock_guard<std::mutex> guard(lock_);
+  return unroll_factor_;
+}
+
+void NanoJitContextImpl::setProfiling(bool enabled) {
+  std::lock_guard<std::mutex> guard(lock_);
+  profiling_ = enabled;
+}
+
+bool NanoJitContextImpl::profiling() {
+  std::lock_guard<std::mutex> guard(lock_);
+  return profiling_;
+}
+
+static void copyCounts(const ProfileCounter *counters, uint32_t n,
+                       NJXBranchProfile *out, int max) {
+  for (uint32_t i = 0; i < n && (int)i < max; i++) {
+    uint64_t executed = *counters[i].executed;
+    uint64_t notTaken = counters[i].notTaken ? *counters[i].notTaken : 0;
+    out[i].taken = executed - notTaken;
+    out[i].not_taken = notTaken;
+  }
+}
+
+bool NanoJitContextImpl::getProfile(const std::string &name,
+                                    NJXProfile *profile,
+                                    NJXBranchProfile *branches,
+                                    int maxBranches, NJXBranchProfile *loops,
+                                    int maxLoops) {
+  std::lock_guard<std::mutex> guard(lock_);
+  auto const &func = fragments_.find(name);
+  if (func == fragments_.end() || !func->second.profile)
+    return false;
+  const Profile *p = func->second.profile;
+  if (profile) {
+    profile->entries = *p->entries;
+    profile->branches = (int)p->nbranches;
+    profile->loops = (int)p->nloops;
+  }
+  if (branches)
+    copyCounts(p->branches, p->nbranches, branches, maxBranches);
+  if (loops)
+    copyCounts(p->loops, p->nloops, loops, maxLoops);
+  return true;
+}
+
+bool NanoJitContextImpl::inlineBody(const std::string &name,
+                                    std::string &body) {
+  std::lock_guard<std::mutex> guard(lock_);
+  auto const &func = fragments_.find(name);
+  if (inline_limit_ == 0 || func == fragments_.end() ||
+      !func->second.inlineBody)
+    return false;
+  body = *func->second.inlineBody;
+  return true;
+}
+
+bool NanoJitContextImpl::setPatchable(const std::string &name, ArgType type,
+                                      int64_t bits) {
+  PatchCell *cell = patchable(name, type);
+  if (!cell)
+    return false;
+  cell->bits = bits;
+  return true;
+}
+
+bool NanoJitContextImpl::freeFunction(const std::string &name) {
+  std::vector<std::string> callees;
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    auto const &func = fragments_.find(name);
+    if (func == fragments_.end()) {
+      fprintf(stderr, "Error: cannot free unknown function '%s'\n",
+              name.c_str());
+      return false;
+    }
+    LirasmFragment &f = func->second;
+    auto const &count = callers_.find(name);
+    if (count != callers_.end()) {
+      fprintf(stderr,
+              "Error: cannot free function '%s' as it is still called by %d "
+              "other function(s)\n",
+              name.c_str(), count->second);
+      return false;
+    }
+    // The first tier lives on in retired_ and runs its own code again
+    TierState *tier = f.tier;
+    release(f, callees);
+    fragments_.erase(func);
+    releaseReplaced(name, tier, callees);
+  }
+  dropCallees(callees);
+  return true;
+}
+
+int NanoJitContextImpl::freeReplaced(const std::string &name) {
+  std::vector<std::string> callees;
+  int freed;
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    auto const &func = fragments_.find(name);
+    freed = releaseReplaced(
+        name, func != fragments_.end() ? func->second.tier : nullptr, callees);
+  }
+  dropCallees(callees);
+  return freed;
+}
+
+int NanoJitContextImpl::releaseReplaced(const std::string &name,
+                                        TierState *tier,
+                                        std::vector<std::string> &callees) {
+  int freed = 0;
+  auto const &versions = retired_.equal_range(name);
+  for (auto i = versions.first; i != versions.second;) {
+    // The first tier of the current function forwards to it, and holds the
+    // counters it bumps if profiled
+    if (tier && i->second.tier == tier) {
+      ++i;
+      continue;
+    }
+    release(i->second, callees);
+    i = retired_.erase(i);
+    freed++;
+  }
+  return freed;
+}
+
+void NanoJitContextImpl::release(LirasmFragment &f,
+                                 std::vector<std::string> &callees) {
+  // A freed optimized tier leaves its first tier to run its own code
+  if (f.tier)
+    f.tier->entry = nullptr;
+  // Returning the blocks lets CodeAlloc coalesce them with their free
+  // neighbours for reuse by later functions.
+  code_alloc_.freeAll(f.codeList);
+  delete f.fragptr;
+  delete f.dataAlloc;
+  delete f.inlineBody;
+  callees.insert(callees.end(), f.callees.begin(), f.callees.end());
+  f.callees.clear();
+}
+
+FunctionBuilderImpl::FunctionBuilderImpl(NanoJitContextImpl &parent,
+                                         const std::string &fragmentName,
+                                         ArgType rvalue, const ArgType *args,
+                                         int argc, bool optimize,
+                                         TierState *recompiling)
+    : parent_(parent), fragName_(fragmentName), config_(parent.config_),
+      dataAlloc_(new Allocator()),
+      optimize_(optimize), bufWriter_(nullptr), cseFilter_(nullptr),
+      exprFilter_(nullptr), verboseWriter_(nullptr), validateWriter1_(nullptr),
+      validateWriter2_(nullptr), paramCount_(0), rvalue_(rvalue),
+      cacheDir_(parent.codeCacheDir()), cacheWriter_(nullptr),
+      tier_(recompiling), firstTier_(false), tierEntry_(nullptr),
+      tierBody_(nullptr), entryCount_(nullptr) {
+  logc_.lcbits = 0;
+  if (!tier_ && optimize) {
+    tier_ = parent_.newTier(fragmentName, rvalue, args, argc);
+    if (tier_) {
+      // Optimization is deferred until the function turns out to be hot
+      firstTier_ = true;
+      optimize = optimize_ = false;
+      // The tier entry code refers to the TierState by address
+      cacheDir_.clear();
+    }
+  }
+  // The optimizing recompile replays the counters of the first tier
+  profiling_ = !recompiling && parent_.profiling();
+  if (profiling_) {
+    // The code refers to the counters by address
+    cacheDir_.clear();
+  }
+  // Values used in loops are kept alive by the Assembler, so front ends
+  // need not add LIR_live instructions themselves
+  config_.loop_lives = true;
+  config_.licm = optimize;
+  config_.gvn = optimize;
+  config_.memopt = optimize;
+  config_.ranges = optimize;
+  config_.divconst = optimize;
+  config_.unroll = optimize ? parent_.unrollFactor() : 0;
+  lirbuf_ = new (alloc_) LirBuffer(alloc_);
+#ifdef DEBUG
+  if (parent_.verbose_) {
+    logc_.lcbits = LC_ReadLIR | LC_AfterDCE | LC_Native | LC_RegAlloc |
+                   LC_Activation | LC_Bytes;
+    lirbuf_->printer = new (alloc_) LInsPrinter(alloc_, LIRASM_NUM_USED_ACCS);
+  }
+#endif
+  if (!cacheDir_.empty())
+    cacheWriter_ = new CodeCacheWriter();
+  assm_ = new Assembler(parent_.code_alloc_, *dataAlloc_, alloc_, &logc_,
+                        config_, cacheWriter_);
+
+  fragment_ = new Fragment(nullptr verbose_only(
+      , (logc_.lcbits & nanojit::LC_FragProfile) ? sProfId++ : 0));
+  fragment_->lirbuf = lirbuf_;
+
+  lir_ = bufWriter_ = new LirBufWriter(lirbuf_, config_);
+#ifdef DEBUG
+  if (optimize) { // don't re-validate if no optimization has taken place
+    lir_ = validateWriter2_ = new ValidateWriter(
+        lir_, fragment_->lirbuf->printer, "end of writer pipeline");
+  }
+#endif
+#ifdef DEBUG
+  if (parent_.verbose_) {
+    lir_ = verboseWriter_ =
+        new VerboseWriter(alloc_, lir_, lirbuf_->printer, &logc_);
+  }
+#endif
+  if (optimize) {
+    lir_ = cseFilter_ = new CseFilter(lir_, LIRASM_NUM_USED_ACCS, alloc_,
+                                      config_);
   }
   if (optimize) {
     lir_ = exprFilter_ = new ExprFilter(lir_);
@@ -626,20 +1532,148 @@ FunctionBuilderImpl::FunctionBuilderImpl(NanoJitContextImpl &parent,
                                                "start of writer pipeline");
 #endif
   returnTypeBits_ = 0;
-  lir_->ins0(LIR_start);
+  prologue_.push_back(lir_->ins0(LIR_start));
   if (argc < 0)
     argc = 0;
   if (argc > MAXARGS)
     argc = MAXARGS;
   for (int i = 0; i < nanojit::NumSavedRegs; ++i) {
-    lir_->insParam(i, 1);
+    prologue_.push_back(lir_->insParam(i, 1));
   }
   // For each expected argument
   // we create an instruction
   for (int i = 0; i < argc; i++) {
     args_[i] = args[i];
     params_[i] = insertParameter();
+    prologue_.push_back(params_[i]);
+  }
+  if (firstTier_)
+    insTierEntry();
+  // Calls forwarded to the optimized tier are counted there
+  if (profiling_)
+    entryCount_ = insCount();
+}
+
+/**
+* Tier-up hook called from the first tier of a tiered function
+*/
+static void tierUp(TierState *tier) { tier->context->tierUp(tier); }
+
+void FunctionBuilderImpl::insTierEntry() {
+  // If the optimized code exists, call it and return its result
+  tierEntry_ = lir_->insImmP(&tier_->entry);
+  LIns *entry = lir_->insLoad(LIR_ldp, tierEntry_, 0, ACCSET_OTHER);
+  LIns *notReady = lir_->insBranch(LIR_jt, lir_->insEqP_0(entry), nullptr);
+
+  // An indirect call takes the address as its first argument
+  ArgType argTypes[MAXARGS];
+  LIns *args[MAXARGS]; // In reverse order
+  argTypes[0] = ARGTYPE_P;
+  args[paramCount_] = entry;
+  for (int i = 0; i < paramCount_; i++) {
+    // Integer parameters are words, see getParameter()
+    argTypes[i + 1] = paramOpcode(args_[i]) == LIR_paramp ? ARGTYPE_P : args_[i];
+    args[paramCount_ - 1 - i] = params_[i];
   }
+  CallInfo *forward = new (alloc_) CallInfo;
+  memset(forward, 0, sizeof(CallInfo));
+  forward->_address = CALL_INDIRECT;
+  forward->_typesig = CallInfo::typeSigN(rvalue_, paramCount_ + 1, argTypes);
+  forward->_abi = ABI_FASTCALL;
+  forward->_storeAccSet = ACCSET_STORE_ANY;
+  verbose_only(forward->_name = "tier2";)
+  LIns *result = lir_->insCall(forward, args);
+  switch (rvalue_) {
+  case ARGTYPE_I:
+    lir_->ins1(LIR_reti, result);
+    break;
+  case ARGTYPE_Q:
+    lir_->ins1(LIR_retq, result);
+    break;
+  case ARGTYPE_D:
+    lir_->ins1(LIR_retd, result);
+    break;
+  case ARGTYPE_F4:
+    lir_->ins1(LIR_retf4, result);
+    break;
+  default:
+    NanoAssert(rvalue_ == ARGTYPE_F);
+    lir_->ins1(LIR_retf, result);
+    break;
+  }
+  notReady->setTarget(lir_->ins0(LIR_label));
+
+  // Otherwise count the call, and ask for the optimized code when the
+  // count reaches zero
+  LIns *counter = lir_->insImmP(&tier_->count);
+  LIns *count = lir_->ins2(LIR_subi,
+                           lir_->insLoad(LIR_ldi, counter, 0, ACCSET_OTHER),
+                           lir_->insImmI(1));
+  lir_->insStore(LIR_sti, count, counter, 0, ACCSET_OTHER);
+  LIns *notHot = lir_->insBranch(
+      LIR_jf, lir_->ins2(LIR_eqi, count, lir_->insImmI(0)), nullptr);
+  CallInfo *hook = new (alloc_) CallInfo;
+  memset(hook, 0, sizeof(CallInfo));
+  ArgType hookArgs[1] = {ARGTYPE_P};
+  hook->_address = (uintptr_t)tierUp;
+  hook->_typesig = CallInfo::typeSigN(ARGTYPE_V, 1, hookArgs);
+  hook->_abi = ABI_CDECL;
+  hook->_storeAccSet = ACCSET_STORE_ANY;
+  verbose_only(hook->_name = "tierUp";)
+  LIns *hookArg[1] = {lir_->insImmP(tier_)};
+  lir_->insCall(hook, hookArg);
+  tierBody_ = lir_->ins0(LIR_label);
+  notHot->setTarget(tierBody_);
+}
+
+uint64_t *FunctionBuilderImpl::insCount() {
+  uint64_t *counter = new (*dataAlloc_) uint64_t(0);
+  lir_->ins1(LIR_count, lir_->insImmP(counter));
+  return counter;
+}
+
+LIns *FunctionBuilderImpl::cbrHint(LOpcode op, LIns *cond, LIns *to,
+                                   NJXBranchHint hint) {
+  // A branch to a label that exists already goes back to the top of a
+  // loop; other unconditional jumps are not counted
+  bool backward = to != nullptr;
+  uint64_t *executed =
+      profiling_ && (op != LIR_j || backward) ? insCount() : nullptr;
+  LIns *br = lir_->insBranch(op, cond, to);
+  // The branch may have been folded away or into a LIR_j
+  bool conditional = br && (br->isop(LIR_jt) || br->isop(LIR_jf));
+  if (conditional) {
+    if (hint == NJX_BRANCH_LIKELY)
+      lir_->ins0(LIR_likely);
+    else if (hint == NJX_BRANCH_UNLIKELY)
+      lir_->ins0(LIR_unlikely);
+  }
+  if (executed) {
+    ProfileCounter counter = {executed, nullptr};
+    if (conditional)
+      counter.notTaken = insCount();
+    else if (!br)
+      counter.notTaken = executed;
+    if (op != LIR_j)
+      branchCounts_.push_back(counter);
+    if (backward)
+      loopCounts_.push_back(counter);
+  }
+  return br;
+}
+
+const Profile *FunctionBuilderImpl::profile() {
+  if (!profiling_)
+    return tier_ && !firstTier_ ? tier_->profile : nullptr;
+  Profile *p = new (*dataAlloc_) Profile();
+  p->entries = entryCount_;
+  p->nbranches = (uint32_t)branchCounts_.size();
+  p->branches = new (*dataAlloc_) ProfileCounter[p->nbranches];
+  std::copy(branchCounts_.begin(), branchCounts_.end(), p->branches);
+  p->nloops = (uint32_t)loopCounts_.size();
+  p->loops = new (*dataAlloc_) ProfileCounter[p->nloops];
+  std::copy(loopCounts_.begin(), loopCounts_.end(), p->loops);
+  return p;
 }
 
 FunctionBuilderImpl::~FunctionBuilderImpl() {
@@ -649,6 +1683,13 @@ FunctionBuilderImpl::~FunctionBuilderImpl() {
   delete exprFilter_;
   delete cseFilter_;
   delete bufWriter_;
+  delete assm_;
+  delete cacheWriter_;
+  // Only set if the function was never published
+  delete fragment_;
+  delete dataAlloc_;
+  if (!callees_.empty())
+    parent_.dropCallees(callees_);
 }
 
 LIns *FunctionBuilderImpl::getParameter(int pos) {
@@ -668,21 +1709,34 @@ LIns *FunctionBuilderImpl::getParameter(int pos) {
   }
 }
 
+LIns *FunctionBuilderImpl::patchable(const char *name, ArgType type) {
+  PatchCell *cell = parent_.patchable(std::string(name), type);
+  if (!cell)
+    return nullptr;
+  // The value is fixed for the duration of a call, so the load may be
+  // shared and hoisted like an immediate
+  LOpcode op = type == ARGTYPE_I ? LIR_ldi : type == ARGTYPE_Q ? LIR_ldq
+                                                                 : LIR_ldd;
+  return lir_->insLoad(op, lir_->insImmP(&cell->bits), 0, ACCSET_OTHER,
+                       LOAD_CONST);
+}
+
 LIns *FunctionBuilderImpl::call(const char *funcname, LOpcode opcode,
                                 AbiKind abi, int argc, LIns *argsin[]) {
   if (argc < 0 || argc > MAXARGS)
     return nullptr;
 
   std::string func(funcname);
-  CallInfo *ci = new (parent_.alloc_) CallInfo;
+  CallInfo *ci = new (alloc_) CallInfo;
 
   // We can only call functions previously defined
   // TODO is there a need to handle functions compiled by
   // nanojit differently than externally defined functions.
   // Internals are FASTCALL for example
-  int known = parent_.lookupFunction(func, ci);
+  int known = parent_.lookupFunction(func, ci, callees_);
   if (!known)
     return nullptr;
+  callNames_[ci] = func;
 
   ArgType argTypes[MAXARGS]; // In order
   LIns *args[MAXARGS];	// In reverse order
@@ -698,6 +1752,8 @@ LIns *FunctionBuilderImpl::call(const char *funcname, LOpcode opcode,
       argTypes[j] = ARGTYPE_D;
     else if (args[i]->isF())
       argTypes[j] = ARGTYPE_F;
+    else if (args[i]->isF4())
+      argTypes[j] = ARGTYPE_F4;
     else if (args[i]->isQ())
       argTypes[j] = ARGTYPE_Q;
     else
@@ -716,6 +1772,8 @@ LIns *FunctionBuilderImpl::call(const char *funcname, LOpcode opcode,
     retType = ARGTYPE_D;
   else if (opcode == LIR_callf)
     retType = ARGTYPE_F;
+  else if (opcode == LIR_callf4)
+    retType = ARGTYPE_F4;
   else
     return nullptr;
 
@@ -728,6 +1786,11 @@ LIns *FunctionBuilderImpl::call(const char *funcname, LOpcode opcode,
 
   ci->_typesig = callSiteTypeSig;
 
+  if (known == 2) {
+    LIns *result = inlineCall(ci, args);
+    if (result)
+      return result;
+  }
   return lir_->insCall(ci, args);
 }
 
@@ -755,103 +1818,1062 @@ LIns *FunctionBuilderImpl::retq(LIns *result) {
   return lir_->ins1(LIR_retq, result);
 }
 
+LIns *FunctionBuilderImpl::retf4(LIns *result) {
+  NanoAssert(rvalue_ == ARGTYPE_F4);
+  returnTypeBits_ |= ReturnType::RT_FLOAT4;
+  return lir_->ins1(LIR_retf4, result);
+}
+
 SideExit *FunctionBuilderImpl::createSideExit() {
-  SideExit *exit = new (parent_.alloc_) SideExit();
+  SideExit *exit = new (*dataAlloc_) SideExit();
   memset(exit, 0, sizeof(SideExit));
   exit->from = fragment_;
   exit->target = nullptr;
   return exit;
 }
 
-GuardRecord *FunctionBuilderImpl::createGuardRecord(SideExit *exit) {
-  GuardRecord *rec = new (parent_.alloc_) GuardRecord;
-  memset(rec, 0, sizeof(GuardRecord));
-  rec->exit = exit;
-  exit->addGuard(rec);
-  return rec;
-}
+GuardRecord *FunctionBuilderImpl::createGuardRecord(SideExit *exit) {
+  GuardRecord *rec = new (*dataAlloc_) GuardRecord;
+  memset(rec, 0, sizeof(GuardRecord));
+  rec->exit = exit;
+  exit->addGuard(rec);
+  return rec;
+}
+
+void *FunctionBuilderImpl::finalize() {
+  if (returnTypeBits_ == 0) {
+    std::cerr << "warning: no return type in fragment '" << fragName_ << "'"
+              << std::endl;
+
+  } else if (returnTypeBits_ != RT_INT && returnTypeBits_ != RT_QUAD &&
+             returnTypeBits_ != RT_DOUBLE && returnTypeBits_ != RT_FLOAT &&
+             returnTypeBits_ != RT_FLOAT4) {
+    std::cerr << "warning: multiple return types in fragment '" << fragName_
+              << "'" << std::endl;
+    return nullptr;
+  }
+
+  // Keep small bodies for inlining into later callers
+  std::unique_ptr<std::string> inlineBody;
+  int inlineLimit = parent_.inlineLimit();
+  if (inlineLimit > 0 && inlinable(inlineLimit)) {
+    inlineBody.reset(new std::string());
+    if (!serializeTo(*inlineBody))
+      inlineBody.reset();
+  }
+
+  // Keep the body for the optimizing recompile; without it the function
+  // simply stays in the first tier
+  if (firstTier_) {
+    tier_->lookahead = config_.regalloc_lookahead;
+    if (!serializeTo(tier_->lir, true))
+      tier_->lir.clear();
+  }
+
+  /*
+  * Note that it is necessary to mark the parameters as 'live'
+  * after the function code is complete - i.e. at the very end. This
+  * needed to tell the register allocator to not use the register
+  * associated with the parameter.
+  */
+  for (int i = 0; i < paramCount_; i++) {
+    if (args_[i] == ARGTYPE_D)
+      lived(params_[i]);
+    else if (args_[i] == ARGTYPE_F)
+      livef(params_[i]);
+    else if (args_[i] == ARGTYPE_F4)
+      livef4(params_[i]);
+    else
+      liveq(params_[i]);
+  }
+
+  fragment_->lastIns =
+      lir_->insGuard(LIR_x, NULL, createGuardRecord(createSideExit()));
+
+  uint64_t key = 0;
+  bool cacheable = cacheWriter_ && cacheKey(key);
+  CodeList *codeList = nullptr;
+  if (cacheable && loadCached(key, codeList)) {
+    parent_.code_cache_hits_++;
+    cacheable = false;
+  } else {
+    if (cacheable)
+      parent_.code_cache_misses_++;
+    assm_->compile(fragment_, alloc_,
+                   optimize_ verbose_only(, lirbuf_->printer));
+    codeList = assm_->codeList;
+    assm_->codeList = nullptr;
+  }
+
+  if (assm_->error() != nanojit::None) {
+    std::cerr << "error during assembly: ";
+    switch (assm_->error()) {
+    case nanojit::BranchTooFar:
+      std::cerr << "BranchTooFar";
+      break;
+    case nanojit::StackFull:
+      std::cerr << "StackFull";
+      break;
+    case nanojit::UnknownBranch:
+      std::cerr << "UnknownBranch";
+      break;
+    case nanojit::UnsupportedOpcode:
+      std::cerr << "UnsupportedOpcode";
+      break;
+    case nanojit::None:
+      std::cerr << "None";
+      break;
+    default:
+      NanoAssert(0);
+      break;
+    }
+    std::cerr << std::endl;
+    // The Assembler has already released the partial code
+    return nullptr;
+  }
+
+  LirasmFragment f;
+  void *code = nullptr;
+
+  switch (returnTypeBits_) {
+  case RT_INT:
+    f.rint = (RetInt)((uintptr_t)fragment_->code());
+    f.mReturnType = RT_INT;
+    code = reinterpret_cast<void *>(f.rint);
+    break;
+  case RT_QUAD:
+    f.rquad = (RetQuad)((uintptr_t)fragment_->code());
+    f.mReturnType = RT_QUAD;
+    code = reinterpret_cast<void *>(f.rquad);
+    break;
+  case RT_DOUBLE:
+    f.rdouble = (RetDouble)((uintptr_t)fragment_->code());
+    f.mReturnType = RT_DOUBLE;
+    code = reinterpret_cast<void *>(f.rdouble);
+    break;
+  case RT_FLOAT:
+    f.rfloat = (RetFloat)((uintptr_t)fragment_->code());
+    f.mReturnType = RT_FLOAT;
+    code = reinterpret_cast<void *>(f.rfloat);
+    break;
+  case RT_FLOAT4:
+    f.rfloat4 = (RetFloat4)((uintptr_t)fragment_->code());
+    f.mReturnType = RT_FLOAT4;
+    code = reinterpret_cast<void *>(f.rfloat4);
+    break;
+  default:
+    NanoAssert(0);
+    std::cerr << "invalid return type\n";
+    return nullptr;
+  }
+  f.typeSig = CallInfo::typeSigN(rvalue_, paramCount_, args_);
+
+  if (cacheable)
+    saveCached(key, codeList);
+
+  // The LIR dies with this builder; the code and its data live on in the
+  // parent context.
+  fragment_->lirbuf = nullptr;
+  f.fragptr = fragment_;
+  f.dataAlloc = dataAlloc_;
+  f.codeList = codeList;
+  f.tier = tier_;
+  f.inlineBody = inlineBody.get();
+  f.profile = profile();
+  if (firstTier_)
+    tier_->profile = f.profile;
+  f.callees.swap(callees_);
+  if (!parent_.publish(fragName_, f, tier_ && !firstTier_ ? code : nullptr)) {
+    // The optimized tier is no longer wanted
+    parent_.code_alloc_.freeAll(codeList);
+    callees_.swap(f.callees);
+    return nullptr;
+  }
+  inlineBody.release();
+  fragment_ = nullptr;
+  dataAlloc_ = nullptr;
+  return code;
+}
+
+bool FunctionBuilderImpl::cacheKey(uint64_t &key) {
+  Hasher h;
+  h.add(CODE_CACHE_VERSION);
+  h.add(sizeof(void *));
+
+  const Config &config = config_;
+  h.add(config.arm_arch);
+  h.add(config.cseopt);
+  h.add(config.regalloc_lookahead);
+  h.add(config.loop_lives);
+  h.add(config.licm);
+  h.add(config.gvn);
+  h.add(config.memopt);
+  h.add(config.ranges);
+  h.add(config.divconst);
+  h.add(config.unroll);
+  h.add(config.force_long_branch);
+  h.add(config.i386_sse2);
+  h.add(config.i386_sse3);
+  h.add(config.i386_sse41);
+  h.add(config.i386_use_cmov);
+  h.add(config.i386_fixed_esp);
+  h.add(config.arm_vfp);
+  h.add(config.soft_float);
+  h.add(config.check_page_flags);
+  h.add(config.x64_avx);
+  h.add(config.x64_avx2);
+  h.add(config.x64_fma);
+  h.add(config.x64_popcnt);
+  h.add(config.x64_lzcnt);
+  h.add(config.x64_bmi1);
+  h.add(config.x64_bmi2);
+
+  h.add(optimize_);
+  h.add(returnTypeBits_);
+  h.add(CallInfo::typeSigN(rvalue_, paramCount_, args_));
+
+  // Operands are identified by their position in the stream
+  std::vector<LIns *> code;
+  LirReader reader(fragment_->lastIns);
+  for (LIns *ins = reader.read();; ins = reader.read()) {
+    code.push_back(ins);
+    if (ins->isop(LIR_start))
+      break;
+  }
+  std::map<LIns *, uint64_t> index;
+  for (size_t i = code.size(); i > 0; i--)
+    index[code[i - 1]] = code.size() - i + 1;
+  auto id = [&index](LIns *ins) -> uint64_t {
+    return ins ? index[ins] : 0;
+  };
+
+  for (size_t i = code.size(); i > 0; i--) {
+    LIns *ins = code[i - 1];
+    LOpcode op = ins->opcode();
+    h.add(op);
+    if (op == LIR_comment)
+      continue;
+    if (ins->isGuard()) {
+      // The guard record is recreated when the code is loaded
+      h.add(id(ins->oprnd1()));
+      if (ins->isLInsOp3())
+        h.add(id(ins->oprnd2()));
+      continue;
+    }
+    if (ins->isLInsOp1()) {
+      h.add(id(ins->oprnd1()));
+    } else if (ins->isLInsOp1b()) {
+      h.add(id(ins->oprnd1()));
+      h.add(ins->mask());
+    } else if (ins->isLInsOp2()) {
+      h.add(id(ins->oprnd1()));
+      h.add(id(ins->oprnd2()));
+    } else if (ins->isLInsOp3()) {
+      h.add(id(ins->oprnd1()));
+      h.add(id(ins->oprnd2()));
+      h.add(id(ins->oprnd3()));
+    } else if (ins->isLInsOp4()) {
+      h.add(id(ins->oprnd1()));
+      h.add(id(ins->oprnd2()));
+      h.add(id(ins->oprnd3()));
+      h.add(id(ins->oprnd4()));
+    } else if (ins->isLInsLd()) {
+      h.add(id(ins->oprnd1()));
+      h.add(ins->disp());
+      h.add(ins->accSet());
+      h.add(ins->loadQual());
+    } else if (ins->isLInsSt()) {
+      h.add(id(ins->oprnd1()));
+      h.add(id(ins->oprnd2()));
+      h.add(ins->disp());
+      h.add(ins->accSet());
+    } else if (ins->isLInsC()) {
+      const CallInfo *ci = ins->callInfo();
+      auto const &name = callNames_.find(ci);
+      if (name == callNames_.end())
+        return false;
+      h.add(name->second);
+      h.add(ci->_typesig);
+      h.add(ci->_abi);
+      h.add(ci->_isPure);
+      h.add(ci->_storeAccSet);
+      h.add(ins->argc());
+      for (uint32_t j = 0; j < ins->argc(); j++)
+        h.add(id(ins->arg(j)));
+    } else if (ins->isLInsP()) {
+      h.add(ins->paramArg());
+      h.add(ins->paramKind());
+    } else if (ins->isLInsIorF()) {
+      if (op == LIR_allocp)
+        h.add(ins->size());
+      else if (op == LIR_immf)
+        h.add(ins->immFasI());
+      else
+        h.add(ins->immI());
+    } else if (ins->isLInsQorD()) {
+      h.add(op == LIR_immd ? ins->immDasQ() : ins->immQ());
+    } else if (ins->isLInsF4()) {
+      float4_t f4 = ins->immF4();
+      h.add(&f4, sizeof(f4));
+    } else if (ins->isLInsJtbl()) {
+      h.add(id(ins->oprnd1()));
+      h.add(ins->getTableSize());
+      for (uint32_t j = 0; j < ins->getTableSize(); j++)
+        h.add(id(ins->getTarget(j)));
+    } else if (!ins->isLInsOp0()) {
+      // e.g. safepoints, which refer to embedder data
+      return false;
+    }
+  }
+  key = h.hash();
+  return true;
+}
+
+std::string FunctionBuilderImpl::cachePath(uint64_t key) {
+  char name[32];
+  snprintf(name, sizeof name, "/%016llx.njc", (unsigned long long)key);
+  return cacheDir_ + name;
+}
+
+bool FunctionBuilderImpl::loadCached(uint64_t key, CodeList *&codeList) {
+  FILE *fp = fopen(cachePath(key).c_str(), "rb");
+  if (!fp)
+    return false;
+  std::vector<uint8_t> data;
+  uint8_t buf[4096];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof buf, fp)) > 0)
+    data.insert(data.end(), buf, buf + n);
+  fclose(fp);
+
+  CodeCacheHeader header;
+  if (data.size() < sizeof header)
+    return false;
+  memcpy(&header, &data[0], sizeof header);
+  if (header.magic != CODE_CACHE_MAGIC ||
+      header.version != CODE_CACHE_VERSION || header.key != key ||
+      header.returnType != (uint32_t)returnTypeBits_ ||
+      header.typeSig != CallInfo::typeSigN(rvalue_, paramCount_, args_) ||
+      header.entryOffset >= header.codeSize)
+    return false;
+
+  // Check the relocations before committing to this entry
+  std::vector<std::pair<CodeCacheReloc, size_t> > relocs;
+  size_t pos = sizeof header;
+  for (uint32_t i = 0; i < header.relocCount; i++) {
+    CodeCacheReloc r;
+    if (data.size() - pos < sizeof r)
+      return false;
+    memcpy(&r, &data[pos], sizeof r);
+    pos += sizeof r;
+    if (data.size() - pos < r.size || r.offset < sizeof(uint64_t) ||
+        r.offset > header.codeSize)
+      return false;
+    relocs.push_back(std::make_pair(r, pos));
+    pos += r.size;
+  }
+  if (data.size() - pos != header.codeSize)
+    return false;
+  const uint8_t *code = &data[pos];
+
+  // Calls are bound to the functions this builder's LIR calls
+  std::map<std::string, uintptr_t> callTargets;
+  for (auto const &call : callNames_)
+    callTargets[call.second] = call.first->_address;
+  for (auto const &r : relocs) {
+    if (r.first.kind == RELOC_CALL) {
+      std::string name((const char *)&data[r.second], r.first.size);
+      if (callTargets.find(name) == callTargets.end())
+        return false;
+    } else if (r.first.kind == RELOC_CODE || r.first.kind == RELOC_JTBL) {
+      for (uint32_t j = 0; j < r.first.size / sizeof(uint32_t); j++) {
+        uint32_t offset;
+        memcpy(&offset, &data[r.second + j * sizeof offset], sizeof offset);
+        if (offset >= header.codeSize)
+          return false;
+      }
+    } else if (r.first.kind != RELOC_GUARD && r.first.kind != RELOC_DATA) {
+      return false;
+    }
+  }
+
+  // Find a block big enough, putting back any that are too small
+  CodeAlloc &codeAlloc = parent_.code_alloc_;
+  std::vector<std::pair<NIns *, NIns *> > small;
+  NIns *start, *end;
+  uint8_t *dest;
+  for (;;) {
+    codeAlloc.alloc(start, end, 0);
+    dest = (uint8_t *)(((uintptr_t)end - header.codeSize) & ~uintptr_t(15));
+    if ((uintptr_t)end - (uintptr_t)start >= header.codeSize + 16 &&
+        dest >= (uint8_t *)start)
+      break;
+    small.push_back(std::make_pair(start, end));
+    if (small.size() > 64)
+      break;
+  }
+  for (auto const &block : small)
+    codeAlloc.free(block.first, block.second);
+  if (small.size() > 64)
+    return false;
+
+  memcpy(dest, code, header.codeSize);
+  for (auto const &r : relocs) {
+    const uint8_t *payload = &data[r.second];
+    uint64_t value = 0;
+    switch (r.first.kind) {
+    case RELOC_CODE: {
+      uint32_t offset;
+      memcpy(&offset, payload, sizeof offset);
+      value = (uintptr_t)(dest + offset);
+      break;
+    }
+    case RELOC_CALL:
+      value = callTargets[std::string((const char *)payload, r.first.size)];
+      break;
+    case RELOC_GUARD:
+      value = (uintptr_t)createGuardRecord(createSideExit());
+      break;
+    case RELOC_JTBL: {
+      uint32_t count = r.first.size / sizeof(uint32_t);
+      NIns **table = new (*dataAlloc_) NIns *[count];
+      for (uint32_t j = 0; j < count; j++) {
+        uint32_t offset;
+        memcpy(&offset, payload + j * sizeof offset, sizeof offset);
+        table[j] = (NIns *)(dest + offset);
+      }
+      value = (uintptr_t)table;
+      break;
+    }
+    case RELOC_DATA: {
+      void *copy = dataAlloc_->alloc(r.first.size, 16);
+      memcpy(copy, payload, r.first.size);
+      value = (uintptr_t)copy;
+      break;
+    }
+    }
+    memcpy(dest + r.first.offset - sizeof value, &value, sizeof value);
+  }
+
+  codeAlloc.addRemainder(codeList, start, end, start, (NIns *)dest);
+  codeAlloc.markExec(codeList);
+  CodeAlloc::flushICache(codeList);
+  fragment_->fragEntry = (NIns *)(dest + header.entryOffset);
+  fragment_->setCode((NIns *)dest);
+  return true;
+}
+
+void FunctionBuilderImpl::saveCached(uint64_t key, CodeList *codeList) {
+  // Only code that was assembled into a single block can be moved as a whole
+  if (!codeList || codeList->nextBlock() ||
+      !codeList->isInBlock(fragment_->code()))
+    return;
+  uint8_t *code = (uint8_t *)fragment_->code();
+  uint8_t *end = (uint8_t *)codeList->blockEnd();
+  auto inCode = [code, end](uintptr_t p) {
+    return p >= (uintptr_t)code && p < (uintptr_t)end;
+  };
+
+  CodeCacheHeader header;
+  memset(&header, 0, sizeof header);
+  header.magic = CODE_CACHE_MAGIC;
+  header.version = CODE_CACHE_VERSION;
+  header.key = key;
+  header.returnType = returnTypeBits_;
+  header.typeSig = CallInfo::typeSigN(rvalue_, paramCount_, args_);
+  header.codeSize = (uint32_t)(end - code);
+  header.entryOffset = (uint32_t)((uint8_t *)fragment_->fragEntry - code);
+  header.relocCount = (uint32_t)cacheWriter_->relocs_.size();
+
+  std::string out((const char *)&header, sizeof header);
+  for (auto const &reloc : cacheWriter_->relocs_) {
+    if (!inCode((uintptr_t)reloc.address - sizeof(uint64_t)) ||
+        (uintptr_t)reloc.address > (uintptr_t)end)
+      return;
+    std::string payload;
+    switch (reloc.kind) {
+    case RELOC_CODE: {
+      uint64_t value;
+      memcpy(&value, reloc.address - sizeof value, sizeof value);
+      if (!inCode(value))
+        return;
+      uint32_t offset = (uint32_t)(value - (uintptr_t)code);
+      payload.assign((const char *)&offset, sizeof offset);
+      break;
+    }
+    case RELOC_CALL: {
+      auto const &name = callNames_.find((const CallInfo *)reloc.target);
+      if (name == callNames_.end())
+        return;
+      payload = name->second;
+      break;
+    }
+    case RELOC_GUARD:
+      break;
+    case RELOC_JTBL: {
+      NIns *const *table = (NIns *const *)reloc.target;
+      for (size_t j = 0; j < reloc.size / sizeof(NIns *); j++) {
+        if (!inCode((uintptr_t)table[j]))
+          return;
+        uint32_t offset = (uint32_t)((uint8_t *)table[j] - code);
+        payload.append((const char *)&offset, sizeof offset);
+      }
+      break;
+    }
+    case RELOC_DATA:
+      payload.assign((const char *)reloc.target, reloc.size);
+      break;
+    }
+    CodeCacheReloc r;
+    r.kind = reloc.kind;
+    r.offset = (uint32_t)(reloc.address - code);
+    r.size = (uint32_t)payload.size();
+    out.append((const char *)&r, sizeof r);
+    out.append(payload);
+  }
+  out.append((const char *)code, header.codeSize);
+
+  // Write to a private file first so that readers never see a partial entry
+  std::string path = cachePath(key);
+  char suffix[32];
+  snprintf(suffix, sizeof suffix, ".%p.tmp", (void *)this);
+  std::string tmp = path + suffix;
+  FILE *fp = fopen(tmp.c_str(), "wb");
+  if (!fp)
+    return;
+  bool ok = fwrite(out.data(), 1, out.size(), fp) == out.size();
+  ok = fclose(fp) == 0 && ok;
+  if (!ok || rename(tmp.c_str(), path.c_str()) != 0)
+    remove(tmp.c_str());
+}
+
+/**
+* Binds the calls and guards of serialized LIR for a function builder.
+* Calls are named by the function they call, and are looked up again by
+* name when loading; guards get new records.
+*/
+class BuilderSymbols : public LirSymbols {
+public:
+  // The jitted functions called by the LIR are added to callees, by
+  // default those of the builder
+  BuilderSymbols(FunctionBuilderImpl &builder,
+                 std::vector<std::string> *callees = nullptr)
+      : builder_(builder), callees_(callees ? *callees : builder.callees_) {}
+
+  const char *callName(const CallInfo *ci) {
+    auto const &name = builder_.callNames_.find(ci);
+    return name == builder_.callNames_.end() ? nullptr : name->second.c_str();
+  }
+
+  const CallInfo *lookupCall(const char *name, const CallInfo &desc) {
+    std::string func(name);
+    CallInfo *ci = new (builder_.alloc_) CallInfo;
+    if (!builder_.parent_.lookupFunction(func, ci, callees_)) {
+      fprintf(stderr, "Error: serialized LIR calls unknown function '%s'\n",
+              name);
+      return nullptr;
+    }
+    if (ci->_typesig != 0 && ci->_typesig != desc._typesig) {
+      fprintf(stderr, "Error: mismatch in type signature between serialized "
+                      "call and definition of '%s'\n",
+              name);
+      return nullptr;
+    }
+    ci->_typesig = desc._typesig;
+    builder_.callNames_[ci] = func;
+    return ci;
+  }
+
+  GuardRecord *guardRecord(uint32_t) {
+    return builder_.createGuardRecord(builder_.createSideExit());
+  }
+
+private:
+  FunctionBuilderImpl &builder_;
+  std::vector<std::string> &callees_;
+};
+
+/**
+* Sits in front of the writer pipeline while serialized LIR is loaded,
+* to collect the return types and reject LIR that was built for a function
+* with more parameters.
+*/
+class LoadFilter : public LirWriter {
+public:
+  LoadFilter(LirWriter *out, FunctionBuilderImpl &builder)
+      : LirWriter(out), returnTypeBits_(0), ok_(true), builder_(builder) {}
+
+  LIns *ins1(LOpcode op, LIns *a) {
+    switch (op) {
+    case LIR_reti:
+      returnTypeBits_ |= RT_INT;
+      break;
+    case LIR_retq:
+      returnTypeBits_ |= RT_QUAD;
+      break;
+    case LIR_retd:
+      returnTypeBits_ |= RT_DOUBLE;
+      break;
+    case LIR_retf:
+      returnTypeBits_ |= RT_FLOAT;
+      break;
+    case LIR_retf4:
+      returnTypeBits_ |= RT_FLOAT4;
+      break;
+    default:
+      break;
+    }
+    return out->ins1(op, a);
+  }
+
+  LIns *insParam(int32_t arg, int32_t kind, LOpcode op = LIR_paramp) {
+    ok_ = false;
+    return out->insParam(arg, kind, op);
+  }
+
+  // Calls are inlined as if the front end had made them
+  LIns *insCall(const CallInfo *ci, LIns *args[]) {
+    LIns *result = builder_.inlineCall(ci, args);
+    return result ? result : out->insCall(ci, args);
+  }
+
+  char returnTypeBits_;
+  bool ok_;
+
+private:
+  FunctionBuilderImpl &builder_;
+};
+
+/**
+* Sits in front of the writer pipeline while the body of an inlined
+* function is loaded, to substitute the arguments of the call for its
+* parameters and capture the value it returns.
+*/
+class InlineFilter : public LirWriter {
+public:
+  InlineFilter(LirWriter *out, LIns *const *params, const ArgType *types,
+               int nparams, LIns *const *saved)
+      : LirWriter(out), result_(nullptr), ok_(true), params_(params),
+        types_(types), nparams_(nparams), saved_(saved) {}
+
+  LIns *insParam(int32_t arg, int32_t kind, LOpcode op = LIR_paramp) {
+    if (kind == 0) {
+      for (int i = 0; i < nparams_; i++) {
+        if (paramNumber(types_, i) == arg && paramOpcode(types_[i]) == op)
+          return params_[i];
+      }
+    }
+    if (kind == 1 && arg < NumSavedRegs)
+      return saved_[arg];
+    ok_ = false;
+    return out->insParam(arg, kind, op);
+  }
+
+  LIns *ins1(LOpcode op, LIns *a) {
+    if (isRetOpcode(op)) {
+      // The return is the last instruction of the body
+      result_ = a;
+      return a;
+    }
+    return out->ins1(op, a);
+  }
+
+  LIns *result_;
+  bool ok_;
+
+private:
+  LIns *const *params_;
+  const ArgType *types_;
+  int nparams_;
+  LIns *const *saved_;
+};
+
+/**
+* Skips the tier entry code of a first tier function when reading its LIR
+* back, so that only the body written by the front end is serialized.
+*/
+class TierEntryFilter : public LirFilter {
+public:
+  TierEntryFilter(LirFilter *in, LIns *first, LIns *last)
+      : LirFilter(in), first_(first), last_(last) {}
+
+  LIns *read() {
+    LIns *ins = in->read();
+    if (ins == last_) {
+      while (ins != first_)
+        ins = in->read();
+      ins = in->read();
+    }
+    return ins;
+  }
+
+private:
+  LIns *first_;
+  LIns *last_;
+};
+
+/**
+* Skips the profiling counter increments, and the immediates giving their
+* addresses, when reading LIR back for copies that may outlive the
+* counters.
+*/
+class CountFilter : public LirFilter {
+public:
+  CountFilter(LirFilter *in) : LirFilter(in) {}
+
+  LIns *read() {
+    LIns *ins = in->read();
+    while (ins->isop(LIR_count)) {
+      LIns *counter = ins->oprnd1();
+      ins = in->read();
+      if (ins == counter)
+        ins = in->read();
+    }
+    return ins;
+  }
+};
+
+bool FunctionBuilderImpl::serializeTo(std::string &out, bool counters) {
+  BuilderSymbols symbols(*this);
+  LirReader reader(lirbuf_->lastIns());
+  TierEntryFilter filter(&reader, tierEntry_, tierBody_);
+  CountFilter countFilter(&filter);
+  LirSerializer serializer(counters ? (LirFilter *)&filter : &countFilter,
+                           alloc_, symbols);
+  while (!serializer.read()->isop(LIR_start))
+    ;
+  if (!serializer.succeeded())
+    return false;
+  out.assign((const char *)serializer.data(), serializer.size());
+  return true;
+}
+
+size_t FunctionBuilderImpl::serialize(void *buffer, size_t size) {
+  std::string data;
+  if (!serializeTo(data)) {
+    fprintf(stderr, "Error: function '%s' cannot be serialized\n",
+            fragName_.c_str());
+    return 0;
+  }
+  if (buffer && data.size() <= size)
+    memcpy(buffer, data.data(), data.size());
+  return data.size();
+}
+
+bool FunctionBuilderImpl::deserialize(const void *data, size_t size) {
+  BuilderSymbols symbols(*this);
+  LoadFilter filter(lir_, *this);
+  LirLoader loader(alloc_, symbols);
+  bool ok = loader.load((const uint8_t *)data, size, &filter, &prologue_[0],
+                        (uint32_t)prologue_.size());
+  if (!ok || !filter.ok_) {
+    fprintf(stderr, "Error: invalid serialized LIR for function '%s'\n",
+            fragName_.c_str());
+    return false;
+  }
+  returnTypeBits_ |= filter.returnTypeBits_;
+  return true;
+}
+
+bool FunctionBuilderImpl::inlinable(int limit) {
+  LirReader reader(lirbuf_->lastIns());
+  TierEntryFilter tierFilter(&reader, tierEntry_, tierBody_);
+  CountFilter filter(&tierFilter);
+  int count = 0;
+  for (LIns *ins = filter.read(); !ins->isop(LIR_start); ins = filter.read()) {
+    if (ins->isParam() || ins->isop(LIR_comment))
+      continue;
+    if (ins->isRet() ? count > 0 : count == 0)
+      return false;
+    if (ins->isGuard() || ++count > limit)
+      return false;
+  }
+  return count > 0;
+}
+
+LIns *FunctionBuilderImpl::inlineCall(const CallInfo *ci, LIns *args[]) {
+  if (!optimize_)
+    return nullptr;
+  auto const &name = callNames_.find(ci);
+  std::string body;
+  if (name == callNames_.end() || !parent_.inlineBody(name->second, body))
+    return nullptr;
+
+  ArgType argTypes[MAXARGS]; // In reverse order, like args
+  int argc = (int)ci->getArgTypes(argTypes);
+  ArgType types[MAXARGS];
+  LIns *params[MAXARGS];
+  for (int i = 0; i < argc; i++) {
+    types[i] = argTypes[argc - 1 - i];
+    params[i] = args[argc - 1 - i];
+  }
+
+  // Load the body into a scratch buffer first, so that nothing has been
+  // written if it turns out not to fit the call
+  {
+    std::vector<std::string> callees;
+    BuilderSymbols symbols(*this, &callees);
+    LirBuffer *scratch = new (alloc_) LirBuffer(alloc_);
+    LirBufWriter writer(scratch, config_);
+    InlineFilter filter(&writer, params, types, argc, &prologue_[1]);
+    LirLoader loader(alloc_, symbols);
+    bool ok = loader.load((const uint8_t *)body.data(), body.size(), &filter,
+                          &prologue_[0], 1) &&
+              filter.ok_ && filter.result_;
+    parent_.dropCallees(callees);
+    if (!ok) {
+      fprintf(stderr, "Warning: cannot inline function '%s', calling it\n",
+              name->second.c_str());
+      return nullptr;
+    }
+  }
+
+  // The callee takes its integer parameters as words, see getParameter()
+  for (int i = 0; i < argc; i++) {
+    if (types[i] == ARGTYPE_I)
+      params[i] = lir_->ins1(LIR_i2q, params[i]);
+  }
+  BuilderSymbols symbols(*this);
+  InlineFilter filter(lir_, params, types, argc, &prologue_[1]);
+  LirLoader loader(alloc_, symbols);
+  bool ok = loader.load((const uint8_t *)body.data(), body.size(), &filter,
+                        &prologue_[0], 1) &&
+            filter.ok_ && filter.result_;
+  NanoAssert(ok);
+  (void)ok;
+
+  // The callee itself is no longer called from here
+  std::string callee = name->second;
+  for (auto i = callees_.rbegin(); i != callees_.rend(); ++i) {
+    if (*i == callee) {
+      callees_.erase(std::next(i).base());
+      break;
+    }
+  }
+  parent_.dropCallees(std::vector<std::string>(1, callee));
+  return filter.result_;
+}
+
+/**
+* Tracks one asynchronous finalize. The ticket is shared between the
+* caller and the worker that compiles it, and is freed when both have
+* released it.
+*/
+class CompileTicket {
+public:
+  enum State { PENDING, DONE, FAILED };
+
+  CompileTicket(FunctionBuilderImpl *builder, NJXCompileCallback callback,
+                void *userdata)
+      : builder_(builder), tier_(nullptr), callback_(callback),
+        userdata_(userdata), state_(PENDING), code_(nullptr), refs_(2) {}
+
+  // Recompiles a tiered function; only the worker holds a reference
+  CompileTicket(TierState *tier)
+      : builder_(nullptr), tier_(tier), callback_(nullptr), userdata_(nullptr),
+        state_(PENDING), code_(nullptr), refs_(1) {}
+
+  // Runs on a worker thread: assembles, publishes and notifies
+  void run() {
+    void *code;
+    if (tier_) {
+      code = tier_->context->recompile(tier_);
+    } else {
+      code = builder_->finalize();
+      delete builder_;
+      builder_ = nullptr;
+    }
+    {
+      std::lock_guard<std::mutex> guard(lock_);
+      code_ = code;
+      state_ = code ? DONE : FAILED;
+    }
+    done_.notify_all();
+    if (callback_)
+      callback_(wrap(), code, userdata_);
+    release();
+  }
 
-void *FunctionBuilderImpl::finalize() {
-  if (returnTypeBits_ == 0) {
-    std::cerr << "warning: no return type in fragment '" << fragName_ << "'"
-              << std::endl;
+  State state() {
+    std::lock_guard<std::mutex> guard(lock_);
+    return state_;
+  }
 
-  } else if (returnTypeBits_ != RT_INT && returnTypeBits_ != RT_QUAD &&
-             returnTypeBits_ != RT_DOUBLE && returnTypeBits_ != RT_FLOAT) {
-    std::cerr << "warning: multiple return types in fragment '" << fragName_
-              << "'" << std::endl;
-    return nullptr;
+  void *wait() {
+    std::unique_lock<std::mutex> guard(lock_);
+    done_.wait(guard, [this] { return state_ != PENDING; });
+    return code_;
   }
 
-  /*
-  * Note that it is necessary to mark the parameters as 'live'
-  * after the function code is complete - i.e. at the very end. This
-  * needed to tell the register allocator to not use the register
-  * associated with the parameter.
-  */
-  for (int i = 0; i < paramCount_; i++) {
-    liveq(params_[i]);
+  void release() {
+    if (--refs_ == 0)
+      delete this;
   }
 
-  fragment_->lastIns =
-      lir_->insGuard(LIR_x, NULL, createGuardRecord(createSideExit()));
+  NJXCompileTicketRef wrap() {
+    return reinterpret_cast<NJXCompileTicketRef>(this);
+  }
 
-  parent_.asm_.compile(fragment_, parent_.alloc_,
-                       optimize_ verbose_only(, parent_.lirbuf_->printer));
+private:
+  FunctionBuilderImpl *builder_;
+  TierState *tier_;
+  NJXCompileCallback callback_;
+  void *userdata_;
+  std::mutex lock_;
+  std::condition_variable done_;
+  State state_;
+  void *code_;
+  std::atomic<int> refs_;
+};
 
-  if (parent_.asm_.error() != nanojit::None) {
-    std::cerr << "error during assembly: ";
-    switch (parent_.asm_.error()) {
-    case nanojit::BranchTooFar:
-      std::cerr << "BranchTooFar";
-      break;
-    case nanojit::StackFull:
-      std::cerr << "StackFull";
-      break;
-    case nanojit::UnknownBranch:
-      std::cerr << "UnknownBranch";
-      break;
-    case nanojit::None:
-      std::cerr << "None";
-      break;
-    default:
-      NanoAssert(0);
-      break;
+/**
+* A fixed pool of threads that run queued CompileTickets in FIFO order.
+* Destroying the queue completes all queued work before joining.
+*/
+class CompileQueue {
+public:
+  CompileQueue() : stopping_(false) {
+    unsigned n = std::thread::hardware_concurrency();
+    if (n == 0)
+      n = 1;
+    for (unsigned i = 0; i < n; i++)
+      workers_.emplace_back([this] { work(); });
+  }
+
+  ~CompileQueue() {
+    {
+      std::lock_guard<std::mutex> guard(lock_);
+      stopping_ = true;
     }
-    std::cerr << std::endl;
-    std::exit(1);
+    ready_.notify_all();
+    for (auto &worker : workers_)
+      worker.join();
   }
 
-  LirasmFragment *f;
-  f = &parent_.fragments_[fragName_];
+  void push(CompileTicket *ticket) {
+    {
+      std::lock_guard<std::mutex> guard(lock_);
+      pending_.push_back(ticket);
+    }
+    ready_.notify_one();
+  }
 
-  switch (returnTypeBits_) {
-  case RT_INT:
-    f->rint = (RetInt)((uintptr_t)fragment_->code());
-    f->mReturnType = RT_INT;
-    f->typeSig = CallInfo::typeSigN(rvalue_, paramCount_, args_);
-    return reinterpret_cast<void *>(f->rint);
-  case RT_QUAD:
-    f->rquad = (RetQuad)((uintptr_t)fragment_->code());
-    f->mReturnType = RT_QUAD;
-    f->typeSig = CallInfo::typeSigN(rvalue_, paramCount_, args_);
-    return reinterpret_cast<void *>(f->rquad);
-  case RT_DOUBLE:
-    f->rdouble = (RetDouble)((uintptr_t)fragment_->code());
-    f->mReturnType = RT_DOUBLE;
-    f->typeSig = CallInfo::typeSigN(rvalue_, paramCount_, args_);
-    return reinterpret_cast<void *>(f->rdouble);
-  case RT_FLOAT:
-    f->rfloat = (RetFloat)((uintptr_t)fragment_->code());
-    f->mReturnType = RT_FLOAT;
-    f->typeSig = CallInfo::typeSigN(rvalue_, paramCount_, args_);
-    return reinterpret_cast<void *>(f->rfloat);
-  default:
-    NanoAssert(0);
-    std::cerr << "invalid return type\n";
-    break;
+private:
+  void work() {
+    for (;;) {
+      CompileTicket *ticket;
+      {
+        std::unique_lock<std::mutex> guard(lock_);
+        ready_.wait(guard, [this] { return stopping_ || !pending_.empty(); });
+        if (pending_.empty())
+          return;
+        ticket = pending_.front();
+        pending_.pop_front();
+      }
+      ticket->run();
+    }
   }
-  return nullptr;
+
+  std::mutex lock_;
+  std::condition_variable ready_;
+  std::deque<CompileTicket *> pending_;
+  std::vector<std::thread> workers_;
+  bool stopping_;
+};
+
+NanoJitContextImpl::~NanoJitContextImpl() {
+  // Pending compiles still reference the context, so finish them first
+  delete compile_queue_;
+  Fragments::iterator i;
+  for (i = fragments_.begin(); i != fragments_.end(); ++i) {
+    delete i->second.fragptr;
+    delete i->second.dataAlloc;
+    delete i->second.inlineBody;
+  }
+  for (auto &f : retired_) {
+    delete f.second.fragptr;
+    delete f.second.dataAlloc;
+    delete f.second.inlineBody;
+  }
+  for (auto tier : tiers_)
+    delete tier;
+  for (auto const &stub : stubs_)
+    delete stub.second.slot;
+  for (auto const &cell : patchables_)
+    delete cell.second;
+}
+
+void NanoJitContextImpl::enqueue(CompileTicket *ticket) {
+  CompileQueue *queue;
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    if (!compile_queue_)
+      compile_queue_ = new CompileQueue();
+    queue = compile_queue_;
+  }
+  queue->push(ticket);
+}
+
+void NanoJitContextImpl::setTierThreshold(int calls) {
+  std::lock_guard<std::mutex> guard(lock_);
+  tier_threshold_ = calls > 0 ? calls : 0;
+}
+
+TierState *NanoJitContextImpl::newTier(const std::string &name,
+                                       ArgType rvalue, const ArgType *args,
+                                       int argc) {
+  std::lock_guard<std::mutex> guard(lock_);
+  if (tier_threshold_ == 0)
+    return nullptr;
+  TierState *tier = new TierState();
+  tier->entry = nullptr;
+  tier->count = tier_threshold_;
+  tier->context = this;
+  tier->name = name;
+  tier->rvalue = rvalue;
+  tier->args.assign(args, args + argc);
+  tier->lookahead = false;
+  tier->profile = nullptr;
+  tier->queued = false;
+  tiers_.push_back(tier);
+  return tier;
+}
+
+void NanoJitContextImpl::tierUp(TierState *tier) {
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    if (tier->queued || tier->lir.empty())
+      return;
+    tier->queued = true;
+    tier_pending_++;
+  }
+  enqueue(new CompileTicket(tier));
+}
+
+void *NanoJitContextImpl::recompile(TierState *tier) {
+  void *code = nullptr;
+  {
+    FunctionBuilderImpl builder(*this, tier->name, tier->rvalue,
+                                tier->args.data(), (int)tier->args.size(),
+                                true, tier);
+    builder.setLookaheadRegAlloc(tier->lookahead);
+    if (builder.deserialize(tier->lir.data(), tier->lir.size()))
+      code = builder.finalize();
+  }
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    tier_pending_--;
+    if (code)
+      tier_done_++;
+  }
+  tier_idle_.notify_all();
+  return code;
+}
+
+int NanoJitContextImpl::waitForTierUp() {
+  std::unique_lock<std::mutex> guard(lock_);
+  tier_idle_.wait(guard, [this] { return tier_pending_ == 0; });
+  return tier_done_;
 }
 }
 
@@ -883,6 +2905,10 @@ static inline LIns *unwrap_ins(NJXLInsRef p) {
   return reinterpret_cast<LIns *>(p);
 }
 
+static inline CompileTicket *unwrap_ticket(NJXCompileTicketRef p) {
+  return reinterpret_cast<CompileTicket *>(p);
+}
+
 extern "C" {
 
 NJXContextRef NJX_create_context(int verbose) {
@@ -897,22 +2923,100 @@ void NJX_destroy_context(NJXContextRef ctx) {
 
 void *NJX_get_function_by_name(NJXContextRef ctx, const char *name) {
   auto impl = unwrap_context(ctx);
-  LirasmFragment *f = impl->get_fragment(name);
-  if (f) {
-    switch (f->mReturnType) {
+  LirasmFragment f;
+  if (impl->get_fragment(name, f)) {
+    switch (f.mReturnType) {
     case RT_INT:
-      return reinterpret_cast<void *>(f->rint);
+      return reinterpret_cast<void *>(f.rint);
     case RT_QUAD:
-      return reinterpret_cast<void *>(f->rquad);
+      return reinterpret_cast<void *>(f.rquad);
     case RT_DOUBLE:
-      return reinterpret_cast<void *>(f->rdouble);
+      return reinterpret_cast<void *>(f.rdouble);
     case RT_FLOAT:
-      return reinterpret_cast<void *>(f->rfloat);
+      return reinterpret_cast<void *>(f.rfloat);
+    case RT_FLOAT4:
+      return reinterpret_cast<void *>(f.rfloat4);
     }
   }
   return nullptr;
 }
 
+bool NJX_set_code_cache(NJXContextRef ctx, const char *directory) {
+  auto impl = unwrap_context(ctx);
+  return impl->setCodeCache(directory ? std::string(directory) : std::string());
+}
+
+void NJX_set_tier_up_threshold(NJXContextRef ctx, int calls) {
+  unwrap_context(ctx)->setTierThreshold(calls);
+}
+
+int NJX_wait_for_tier_up(NJXContextRef ctx) {
+  return unwrap_context(ctx)->waitForTierUp();
+}
+
+void NJX_set_inline_limit(NJXContextRef ctx, int instructions) {
+  unwrap_context(ctx)->setInlineLimit(instructions);
+}
+
+void NJX_set_unroll_factor(NJXContextRef ctx, int factor) {
+  unwrap_context(ctx)->setUnrollFactor(factor);
+}
+
+void NJX_set_profiling(NJXContextRef ctx, int enabled) {
+  unwrap_context(ctx)->setProfiling(enabled != 0);
+}
+
+bool NJX_get_profile(NJXContextRef ctx, const char *name, NJXProfile *profile,
+                     NJXBranchProfile *branches, int max_branches,
+                     NJXBranchProfile *loops, int max_loops) {
+  return unwrap_context(ctx)->getProfile(std::string(name), profile, branches,
+                                         max_branches, loops, max_loops);
+}
+
+bool NJX_set_patchable_i(NJXContextRef ctx, const char *name, int32_t value) {
+  return unwrap_context(ctx)->setPatchable(std::string(name), ARGTYPE_I,
+                                           value);
+}
+
+bool NJX_set_patchable_q(NJXContextRef ctx, const char *name, int64_t value) {
+  return unwrap_context(ctx)->setPatchable(std::string(name), ARGTYPE_Q,
+                                           value);
+}
+
+bool NJX_set_patchable_d(NJXContextRef ctx, const char *name, double value) {
+  int64_t bits;
+  memcpy(&bits, &value, sizeof bits);
+  return unwrap_context(ctx)->setPatchable(std::string(name), ARGTYPE_D,
+                                           bits);
+}
+
+void NJX_get_code_cache_stats(NJXContextRef ctx, int *hits, int *misses) {
+  auto impl = unwrap_context(ctx);
+  if (hits)
+    *hits = impl->code_cache_hits_;
+  if (misses)
+    *misses = impl->code_cache_misses_;
+}
+
+size_t NJX_serialize_lir(NJXFunctionBuilderRef fn, void *buffer,
+                         size_t size) {
+  return unwrap_function_builder(fn)->serialize(buffer, size);
+}
+
+bool NJX_deserialize_lir(NJXFunctionBuilderRef fn, const void *data,
+                         size_t size) {
+  return unwrap_function_builder(fn)->deserialize(data, size);
+}
+
+bool NJX_free_function(NJXContextRef ctx, const char *name) {
+  auto impl = unwrap_context(ctx);
+  return impl->freeFunction(std::string(name));
+}
+
+int NJX_free_replaced_functions(NJXContextRef ctx, const char *name) {
+  return unwrap_context(ctx)->freeReplaced(std::string(name));
+}
+
 bool NJX_register_C_function(NJXContextRef context, const char *name,
                              void *fptr, NJXValueKind return_type,
                              const NJXValueKind *args, int argc) {
@@ -933,14 +3037,28 @@ NJXFunctionBuilderRef NJX_create_function_builder(NJXContextRef context,
     return nullptr;
   }
   for (int i = 0; i < argc; i++) {
-    if (args[i] != NJXValueKind_I && args[i] != NJXValueKind_Q) {
-      fprintf(stderr, "Error in arg[%d]: Function cannot accept non integer / "
-                      "pointer arguments at present\n",
+    if (args[i] != NJXValueKind_I && args[i] != NJXValueKind_Q &&
+        args[i] != NJXValueKind_D && args[i] != NJXValueKind_F &&
+        args[i] != NJXValueKind_F4) {
+      fprintf(stderr, "Error in arg[%d]: Function cannot accept arguments of "
+                      "this type\n",
+              i);
+      return nullptr;
+    }
+#if defined(NANOJIT_X64) && !defined(_WIN64)
+    if (args[i] == NJXValueKind_F4 &&
+        paramNumber((const ArgType *)args, i) >= NumFpArgRegs) {
+#else
+    if (args[i] == NJXValueKind_F4) {
+#endif
+      // Callers pass these by reference, which is not supported yet
+      fprintf(stderr, "Error in arg[%d]: float4 arguments must be passed in "
+                      "registers\n",
               i);
       return nullptr;
     }
   }
-  if (return_type < NJXValueKind_I || return_type > NJXValueKind_F) {
+  if (return_type < NJXValueKind_I || return_type > NJXValueKind_F4) {
     fprintf(stderr, "Error: Function must return a value\n");
     return nullptr;
   }
@@ -971,6 +3089,10 @@ NJXLInsRef NJX_retq(NJXFunctionBuilderRef fn, NJXLInsRef result) {
   return wrap_ins(unwrap_function_builder(fn)->retq(unwrap_ins(result)));
 }
 
+NJXLInsRef NJX_retf4(NJXFunctionBuilderRef fn, NJXLInsRef result) {
+  return wrap_ins(unwrap_function_builder(fn)->retf4(unwrap_ins(result)));
+}
+
 NJXLInsRef NJX_ret(NJXFunctionBuilderRef fn) {
   return wrap_ins(unwrap_function_builder(fn)->ret());
 }
@@ -991,6 +3113,23 @@ NJXLInsRef NJX_immf(NJXFunctionBuilderRef fn, float f) {
   return wrap_ins(unwrap_function_builder(fn)->immf(f));
 }
 
+NJXLInsRef NJX_immf4(NJXFunctionBuilderRef fn, float x, float y, float z,
+                     float w) {
+  return wrap_ins(unwrap_function_builder(fn)->immf4(x, y, z, w));
+}
+
+NJXLInsRef NJX_patchable_immi(NJXFunctionBuilderRef fn, const char *name) {
+  return wrap_ins(unwrap_function_builder(fn)->patchable(name, ARGTYPE_I));
+}
+
+NJXLInsRef NJX_patchable_immq(NJXFunctionBuilderRef fn, const char *name) {
+  return wrap_ins(unwrap_function_builder(fn)->patchable(name, ARGTYPE_Q));
+}
+
+NJXLInsRef NJX_patchable_immd(NJXFunctionBuilderRef fn, const char *name) {
+  return wrap_ins(unwrap_function_builder(fn)->patchable(name, ARGTYPE_D));
+}
+
 /**
 * Gets a function parameter.
 */
@@ -1042,6 +3181,10 @@ NJXLInsRef NJX_mulq(NJXFunctionBuilderRef fn, NJXLInsRef lhs, NJXLInsRef rhs) {
   return wrap_ins(
       unwrap_function_builder(fn)->mulq(unwrap_ins(lhs), unwrap_ins((rhs))));
 }
+NJXLInsRef NJX_mulhq(NJXFunctionBuilderRef fn, NJXLInsRef lhs, NJXLInsRef rhs) {
+  return wrap_ins(
+      unwrap_function_builder(fn)->mulhq(unwrap_ins(lhs), unwrap_ins((rhs))));
+}
 NJXLInsRef NJX_muld(NJXFunctionBuilderRef fn, NJXLInsRef lhs, NJXLInsRef rhs) {
   return wrap_ins(
       unwrap_function_builder(fn)->muld(unwrap_ins(lhs), unwrap_ins((rhs))));
@@ -1051,6 +3194,22 @@ NJXLInsRef NJX_mulf(NJXFunctionBuilderRef fn, NJXLInsRef lhs, NJXLInsRef rhs) {
       unwrap_function_builder(fn)->mulf(unwrap_ins(lhs), unwrap_ins((rhs))));
 }
 
+NJXLInsRef NJX_fmad(NJXFunctionBuilderRef fn, NJXLInsRef a, NJXLInsRef b,
+                    NJXLInsRef c) {
+  return wrap_ins(unwrap_function_builder(fn)->fmad(
+      unwrap_ins(a), unwrap_ins(b), unwrap_ins(c)));
+}
+NJXLInsRef NJX_fmaf(NJXFunctionBuilderRef fn, NJXLInsRef a, NJXLInsRef b,
+                    NJXLInsRef c) {
+  return wrap_ins(unwrap_function_builder(fn)->fmaf(
+      unwrap_ins(a), unwrap_ins(b), unwrap_ins(c)));
+}
+NJXLInsRef NJX_fmaf4(NJXFunctionBuilderRef fn, NJXLInsRef a, NJXLInsRef b,
+                     NJXLInsRef c) {
+  return wrap_ins(unwrap_function_builder(fn)->fmaf4(
+      unwrap_ins(a), unwrap_ins(b), unwrap_ins(c)));
+}
+
 NJXLInsRef NJX_divi(NJXFunctionBuilderRef fn, NJXLInsRef lhs, NJXLInsRef rhs) {
   return wrap_ins(
       unwrap_function_builder(fn)->divi(unwrap_ins(lhs), unwrap_ins((rhs))));
@@ -1090,6 +3249,48 @@ NJXLInsRef NJX_negd(NJXFunctionBuilderRef fn, NJXLInsRef q) {
   return wrap_ins(unwrap_function_builder(fn)->negd(unwrap_ins(q)));
 }
 
+NJXLInsRef NJX_mind(NJXFunctionBuilderRef fn, NJXLInsRef lhs, NJXLInsRef rhs) {
+  return wrap_ins(
+      unwrap_function_builder(fn)->mind(unwrap_ins(lhs), unwrap_ins((rhs))));
+}
+NJXLInsRef NJX_maxd(NJXFunctionBuilderRef fn, NJXLInsRef lhs, NJXLInsRef rhs) {
+  return wrap_ins(
+      unwrap_function_builder(fn)->maxd(unwrap_ins(lhs), unwrap_ins((rhs))));
+}
+NJXLInsRef NJX_minf(NJXFunctionBuilderRef fn, NJXLInsRef lhs, NJXLInsRef rhs) {
+  return wrap_ins(
+      unwrap_function_builder(fn)->minf(unwrap_ins(lhs), unwrap_ins((rhs))));
+}
+NJXLInsRef NJX_maxf(NJXFunctionBuilderRef fn, NJXLInsRef lhs, NJXLInsRef rhs) {
+  return wrap_ins(
+      unwrap_function_builder(fn)->maxf(unwrap_ins(lhs), unwrap_ins((rhs))));
+}
+
+NJXLInsRef NJX_floord(NJXFunctionBuilderRef fn, NJXLInsRef q) {
+  return wrap_ins(unwrap_function_builder(fn)->floord(unwrap_ins(q)));
+}
+NJXLInsRef NJX_ceild(NJXFunctionBuilderRef fn, NJXLInsRef q) {
+  return wrap_ins(unwrap_function_builder(fn)->ceild(unwrap_ins(q)));
+}
+NJXLInsRef NJX_truncd(NJXFunctionBuilderRef fn, NJXLInsRef q) {
+  return wrap_ins(unwrap_function_builder(fn)->truncd(unwrap_ins(q)));
+}
+NJXLInsRef NJX_roundd(NJXFunctionBuilderRef fn, NJXLInsRef q) {
+  return wrap_ins(unwrap_function_builder(fn)->roundd(unwrap_ins(q)));
+}
+NJXLInsRef NJX_floorf(NJXFunctionBuilderRef fn, NJXLInsRef q) {
+  return wrap_ins(unwrap_function_builder(fn)->floorf(unwrap_ins(q)));
+}
+NJXLInsRef NJX_ceilf(NJXFunctionBuilderRef fn, NJXLInsRef q) {
+  return wrap_ins(unwrap_function_builder(fn)->ceilf(unwrap_ins(q)));
+}
+NJXLInsRef NJX_truncf(NJXFunctionBuilderRef fn, NJXLInsRef q) {
+  return wrap_ins(unwrap_function_builder(fn)->truncf(unwrap_ins(q)));
+}
+NJXLInsRef NJX_roundf(NJXFunctionBuilderRef fn, NJXLInsRef q) {
+  return wrap_ins(unwrap_function_builder(fn)->roundf(unwrap_ins(q)));
+}
+
 NJXLInsRef NJX_notq(NJXFunctionBuilderRef fn, NJXLInsRef q) {
   return wrap_ins(unwrap_function_builder(fn)->notq(unwrap_ins(q)));
 }
@@ -1145,6 +3346,46 @@ NJXLInsRef NJX_rshuq(NJXFunctionBuilderRef fn, NJXLInsRef lhs, NJXLInsRef rhs) {
   return wrap_ins(
       unwrap_function_builder(fn)->rshuq(unwrap_ins(lhs), unwrap_ins((rhs))));
 }
+NJXLInsRef NJX_popcnti(NJXFunctionBuilderRef fn, NJXLInsRef i) {
+  return wrap_ins(unwrap_function_builder(fn)->popcnti(unwrap_ins(i)));
+}
+NJXLInsRef NJX_popcntq(NJXFunctionBuilderRef fn, NJXLInsRef q) {
+  return wrap_ins(unwrap_function_builder(fn)->popcntq(unwrap_ins(q)));
+}
+NJXLInsRef NJX_lzcnti(NJXFunctionBuilderRef fn, NJXLInsRef i) {
+  return wrap_ins(unwrap_function_builder(fn)->lzcnti(unwrap_ins(i)));
+}
+NJXLInsRef NJX_lzcntq(NJXFunctionBuilderRef fn, NJXLInsRef q) {
+  return wrap_ins(unwrap_function_builder(fn)->lzcntq(unwrap_ins(q)));
+}
+NJXLInsRef NJX_tzcnti(NJXFunctionBuilderRef fn, NJXLInsRef i) {
+  return wrap_ins(unwrap_function_builder(fn)->tzcnti(unwrap_ins(i)));
+}
+NJXLInsRef NJX_tzcntq(NJXFunctionBuilderRef fn, NJXLInsRef q) {
+  return wrap_ins(unwrap_function_builder(fn)->tzcntq(unwrap_ins(q)));
+}
+NJXLInsRef NJX_bswapi(NJXFunctionBuilderRef fn, NJXLInsRef i) {
+  return wrap_ins(unwrap_function_builder(fn)->bswapi(unwrap_ins(i)));
+}
+NJXLInsRef NJX_bswapq(NJXFunctionBuilderRef fn, NJXLInsRef q) {
+  return wrap_ins(unwrap_function_builder(fn)->bswapq(unwrap_ins(q)));
+}
+NJXLInsRef NJX_roli(NJXFunctionBuilderRef fn, NJXLInsRef lhs, NJXLInsRef rhs) {
+  return wrap_ins(
+      unwrap_function_builder(fn)->roli(unwrap_ins(lhs), unwrap_ins((rhs))));
+}
+NJXLInsRef NJX_rolq(NJXFunctionBuilderRef fn, NJXLInsRef lhs, NJXLInsRef rhs) {
+  return wrap_ins(
+      unwrap_function_builder(fn)->rolq(unwrap_ins(lhs), unwrap_ins((rhs))));
+}
+NJXLInsRef NJX_rori(NJXFunctionBuilderRef fn, NJXLInsRef lhs, NJXLInsRef rhs) {
+  return wrap_ins(
+      unwrap_function_builder(fn)->rori(unwrap_ins(lhs), unwrap_ins((rhs))));
+}
+NJXLInsRef NJX_rorq(NJXFunctionBuilderRef fn, NJXLInsRef lhs, NJXLInsRef rhs) {
+  return wrap_ins(
+      unwrap_function_builder(fn)->rorq(unwrap_ins(lhs), unwrap_ins((rhs))));
+}
 
 NJXLInsRef NJX_eqi(NJXFunctionBuilderRef fn, NJXLInsRef lhs, NJXLInsRef rhs) {
   return wrap_ins(
@@ -1300,6 +3541,24 @@ NJXLInsRef NJX_f2i(NJXFunctionBuilderRef fn, NJXLInsRef q) {
 NJXLInsRef NJX_d2q(NJXFunctionBuilderRef fn, NJXLInsRef q) {
   return wrap_ins(unwrap_function_builder(fn)->d2q(unwrap_ins(q)));
 }
+NJXLInsRef NJX_d2ui(NJXFunctionBuilderRef fn, NJXLInsRef q) {
+  return wrap_ins(unwrap_function_builder(fn)->d2ui(unwrap_ins(q)));
+}
+NJXLInsRef NJX_f2ui(NJXFunctionBuilderRef fn, NJXLInsRef q) {
+  return wrap_ins(unwrap_function_builder(fn)->f2ui(unwrap_ins(q)));
+}
+NJXLInsRef NJX_f2q(NJXFunctionBuilderRef fn, NJXLInsRef q) {
+  return wrap_ins(unwrap_function_builder(fn)->f2q(unwrap_ins(q)));
+}
+NJXLInsRef NJX_q2f(NJXFunctionBuilderRef fn, NJXLInsRef q) {
+  return wrap_ins(unwrap_function_builder(fn)->q2f(unwrap_ins(q)));
+}
+NJXLInsRef NJX_uq2d(NJXFunctionBuilderRef fn, NJXLInsRef q) {
+  return wrap_ins(unwrap_function_builder(fn)->uq2d(unwrap_ins(q)));
+}
+NJXLInsRef NJX_uq2f(NJXFunctionBuilderRef fn, NJXLInsRef q) {
+  return wrap_ins(unwrap_function_builder(fn)->uq2f(unwrap_ins(q)));
+}
 
 NJXLInsRef NJX_liveq(NJXFunctionBuilderRef fn, NJXLInsRef q) {
   return wrap_ins(unwrap_function_builder(fn)->liveq(unwrap_ins(q)));
@@ -1313,6 +3572,9 @@ NJXLInsRef NJX_livef(NJXFunctionBuilderRef fn, NJXLInsRef q) {
 NJXLInsRef NJX_lived(NJXFunctionBuilderRef fn, NJXLInsRef q) {
   return wrap_ins(unwrap_function_builder(fn)->lived(unwrap_ins(q)));
 }
+NJXLInsRef NJX_livef4(NJXFunctionBuilderRef fn, NJXLInsRef q) {
+  return wrap_ins(unwrap_function_builder(fn)->livef4(unwrap_ins(q)));
+}
 
 NJXLInsRef NJX_add_label(NJXFunctionBuilderRef fn) {
   return wrap_ins(unwrap_function_builder(fn)->addLabel());
@@ -1338,6 +3600,18 @@ NJXLInsRef NJX_cbr_false(NJXFunctionBuilderRef fn, NJXLInsRef cond,
                                                         unwrap_ins((to))));
 }
 
+NJXLInsRef NJX_cbr_true_hint(NJXFunctionBuilderRef fn, NJXLInsRef cond,
+                             NJXLInsRef to, enum NJXBranchHint hint) {
+  return wrap_ins(unwrap_function_builder(fn)->cbrHint(
+      LIR_jt, unwrap_ins(cond), unwrap_ins(to), hint));
+}
+
+NJXLInsRef NJX_cbr_false_hint(NJXFunctionBuilderRef fn, NJXLInsRef cond,
+                              NJXLInsRef to, enum NJXBranchHint hint) {
+  return wrap_ins(unwrap_function_builder(fn)->cbrHint(
+      LIR_jf, unwrap_ins(cond), unwrap_ins(to), hint));
+}
+
 NJXLInsRef NJX_choose(NJXFunctionBuilderRef fn, NJXLInsRef cond, NJXLInsRef iftrue,
                    NJXLInsRef iffalse, bool use_cmov) {
   return wrap_ins(unwrap_function_builder(fn)->choose(
@@ -1391,6 +3665,10 @@ NJXLInsRef NJX_load_f2d(NJXFunctionBuilderRef fn, NJXLInsRef ptr,
   return wrap_ins(
       unwrap_function_builder(fn)->loadf2d(unwrap_ins(ptr), offset));
 }
+NJXLInsRef NJX_load_f4(NJXFunctionBuilderRef fn, NJXLInsRef ptr,
+                       int32_t offset) {
+  return wrap_ins(unwrap_function_builder(fn)->loadf4(unwrap_ins(ptr), offset));
+}
 
 NJXLInsRef NJX_store_i2c(NJXFunctionBuilderRef fn, NJXLInsRef value,
                          NJXLInsRef ptr, int32_t offset) {
@@ -1422,11 +3700,129 @@ NJXLInsRef NJX_store_f(NJXFunctionBuilderRef fn, NJXLInsRef value,
   return wrap_ins(unwrap_function_builder(fn)->storef(unwrap_ins(value),
                                                       unwrap_ins(ptr), offset));
 }
+NJXLInsRef NJX_store_f4(NJXFunctionBuilderRef fn, NJXLInsRef value,
+                        NJXLInsRef ptr, int32_t offset) {
+  return wrap_ins(unwrap_function_builder(fn)->storef4(
+      unwrap_ins(value), unwrap_ins(ptr), offset));
+}
 
 bool NJX_is_i(NJXLInsRef ins) { return unwrap_ins(ins)->isI(); }
 bool NJX_is_q(NJXLInsRef ins) { return unwrap_ins(ins)->isQ(); }
 bool NJX_is_d(NJXLInsRef ins) { return unwrap_ins(ins)->isD(); }
 bool NJX_is_f(NJXLInsRef ins) { return unwrap_ins(ins)->isF(); }
+bool NJX_is_f4(NJXLInsRef ins) { return unwrap_ins(ins)->isF4(); }
+
+NJXLInsRef NJX_addf4(NJXFunctionBuilderRef fn, NJXLInsRef lhs, NJXLInsRef rhs) {
+  return wrap_ins(
+      unwrap_function_builder(fn)->addf4(unwrap_ins(lhs), unwrap_ins(rhs)));
+}
+NJXLInsRef NJX_subf4(NJXFunctionBuilderRef fn, NJXLInsRef lhs, NJXLInsRef rhs) {
+  return wrap_ins(
+      unwrap_function_builder(fn)->subf4(unwrap_ins(lhs), unwrap_ins(rhs)));
+}
+NJXLInsRef NJX_mulf4(NJXFunctionBuilderRef fn, NJXLInsRef lhs, NJXLInsRef rhs) {
+  return wrap_ins(
+      unwrap_function_builder(fn)->mulf4(unwrap_ins(lhs), unwrap_ins(rhs)));
+}
+NJXLInsRef NJX_divf4(NJXFunctionBuilderRef fn, NJXLInsRef lhs, NJXLInsRef rhs) {
+  return wrap_ins(
+      unwrap_function_builder(fn)->divf4(unwrap_ins(lhs), unwrap_ins(rhs)));
+}
+NJXLInsRef NJX_minf4(NJXFunctionBuilderRef fn, NJXLInsRef lhs, NJXLInsRef rhs) {
+  return wrap_ins(
+      unwrap_function_builder(fn)->minf4(unwrap_ins(lhs), unwrap_ins(rhs)));
+}
+NJXLInsRef NJX_maxf4(NJXFunctionBuilderRef fn, NJXLInsRef lhs, NJXLInsRef rhs) {
+  return wrap_ins(
+      unwrap_function_builder(fn)->maxf4(unwrap_ins(lhs), unwrap_ins(rhs)));
+}
+NJXLInsRef NJX_negf4(NJXFunctionBuilderRef fn, NJXLInsRef q) {
+  return wrap_ins(unwrap_function_builder(fn)->negf4(unwrap_ins(q)));
+}
+NJXLInsRef NJX_absf4(NJXFunctionBuilderRef fn, NJXLInsRef q) {
+  return wrap_ins(unwrap_function_builder(fn)->absf4(unwrap_ins(q)));
+}
+NJXLInsRef NJX_sqrtf4(NJXFunctionBuilderRef fn, NJXLInsRef q) {
+  return wrap_ins(unwrap_function_builder(fn)->sqrtf4(unwrap_ins(q)));
+}
+NJXLInsRef NJX_recipf4(NJXFunctionBuilderRef fn, NJXLInsRef q) {
+  return wrap_ins(unwrap_function_builder(fn)->recipf4(unwrap_ins(q)));
+}
+NJXLInsRef NJX_rsqrtf4(NJXFunctionBuilderRef fn, NJXLInsRef q) {
+  return wrap_ins(unwrap_function_builder(fn)->rsqrtf4(unwrap_ins(q)));
+}
+
+NJXLInsRef NJX_eqf4(NJXFunctionBuilderRef fn, NJXLInsRef lhs, NJXLInsRef rhs) {
+  return wrap_ins(
+      unwrap_function_builder(fn)->eqf4(unwrap_ins(lhs), unwrap_ins(rhs)));
+}
+NJXLInsRef NJX_cmpeqf4(NJXFunctionBuilderRef fn, NJXLInsRef lhs,
+                       NJXLInsRef rhs) {
+  return wrap_ins(unwrap_function_builder(fn)->cmpf4(
+      LIR_cmpeqf4, unwrap_ins(lhs), unwrap_ins(rhs)));
+}
+NJXLInsRef NJX_cmpnef4(NJXFunctionBuilderRef fn, NJXLInsRef lhs,
+                       NJXLInsRef rhs) {
+  return wrap_ins(unwrap_function_builder(fn)->cmpf4(
+      LIR_cmpnef4, unwrap_ins(lhs), unwrap_ins(rhs)));
+}
+NJXLInsRef NJX_cmpltf4(NJXFunctionBuilderRef fn, NJXLInsRef lhs,
+                       NJXLInsRef rhs) {
+  return wrap_ins(unwrap_function_builder(fn)->cmpf4(
+      LIR_cmpltf4, unwrap_ins(lhs), unwrap_ins(rhs)));
+}
+NJXLInsRef NJX_cmplef4(NJXFunctionBuilderRef fn, NJXLInsRef lhs,
+                       NJXLInsRef rhs) {
+  return wrap_ins(unwrap_function_builder(fn)->cmpf4(
+      LIR_cmplef4, unwrap_ins(lhs), unwrap_ins(rhs)));
+}
+NJXLInsRef NJX_cmpgtf4(NJXFunctionBuilderRef fn, NJXLInsRef lhs,
+                       NJXLInsRef rhs) {
+  return wrap_ins(unwrap_function_builder(fn)->cmpf4(
+      LIR_cmpgtf4, unwrap_ins(lhs), unwrap_ins(rhs)));
+}
+NJXLInsRef NJX_cmpgef4(NJXFunctionBuilderRef fn, NJXLInsRef lhs,
+                       NJXLInsRef rhs) {
+  return wrap_ins(unwrap_function_builder(fn)->cmpf4(
+      LIR_cmpgef4, unwrap_ins(lhs), unwrap_ins(rhs)));
+}
+
+NJXLInsRef NJX_dotf4(NJXFunctionBuilderRef fn, NJXLInsRef lhs, NJXLInsRef rhs) {
+  return wrap_ins(
+      unwrap_function_builder(fn)->dotf4(unwrap_ins(lhs), unwrap_ins(rhs)));
+}
+NJXLInsRef NJX_dotf3(NJXFunctionBuilderRef fn, NJXLInsRef lhs, NJXLInsRef rhs) {
+  return wrap_ins(
+      unwrap_function_builder(fn)->dotf3(unwrap_ins(lhs), unwrap_ins(rhs)));
+}
+NJXLInsRef NJX_dotf2(NJXFunctionBuilderRef fn, NJXLInsRef lhs, NJXLInsRef rhs) {
+  return wrap_ins(
+      unwrap_function_builder(fn)->dotf2(unwrap_ins(lhs), unwrap_ins(rhs)));
+}
+
+NJXLInsRef NJX_f2f4(NJXFunctionBuilderRef fn, NJXLInsRef q) {
+  return wrap_ins(unwrap_function_builder(fn)->f2f4(unwrap_ins(q)));
+}
+NJXLInsRef NJX_ffff2f4(NJXFunctionBuilderRef fn, NJXLInsRef x, NJXLInsRef y,
+                       NJXLInsRef z, NJXLInsRef w) {
+  return wrap_ins(unwrap_function_builder(fn)->ffff2f4(
+      unwrap_ins(x), unwrap_ins(y), unwrap_ins(z), unwrap_ins(w)));
+}
+NJXLInsRef NJX_f4x(NJXFunctionBuilderRef fn, NJXLInsRef q) {
+  return wrap_ins(unwrap_function_builder(fn)->f4x(unwrap_ins(q)));
+}
+NJXLInsRef NJX_f4y(NJXFunctionBuilderRef fn, NJXLInsRef q) {
+  return wrap_ins(unwrap_function_builder(fn)->f4y(unwrap_ins(q)));
+}
+NJXLInsRef NJX_f4z(NJXFunctionBuilderRef fn, NJXLInsRef q) {
+  return wrap_ins(unwrap_function_builder(fn)->f4z(unwrap_ins(q)));
+}
+NJXLInsRef NJX_f4w(NJXFunctionBuilderRef fn, NJXLInsRef q) {
+  return wrap_ins(unwrap_function_builder(fn)->f4w(unwrap_ins(q)));
+}
+NJXLInsRef NJX_swzf4(NJXFunctionBuilderRef fn, NJXLInsRef q, uint8_t mask) {
+  return wrap_ins(unwrap_function_builder(fn)->swzf4(unwrap_ins(q), mask));
+}
 
 /**
 * Sets the target of a jump instruction
@@ -1496,6 +3892,10 @@ NJXLInsRef NJX_calld(NJXFunctionBuilderRef fn, const char *funcname,
                      NJXCallAbiKind abi, int nargs, NJXLInsRef args[]) {
   return NJX_call(fn, funcname, LIR_calld, abi, nargs, args);
 }
+NJXLInsRef NJX_callf4(NJXFunctionBuilderRef fn, const char *funcname,
+                      NJXCallAbiKind abi, int nargs, NJXLInsRef args[]) {
+  return NJX_call(fn, funcname, LIR_callf4, abi, nargs, args);
+}
 
 NJXLInsRef NJX_comment(NJXFunctionBuilderRef fn, const char *s) {
   return wrap_ins(unwrap_function_builder(fn)->comment(s));
@@ -1514,4 +3914,43 @@ NJXLInsRef NJX_comment(NJXFunctionBuilderRef fn, const char *s) {
 void *NJX_finalize(NJXFunctionBuilderRef fn) {
   return unwrap_function_builder(fn)->finalize();
 }
+
+void NJX_set_lookahead_regalloc(NJXFunctionBuilderRef fn, bool enable) {
+  unwrap_function_builder(fn)->setLookaheadRegAlloc(enable);
+}
+
+void NJX_set_fp_contract(NJXFunctionBuilderRef fn, bool enable) {
+  unwrap_function_builder(fn)->setFpContract(enable);
+}
+
+void NJX_get_regalloc_stats(NJXFunctionBuilderRef fn, int *spills,
+                            int *restores) {
+  unwrap_function_builder(fn)->regAllocStats(spills, restores);
+}
+
+void NJX_get_memopt_stats(NJXFunctionBuilderRef fn, int *loads, int *stores) {
+  unwrap_function_builder(fn)->memOptStats(loads, stores);
+}
+
+NJXCompileTicketRef NJX_finalize_async(NJXContextRef context,
+                                       NJXFunctionBuilderRef fn,
+                                       NJXCompileCallback callback,
+                                       void *userdata) {
+  auto ticket =
+      new CompileTicket(unwrap_function_builder(fn), callback, userdata);
+  unwrap_context(context)->enqueue(ticket);
+  return ticket->wrap();
+}
+
+bool NJX_ticket_is_ready(NJXCompileTicketRef ticket) {
+  return unwrap_ticket(ticket)->state() != CompileTicket::PENDING;
+}
+
+void *NJX_ticket_wait(NJXCompileTicketRef ticket) {
+  return unwrap_ticket(ticket)->wait();
+}
+
+void NJX_release_ticket(NJXCompileTicketRef ticket) {
+  unwrap_ticket(ticket)->release();
+}
 }
@@ -6,6 +6,7 @@
 #define __nanojit_extra__
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 /*
@@ -26,6 +27,10 @@ typedef struct NJXLIns *NJXLInsRef;
 * Context must be kept alive as long as any functions within it are
 * needed. Deleting the Jit Context will also delete all compiled
 * functions managed by the context.
+* A context may be shared by several threads: each Function Builder owns
+* its own LIR buffer and assembler, so functions can be built and
+* finalized concurrently. Only the code memory and the registry of
+* compiled functions are shared, and access to these is synchronized.
 */
 typedef struct NJXContext *NJXContextRef;
 
@@ -34,9 +39,23 @@ typedef struct NJXContext *NJXContextRef;
 * C function equivalent. Once the code is generated by invoking
 * finalize on the builder, the builder itself can be destroyed as the
 * compiled function lives on in the associated Jit Context.
+* A Function Builder must only be used by one thread at a time.
 */
 typedef struct NFXFunctionBuilder *NJXFunctionBuilderRef;
 
+/**
+* A Compile Ticket tracks a function that is being finalized in the
+* background - see NJX_finalize_async().
+*/
+typedef struct NJXCompileTicket *NJXCompileTicketRef;
+
+/**
+* Called on a compiler thread when an asynchronous finalize completes.
+* code is the compiled function, or NULL if compilation failed.
+*/
+typedef void (*NJXCompileCallback)(NJXCompileTicketRef ticket, void *code,
+                                   void *userdata);
+
 /**
 * Nanojit function parameter types are is a 64-bit quantities
 * on a 64-bit machine
@@ -59,11 +78,7 @@ enum NJXCallAbiKind {
 * accepted by a JITed function.
 */
 enum {
-#ifdef _WIN64
-  NJXMaxArgs = 4
-#else
-  NJXMaxArgs = 6
-#endif
+  NJXMaxArgs = 8
 };
 
 /*
@@ -79,6 +94,7 @@ enum NJXValueKind {
 #endif
   NJXValueKind_D = 4, // double
   NJXValueKind_F = 5, // single-precision float;
+  NJXValueKind_F4 = 6, // vector of 4 single-precision floats (__m128)
 #ifdef NANOJIT_64BIT
   NJXValueKind_P = NJXValueKind_Q, // pointer
 #else
@@ -86,6 +102,33 @@ enum NJXValueKind {
 #endif
 };
 
+/*
+* How often a conditional branch is taken, see NJX_cbr_true_hint().
+*/
+enum NJXBranchHint {
+  NJX_BRANCH_NORMAL,   // no hint
+  NJX_BRANCH_LIKELY,   // the branch is usually taken
+  NJX_BRANCH_UNLIKELY  // the branch is rarely taken
+};
+
+/*
+* Execution counts of a conditional branch, or of the backward branch that
+* closes a loop, see NJX_get_profile().
+*/
+struct NJXBranchProfile {
+  uint64_t taken;
+  uint64_t not_taken;
+};
+
+/*
+* Execution counts of a function, see NJX_get_profile().
+*/
+struct NJXProfile {
+  uint64_t entries; // calls that ran this function's code
+  int branches;     // conditional branches profiled
+  int loops;        // branches to an earlier label profiled
+};
+
 /*
 * Note on NanoJIT types:
 * The NanoJIT IR operates on 4 types of values:
@@ -125,23 +168,157 @@ extern bool NJX_register_C_function(NJXContextRef context, const char *name,
 * Returns a Jit compiled function looking it up by name.
 * The pointer must be cast to the correct signature.
 * Returns nullptr if function not found.
+* Other Jit compiled functions call a function through a stable entry point
+* for its name, so that when a new function is finalized under the same
+* name its existing callers switch to it without being recompiled. The
+* pointer returned here is not redirected.
 */
 extern void *NJX_get_function_by_name(NJXContextRef, const char *name);
 
+/**
+* Enables a persistent cache of generated code in the given directory, which
+* must exist. Functions subsequently created in this Context are looked up in
+* the cache by a hash of their LIR and the code generation settings; on a hit
+* the cached code is copied into the Context and relocated instead of being
+* compiled, and on a miss the newly compiled code is added to the cache.
+* Calls are bound by name to the functions visible to the builder, as for
+* compiled code. The cache may be shared by several Contexts and processes
+* on the same machine. Passing NULL disables the cache.
+* Returns false if the cache is not supported on this platform.
+*/
+extern bool NJX_set_code_cache(NJXContextRef, const char *directory);
+
+/**
+* Retrieves the number of functions that were loaded from the code cache and
+* the number that had to be compiled while the cache was enabled.
+*/
+extern void NJX_get_code_cache_stats(NJXContextRef, int *hits, int *misses);
+
+/**
+* Enables tiered compilation for functions subsequently created in this
+* Context with the optimize flag set. Such functions are first compiled
+* quickly without optimization, with a counter on entry. The call that
+* brings the count to the given threshold queues the function to be compiled
+* again from its LIR with full optimization on a background thread owned by
+* the Context. The optimized code then replaces the first one under the
+* function's name, and the first code forwards every call to it, so callers
+* holding the old pointer or compiled against it switch over too.
+* A threshold of 0 (the default) disables tiering.
+*/
+extern void NJX_set_tier_up_threshold(NJXContextRef, int calls);
+
+/**
+* Blocks until every recompilation queued by tiered compilation so far has
+* completed, and returns the number of functions that were recompiled.
+*/
+extern int NJX_wait_for_tier_up(NJXContextRef);
+
+/**
+* Enables inlining of small Jit compiled functions. A function finalized
+* while this is set keeps its LIR if it has no more than the given number
+* of instructions, no guards and a single return at its end. A call to it
+* from an optimized function is then replaced by a copy of its body,
+* which the caller's optimizations see as part of the caller. Inlined
+* copies are not updated when the function is replaced under the same
+* name. A limit of 0 (the default) disables inlining.
+*/
+extern void NJX_set_inline_limit(NJXContextRef, int instructions);
+
+/**
+* Sets how many times optimized functions finalized afterwards unroll their
+* counted loops: loops that step a variable by a constant until it reaches
+* a bound fixed before the loop, with no other branches or labels inside.
+* The leftover iterations run in the original loop. A factor of 0 or 1
+* (the default) disables unrolling; factors above 16 are taken as 16.
+*/
+extern void NJX_set_unroll_factor(NJXContextRef, int factor);
+
+/**
+* Enables execution profiling for functions subsequently created in this
+* Context. Their code counts the calls that run it, how often each
+* conditional branch is taken and not taken, and how often each branch to
+* an existing label - the back edge of a loop - is taken, with inline
+* 64-bit increments. Profiled functions are not loaded from or saved to the
+* code cache, and the LIR of their bodies is inlined or serialized without
+* the counters. Tiered functions keep counting into the same counters once
+* optimized. Profiling is disabled by default.
+*/
+extern void NJX_set_profiling(NJXContextRef, int enabled);
+
+/**
+* Takes a snapshot of the execution counts of the named function. Branches
+* and loops are numbered in the order the builder added them; up to
+* max_branches and max_loops of them are copied to branches and loops,
+* which may be NULL. The counters are updated without synchronization, so
+* calls running on other threads during the snapshot may be missed.
+* Returns false if there is no such function or it was not profiled.
+*/
+extern bool NJX_get_profile(NJXContextRef, const char *name,
+                            struct NJXProfile *profile,
+                            struct NJXBranchProfile *branches,
+                            int max_branches, struct NJXBranchProfile *loops,
+                            int max_loops);
+
+/**
+* Sets the value of a patchable constant (see NJX_patchable_immi()),
+* creating it if needed. Returns false if it exists with another type.
+*/
+extern bool NJX_set_patchable_i(NJXContextRef, const char *name,
+                                int32_t value);
+extern bool NJX_set_patchable_q(NJXContextRef, const char *name,
+                                int64_t value);
+extern bool NJX_set_patchable_d(NJXContextRef, const char *name,
+                                double value);
+
+/**
+* Frees a Jit compiled function before the Context ends. Its code memory is
+* returned to the Context for reuse by later functions, and the name is no
+* longer known to NJX_get_function_by_name() or to calls from new functions.
+* The versions it replaced under the same name are freed too, except the
+* first tier of a tiered function, which runs its own code again.
+* Fails, returning false, if there is no such function or if it is still
+* called by another function of the Context (including functions still
+* being built); free or destroy the callers first.
+* The caller must ensure that the function is not executing and that no
+* pointer to it is used afterwards.
+*/
+extern bool NJX_free_function(NJXContextRef, const char *name);
+
+/**
+* A function finalized under the name of an existing one replaces it, but
+* the code of the old version is kept, as it may still be running or be
+* called through a pointer obtained earlier. Replacing a function
+* repeatedly therefore uses more code memory each time, until the name is
+* freed or the Context is destroyed. This frees the replaced versions of
+* the named function now, except the unoptimized first tier of a tiered
+* function, which the current version needs. Returns the number of
+* versions freed.
+* The caller must ensure that none of them is executing and that no
+* pointer to them is used afterwards.
+*/
+extern int NJX_free_replaced_functions(NJXContextRef, const char *name);
+
 /**
 * Creates a new FunctionBuilder object. The builder is used to construct the
 * code that will go into one function. Once the function has been defined,
 * machine code is generated by calling finalize(). After the function is
 * compiled the builder object can be thrown away - the compiled function
 * will live as long as the owning Jit Context lives.
-* If optimize flag is true then NanoJit's CSE and Expr filters are enabled.
-* *** IMPORTANT ***
-* Note that a limitation of NanoJIT is that the function can only
-* accept integer or pointer parameters on X64 architecture. Furthermore
-* the number of parameters is limited to 4 on WIN64 and 6 on UNIX platforms
-* as these are the integer/pointer registers used by these OSes on
-* X64 platform. If you specify unsupported number of arguments then
-* an error will be reported and this function will fail.
+* If optimize flag is true then NanoJit's CSE and Expr filters are enabled,
+* values are reused across labels where the code computing them dominates,
+* stored values are forwarded to loads and dead stores removed,
+* overflow checks and branches that value ranges rule out are removed,
+* loop-invariant code is moved out of loops, and counted loops are unrolled
+* (see NJX_set_unroll_factor()). If tiered compilation is
+* enabled (see NJX_set_tier_up_threshold()) this only happens once the
+* function has been called often enough.
+* The function can accept integer, pointer, double and float parameters,
+* up to NJXMaxArgs of them. They are received as the platform ABI passes
+* them: in registers where available (XMM registers for double and float),
+* otherwise on the stack. Float4 parameters are only accepted while they
+* fit in XMM registers, and not at all on Win64, which passes them by
+* reference. If you specify unsupported number of arguments
+* then an error will be reported and this function will fail.
 */
 extern NJXFunctionBuilderRef NJX_create_function_builder(
     NJXContextRef context, const char *name, enum NJXValueKind return_type,
@@ -172,6 +349,9 @@ extern NJXLInsRef NJX_retf(NJXFunctionBuilderRef fn, NJXLInsRef result);
 */
 extern NJXLInsRef NJX_retq(NJXFunctionBuilderRef fn, NJXLInsRef result);
 
+/* Return float4 */
+extern NJXLInsRef NJX_retf4(NJXFunctionBuilderRef fn, NJXLInsRef result);
+
 /**
 * Creates an int32 constant
 */
@@ -192,6 +372,27 @@ extern NJXLInsRef NJX_immd(NJXFunctionBuilderRef fn, double d);
 */
 extern NJXLInsRef NJX_immf(NJXFunctionBuilderRef fn, float f);
 
+/**
+* Creates a float4 constant
+*/
+extern NJXLInsRef NJX_immf4(NJXFunctionBuilderRef fn, float x, float y,
+                            float z, float w);
+
+/**
+* Creates a patchable constant: the current value of the named int, quad
+* or double constant of the Context, which can be changed later with
+* NJX_set_patchable_i() etc. without recompiling the functions that use it.
+* A new value is seen by calls that start after it was set. The constant is
+* created with a value of 0 if it does not exist yet; returns NULL if it
+* exists with another type.
+*/
+extern NJXLInsRef NJX_patchable_immi(NJXFunctionBuilderRef fn,
+                                     const char *name);
+extern NJXLInsRef NJX_patchable_immq(NJXFunctionBuilderRef fn,
+                                     const char *name);
+extern NJXLInsRef NJX_patchable_immd(NJXFunctionBuilderRef fn,
+                                     const char *name);
+
 /**
 * Gets a function parameter. The number and types of parameters
 * of a function are specified in NJX_create_function_builder().
@@ -235,6 +436,23 @@ extern NJXLInsRef NJX_muld(NJXFunctionBuilderRef fn, NJXLInsRef lhs,
 extern NJXLInsRef NJX_mulf(NJXFunctionBuilderRef fn, NJXLInsRef lhs,
                            NJXLInsRef rhs);
 
+/**
+* The high 64 bits of the 128-bit signed product of two quads.
+*/
+extern NJXLInsRef NJX_mulhq(NJXFunctionBuilderRef fn, NJXLInsRef lhs,
+                            NJXLInsRef rhs);
+
+/**
+* Fused multiply-add: a * b + c, rounded once when the CPU has FMA
+* instructions, and computed as a multiply and an add otherwise.
+*/
+extern NJXLInsRef NJX_fmad(NJXFunctionBuilderRef fn, NJXLInsRef a,
+                           NJXLInsRef b, NJXLInsRef c);
+extern NJXLInsRef NJX_fmaf(NJXFunctionBuilderRef fn, NJXLInsRef a,
+                           NJXLInsRef b, NJXLInsRef c);
+extern NJXLInsRef NJX_fmaf4(NJXFunctionBuilderRef fn, NJXLInsRef a,
+                            NJXLInsRef b, NJXLInsRef c);
+
 /* Divide */
 extern NJXLInsRef NJX_divi(NJXFunctionBuilderRef fn, NJXLInsRef lhs,
                            NJXLInsRef rhs);
@@ -257,6 +475,32 @@ extern NJXLInsRef NJX_negi(NJXFunctionBuilderRef fn, NJXLInsRef q);
 extern NJXLInsRef NJX_negf(NJXFunctionBuilderRef fn, NJXLInsRef q);
 extern NJXLInsRef NJX_negd(NJXFunctionBuilderRef fn, NJXLInsRef q);
 
+/**
+* Minimum and maximum. If either operand is a NaN, or both are zero, the
+* result is rhs.
+*/
+extern NJXLInsRef NJX_mind(NJXFunctionBuilderRef fn, NJXLInsRef lhs,
+                           NJXLInsRef rhs);
+extern NJXLInsRef NJX_maxd(NJXFunctionBuilderRef fn, NJXLInsRef lhs,
+                           NJXLInsRef rhs);
+extern NJXLInsRef NJX_minf(NJXFunctionBuilderRef fn, NJXLInsRef lhs,
+                           NJXLInsRef rhs);
+extern NJXLInsRef NJX_maxf(NJXFunctionBuilderRef fn, NJXLInsRef lhs,
+                           NJXLInsRef rhs);
+
+/**
+* Rounding to an integral value, as C's floor(), ceil(), trunc() and
+* round(); round() takes halfway cases away from zero.
+*/
+extern NJXLInsRef NJX_floord(NJXFunctionBuilderRef fn, NJXLInsRef q);
+extern NJXLInsRef NJX_ceild(NJXFunctionBuilderRef fn, NJXLInsRef q);
+extern NJXLInsRef NJX_truncd(NJXFunctionBuilderRef fn, NJXLInsRef q);
+extern NJXLInsRef NJX_roundd(NJXFunctionBuilderRef fn, NJXLInsRef q);
+extern NJXLInsRef NJX_floorf(NJXFunctionBuilderRef fn, NJXLInsRef q);
+extern NJXLInsRef NJX_ceilf(NJXFunctionBuilderRef fn, NJXLInsRef q);
+extern NJXLInsRef NJX_truncf(NJXFunctionBuilderRef fn, NJXLInsRef q);
+extern NJXLInsRef NJX_roundf(NJXFunctionBuilderRef fn, NJXLInsRef q);
+
 /* Bitwise Operators */
 extern NJXLInsRef NJX_notq(NJXFunctionBuilderRef fn, NJXLInsRef q);
 extern NJXLInsRef NJX_noti(NJXFunctionBuilderRef fn, NJXLInsRef q);
@@ -285,6 +529,29 @@ extern NJXLInsRef NJX_rshui(NJXFunctionBuilderRef fn, NJXLInsRef lhs,
 extern NJXLInsRef NJX_rshuq(NJXFunctionBuilderRef fn, NJXLInsRef lhs,
                             NJXLInsRef rhs);
 
+/**
+* Bit counts and byte swaps. The counts return an int for quad operands
+* too, and lzcnt/tzcnt of zero return the operand width (32 or 64).
+* Rotates use the bottom 5 (int) or 6 (quad) bits of rhs, which is
+* always an int.
+*/
+extern NJXLInsRef NJX_popcnti(NJXFunctionBuilderRef fn, NJXLInsRef i);
+extern NJXLInsRef NJX_popcntq(NJXFunctionBuilderRef fn, NJXLInsRef q);
+extern NJXLInsRef NJX_lzcnti(NJXFunctionBuilderRef fn, NJXLInsRef i);
+extern NJXLInsRef NJX_lzcntq(NJXFunctionBuilderRef fn, NJXLInsRef q);
+extern NJXLInsRef NJX_tzcnti(NJXFunctionBuilderRef fn, NJXLInsRef i);
+extern NJXLInsRef NJX_tzcntq(NJXFunctionBuilderRef fn, NJXLInsRef q);
+extern NJXLInsRef NJX_bswapi(NJXFunctionBuilderRef fn, NJXLInsRef i);
+extern NJXLInsRef NJX_bswapq(NJXFunctionBuilderRef fn, NJXLInsRef q);
+extern NJXLInsRef NJX_roli(NJXFunctionBuilderRef fn, NJXLInsRef lhs,
+                           NJXLInsRef rhs);
+extern NJXLInsRef NJX_rolq(NJXFunctionBuilderRef fn, NJXLInsRef lhs,
+                           NJXLInsRef rhs);
+extern NJXLInsRef NJX_rori(NJXFunctionBuilderRef fn, NJXLInsRef lhs,
+                           NJXLInsRef rhs);
+extern NJXLInsRef NJX_rorq(NJXFunctionBuilderRef fn, NJXLInsRef lhs,
+                           NJXLInsRef rhs);
+
 /**
 * Comparisons. Note that there is no api for testing "not equal to". 
 * You can call the eq?() api twice to get not equal.
@@ -364,6 +631,12 @@ extern NJXLInsRef NJX_d2f(NJXFunctionBuilderRef fn, NJXLInsRef q);
 extern NJXLInsRef NJX_d2i(NJXFunctionBuilderRef fn, NJXLInsRef q);
 extern NJXLInsRef NJX_f2i(NJXFunctionBuilderRef fn, NJXLInsRef q);
 extern NJXLInsRef NJX_d2q(NJXFunctionBuilderRef fn, NJXLInsRef q);
+extern NJXLInsRef NJX_d2ui(NJXFunctionBuilderRef fn, NJXLInsRef q);
+extern NJXLInsRef NJX_f2ui(NJXFunctionBuilderRef fn, NJXLInsRef q);
+extern NJXLInsRef NJX_f2q(NJXFunctionBuilderRef fn, NJXLInsRef q);
+extern NJXLInsRef NJX_q2f(NJXFunctionBuilderRef fn, NJXLInsRef q);
+extern NJXLInsRef NJX_uq2d(NJXFunctionBuilderRef fn, NJXLInsRef q);
+extern NJXLInsRef NJX_uq2f(NJXFunctionBuilderRef fn, NJXLInsRef q);
 
 /**
 * Inserts a label at current position, no code is emitted for this
@@ -391,6 +664,19 @@ extern NJXLInsRef NJX_cbr_true(NJXFunctionBuilderRef fn, NJXLInsRef cond,
 extern NJXLInsRef NJX_cbr_false(NJXFunctionBuilderRef fn, NJXLInsRef cond,
                                 NJXLInsRef to);
 
+/**
+* Conditional branches with a hint saying how often the branch is taken.
+* The rarely executed side - the target of an unlikely branch, or the code
+* following a likely one - is laid out at the end of the function, so that
+* the usual path falls through without taken branches. The cold code runs
+* up to the next return or jump, or up to the next label; it is left in
+* place if other code falls into it or it defines values used elsewhere.
+*/
+extern NJXLInsRef NJX_cbr_true_hint(NJXFunctionBuilderRef fn, NJXLInsRef cond,
+                                    NJXLInsRef to, enum NJXBranchHint hint);
+extern NJXLInsRef NJX_cbr_false_hint(NJXFunctionBuilderRef fn, NJXLInsRef cond,
+                                     NJXLInsRef to, enum NJXBranchHint hint);
+
 /**
 * Assigns a value based on the condition - similar to C's ?: operator.
 * If use_cmov is true, then emit CMOV assembly instruction
@@ -461,6 +747,78 @@ extern NJXLInsRef NJX_store_d(NJXFunctionBuilderRef fn, NJXLInsRef value,
 extern NJXLInsRef NJX_store_f(NJXFunctionBuilderRef fn, NJXLInsRef value,
                               NJXLInsRef ptr, int32_t offset);
 
+/* Float4 load and store; the address must be 16-byte aligned */
+extern NJXLInsRef NJX_load_f4(NJXFunctionBuilderRef fn, NJXLInsRef ptr,
+                              int32_t offset);
+extern NJXLInsRef NJX_store_f4(NJXFunctionBuilderRef fn, NJXLInsRef value,
+                               NJXLInsRef ptr, int32_t offset);
+
+/**
+* Float4 (SIMD) operations; these work on all four components at once.
+* recip and rsqrt are approximations, as computed by RCPPS and RSQRTPS.
+*/
+extern NJXLInsRef NJX_addf4(NJXFunctionBuilderRef fn, NJXLInsRef lhs,
+                            NJXLInsRef rhs);
+extern NJXLInsRef NJX_subf4(NJXFunctionBuilderRef fn, NJXLInsRef lhs,
+                            NJXLInsRef rhs);
+extern NJXLInsRef NJX_mulf4(NJXFunctionBuilderRef fn, NJXLInsRef lhs,
+                            NJXLInsRef rhs);
+extern NJXLInsRef NJX_divf4(NJXFunctionBuilderRef fn, NJXLInsRef lhs,
+                            NJXLInsRef rhs);
+extern NJXLInsRef NJX_minf4(NJXFunctionBuilderRef fn, NJXLInsRef lhs,
+                            NJXLInsRef rhs);
+extern NJXLInsRef NJX_maxf4(NJXFunctionBuilderRef fn, NJXLInsRef lhs,
+                            NJXLInsRef rhs);
+extern NJXLInsRef NJX_negf4(NJXFunctionBuilderRef fn, NJXLInsRef q);
+extern NJXLInsRef NJX_absf4(NJXFunctionBuilderRef fn, NJXLInsRef q);
+extern NJXLInsRef NJX_sqrtf4(NJXFunctionBuilderRef fn, NJXLInsRef q);
+extern NJXLInsRef NJX_recipf4(NJXFunctionBuilderRef fn, NJXLInsRef q);
+extern NJXLInsRef NJX_rsqrtf4(NJXFunctionBuilderRef fn, NJXLInsRef q);
+
+/**
+* Float4 comparisons. NJX_eqf4() yields an int that is 1 when all four
+* components are equal; the others yield a float4 holding 1.0 in the
+* components where the comparison holds and 0.0 elsewhere.
+*/
+extern NJXLInsRef NJX_eqf4(NJXFunctionBuilderRef fn, NJXLInsRef lhs,
+                           NJXLInsRef rhs);
+extern NJXLInsRef NJX_cmpeqf4(NJXFunctionBuilderRef fn, NJXLInsRef lhs,
+                              NJXLInsRef rhs);
+extern NJXLInsRef NJX_cmpnef4(NJXFunctionBuilderRef fn, NJXLInsRef lhs,
+                              NJXLInsRef rhs);
+extern NJXLInsRef NJX_cmpltf4(NJXFunctionBuilderRef fn, NJXLInsRef lhs,
+                              NJXLInsRef rhs);
+extern NJXLInsRef NJX_cmplef4(NJXFunctionBuilderRef fn, NJXLInsRef lhs,
+                              NJXLInsRef rhs);
+extern NJXLInsRef NJX_cmpgtf4(NJXFunctionBuilderRef fn, NJXLInsRef lhs,
+                              NJXLInsRef rhs);
+extern NJXLInsRef NJX_cmpgef4(NJXFunctionBuilderRef fn, NJXLInsRef lhs,
+                              NJXLInsRef rhs);
+
+/* Dot product of the first 4, 3 or 2 components, as a float */
+extern NJXLInsRef NJX_dotf4(NJXFunctionBuilderRef fn, NJXLInsRef lhs,
+                            NJXLInsRef rhs);
+extern NJXLInsRef NJX_dotf3(NJXFunctionBuilderRef fn, NJXLInsRef lhs,
+                            NJXLInsRef rhs);
+extern NJXLInsRef NJX_dotf2(NJXFunctionBuilderRef fn, NJXLInsRef lhs,
+                            NJXLInsRef rhs);
+
+/**
+* Building and taking apart float4 values. NJX_f2f4() copies a float into
+* all four components. NJX_swzf4() rearranges the components: component i of
+* the result is the component of q selected by bits 2i and 2i+1 of mask
+* (so the lowest two bits choose x), as with SHUFPS.
+*/
+extern NJXLInsRef NJX_f2f4(NJXFunctionBuilderRef fn, NJXLInsRef q);
+extern NJXLInsRef NJX_ffff2f4(NJXFunctionBuilderRef fn, NJXLInsRef x,
+                              NJXLInsRef y, NJXLInsRef z, NJXLInsRef w);
+extern NJXLInsRef NJX_f4x(NJXFunctionBuilderRef fn, NJXLInsRef q);
+extern NJXLInsRef NJX_f4y(NJXFunctionBuilderRef fn, NJXLInsRef q);
+extern NJXLInsRef NJX_f4z(NJXFunctionBuilderRef fn, NJXLInsRef q);
+extern NJXLInsRef NJX_f4w(NJXFunctionBuilderRef fn, NJXLInsRef q);
+extern NJXLInsRef NJX_swzf4(NJXFunctionBuilderRef fn, NJXLInsRef q,
+                            uint8_t mask);
+
 /**
 * Tests the type of an instruction
 */
@@ -468,30 +826,24 @@ extern bool NJX_is_i(NJXLInsRef ins);
 extern bool NJX_is_q(NJXLInsRef ins);
 extern bool NJX_is_d(NJXLInsRef ins);
 extern bool NJX_is_f(NJXLInsRef ins);
+extern bool NJX_is_f4(NJXLInsRef ins);
 
 /*
 * Insert liveness information.
 * The register allocator computes virtual register liveness as it runs, while it
-* is scanning LIR bottom-up. To prevent the allocator from thinking a
-* register is available when it is not, following actions are needed:
-*
-* a) Mark function parameters as live after all code is emitted for the
-* function.
-*
-* b) If a virtual register is being defined before the loop entry
-* point, and used inside a loop, then it's live range must cover the whole loop.
-* the frontend compiler must insert LIR_live at the loop jumps (back edges)
-* to extend the live range.
-*
-* Example: Suppose you have a jump to block B. LIR_live for B's live-in
-* registers, just before the jump, should be added (only needed for backwards
-* jumps though). Note that if the jump is in B1 and the target is B2, you
-* need LIR_live for B2's live-in registers.
+* is scanning LIR bottom-up. A value that is defined before a loop and used
+* inside it must stay live for the whole loop, which needs LIR_live at the
+* loop's back edges. The builder works out the values live into each loop
+* (including the alloca memory that live pointers point into) and inserts
+* these itself when the function is finalized, so front ends need not; any
+* LIR_live written just after a backward jump is replaced by that set, except
+* on alloca memory, whose indirect uses cannot always be seen.
 */
 extern NJXLInsRef NJX_liveq(NJXFunctionBuilderRef fn, NJXLInsRef);
 extern NJXLInsRef NJX_livei(NJXFunctionBuilderRef fn, NJXLInsRef);
 extern NJXLInsRef NJX_livef(NJXFunctionBuilderRef fn, NJXLInsRef);
 extern NJXLInsRef NJX_lived(NJXFunctionBuilderRef fn, NJXLInsRef);
+extern NJXLInsRef NJX_livef4(NJXFunctionBuilderRef fn, NJXLInsRef);
 
 /*
 Insert calls - note maximum number of arguments is 8 on X86-64 platforms
@@ -517,6 +869,9 @@ extern NJXLInsRef NJX_callf(NJXFunctionBuilderRef fn, const char *funcname,
 extern NJXLInsRef NJX_calld(NJXFunctionBuilderRef fn, const char *funcname,
                             enum NJXCallAbiKind abi, int nargs,
                             NJXLInsRef args[]);
+extern NJXLInsRef NJX_callf4(NJXFunctionBuilderRef fn, const char *funcname,
+                             enum NJXCallAbiKind abi, int nargs,
+                             NJXLInsRef args[]);
 
 /* 
 * Inserts a comment, the supplied string must be valid as long as the 
@@ -525,15 +880,107 @@ extern NJXLInsRef NJX_calld(NJXFunctionBuilderRef fn, const char *funcname,
 */
 extern NJXLInsRef NJX_comment(NJXFunctionBuilderRef fn, const char *s);
 
+/**
+* Serializes the LIR of the function built so far into a compact binary
+* form, which NJX_deserialize_lir() can replay into another builder, possibly
+* in another process. Calls are recorded by the name of the function called.
+* Returns the number of bytes required, or 0 if the LIR cannot be serialized;
+* the data is only written to buffer if it fits in size bytes, so passing
+* NULL queries the size.
+*/
+extern size_t NJX_serialize_lir(NJXFunctionBuilderRef fn, void *buffer,
+                                size_t size);
+
+/**
+* Replays LIR serialized by NJX_serialize_lir() into a new builder, which
+* must have been created with the same return type and parameters as the
+* original. The instructions go through the builder's optimizations as if
+* they had been created with the API. Called functions must be known to
+* this builder's Context. Returns false if the data is not valid, in which
+* case the builder should be destroyed.
+*/
+extern bool NJX_deserialize_lir(NJXFunctionBuilderRef fn, const void *data,
+                                size_t size);
+
+/**
+* Selects lookahead register allocation for the function: before assembly a
+* pass over the code works out where each value is used next, so that the
+* value needed furthest ahead is the one spilled when registers run out, and
+* values that are not live across a call avoid callee-saved registers.
+* Compilation is slightly slower. Off by default.
+*/
+extern void NJX_set_lookahead_regalloc(NJXFunctionBuilderRef fn, bool enable);
+
+/**
+* Allows an optimized function to contract a multiply followed by an add of
+* its result into a fused multiply-add (see NJX_fmad()), for the
+* instructions created after this call. The result can then differ in the
+* last bit from the separately rounded one. Off by default.
+*/
+extern void NJX_set_fp_contract(NJXFunctionBuilderRef fn, bool enable);
+
 /**
 * Completes the function, and assembles the code.
 * If assembly is successful then the generated code is saved in the parent
 * Context object by fragment name. The pointer to executable function is
 * returned. Note that the pointer is valid only until the NanoJitContext
 * is valid, as all functions are destroyed when the Context ends.
+* Returns NULL if the function is invalid or cannot be assembled (for
+* instance if its stack frame is too large).
 */
 extern void *NJX_finalize(NJXFunctionBuilderRef fn);
 
+/**
+* Retrieves the number of register spills (stores to the stack frame) and
+* restores (reloads from it) in the code generated by NJX_finalize(). Values
+* that are recomputed instead of reloaded are not counted. Both are 0 if the
+* code came from the code cache.
+*/
+extern void NJX_get_regalloc_stats(NJXFunctionBuilderRef fn, int *spills,
+                                   int *restores);
+
+/**
+* Retrieves the number of loads that NJX_finalize() replaced by a value
+* stored to or loaded from the same address before, and the number of
+* stores it removed as nothing reads them. Both are 0 if the code was
+* compiled without optimization or came from the code cache.
+*/
+extern void NJX_get_memopt_stats(NJXFunctionBuilderRef fn, int *loads,
+                                 int *stores);
+
+/**
+* Like NJX_finalize() but assembles the function on a background thread
+* owned by the context, returning immediately. Ownership of the builder
+* passes to the context - it must not be used or destroyed by the caller
+* afterwards. The function is only visible to NJX_get_function_by_name()
+* and to calls from other functions once it has been compiled.
+* If callback is not NULL it is invoked on the compiler thread once the
+* function is available (or compilation has failed).
+* The returned ticket must be released with NJX_release_ticket().
+*/
+extern NJXCompileTicketRef NJX_finalize_async(NJXContextRef context,
+                                              NJXFunctionBuilderRef fn,
+                                              NJXCompileCallback callback,
+                                              void *userdata);
+
+/**
+* Returns true once the compilation tracked by the ticket has completed,
+* successfully or not. Never blocks.
+*/
+extern bool NJX_ticket_is_ready(NJXCompileTicketRef ticket);
+
+/**
+* Blocks until the compilation tracked by the ticket has completed, and
+* returns the compiled function, or NULL if compilation failed.
+*/
+extern void *NJX_ticket_wait(NJXCompileTicketRef ticket);
+
+/**
+* Releases the caller's reference to the ticket. A pending compilation
+* is not cancelled; the function is still published when it completes.
+*/
+extern void NJX_release_ticket(NJXCompileTicketRef ticket);
+
 #ifdef __cplusplus
 }
 #endif
@@ -5,10 +5,21 @@
 #include <nanojitextra.h>
 
 #include <stdint.h>
+#include <stdio.h>
+#include <xmmintrin.h>
 
+#ifndef _WIN32
+#include <dirent.h>
+#include <stdlib.h>
+#include <unistd.h>
+#endif
+
+#include <atomic>
 #include <iostream>
 #include <map>
 #include <string>
+#include <thread>
+#include <vector>
 
 /**
 * Compiles simplest function:
@@ -223,6 +234,1260 @@ static int callextf1(NJXContextRef jit) {
   return 1;
 }
 
+/**
+* Builds and finalizes functions from several threads at once
+* int addN(int x) { return x+N; }
+*/
+static int concurrent(NJXContextRef jit) {
+  typedef int (*functype)(NJXParamType);
+  const int nthreads = 4;
+  const int nfuncs = 25;
+  std::vector<int> failures(nthreads, 0);
+  std::vector<std::thread> threads;
+
+  for (int t = 0; t < nthreads; t++) {
+    threads.emplace_back([jit, t, &failures]() {
+      for (int n = 0; n < nfuncs; n++) {
+        std::string name = "add_" + std::to_string(t) + "_" + std::to_string(n);
+        NJXValueKind args[1] = {NJXValueKind_I};
+        NJXFunctionBuilderRef builder = NJX_create_function_builder(
+            jit, name.c_str(), NJXValueKind_I, args, 1, true);
+        auto k = NJX_immi(builder, t * 1000 + n);
+        auto x = NJX_get_parameter(builder, 0);
+        NJX_reti(builder, NJX_addi(builder, x, k));
+        functype f = (functype)NJX_finalize(builder);
+        NJX_destroy_function_builder(builder);
+        if (f == nullptr || f(5) != t * 1000 + n + 5)
+          failures[t]++;
+      }
+    });
+  }
+  for (auto &thread : threads)
+    thread.join();
+
+  int rc = 0;
+  for (int t = 0; t < nthreads; t++) {
+    rc += failures[t];
+    // Every function must still be reachable by name afterwards
+    for (int n = 0; n < nfuncs; n++) {
+      std::string name = "add_" + std::to_string(t) + "_" + std::to_string(n);
+      functype f = (functype)NJX_get_function_by_name(jit, name.c_str());
+      if (f == nullptr || f(1) != t * 1000 + n + 1)
+        rc++;
+    }
+  }
+  return rc == 0 ? 0 : 1;
+}
+
+static void countCompiled(NJXCompileTicketRef, void *code, void *userdata) {
+  if (code != nullptr)
+    ++*reinterpret_cast<std::atomic<int> *>(userdata);
+}
+
+static void countFailed(NJXCompileTicketRef, void *code, void *userdata) {
+  if (code == nullptr)
+    ++*reinterpret_cast<std::atomic<int> *>(userdata);
+}
+
+/**
+* Finalizes functions on the context's compiler threads
+* int mulN(int x) { return x*N; }
+*/
+static int asyncfinalize() {
+  NJXContextRef jit = NJX_create_context(false);
+  typedef int (*functype)(NJXParamType);
+  const int nfuncs = 16;
+  std::atomic<int> compiled(0);
+  NJXCompileTicketRef tickets[nfuncs];
+
+  for (int n = 0; n < nfuncs; n++) {
+    std::string name = "mul_" + std::to_string(n);
+    NJXValueKind args[1] = {NJXValueKind_I};
+    NJXFunctionBuilderRef builder = NJX_create_function_builder(
+        jit, name.c_str(), NJXValueKind_I, args, 1, true);
+    auto x = NJX_get_parameter(builder, 0);
+    NJX_reti(builder, NJX_muli(builder, x, NJX_immi(builder, n)));
+    tickets[n] = NJX_finalize_async(jit, builder, countCompiled, &compiled);
+  }
+
+  int rc = 0;
+  for (int n = 0; n < nfuncs; n++) {
+    functype f = (functype)NJX_ticket_wait(tickets[n]);
+    if (!NJX_ticket_is_ready(tickets[n]) || f == nullptr || f(3) != 3 * n)
+      rc++;
+    std::string name = "mul_" + std::to_string(n);
+    if (NJX_get_function_by_name(jit, name.c_str()) != (void *)f)
+      rc++;
+    NJX_release_ticket(tickets[n]);
+  }
+
+  // A frame too large for the assembler fails the ticket, and the callback
+  // still runs
+  NJXFunctionBuilderRef builder = NJX_create_function_builder(
+      jit, "too_big", NJXValueKind_I, nullptr, 0, false);
+  auto mem = NJX_alloca(builder, 1 << 20);
+  NJX_store_i(builder, NJX_immi(builder, 1), mem, 0);
+  NJX_reti(builder, NJX_load_i(builder, mem, 0));
+  std::atomic<int> failures(0);
+  NJXCompileTicketRef failed =
+      NJX_finalize_async(jit, builder, countFailed, &failures);
+  if (NJX_ticket_wait(failed) != nullptr ||
+      NJX_get_function_by_name(jit, "too_big") != nullptr)
+    rc++;
+  NJX_release_ticket(failed);
+
+  // Callbacks may still be running after the waits above return, but
+  // destroying the context joins the compiler threads
+  NJX_destroy_context(jit);
+  return (rc == 0 && compiled == nfuncs && failures == 1) ? 0 : 1;
+}
+
+/**
+* Frees functions, checking that a function cannot be freed while another
+* function calls it, and that freed code memory is reused
+* int sq(int x) { return x*x; }
+* int callsq() { return sq(12); }
+*/
+static int freefunction() {
+  NJXContextRef jit = NJX_create_context(false);
+  typedef int (*sqfunc)(NJXParamType);
+  typedef int (*callerfunc)();
+  int rc = 0;
+
+  for (int round = 0; round < 10; round++) {
+    NJXValueKind args1[1] = {NJXValueKind_I};
+    NJXFunctionBuilderRef builder =
+        NJX_create_function_builder(jit, "sq", NJXValueKind_I, args1, 1, true);
+    auto x = NJX_get_parameter(builder, 0);
+    NJX_reti(builder, NJX_muli(builder, x, x));
+    sqfunc fsq = (sqfunc)NJX_finalize(builder);
+    NJX_destroy_function_builder(builder);
+
+    builder = NJX_create_function_builder(jit, "callsq", NJXValueKind_I,
+                                          nullptr, 0, true);
+    NJXLInsRef args[1] = {NJX_immi(builder, 12)};
+    auto result =
+        NJX_calli(builder, "sq", NJXCallAbiKind::NJX_CALLABI_FASTCALL, 1, args);
+    NJX_reti(builder, result);
+    callerfunc fcaller = (callerfunc)NJX_finalize(builder);
+    NJX_destroy_function_builder(builder);
+
+    if (!fsq || !fcaller || fsq(5) != 25 || fcaller() != 144)
+      return 1;
+
+    // sq is still called by callsq
+    if (NJX_free_function(jit, "sq"))
+      rc++;
+    if (!NJX_free_function(jit, "callsq") || !NJX_free_function(jit, "sq"))
+      rc++;
+    if (NJX_get_function_by_name(jit, "sq") ||
+        NJX_get_function_by_name(jit, "callsq"))
+      rc++;
+    if (NJX_free_function(jit, "sq"))
+      rc++;
+  }
+
+  // Replaced versions are kept until freed explicitly; the current one
+  // and its callers are unaffected
+  NJXFunctionBuilderRef builder;
+  for (int k = 1; k <= 3; k++) {
+    NJXValueKind args1[1] = {NJXValueKind_I};
+    builder = NJX_create_function_builder(jit, "scale", NJXValueKind_I, args1,
+                                          1, false);
+    auto x = NJX_get_parameter(builder, 0);
+    NJX_reti(builder, NJX_muli(builder, x, NJX_immi(builder, k)));
+    if (!NJX_finalize(builder))
+      rc++;
+    NJX_destroy_function_builder(builder);
+  }
+  builder = NJX_create_function_builder(jit, "callscale", NJXValueKind_I,
+                                        nullptr, 0, false);
+  NJXLInsRef scaleArgs[1] = {NJX_immi(builder, 7)};
+  NJX_reti(builder, NJX_calli(builder, "scale",
+                              NJXCallAbiKind::NJX_CALLABI_FASTCALL, 1,
+                              scaleArgs));
+  callerfunc fscale = (callerfunc)NJX_finalize(builder);
+  NJX_destroy_function_builder(builder);
+  if (NJX_free_replaced_functions(jit, "scale") != 2 ||
+      NJX_free_replaced_functions(jit, "scale") != 0 || !fscale ||
+      fscale() != 21)
+    rc++;
+  if (!NJX_free_function(jit, "callscale") ||
+      !NJX_free_function(jit, "scale"))
+    rc++;
+
+  // A builder that calls a function also keeps it alive
+  NJXValueKind args1[1] = {NJXValueKind_I};
+  builder =
+      NJX_create_function_builder(jit, "sq", NJXValueKind_I, args1, 1, true);
+  auto x = NJX_get_parameter(builder, 0);
+  NJX_reti(builder, NJX_muli(builder, x, x));
+  NJX_finalize(builder);
+  NJX_destroy_function_builder(builder);
+  builder = NJX_create_function_builder(jit, "callsq", NJXValueKind_I, nullptr,
+                                        0, true);
+  NJXLInsRef args[1] = {NJX_immi(builder, 3)};
+  NJX_calli(builder, "sq", NJXCallAbiKind::NJX_CALLABI_FASTCALL, 1, args);
+  if (NJX_free_function(jit, "sq"))
+    rc++;
+  NJX_destroy_function_builder(builder);
+  if (!NJX_free_function(jit, "sq"))
+    rc++;
+
+  NJX_destroy_context(jit);
+  return rc;
+}
+
+static double cachedext(double a, double b) { return a + b; }
+
+/**
+* Builds functions that exercise the kinds of relocation in cached code
+* int cc_sum(int n) { int s = 0; for (int i = 0; i < n; i++) s += i; return s; }
+* int cc_call() { return cc_sum(5); }
+* double cc_neg() { return -cachedext(1.5, 2.0); }
+*/
+static int buildcached(NJXContextRef jit) {
+  typedef int (*intfunc)(NJXParamType);
+  typedef int (*voidfunc)();
+  typedef double (*doublefunc)();
+  int rc = 0;
+
+  NJXValueKind declargs[2] = {NJXValueKind_D, NJXValueKind_D};
+  if (!NJX_register_C_function(jit, "cachedext",
+                               reinterpret_cast<void *>(cachedext),
+                               NJXValueKind_D, declargs, 2))
+    return 1;
+
+  NJXValueKind args1[1] = {NJXValueKind_I};
+  NJXFunctionBuilderRef builder =
+      NJX_create_function_builder(jit, "cc_sum", NJXValueKind_I, args1, 1, true);
+  auto n = NJX_get_parameter(builder, 0);
+  // Values used across the back edge are kept in memory
+  auto mem = NJX_alloca(builder, 12);
+  NJX_store_i(builder, NJX_immi(builder, 0), mem, 0);
+  NJX_store_i(builder, NJX_immi(builder, 0), mem, 4);
+  NJX_store_i(builder, n, mem, 8);
+  auto top = NJX_add_label(builder);
+  auto s = NJX_load_i(builder, mem, 0);
+  auto i = NJX_load_i(builder, mem, 4);
+  auto exit = NJX_cbr_false(
+      builder, NJX_lti(builder, i, NJX_load_i(builder, mem, 8)), nullptr);
+  NJX_store_i(builder, NJX_addi(builder, s, i), mem, 0);
+  NJX_store_i(builder, NJX_addi(builder, i, NJX_immi(builder, 1)), mem, 4);
+  NJX_br(builder, top);
+  NJX_set_jmp_target(exit, NJX_add_label(builder));
+  NJX_reti(builder, NJX_load_i(builder, mem, 0));
+  intfunc fsum = (intfunc)NJX_finalize(builder);
+  NJX_destroy_function_builder(builder);
+  if (!fsum || fsum(10) != 45)
+    rc++;
+
+  builder = NJX_create_function_builder(jit, "cc_call", NJXValueKind_I,
+                                        nullptr, 0, true);
+  NJXLInsRef callargs[1] = {NJX_immi(builder, 5)};
+  NJX_reti(builder, NJX_calli(builder, "cc_sum",
+                              NJXCallAbiKind::NJX_CALLABI_FASTCALL, 1,
+                              callargs));
+  voidfunc fcall = (voidfunc)NJX_finalize(builder);
+  NJX_destroy_function_builder(builder);
+  if (!fcall || fcall() != 10)
+    rc++;
+
+  builder = NJX_create_function_builder(jit, "cc_neg", NJXValueKind_D, nullptr,
+                                        0, true);
+  NJXLInsRef extargs[2] = {NJX_immd(builder, 1.5), NJX_immd(builder, 2.0)};
+  auto sum = NJX_calld(builder, "cachedext", NJXCallAbiKind::NJX_CALLABI_CDECL,
+                       2, extargs);
+  NJX_retd(builder, NJX_negd(builder, sum));
+  doublefunc fneg = (doublefunc)NJX_finalize(builder);
+  NJX_destroy_function_builder(builder);
+  if (!fneg || fneg() != -3.5)
+    rc++;
+
+  return rc;
+}
+
+/**
+* Compiles functions with the code cache enabled, then checks that a new
+* context loads them from the cache and that they still work
+*/
+static int codecache() {
+#ifdef _WIN32
+  return 0;
+#else
+  char dir[] = "/tmp/njxcacheXXXXXX";
+  if (!mkdtemp(dir))
+    return 1;
+  int rc = 0;
+  int hits = -1, misses = -1;
+
+  NJXContextRef jit = NJX_create_context(false);
+  if (!NJX_set_code_cache(jit, dir))
+    rc++;
+  rc += buildcached(jit);
+  NJX_get_code_cache_stats(jit, &hits, &misses);
+  if (hits != 0 || misses != 3)
+    rc++;
+  NJX_destroy_context(jit);
+
+  jit = NJX_create_context(false);
+  if (!NJX_set_code_cache(jit, dir))
+    rc++;
+  rc += buildcached(jit);
+  NJX_get_code_cache_stats(jit, &hits, &misses);
+  if (hits != 3 || misses != 0)
+    rc++;
+  NJX_destroy_context(jit);
+
+  DIR *d = opendir(dir);
+  if (d) {
+    struct dirent *entry;
+    while ((entry = readdir(d)) != nullptr) {
+      std::string path = std::string(dir) + "/" + entry->d_name;
+      if (entry->d_name[0] != '.')
+        unlink(path.c_str());
+    }
+    closedir(d);
+  }
+  rmdir(dir);
+  return rc;
+#endif
+}
+
+/**
+* Serializes the LIR of two functions and replays it into builders in
+* another context, where the functions must behave the same
+* int ser_sum(int n) { int s = 0; for (int i = 0; i < n; i++) s += i; return s; }
+* double ser_ext(int x) { return cachedext(x, 0.25); }
+*/
+static int serializelir() {
+  typedef int (*intfunc)(NJXParamType);
+  typedef double (*doublefunc)(NJXParamType);
+  int rc = 0;
+
+  NJXContextRef jit = NJX_create_context(false);
+  NJXValueKind declargs[2] = {NJXValueKind_D, NJXValueKind_D};
+  NJX_register_C_function(jit, "cachedext", reinterpret_cast<void *>(cachedext),
+                          NJXValueKind_D, declargs, 2);
+
+  NJXValueKind args1[1] = {NJXValueKind_I};
+  NJXFunctionBuilderRef builder = NJX_create_function_builder(
+      jit, "ser_sum", NJXValueKind_I, args1, 1, true);
+  auto n = NJX_get_parameter(builder, 0);
+  auto mem = NJX_alloca(builder, 12);
+  NJX_store_i(builder, NJX_immi(builder, 0), mem, 0);
+  NJX_store_i(builder, NJX_immi(builder, 0), mem, 4);
+  NJX_store_i(builder, n, mem, 8);
+  auto top = NJX_add_label(builder);
+  auto s = NJX_load_i(builder, mem, 0);
+  auto i = NJX_load_i(builder, mem, 4);
+  auto exit = NJX_cbr_false(
+      builder, NJX_lti(builder, i, NJX_load_i(builder, mem, 8)), nullptr);
+  NJX_store_i(builder, NJX_addi(builder, s, i), mem, 0);
+  NJX_store_i(builder, NJX_addi(builder, i, NJX_immi(builder, 1)), mem, 4);
+  NJX_br(builder, top);
+  NJX_set_jmp_target(exit, NJX_add_label(builder));
+  NJX_reti(builder, NJX_load_i(builder, mem, 0));
+  size_t sumSize = NJX_serialize_lir(builder, nullptr, 0);
+  std::vector<char> sumLir(sumSize);
+  if (sumSize == 0 ||
+      NJX_serialize_lir(builder, &sumLir[0], sumSize) != sumSize)
+    rc++;
+  NJX_destroy_function_builder(builder);
+
+  builder = NJX_create_function_builder(jit, "ser_ext", NJXValueKind_D, args1,
+                                        1, true);
+  NJXLInsRef extargs[2] = {NJX_i2d(builder, NJX_get_parameter(builder, 0)),
+                           NJX_immd(builder, 0.25)};
+  NJX_retd(builder, NJX_calld(builder, "cachedext",
+                              NJXCallAbiKind::NJX_CALLABI_CDECL, 2, extargs));
+  size_t extSize = NJX_serialize_lir(builder, nullptr, 0);
+  std::vector<char> extLir(extSize);
+  if (extSize == 0 ||
+      NJX_serialize_lir(builder, &extLir[0], extSize) != extSize)
+    rc++;
+  NJX_destroy_function_builder(builder);
+  NJX_destroy_context(jit);
+  if (rc)
+    return rc;
+
+  jit = NJX_create_context(false);
+  NJX_register_C_function(jit, "cachedext", reinterpret_cast<void *>(cachedext),
+                          NJXValueKind_D, declargs, 2);
+
+  builder = NJX_create_function_builder(jit, "ser_sum", NJXValueKind_I, args1,
+                                        1, true);
+  if (!NJX_deserialize_lir(builder, &sumLir[0], sumSize))
+    rc++;
+  intfunc fsum = (intfunc)NJX_finalize(builder);
+  NJX_destroy_function_builder(builder);
+  if (!fsum || fsum(10) != 45 || fsum(0) != 0)
+    rc++;
+
+  builder = NJX_create_function_builder(jit, "ser_ext", NJXValueKind_D, args1,
+                                        1, true);
+  if (!NJX_deserialize_lir(builder, &extLir[0], extSize))
+    rc++;
+  doublefunc fext = (doublefunc)NJX_finalize(builder);
+  NJX_destroy_function_builder(builder);
+  if (!fext || fext(3) != 3.25)
+    rc++;
+
+  // The parameters must match, and truncated data is rejected
+  builder = NJX_create_function_builder(jit, "ser_bad", NJXValueKind_I,
+                                        nullptr, 0, true);
+  if (NJX_deserialize_lir(builder, &sumLir[0], sumSize))
+    rc++;
+  NJX_destroy_function_builder(builder);
+  builder = NJX_create_function_builder(jit, "ser_bad", NJXValueKind_I, args1,
+                                        1, true);
+  if (NJX_deserialize_lir(builder, &sumLir[0], sumSize - 1))
+    rc++;
+  NJX_destroy_function_builder(builder);
+
+  NJX_destroy_context(jit);
+  return rc;
+}
+
+/**
+* Builds a function that keeps more values live than there are registers
+* int pressure(int x) { v[i] = x * (i + 2) + i; return sum of v[i] in a
+* scrambled order; }
+* and returns its result for x = 3 along with the spill and restore counts
+*/
+static int buildpressure(NJXContextRef jit, const char *name, bool lookahead,
+                         int *spills, int *restores) {
+  typedef int (*functype)(NJXParamType);
+  const int nvalues = 24;
+  NJXValueKind args[1] = {NJXValueKind_I};
+  NJXFunctionBuilderRef builder = NJX_create_function_builder(
+      jit, name, NJXValueKind_I, args, 1, false);
+  NJX_set_lookahead_regalloc(builder, lookahead);
+  NJXLInsRef x = NJX_get_parameter(builder, 0);
+  NJXLInsRef v[nvalues];
+  for (int i = 0; i < nvalues; i++)
+    v[i] = NJX_addi(builder, NJX_muli(builder, x, NJX_immi(builder, i + 2)),
+                    NJX_immi(builder, i));
+  NJXLInsRef sum = v[0];
+  for (int i = 1; i < nvalues; i++)
+    sum = NJX_addi(builder, sum, v[(i * 7) % nvalues]);
+  NJX_reti(builder, sum);
+  functype f = (functype)NJX_finalize(builder);
+  NJX_get_regalloc_stats(builder, spills, restores);
+  NJX_destroy_function_builder(builder);
+  return f != nullptr ? f(3) : -1;
+}
+
+/**
+* The lookahead allocator must produce the same result as the default one
+* without needing more spills
+*/
+static int regpressure() {
+  NJXContextRef jit = NJX_create_context(false);
+  int expected = 0;
+  for (int i = 0; i < 24; i++)
+    expected += 3 * (i + 2) + i;
+
+  int spills = -1, restores = -1;
+  int lspills = -1, lrestores = -1;
+  int rc = 0;
+  if (buildpressure(jit, "pressure", false, &spills, &restores) != expected)
+    rc++;
+  if (buildpressure(jit, "lookahead", true, &lspills, &lrestores) != expected)
+    rc++;
+  if (spills <= 0 || restores <= 0)
+    rc++;
+  if (lspills > spills || lrestores > restores)
+    rc++;
+  NJX_destroy_context(jit);
+  return rc;
+}
+
+/**
+* A loop that uses many values computed before it, with no LIR_live
+* instructions; the builder must keep them alive around the loop
+* int looplive(int n) {
+*   int c[16] = { n * (j + 2) + j, ... };
+*   int s = 0;
+*   for (int i = 0; i < n; i++) {
+*     int t = i;
+*     for (int j = 0; j < 16; j++) t = (t + c[j]) ^ s;
+*     s = t;
+*   }
+*   return s;
+* }
+*/
+static int looplives() {
+  typedef int (*functype)(NJXParamType);
+  const int nvalues = 16;
+  NJXContextRef jit = NJX_create_context(false);
+  NJXValueKind args[1] = {NJXValueKind_I};
+  NJXFunctionBuilderRef builder = NJX_create_function_builder(
+      jit, "looplive", NJXValueKind_I, args, 1, true);
+  auto n = NJX_get_parameter(builder, 0);
+  NJXLInsRef c[nvalues];
+  for (int j = 0; j < nvalues; j++)
+    c[j] = NJX_addi(builder, NJX_muli(builder, n, NJX_immi(builder, j + 2)),
+                    NJX_immi(builder, j));
+  auto mem = NJX_alloca(builder, 8);
+  NJX_store_i(builder, NJX_immi(builder, 0), mem, 0);
+  NJX_store_i(builder, NJX_immi(builder, 0), mem, 4);
+  auto top = NJX_add_label(builder);
+  auto s = NJX_load_i(builder, mem, 0);
+  auto i = NJX_load_i(builder, mem, 4);
+  auto exit = NJX_cbr_false(builder, NJX_lti(builder, i, n), nullptr);
+  auto t = i;
+  for (int j = 0; j < nvalues; j++)
+    t = NJX_xori(builder, NJX_addi(builder, t, c[j]), s);
+  NJX_store_i(builder, t, mem, 0);
+  NJX_store_i(builder, NJX_addi(builder, i, NJX_immi(builder, 1)), mem, 4);
+  NJX_br(builder, top);
+  NJX_set_jmp_target(exit, NJX_add_label(builder));
+  NJX_reti(builder, NJX_load_i(builder, mem, 0));
+  auto f = (functype)NJX_finalize(builder);
+  NJX_destroy_function_builder(builder);
+
+  int expected = 0;
+  for (int x = 0; x < 10; x++) {
+    int y = x;
+    for (int j = 0; j < nvalues; j++)
+      y = (y + 10 * (j + 2) + j) ^ expected;
+    expected = y;
+  }
+  int rc = (f != nullptr && f(10) == expected) ? 0 : 1;
+  NJX_destroy_context(jit);
+  return rc;
+}
+
+static int licm() {
+  typedef int (*functype)(int *, int);
+  NJXContextRef jit = NJX_create_context(false);
+  NJXValueKind args[2] = {NJXValueKind_P, NJXValueKind_I};
+  NJXFunctionBuilderRef builder = NJX_create_function_builder(
+      jit, "licm", NJXValueKind_I, args, 2, true);
+  auto p = NJX_get_parameter(builder, 0);
+  auto n = NJX_get_parameter(builder, 1);
+  auto mem = NJX_alloca(builder, 12);
+  NJX_store_i(builder, NJX_immi(builder, 0), mem, 0);
+  NJX_store_i(builder, NJX_immi(builder, 0), mem, 4);
+  NJX_store_i(builder, NJX_muli(builder, n, NJX_immi(builder, 3)), mem, 8);
+  auto top = NJX_add_label(builder);
+  // p[0] is stored to in the loop, so its load must stay; mem[8] is not,
+  // so its load and the arithmetic on it can be moved out
+  auto v = NJX_load_i(builder, p, 0);
+  auto i = NJX_load_i(builder, mem, 4);
+  auto exit = NJX_cbr_false(builder, NJX_lti(builder, i, n), nullptr);
+  auto k = NJX_load_i(builder, mem, 8);
+  auto inv = NJX_addi(builder, NJX_muli(builder, k, n), NJX_immi(builder, 7));
+  auto w = NJX_load_i(builder, p, 4);
+  auto t = NJX_addi(builder, NJX_load_i(builder, mem, 0), inv);
+  t = NJX_addi(builder, NJX_addi(builder, t, v), w);
+  NJX_store_i(builder, t, mem, 0);
+  NJX_store_i(builder, NJX_addi(builder, v, NJX_immi(builder, 1)), p, 0);
+  NJX_store_i(builder, NJX_addi(builder, i, NJX_immi(builder, 1)), mem, 4);
+  NJX_br(builder, top);
+  NJX_set_jmp_target(exit, NJX_add_label(builder));
+  NJX_reti(builder, NJX_load_i(builder, mem, 0));
+  auto f = (functype)NJX_finalize(builder);
+  NJX_destroy_function_builder(builder);
+
+  int data[2] = {5, 2};
+  int expected = 0;
+  for (int x = 0; x < 10; x++)
+    expected += 10 * 3 * 10 + 7 + (5 + x) + 2;
+  int rc = (f != nullptr && f(data, 10) == expected && data[0] == 15) ? 0 : 1;
+  NJX_destroy_context(jit);
+  return rc;
+}
+
+static int gvn() {
+  typedef int (*functype)(int *, int);
+  NJXContextRef jit = NJX_create_context(false);
+  NJXValueKind args[2] = {NJXValueKind_P, NJXValueKind_I};
+  NJXFunctionBuilderRef builder = NJX_create_function_builder(
+      jit, "gvn", NJXValueKind_I, args, 2, true);
+  auto p = NJX_get_parameter(builder, 0);
+  auto x = NJX_get_parameter(builder, 1);
+  auto mem = NJX_alloca(builder, 4);
+  auto sq = NJX_addi(builder, NJX_muli(builder, x, x), NJX_immi(builder, 1));
+  auto v = NJX_load_i(builder, p, 0);
+  auto other = NJX_cbr_false(builder, NJX_gti(builder, x, NJX_immi(builder, 0)),
+                             nullptr);
+  NJX_store_i(builder, NJX_muli(builder, sq, NJX_immi(builder, 2)), mem, 0);
+  NJX_store_i(builder, NJX_immi(builder, 9), p, 0);
+  auto done = NJX_br(builder, nullptr);
+  // x * x + 1 is recomputed after each label, where the first one dominates
+  NJX_set_jmp_target(other, NJX_add_label(builder));
+  sq = NJX_addi(builder, NJX_muli(builder, x, x), NJX_immi(builder, 1));
+  NJX_store_i(builder, NJX_subi(builder, sq, NJX_immi(builder, 3)), mem, 0);
+  NJX_set_jmp_target(done, NJX_add_label(builder));
+  sq = NJX_addi(builder, NJX_muli(builder, x, x), NJX_immi(builder, 1));
+  // p[0] may have changed since v was loaded
+  auto w = NJX_load_i(builder, p, 0);
+  auto t = NJX_addi(builder, NJX_load_i(builder, mem, 0), sq);
+  NJX_reti(builder, NJX_addi(builder, NJX_addi(builder, t, w), v));
+  auto f = (functype)NJX_finalize(builder);
+  NJX_destroy_function_builder(builder);
+
+  int data1 = 4, data2 = 4;
+  int rc = (f != nullptr && f(&data1, 5) == 91 && data1 == 9 &&
+            f(&data2, -2) == 15 && data2 == 4)
+               ? 0
+               : 1;
+  NJX_destroy_context(jit);
+  return rc;
+}
+
+static int memopt() {
+  typedef int (*functype)(int *, int);
+  NJXContextRef jit = NJX_create_context(false);
+  NJXValueKind args[2] = {NJXValueKind_P, NJXValueKind_I};
+  NJXFunctionBuilderRef builder = NJX_create_function_builder(
+      jit, "memopt", NJXValueKind_I, args, 2, true);
+  auto p = NJX_get_parameter(builder, 0);
+  auto x = NJX_get_parameter(builder, 1);
+  auto mem = NJX_alloca(builder, 8);
+  NJX_store_i(builder, x, mem, 0);
+  NJX_store_i(builder, NJX_addi(builder, x, NJX_immi(builder, 1)), mem, 4);
+  // the first store to p[0] is overwritten before anything can read it
+  NJX_store_i(builder, NJX_immi(builder, 1), p, 0);
+  NJX_store_i(builder, NJX_immi(builder, 2), p, 0);
+  auto a = NJX_load_i(builder, mem, 0);
+  auto b = NJX_load_i(builder, mem, 4);
+  auto other = NJX_cbr_false(builder, NJX_gti(builder, a, NJX_immi(builder, 0)),
+                             nullptr);
+  NJX_store_i(builder, NJX_muli(builder, a, b), mem, 0);
+  auto done = NJX_br(builder, nullptr);
+  NJX_set_jmp_target(other, NJX_add_label(builder));
+  NJX_store_i(builder, NJX_subi(builder, a, b), mem, 0);
+  NJX_set_jmp_target(done, NJX_add_label(builder));
+  // mem[0] has two stores reaching it; mem[4] and p[0] just one
+  auto t = NJX_addi(builder, NJX_load_i(builder, mem, 0), NJX_load_i(builder, mem, 4));
+  NJX_reti(builder, NJX_addi(builder, t, NJX_load_i(builder, p, 0)));
+  auto f = (functype)NJX_finalize(builder);
+  // a, b and the loads of mem[4] and p[0] get the stored values; then the
+  // first store to mem[0], overwritten on both paths, and the one to mem[4]
+  // go along with the first one to p[0]
+  int loads = -1, stores = -1;
+  NJX_get_memopt_stats(builder, &loads, &stores);
+  NJX_destroy_function_builder(builder);
+
+  int data1 = 0, data2 = 0;
+  int rc = (f != nullptr && loads == 4 && stores == 3 && f(&data1, 3) == 18 &&
+            data1 == 2 && f(&data2, -1) == 1 && data2 == 2)
+               ? 0
+               : 1;
+  NJX_destroy_context(jit);
+  return rc;
+}
+
+/**
+* Tiered compilation: the function runs unoptimized until its third call,
+* is then recompiled with optimization, and the old code forwards to the
+* new. Freeing the optimized code makes the old code run its own body again.
+* int tiered(int x) { return x * 3 + 1; }
+* int calltiered(int x) { return tiered(x) + 1; }
+*/
+static int tiered() {
+  typedef int (*functype)(int);
+  NJXContextRef jit = NJX_create_context(false);
+  NJX_set_tier_up_threshold(jit, 3);
+  NJXValueKind args[1] = {NJXValueKind_I};
+  NJXFunctionBuilderRef builder = NJX_create_function_builder(
+      jit, "tiered", NJXValueKind_I, args, 1, true);
+  auto x = NJX_get_parameter(builder, 0);
+  auto x3 = NJX_addi(builder, NJX_addi(builder, x, x), x);
+  NJX_reti(builder, NJX_addi(builder, x3, NJX_immi(builder, 1)));
+  auto f = (functype)NJX_finalize(builder);
+  NJX_destroy_function_builder(builder);
+
+  builder = NJX_create_function_builder(jit, "calltiered", NJXValueKind_I,
+                                        args, 1, false);
+  NJXLInsRef callargs[1] = {NJX_get_parameter(builder, 0)};
+  auto r = NJX_calli(builder, "tiered", NJXCallAbiKind::NJX_CALLABI_FASTCALL,
+                     1, callargs);
+  NJX_reti(builder, NJX_addi(builder, r, NJX_immi(builder, 1)));
+  auto g = (functype)NJX_finalize(builder);
+  NJX_destroy_function_builder(builder);
+
+  int rc = 1;
+  if (f != nullptr && g != nullptr && f(1) == 4 && g(2) == 8 &&
+      NJX_wait_for_tier_up(jit) == 0 &&
+      NJX_get_function_by_name(jit, "tiered") == (void *)f && f(3) == 10 &&
+      NJX_wait_for_tier_up(jit) == 1) {
+    auto f2 = (functype)NJX_get_function_by_name(jit, "tiered");
+    if (f2 != nullptr && f2 != f && f2(4) == 13 && f(5) == 16 && g(6) == 20 &&
+        NJX_free_function(jit, "calltiered") &&
+        NJX_free_function(jit, "tiered") && f(7) == 22)
+      rc = 0;
+  }
+  NJX_destroy_context(jit);
+  return rc;
+}
+
+/**
+* Calls between jitted functions go through an entry stub, so replacing the
+* callee redirects existing callers. Patchable constants can be changed
+* after the functions using them are compiled.
+* int callee(int x) { return x + 1; }  -- later { return x + 10; }
+* int patchcaller(int x) { return callee(x) * scale; }
+*/
+static int buildcallee(NJXContextRef jit, int increment) {
+  NJXValueKind args[1] = {NJXValueKind_I};
+  NJXFunctionBuilderRef builder = NJX_create_function_builder(
+      jit, "callee", NJXValueKind_I, args, 1, true);
+  NJX_reti(builder, NJX_addi(builder, NJX_get_parameter(builder, 0),
+                             NJX_immi(builder, increment)));
+  void *f = NJX_finalize(builder);
+  NJX_destroy_function_builder(builder);
+  return f != nullptr ? 0 : 1;
+}
+
+static int patchable() {
+  typedef int (*functype)(int);
+  NJXContextRef jit = NJX_create_context(false);
+  int rc = buildcallee(jit, 1);
+
+  NJXValueKind args[1] = {NJXValueKind_I};
+  NJXFunctionBuilderRef builder = NJX_create_function_builder(
+      jit, "patchcaller", NJXValueKind_I, args, 1, true);
+  NJXLInsRef callargs[1] = {NJX_get_parameter(builder, 0)};
+  auto r = NJX_calli(builder, "callee", NJXCallAbiKind::NJX_CALLABI_FASTCALL,
+                     1, callargs);
+  NJX_reti(builder,
+           NJX_muli(builder, r, NJX_patchable_immi(builder, "scale")));
+  auto f = (functype)NJX_finalize(builder);
+  NJX_destroy_function_builder(builder);
+
+  if (rc == 0 && f != nullptr && NJX_set_patchable_i(jit, "scale", 2) &&
+      f(3) == 8 && buildcallee(jit, 10) == 0 && f(3) == 26 &&
+      NJX_set_patchable_i(jit, "scale", 3) && f(3) == 39 &&
+      !NJX_set_patchable_d(jit, "scale", 1.0))
+    rc = 0;
+  else
+    rc = 1;
+  NJX_destroy_context(jit);
+  return rc;
+}
+
+/**
+* Small functions are inlined into their callers, which then no longer
+* call them.
+* int getx(int *p) { return p[1]; }
+* int inc(int x) { return x + 1; }
+* int sumx(int *p, int x) { return getx(p) + getx(p) + inc(inc(x)); }
+*/
+static int inlining() {
+  typedef int (*functype)(int *, int);
+  NJXContextRef jit = NJX_create_context(false);
+  NJX_set_inline_limit(jit, 8);
+  NJXValueKind pargs[1] = {NJXValueKind_P};
+  NJXFunctionBuilderRef builder = NJX_create_function_builder(
+      jit, "getx", NJXValueKind_I, pargs, 1, true);
+  NJX_reti(builder, NJX_load_i(builder, NJX_get_parameter(builder, 0), 4));
+  NJX_finalize(builder);
+  NJX_destroy_function_builder(builder);
+
+  NJXValueKind iargs[1] = {NJXValueKind_I};
+  builder = NJX_create_function_builder(jit, "inc", NJXValueKind_I, iargs, 1,
+                                        true);
+  NJX_reti(builder, NJX_addi(builder, NJX_get_parameter(builder, 0),
+                             NJX_immi(builder, 1)));
+  NJX_finalize(builder);
+  NJX_destroy_function_builder(builder);
+
+  NJXValueKind args[2] = {NJXValueKind_P, NJXValueKind_I};
+  builder = NJX_create_function_builder(jit, "sumx", NJXValueKind_I, args, 2,
+                                        true);
+  NJXLInsRef p[1] = {NJX_get_parameter(builder, 0)};
+  auto a = NJX_calli(builder, "getx", NJX_CALLABI_FASTCALL, 1, p);
+  auto b = NJX_calli(builder, "getx", NJX_CALLABI_FASTCALL, 1, p);
+  NJXLInsRef x[1] = {NJX_get_parameter(builder, 1)};
+  NJXLInsRef x1[1] = {NJX_calli(builder, "inc", NJX_CALLABI_FASTCALL, 1, x)};
+  auto c = NJX_calli(builder, "inc", NJX_CALLABI_FASTCALL, 1, x1);
+  NJX_reti(builder, NJX_addi(builder, NJX_addi(builder, a, b), c));
+  auto f = (functype)NJX_finalize(builder);
+  NJX_destroy_function_builder(builder);
+
+  int data[2] = {5, 7};
+  int rc = (f != nullptr && NJX_free_function(jit, "getx") &&
+            NJX_free_function(jit, "inc") && f(data, 10) == 26)
+               ? 0
+               : 1;
+  NJX_destroy_context(jit);
+  return rc;
+}
+
+/*
+* double scale(double x, float y, int n) { return x * y + n; }
+* int weigh(int a, int b, int c, int d, int e, int f, int g, double h) {
+*   return a + 2 * b + 3 * c + 4 * d + 5 * e + 6 * f + 7 * g + (int)h;
+* }
+* double callscale(double x) { return scale(x, 0.5f, 3); }
+*/
+static int fpparams() {
+  typedef double (*scalefunc)(double, float, int);
+  typedef int (*weighfunc)(int, int, int, int, int, int, int, double);
+  typedef double (*callfunc)(double);
+  NJXContextRef jit = NJX_create_context(false);
+  NJX_set_inline_limit(jit, 8);
+  NJXValueKind sargs[3] = {NJXValueKind_D, NJXValueKind_F, NJXValueKind_I};
+  NJXFunctionBuilderRef builder = NJX_create_function_builder(
+      jit, "scale", NJXValueKind_D, sargs, 3, true);
+  auto xy = NJX_muld(builder, NJX_get_parameter(builder, 0),
+                     NJX_f2d(builder, NJX_get_parameter(builder, 1)));
+  NJX_retd(builder,
+           NJX_addd(builder, xy, NJX_i2d(builder, NJX_get_parameter(builder, 2))));
+  auto scale = (scalefunc)NJX_finalize(builder);
+  NJX_destroy_function_builder(builder);
+
+  // The seventh integer argument and the double after it are on the stack
+  // on Win64, only the seventh integer argument elsewhere
+  NJXValueKind wargs[8] = {NJXValueKind_I, NJXValueKind_I, NJXValueKind_I,
+                           NJXValueKind_I, NJXValueKind_I, NJXValueKind_I,
+                           NJXValueKind_I, NJXValueKind_D};
+  builder = NJX_create_function_builder(jit, "weigh", NJXValueKind_I, wargs, 8,
+                                        true);
+  auto sum = NJX_d2i(builder, NJX_get_parameter(builder, 7));
+  for (int i = 0; i < 7; i++)
+    sum = NJX_addi(builder, sum,
+                   NJX_muli(builder, NJX_get_parameter(builder, i),
+                            NJX_immi(builder, i + 1)));
+  NJX_reti(builder, sum);
+  auto weigh = (weighfunc)NJX_finalize(builder);
+  NJX_destroy_function_builder(builder);
+
+  NJXValueKind cargs[1] = {NJXValueKind_D};
+  builder = NJX_create_function_builder(jit, "callscale", NJXValueKind_D,
+                                        cargs, 1, true);
+  NJXLInsRef p[3] = {NJX_get_parameter(builder, 0), NJX_immf(builder, 0.5f),
+                     NJX_immi(builder, 3)};
+  NJX_retd(builder, NJX_calld(builder, "scale", NJX_CALLABI_FASTCALL, 3, p));
+  auto callscale = (callfunc)NJX_finalize(builder);
+  NJX_destroy_function_builder(builder);
+
+  int rc = (scale != nullptr && weigh != nullptr && callscale != nullptr &&
+            scale(3.0, 1.5f, -2) == 2.5 &&
+            weigh(1, 2, 3, 4, 5, 6, 7, 9.5) == 149 && callscale(5.0) == 5.5)
+               ? 0
+               : 1;
+  NJX_destroy_context(jit);
+  return rc;
+}
+
+static int float4ops() {
+#ifdef _WIN64
+  // Win64 passes float4 arguments by reference, which is not supported
+  return 0;
+#else
+  typedef __m128 (*lerpfunc)(__m128, __m128, float *);
+  typedef float (*dotfunc)(float *);
+  typedef __m128 (*callfunc)(__m128, float *);
+  NJXContextRef jit = NJX_create_context(false);
+
+  // Returns a + (b - a) * 0.5 and stores it reversed at out
+  NJXValueKind largs[3] = {NJXValueKind_F4, NJXValueKind_F4, NJXValueKind_P};
+  NJXFunctionBuilderRef builder = NJX_create_function_builder(
+      jit, "lerp4", NJXValueKind_F4, largs, 3, true);
+  auto a = NJX_get_parameter(builder, 0);
+  auto b = NJX_get_parameter(builder, 1);
+  auto half = NJX_f2f4(builder, NJX_immf(builder, 0.5f));
+  auto mid = NJX_addf4(builder, a,
+                       NJX_mulf4(builder, NJX_subf4(builder, b, a), half));
+  NJX_store_f4(builder, NJX_swzf4(builder, mid, 0x1b),
+               NJX_get_parameter(builder, 2), 0);
+  NJX_retf4(builder, mid);
+  auto lerp4 = (lerpfunc)NJX_finalize(builder);
+  NJX_destroy_function_builder(builder);
+
+  // Dot product of the two float4 values at p, plus the largest w
+  NJXValueKind dargs[1] = {NJXValueKind_P};
+  builder = NJX_create_function_builder(jit, "dot4", NJXValueKind_F, dargs, 1,
+                                        true);
+  auto x = NJX_load_f4(builder, NJX_get_parameter(builder, 0), 0);
+  auto y = NJX_load_f4(builder, NJX_get_parameter(builder, 0), 16);
+  NJX_retf(builder, NJX_addf(builder, NJX_dotf4(builder, x, y),
+                             NJX_f4w(builder, NJX_maxf4(builder, x, y))));
+  auto dot4 = (dotfunc)NJX_finalize(builder);
+  NJX_destroy_function_builder(builder);
+
+  NJXValueKind cargs[2] = {NJXValueKind_F4, NJXValueKind_P};
+  builder = NJX_create_function_builder(jit, "calllerp", NJXValueKind_F4,
+                                        cargs, 2, true);
+  NJXLInsRef p[3] = {NJX_get_parameter(builder, 0),
+                     NJX_immf4(builder, 10.0f, 20.0f, 30.0f, 40.0f),
+                     NJX_get_parameter(builder, 1)};
+  NJX_retf4(builder,
+            NJX_callf4(builder, "lerp4", NJX_CALLABI_FASTCALL, 3, p));
+  auto calllerp = (callfunc)NJX_finalize(builder);
+  NJX_destroy_function_builder(builder);
+
+  int rc = 1;
+  if (lerp4 != nullptr && dot4 != nullptr && calllerp != nullptr) {
+    alignas(16) float out[4];
+    alignas(16) float mid[4];
+    alignas(16) float v[8] = {1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f, 8.0f};
+    _mm_store_ps(mid, calllerp(_mm_setr_ps(2.0f, 4.0f, 6.0f, 8.0f), out));
+    rc = (mid[0] == 6.0f && mid[1] == 12.0f && mid[2] == 18.0f &&
+          mid[3] == 24.0f && out[0] == 24.0f && out[1] == 18.0f &&
+          out[2] == 12.0f && out[3] == 6.0f && dot4(v) == 78.0f)
+             ? 0
+             : 1;
+  }
+  NJX_destroy_context(jit);
+  return rc;
+#endif
+}
+
+static int fma() {
+  typedef double (*polyfunc)(double);
+  typedef float (*madfunc)(float, float, float);
+  NJXContextRef jit = NJX_create_context(false);
+
+  // Horner evaluation of 2x^3 + 3x^2 - x + 0.5
+  NJXValueKind pargs[1] = {NJXValueKind_D};
+  NJXFunctionBuilderRef builder = NJX_create_function_builder(
+      jit, "poly", NJXValueKind_D, pargs, 1, true);
+  auto x = NJX_get_parameter(builder, 0);
+  auto r = NJX_fmad(builder, NJX_immd(builder, 2.0), x, NJX_immd(builder, 3.0));
+  r = NJX_fmad(builder, r, x, NJX_immd(builder, -1.0));
+  r = NJX_fmad(builder, r, x, NJX_immd(builder, 0.5));
+  NJX_retd(builder, r);
+  auto poly = (polyfunc)NJX_finalize(builder);
+  NJX_destroy_function_builder(builder);
+
+  // a * b + c written as a multiply and an add, contracted by the optimizer
+  NJXValueKind margs[3] = {NJXValueKind_F, NJXValueKind_F, NJXValueKind_F};
+  builder = NJX_create_function_builder(jit, "mad", NJXValueKind_F, margs, 3,
+                                        true);
+  NJX_set_fp_contract(builder, true);
+  NJX_retf(builder,
+           NJX_addf(builder, NJX_get_parameter(builder, 2),
+                    NJX_mulf(builder, NJX_get_parameter(builder, 0),
+                             NJX_get_parameter(builder, 1))));
+  auto mad = (madfunc)NJX_finalize(builder);
+  NJX_destroy_function_builder(builder);
+
+  int rc = (poly != nullptr && mad != nullptr && poly(1.5) == 12.5 &&
+            poly(-2.0) == -1.5 && mad(1.5f, 4.0f, -0.25f) == 5.75f)
+               ? 0
+               : 1;
+  NJX_destroy_context(jit);
+  return rc;
+}
+
+static int bitops() {
+  typedef int (*countsfunc)(int);
+  typedef uint64_t (*swapfunc)(uint64_t);
+  NJXContextRef jit = NJX_create_context(false);
+
+  // popcnt | lzcnt << 8 | tzcnt << 16
+  NJXValueKind iargs[1] = {NJXValueKind_I};
+  NJXFunctionBuilderRef builder = NJX_create_function_builder(
+      jit, "counts", NJXValueKind_I, iargs, 1, true);
+  auto x = NJX_get_parameter(builder, 0);
+  auto r = NJX_ori(
+      builder, NJX_popcnti(builder, x),
+      NJX_ori(builder,
+              NJX_lshi(builder, NJX_lzcnti(builder, x), NJX_immi(builder, 8)),
+              NJX_lshi(builder, NJX_tzcnti(builder, x), NJX_immi(builder, 16))));
+  NJX_reti(builder, r);
+  auto counts = (countsfunc)NJX_finalize(builder);
+  NJX_destroy_function_builder(builder);
+
+  // Byte swap, then rotate left by one byte: a big-endian load of the top 7
+  // bytes with the lowest byte moved to the top.
+  NJXValueKind qargs[1] = {NJXValueKind_Q};
+  builder = NJX_create_function_builder(jit, "swap", NJXValueKind_Q, qargs, 1,
+                                        true);
+  x = NJX_get_parameter(builder, 0);
+  NJX_retq(builder, NJX_rolq(builder, NJX_bswapq(builder, x),
+                             NJX_immi(builder, 8)));
+  auto swap = (swapfunc)NJX_finalize(builder);
+  NJX_destroy_function_builder(builder);
+
+  int rc = (counts != nullptr && swap != nullptr &&
+            counts(0x00F0F000) == 0x0C0808 && counts(0) == 0x202000 &&
+            counts(-1) == 32 &&
+            swap(0x0123456789ABCDEFULL) == 0xCDAB8967452301EFULL)
+               ? 0
+               : 1;
+  NJX_destroy_context(jit);
+  return rc;
+}
+
+static int fprounding() {
+  typedef double (*roundfunc)(double);
+  typedef double (*convfunc)(uint64_t);
+  NJXContextRef jit = NJX_create_context(false);
+
+  // Round to two decimal places, clamped to [-1000, 1000].
+  NJXValueKind dargs[1] = {NJXValueKind_D};
+  NJXFunctionBuilderRef builder = NJX_create_function_builder(
+      jit, "round2", NJXValueKind_D, dargs, 1, true);
+  auto x = NJX_get_parameter(builder, 0);
+  auto hundred = NJX_immd(builder, 100.0);
+  auto r = NJX_divd(
+      builder, NJX_roundd(builder, NJX_muld(builder, x, hundred)), hundred);
+  r = NJX_maxd(builder, NJX_mind(builder, r, NJX_immd(builder, 1000.0)),
+               NJX_immd(builder, -1000.0));
+  NJX_retd(builder, r);
+  auto round2 = (roundfunc)NJX_finalize(builder);
+  NJX_destroy_function_builder(builder);
+
+  NJXValueKind qargs[1] = {NJXValueKind_Q};
+  builder = NJX_create_function_builder(jit, "uq2d", NJXValueKind_D, qargs, 1,
+                                        true);
+  x = NJX_get_parameter(builder, 0);
+  NJX_retd(builder, NJX_floord(builder, NJX_divd(builder,
+                                                 NJX_uq2d(builder, x),
+                                                 NJX_immd(builder, 3.0))));
+  auto third = (convfunc)NJX_finalize(builder);
+  NJX_destroy_function_builder(builder);
+
+  int rc = (round2 != nullptr && third != nullptr &&
+            round2(1.125) == 1.13 && round2(-1.125) == -1.13 &&
+            round2(2.5) == 2.5 && round2(12345.0) == 1000.0 &&
+            round2(-0.001) == 0.0 &&
+            third(18446744073709551615ULL) == 6148914691236516864.0 &&
+            third(10) == 3.0)
+               ? 0
+               : 1;
+  NJX_destroy_context(jit);
+  return rc;
+}
+
+/**
+* A scan kernel with its loop tested at the bottom, unrolled four times; the
+* leftover elements are summed by the original loop
+* int scan(int *p, int n) {
+*   int s = 0, i = 0;
+*   if (0 < n)
+*     do { s += p[i] * 3; i++; } while (i < n);
+*   return s;
+* }
+*/
+static int unrolling() {
+  typedef int (*functype)(int *, int);
+  NJXContextRef jit = NJX_create_context(false);
+  NJX_set_unroll_factor(jit, 4);
+  NJXValueKind args[2] = {NJXValueKind_P, NJXValueKind_I};
+  NJXFunctionBuilderRef builder = NJX_create_function_builder(
+      jit, "scan", NJXValueKind_I, args, 2, true);
+  auto p = NJX_get_parameter(builder, 0);
+  auto n = NJX_get_parameter(builder, 1);
+  auto mem = NJX_alloca(builder, 8);
+  auto zero = NJX_immi(builder, 0);
+  NJX_store_i(builder, zero, mem, 0);
+  NJX_store_i(builder, zero, mem, 4);
+  auto skip = NJX_cbr_false(builder, NJX_lti(builder, zero, n), nullptr);
+  auto top = NJX_add_label(builder);
+  auto i = NJX_load_i(builder, mem, 4);
+  auto addr = NJX_addq(
+      builder, p,
+      NJX_lshq(builder, NJX_i2q(builder, i), NJX_immi(builder, 2)));
+  auto e = NJX_muli(builder, NJX_load_i(builder, addr, 0),
+                    NJX_immi(builder, 3));
+  NJX_store_i(builder, NJX_addi(builder, NJX_load_i(builder, mem, 0), e), mem,
+              0);
+  auto next = NJX_addi(builder, i, NJX_immi(builder, 1));
+  NJX_store_i(builder, next, mem, 4);
+  NJX_cbr_true(builder, NJX_lti(builder, next, n), top);
+  NJX_set_jmp_target(skip, NJX_add_label(builder));
+  NJX_reti(builder, NJX_load_i(builder, mem, 0));
+  auto f = (functype)NJX_finalize(builder);
+  NJX_destroy_function_builder(builder);
+
+  int rc = f != nullptr ? 0 : 1;
+  int data[1001];
+  for (int k = 0; k < 1001; k++)
+    data[k] = k * 7 - 300;
+  const int sizes[] = {0, 1, 3, 4, 5, 8, 17, 1001};
+  for (int size : sizes) {
+    int expected = 0;
+    for (int k = 0; k < size; k++)
+      expected += data[k] * 3;
+    if (rc == 0 && f(data, size) != expected)
+      rc = 1;
+  }
+  NJX_destroy_context(jit);
+  return rc;
+}
+
+/**
+* Branch hints: the checks are expected to pass, so the code handling
+* failures is laid out at the end of the function
+* int sum_checked(int *p, int n) {
+*   int s = 0;
+*   for (int i = 0; i < n; i++) {
+*     if (p[i] < 0) // unlikely
+*       return -1000 - i;
+*     if (p[i] != 13) // likely
+*       s += p[i];
+*     else
+*       s += 1000;
+*   }
+*   return s;
+* }
+*/
+static int branchhints() {
+  typedef int (*functype)(int *, int);
+  NJXContextRef jit = NJX_create_context(false);
+  NJXValueKind args[2] = {NJXValueKind_P, NJXValueKind_I};
+  NJXFunctionBuilderRef builder = NJX_create_function_builder(
+      jit, "sum_checked", NJXValueKind_I, args, 2, true);
+  auto p = NJX_get_parameter(builder, 0);
+  auto n = NJX_get_parameter(builder, 1);
+  auto mem = NJX_alloca(builder, 8);
+  auto zero = NJX_immi(builder, 0);
+  NJX_store_i(builder, zero, mem, 0);
+  NJX_store_i(builder, zero, mem, 4);
+  auto top = NJX_add_label(builder);
+  auto i = NJX_load_i(builder, mem, 4);
+  auto exit = NJX_cbr_false(builder, NJX_lti(builder, i, n), nullptr);
+  auto addr = NJX_addq(
+      builder, p,
+      NJX_lshq(builder, NJX_i2q(builder, i), NJX_immi(builder, 2)));
+  auto v = NJX_load_i(builder, addr, 0);
+  auto fail = NJX_cbr_true_hint(builder, NJX_lti(builder, v, zero), nullptr,
+                                NJX_BRANCH_UNLIKELY);
+  auto s = NJX_load_i(builder, mem, 0);
+  auto notThirteen =
+      NJX_cbr_false_hint(builder, NJX_eqi(builder, v, NJX_immi(builder, 13)),
+                         nullptr, NJX_BRANCH_LIKELY);
+  NJX_store_i(builder, NJX_addi(builder, s, NJX_immi(builder, 1000)), mem, 0);
+  auto join = NJX_br(builder, nullptr);
+  NJX_set_jmp_target(notThirteen, NJX_add_label(builder));
+  NJX_store_i(builder, NJX_addi(builder, s, v), mem, 0);
+  NJX_set_jmp_target(join, NJX_add_label(builder));
+  NJX_store_i(builder, NJX_addi(builder, i, NJX_immi(builder, 1)), mem, 4);
+  NJX_br(builder, top);
+  NJX_set_jmp_target(fail, NJX_add_label(builder));
+  NJX_reti(builder, NJX_subi(builder, NJX_immi(builder, -1000), i));
+  NJX_set_jmp_target(exit, NJX_add_label(builder));
+  NJX_reti(builder, NJX_load_i(builder, mem, 0));
+  auto f = (functype)NJX_finalize(builder);
+  NJX_destroy_function_builder(builder);
+
+  int rc = f != nullptr ? 0 : 1;
+  int data[] = {4, 8, 13, 15, 16, 13, 23, 42, -1, 7};
+  for (int size = 0; size <= 10; size++) {
+    int expected = 0;
+    for (int k = 0; k < size; k++) {
+      if (data[k] < 0) {
+        expected = -1000 - k;
+        break;
+      }
+      expected += data[k] != 13 ? data[k] : 1000;
+    }
+    if (rc == 0 && f(data, size) != expected)
+      rc = 1;
+  }
+  NJX_destroy_context(jit);
+  return rc;
+}
+
+/**
+* Counts the calls, branches and loop trips of a profiled function, across
+* its tier-up to optimized code, and checks them against the same counts
+* taken in C.
+*/
+static int profiling() {
+  typedef int (*functype)(int *, int);
+  NJXContextRef jit = NJX_create_context(false);
+  NJX_set_profiling(jit, true);
+  NJX_set_tier_up_threshold(jit, 5);
+  NJXValueKind args[2] = {NJXValueKind_P, NJXValueKind_I};
+  NJXFunctionBuilderRef builder = NJX_create_function_builder(
+      jit, "sum_profiled", NJXValueKind_I, args, 2, true);
+  auto p = NJX_get_parameter(builder, 0);
+  auto n = NJX_get_parameter(builder, 1);
+  auto mem = NJX_alloca(builder, 8);
+  auto zero = NJX_immi(builder, 0);
+  NJX_store_i(builder, zero, mem, 0);
+  NJX_store_i(builder, zero, mem, 4);
+  auto top = NJX_add_label(builder);
+  auto i = NJX_load_i(builder, mem, 4);
+  auto exit = NJX_cbr_false(builder, NJX_lti(builder, i, n), nullptr);
+  auto addr = NJX_addq(
+      builder, p,
+      NJX_lshq(builder, NJX_i2q(builder, i), NJX_immi(builder, 2)));
+  auto v = NJX_load_i(builder, addr, 0);
+  auto fail = NJX_cbr_true_hint(builder, NJX_lti(builder, v, zero), nullptr,
+                                NJX_BRANCH_UNLIKELY);
+  auto s = NJX_load_i(builder, mem, 0);
+  auto odd = NJX_cbr_false(
+      builder,
+      NJX_eqi(builder, NJX_andi(builder, v, NJX_immi(builder, 1)), zero),
+      nullptr);
+  NJX_store_i(builder, NJX_addi(builder, s, v), mem, 0);
+  NJX_set_jmp_target(odd, NJX_add_label(builder));
+  NJX_store_i(builder, NJX_addi(builder, i, NJX_immi(builder, 1)), mem, 4);
+  NJX_br(builder, top);
+  NJX_set_jmp_target(fail, NJX_add_label(builder));
+  NJX_reti(builder, NJX_immi(builder, -1));
+  NJX_set_jmp_target(exit, NJX_add_label(builder));
+  NJX_reti(builder, NJX_load_i(builder, mem, 0));
+  auto f = (functype)NJX_finalize(builder);
+  NJX_destroy_function_builder(builder);
+
+  int rc = f != nullptr ? 0 : 1;
+  int data[] = {4, 8, 13, 15, 16, 13, 23, 42, -1, 7};
+  uint64_t entries = 0;
+  NJXBranchProfile expected[3] = {};
+  NJXBranchProfile trips = {};
+  for (int round = 0; round < 2 && rc == 0; round++) {
+    for (int size = 0; size <= 10; size++) {
+      int sum = 0, k = 0;
+      entries++;
+      for (;; k++) {
+        if (!(k < size)) {
+          expected[0].taken++;
+          break;
+        }
+        expected[0].not_taken++;
+        if (data[k] < 0) {
+          expected[1].taken++;
+          sum = -1;
+          break;
+        }
+        expected[1].not_taken++;
+        if (data[k] & 1) {
+          expected[2].taken++;
+        } else {
+          expected[2].not_taken++;
+          sum += data[k];
+        }
+        trips.taken++;
+      }
+      if (f(data, size) != sum)
+        rc = 1;
+    }
+    // The second round runs the optimized code
+    if (round == 0 && NJX_wait_for_tier_up(jit) != 1)
+      rc = 1;
+  }
+
+  NJXProfile profile;
+  NJXBranchProfile branches[4] = {}, loops[2] = {};
+  if (!NJX_get_profile(jit, "sum_profiled", &profile, branches, 4, loops, 2) ||
+      profile.entries != entries || profile.branches != 3 ||
+      profile.loops != 1)
+    rc = 1;
+  for (int k = 0; k < 3; k++) {
+    if (branches[k].taken != expected[k].taken ||
+        branches[k].not_taken != expected[k].not_taken)
+      rc = 1;
+  }
+  if (loops[0].taken != trips.taken || loops[0].not_taken != 0)
+    rc = 1;
+  if (NJX_get_profile(jit, "no_such_function", &profile, nullptr, 0, nullptr,
+                      0))
+    rc = 1;
+  NJX_destroy_context(jit);
+  return rc;
+}
+
 int main(int argc, const char *argv[]) {
 
   NJXContextRef jit = NJX_create_context(true);
@@ -238,6 +1503,32 @@ int main(int argc, const char *argv[]) {
 
   NJX_destroy_context(jit);
 
+  // Verbose output from several threads would be interleaved
+  jit = NJX_create_context(false);
+  rc += concurrent(jit);
+  NJX_destroy_context(jit);
+
+  rc += asyncfinalize();
+  rc += freefunction();
+  rc += codecache();
+  rc += serializelir();
+  rc += regpressure();
+  rc += looplives();
+  rc += licm();
+  rc += gvn();
+  rc += memopt();
+  rc += tiered();
+  rc += patchable();
+  rc += inlining();
+  rc += fpparams();
+  rc += float4ops();
+  rc += fma();
+  rc += bitops();
+  rc += fprounding();
+  rc += unrolling();
+  rc += branchhints();
+  rc += profiling();
+
   if (rc == 0)
     printf("Test OK\n");
   else
@@ -0,0 +1,96 @@
+/**
+* Times a scan kernel compiled with and without loop unrolling
+* (see NJX_set_unroll_factor()).
+*
+* Usage: scanbench [elements [repetitions]]
+*/
+#include <nanojitextra.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <chrono>
+#include <vector>
+
+typedef int (*scanfunc)(int *, int);
+
+/**
+* int scan(int *p, int n) {
+*   int s = 0, i = 0;
+*   if (0 < n)
+*     do { s += p[i] * 3; i++; } while (i < n);
+*   return s;
+* }
+*/
+static scanfunc compile_scan(NJXContextRef jit) {
+  NJXValueKind args[2] = {NJXValueKind_P, NJXValueKind_I};
+  NJXFunctionBuilderRef builder = NJX_create_function_builder(
+      jit, "scan", NJXValueKind_I, args, 2, true);
+  auto p = NJX_get_parameter(builder, 0);
+  auto n = NJX_get_parameter(builder, 1);
+  auto mem = NJX_alloca(builder, 8);
+  auto zero = NJX_immi(builder, 0);
+  NJX_store_i(builder, zero, mem, 0);
+  NJX_store_i(builder, zero, mem, 4);
+  auto skip = NJX_cbr_false(builder, NJX_lti(builder, zero, n), nullptr);
+  auto top = NJX_add_label(builder);
+  auto i = NJX_load_i(builder, mem, 4);
+  auto addr = NJX_addq(
+      builder, p,
+      NJX_lshq(builder, NJX_i2q(builder, i), NJX_immi(builder, 2)));
+  auto e = NJX_muli(builder, NJX_load_i(builder, addr, 0),
+                    NJX_immi(builder, 3));
+  NJX_store_i(builder, NJX_addi(builder, NJX_load_i(builder, mem, 0), e), mem,
+              0);
+  auto next = NJX_addi(builder, i, NJX_immi(builder, 1));
+  NJX_store_i(builder, next, mem, 4);
+  NJX_cbr_true(builder, NJX_lti(builder, next, n), top);
+  NJX_set_jmp_target(skip, NJX_add_label(builder));
+  NJX_reti(builder, NJX_load_i(builder, mem, 0));
+  auto f = (scanfunc)NJX_finalize(builder);
+  NJX_destroy_function_builder(builder);
+  return f;
+}
+
+int main(int argc, const char *argv[]) {
+  int elements = argc > 1 ? atoi(argv[1]) : 4099;
+  int repetitions = argc > 2 ? atoi(argv[2]) : 20000;
+  if (elements < 0 || repetitions <= 0) {
+    fprintf(stderr, "usage: scanbench [elements [repetitions]]\n");
+    return 1;
+  }
+
+  std::vector<int> data(elements);
+  int expected = 0;
+  for (int k = 0; k < elements; k++) {
+    data[k] = (k * 7919) % 1000 - 500;
+    expected += data[k] * 3;
+  }
+
+  const int factors[] = {1, 2, 4, 8};
+  int rc = 0;
+  for (int factor : factors) {
+    NJXContextRef jit = NJX_create_context(false);
+    NJX_set_unroll_factor(jit, factor);
+    scanfunc f = compile_scan(jit);
+    if (!f) {
+      fprintf(stderr, "unroll %d: compilation failed\n", factor);
+      NJX_destroy_context(jit);
+      rc = 1;
+      continue;
+    }
+    int result = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int r = 0; r < repetitions; r++)
+      result = f(data.data(), elements);
+    auto stop = std::chrono::steady_clock::now();
+    double ns = std::chrono::duration<double, std::nano>(stop - start).count();
+    printf("unroll %d: %.3f ns/element%s\n", factor,
+           ns / ((double)repetitions * (elements ? elements : 1)),
+           result == expected ? "" : " (WRONG RESULT)");
+    if (result != expected)
+      rc = 1;
+    NJX_destroy_context(jit);
+  }
+  return rc;
+}
@@ -30,6 +30,12 @@
 #include <sys/mman.h>
 #endif
 
+#if defined(AVMPLUS_WIN32)
+#include <windows.h>
+#elif defined(AVMPLUS_UNIX)
+#include <pthread.h>
+#endif
+
 #ifdef AVMPLUS_WIN32
 #if ! defined(_STDINT_H)
 typedef signed char int8_t;
@@ -79,6 +85,40 @@ extern void VMPI_setPageProtection(void *address,
                                    bool executableFlag,
                                    bool writeableFlag);
 
+// Recursive mutex used to protect state that is shared between threads,
+// e.g. a CodeAlloc used by several Assemblers at once.  The owning thread
+// may re-acquire the lock; every acquire must be paired with a release.
+#if defined(AVMPLUS_WIN32)
+typedef CRITICAL_SECTION vmpi_mutex_t;
+
+REALLY_INLINE void VMPI_mutexInit(vmpi_mutex_t* m)    { InitializeCriticalSection(m); }
+REALLY_INLINE void VMPI_mutexDestroy(vmpi_mutex_t* m) { DeleteCriticalSection(m); }
+REALLY_INLINE void VMPI_mutexAcquire(vmpi_mutex_t* m) { EnterCriticalSection(m); }
+REALLY_INLINE void VMPI_mutexRelease(vmpi_mutex_t* m) { LeaveCriticalSection(m); }
+#elif defined(AVMPLUS_UNIX)
+typedef pthread_mutex_t vmpi_mutex_t;
+
+REALLY_INLINE void VMPI_mutexInit(vmpi_mutex_t* m)
+{
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(m, &attr);
+    pthread_mutexattr_destroy(&attr);
+}
+REALLY_INLINE void VMPI_mutexDestroy(vmpi_mutex_t* m) { pthread_mutex_destroy(m); }
+REALLY_INLINE void VMPI_mutexAcquire(vmpi_mutex_t* m) { pthread_mutex_lock(m); }
+REALLY_INLINE void VMPI_mutexRelease(vmpi_mutex_t* m) { pthread_mutex_unlock(m); }
+#else
+// No thread support on this platform; the lock is a no-op.
+typedef int vmpi_mutex_t;
+
+REALLY_INLINE void VMPI_mutexInit(vmpi_mutex_t*)    {}
+REALLY_INLINE void VMPI_mutexDestroy(vmpi_mutex_t*) {}
+REALLY_INLINE void VMPI_mutexAcquire(vmpi_mutex_t*) {}
+REALLY_INLINE void VMPI_mutexRelease(vmpi_mutex_t*) {}
+#endif
+
 //  Keep this warning-set relatively in sync with platform/win32/win32-platform.h in tamarin.
 
 #ifdef _MSC_VER
@@ -5,6 +5,7 @@
  * file, You can obtain one at http://mozilla.org/MPL/2.0/. */
 
 #include <vector>
+#include <list>
 #include <algorithm>
 #include <map>
 #include <string>
@@ -307,6 +308,8 @@ public:
     Allocator mAlloc;
     CodeAlloc mCodeAlloc;
     bool mVerbose;
+    bool mRoundTrip;
+    bool mMemOptStats;
     Fragments mFragments;
     Assembler mAssm;
     map<string, LOpcode> mOpMap;
@@ -378,6 +381,7 @@ private:
     void extract_any_label(string &lab, char lab_delim);
     void resolve_jumps();
     void add_jump_label(const string& lab, LIns* ins);
+    void roundTrip();
     void endFragment();
 };
 
@@ -937,6 +941,59 @@ FragmentAssembler::assemble_jump_jov()
     return ins;
 }
 
+// Names calls and guards by their position in the fragment, for a
+// serialization round trip within this process.
+class LirasmSymbols : public LirSymbols {
+public:
+    const char *callName(const CallInfo *ci) {
+        stringstream name;
+        name << mCalls.size();
+        mCalls.push_back(ci);
+        mNames.push_back(name.str());
+        return mNames.back().c_str();
+    }
+    uint32_t guardId(GuardRecord *gr) {
+        mGuards.push_back(gr);
+        return uint32_t(mGuards.size() - 1);
+    }
+    const CallInfo *lookupCall(const char *name, const CallInfo &) {
+        size_t i = strtoul(name, NULL, 10);
+        return i < mCalls.size() ? mCalls[i] : NULL;
+    }
+    GuardRecord *guardRecord(uint32_t id) {
+        return id < mGuards.size() ? mGuards[id] : NULL;
+    }
+
+private:
+    vector<const CallInfo *> mCalls;
+    list<string> mNames;
+    vector<GuardRecord *> mGuards;
+};
+
+// Replaces the fragment's LIR with the result of serializing and reloading
+// it, which should not change the generated code.
+void
+FragmentAssembler::roundTrip()
+{
+    LirasmSymbols symbols;
+    LirReader reader(mFragment->lastIns);
+    LirSerializer serializer(&reader, mParent.mAlloc, symbols);
+    while (!serializer.read()->isop(LIR_start))
+        ;
+    if (!serializer.succeeded())
+        bad("unable to serialize fragment");
+
+    LirBuffer *lirbuf = new (mParent.mAlloc) LirBuffer(mParent.mAlloc);
+    verbose_only( lirbuf->printer = mParent.mLirbuf->printer; )
+    LirBufWriter writer(lirbuf, mParent.mConfig);
+    LirLoader loader(mParent.mAlloc, symbols);
+    if (!loader.load(serializer.data(), serializer.size(), &writer))
+        bad("unable to load serialized fragment");
+
+    mFragment->lirbuf = lirbuf;
+    mFragment->lastIns = lirbuf->lastIns();
+}
+
 void
 FragmentAssembler::endFragment()
 {
@@ -963,6 +1020,9 @@ FragmentAssembler::endFragment()
     mFragment->lastIns =
         mLir->insGuard(LIR_x, NULL, createGuardRecord(createSideExit()));
 
+    if (mParent.mRoundTrip)
+        roundTrip();
+
     mParent.mAssm.compile(mFragment, mParent.mAlloc, optimize
               verbose_only(, mParent.mLirbuf->printer));
 
@@ -972,6 +1032,7 @@ FragmentAssembler::endFragment()
           case nanojit::BranchTooFar: cerr << "BranchTooFar"; break;
           case nanojit::StackFull: cerr << "StackFull"; break;
           case nanojit::UnknownBranch:  cerr << "UnknownBranch"; break;
+          case nanojit::UnsupportedOpcode: cerr << "UnsupportedOpcode"; break;
           case nanojit::None: cerr << "None"; break;
           default: NanoAssert(0); break;
         }
@@ -979,6 +1040,10 @@ FragmentAssembler::endFragment()
         std::exit(1);
     }
 
+    if (mParent.mMemOptStats)
+        cout << "Forwarded loads: " << mParent.mAssm.forwardedLoadCount()
+             << ", removed stores: " << mParent.mAssm.removedStoreCount() << endl;
+
     LirasmFragment *f;
     f = &mParent.mFragments[mFragName];
 
@@ -1124,6 +1189,8 @@ FragmentAssembler::assembleFragment(LirTokenStream &in, bool implicitBegin, cons
             break;
 
           case LIR_regfence:
+          case LIR_likely:
+          case LIR_unlikely:
             need(0);
             ins = mLir->ins0(mOpcode);
             break;
@@ -1133,6 +1200,7 @@ FragmentAssembler::assembleFragment(LirTokenStream &in, bool implicitBegin, cons
           case LIR_lived:
           case LIR_livef:
           case LIR_livef4:
+          CASE86(LIR_count:)
           case LIR_negi:
           CASE86(LIR_negq:)
           case LIR_negd:
@@ -1165,6 +1233,17 @@ FragmentAssembler::assembleFragment(LirTokenStream &in, bool implicitBegin, cons
           case LIR_modi:
 #endif
           CASE86(LIR_modq:)
+          CASEAVX(LIR_livef8:) CASEAVX(LIR_lived4:) CASEAVX(LIR_livei8:)
+          CASEAVX(LIR_f2f8:) CASEAVX(LIR_f8x:) CASEAVX(LIR_d2d4:)
+          CASEAVX(LIR_d4x:) CASEAVX(LIR_i2i8:) CASEAVX(LIR_i8x:)
+          CASEBIT(LIR_popcnti:) CASEBIT(LIR_lzcnti:) CASEBIT(LIR_tzcnti:)
+          CASEBIT(LIR_bswapi:) CASEBIT(LIR_popcntq:) CASEBIT(LIR_lzcntq:)
+          CASEBIT(LIR_tzcntq:) CASEBIT(LIR_bswapq:)
+          CASEFPX(LIR_floord:) CASEFPX(LIR_ceild:) CASEFPX(LIR_truncd:)
+          CASEFPX(LIR_roundd:) CASEFPX(LIR_floorf:) CASEFPX(LIR_ceilf:)
+          CASEFPX(LIR_truncf:) CASEFPX(LIR_roundf:) CASEFPX(LIR_d2ui:)
+          CASEFPX(LIR_f2ui:) CASEFPX(LIR_f2q:) CASEFPX(LIR_q2f:)
+          CASEFPX(LIR_uq2d:) CASEFPX(LIR_uq2f:)
             need(1);
             ins = mLir->ins1(mOpcode,
                              ref(mTokens[0]));
@@ -1177,6 +1256,7 @@ FragmentAssembler::assembleFragment(LirTokenStream &in, bool implicitBegin, cons
           case LIR_divi:
 #endif
           CASE86(LIR_mulq:)
+          CASE86(LIR_mulhq:)
           CASE86(LIR_divq:)
           case LIR_addd:
           case LIR_subd:
@@ -1186,6 +1266,10 @@ FragmentAssembler::assembleFragment(LirTokenStream &in, bool implicitBegin, cons
           case LIR_subf:
           case LIR_mulf:
           case LIR_divf:
+          case LIR_minf:
+          case LIR_maxf:
+          CASEFPX(LIR_mind:)
+          CASEFPX(LIR_maxd:)
           case LIR_addf4:
           case LIR_subf4:
           case LIR_mulf4:
@@ -1204,6 +1288,8 @@ FragmentAssembler::assembleFragment(LirTokenStream &in, bool implicitBegin, cons
           CASE64(LIR_lshq:)
           CASE64(LIR_rshq:)
           CASE64(LIR_rshuq:)
+          CASEBIT(LIR_roli:) CASEBIT(LIR_rori:)
+          CASEBIT(LIR_rolq:) CASEBIT(LIR_rorq:)
           case LIR_eqi:
           case LIR_lti:
           case LIR_gti:
@@ -1234,6 +1320,15 @@ FragmentAssembler::assembleFragment(LirTokenStream &in, bool implicitBegin, cons
           CASE64(LIR_leuq:)
           CASE64(LIR_geuq:)
           CASESF(LIR_ii2d:)
+          CASEAVX(LIR_addf8:) CASEAVX(LIR_subf8:) CASEAVX(LIR_mulf8:)
+          CASEAVX(LIR_divf8:) CASEAVX(LIR_minf8:) CASEAVX(LIR_maxf8:)
+          CASEAVX(LIR_cmpeqf8:) CASEAVX(LIR_cmpltf8:) CASEAVX(LIR_cmplef8:)
+          CASEAVX(LIR_addd4:) CASEAVX(LIR_subd4:) CASEAVX(LIR_muld4:)
+          CASEAVX(LIR_divd4:) CASEAVX(LIR_mind4:) CASEAVX(LIR_maxd4:)
+          CASEAVX(LIR_cmpeqd4:) CASEAVX(LIR_cmpltd4:) CASEAVX(LIR_cmpled4:)
+          CASEAVX(LIR_addi8:) CASEAVX(LIR_subi8:) CASEAVX(LIR_muli8:)
+          CASEAVX(LIR_andi8:) CASEAVX(LIR_ori8:) CASEAVX(LIR_xori8:)
+          CASEAVX(LIR_cmpeqi8:) CASEAVX(LIR_cmpgti8:)
             need(2);
             ins = mLir->ins2(mOpcode,
                              ref(mTokens[0]),
@@ -1245,6 +1340,8 @@ FragmentAssembler::assembleFragment(LirTokenStream &in, bool implicitBegin, cons
           case LIR_cmovd:
           case LIR_cmovf:
           case LIR_cmovf4:
+          CASEAVX(LIR_blendf8:) CASEAVX(LIR_blendd4:) CASEAVX(LIR_blendi8:)
+          CASEFMA(LIR_fmad:) CASEFMA(LIR_fmaf:) CASEFMA(LIR_fmaf4:)
             need(3);
             ins = mLir->ins3(mOpcode,
                              ref(mTokens[0]),
@@ -1299,6 +1396,7 @@ FragmentAssembler::assembleFragment(LirTokenStream &in, bool implicitBegin, cons
           case LIR_std:
           case LIR_stf:
           case LIR_stf4:
+          CASEAVX(LIR_stf8:) CASEAVX(LIR_std4:) CASEAVX(LIR_sti8:)
             need(3);
             ins = mLir->insStore(mOpcode, ref(mTokens[0]),
                                   ref(mTokens[1]),
@@ -1317,6 +1415,7 @@ FragmentAssembler::assembleFragment(LirTokenStream &in, bool implicitBegin, cons
           case LIR_ldd:
           case LIR_ldf:
           case LIR_ldf4:
+          CASEAVX(LIR_ldf8:) CASEAVX(LIR_ldd4:) CASEAVX(LIR_ldi8:)
             ins = assemble_load();
             break;
 
@@ -1324,9 +1423,12 @@ FragmentAssembler::assembleFragment(LirTokenStream &in, bool implicitBegin, cons
           // you specify qparam on x86 you'll end up with iparam anyway.  Fix
           // this.
           case LIR_paramp:
+          CASE86(LIR_paramd:)
+          CASE86(LIR_paramf:)
+          CASE86(LIR_paramf4:)
             need(2);
             ins = mLir->insParam(immI(mTokens[0]),
-                                 immI(mTokens[1]));
+                                 immI(mTokens[1]), mOpcode);
             break;
 
           // XXX: similar to iparam/qparam above.
@@ -2556,6 +2658,8 @@ Lirasm::Lirasm(bool verbose, Config& config) :
     mAssm(mCodeAlloc, mAlloc, mAlloc, &mLogc, mConfig)
 {
     mVerbose = verbose;
+    mRoundTrip = false;
+    mMemOptStats = false;
     mLogc.lcbits = 0;
 
     mLirbuf = new (mAlloc) LirBuffer(mAlloc);
@@ -2722,6 +2826,16 @@ usageAndQuit(const string& progname)
         "  --[no-]optimize   enable or disable optimization of the LIR (default=off)\n"
         "  --random [N]      generate a random LIR block of size N (default=100)\n"
         "  --stkskip [N]     push approximately N Kbytes of stack before execution (default=100)\n"
+        "  --roundtrip       serialize and reload the LIR of each fragment before assembly\n"
+        "  --lookahead       allocate registers using live ranges computed ahead of assembly\n"
+        "  --loop-lives      insert the LIR_live instructions needed on loop back edges\n"
+        "  --licm            move loop-invariant code out of loops\n"
+        "  --gvn             reuse values across labels where they dominate\n"
+        "  --memopt          forward stored values to loads and remove dead stores\n"
+        "  --memopt-stats    print how many loads --memopt forwarded and stores it removed\n"
+        "  --ranges          remove overflow checks and branches that value ranges rule out\n"
+        "  --divconst        replace division by constants with multiplications and shifts\n"
+        "  --unroll [N]      unroll counted loops N times (default=4)\n"
         "\n"
         "Build query options (these print a value for this build of lirasm and exit)\n"
         "  --show-arch       show the architecture ('i386', 'X64', 'arm', 'ppc',\n"
@@ -2732,6 +2846,13 @@ usageAndQuit(const string& progname)
         "i386-specific options:\n"
         "  --[no]sse         use SSE2 instructions (default=on)\n"
         "\n"
+        "X64-specific options:\n"
+        "  --noavx           don't use AVX or FMA instructions even if the CPU supports them\n"
+        "  --nobitops        don't use POPCNT, LZCNT, BMI1 or BMI2 instructions even if\n"
+        "                    the CPU supports them\n"
+        "  --nosse41         don't use SSE4.1 instructions even if the CPU supports them\n"
+        "  --show-avx2       show whether this CPU supports AVX2 ('yes' or 'no')\n"
+        "\n"
         "ARM-specific options:\n"
         "  --arch N          use ARM architecture version N instructions (default=7)\n"
         "  --[no]vfp         use ARM VFP instructions (default=on)\n"
@@ -2756,6 +2877,8 @@ struct CmdLineOptions {
     bool    optimize;
     int     random;
     int     stkskip;
+    bool    roundtrip;
+    bool    memoptstats;
     string  filename;
     Config  config;
 };
@@ -2791,6 +2914,8 @@ processCmdLine(int argc, char **argv, CmdLineOptions& opts)
     opts.random   = 0;
     opts.optimize = false;
     opts.stkskip  = 0;
+    opts.roundtrip = false;
+    opts.memoptstats = false;
 
     // Architecture-specific options.
 #if defined NANOJIT_IA32
@@ -2818,6 +2943,30 @@ processCmdLine(int argc, char **argv, CmdLineOptions& opts)
             if (!parseOptionalInt(argc, argv, &i, &opts.random, 100))
                 errMsgAndQuit(opts.progname, "--random argument must be greater than zero");
         }
+        else if (arg == "--roundtrip")
+            opts.roundtrip = true;
+        else if (arg == "--lookahead")
+            opts.config.regalloc_lookahead = true;
+        else if (arg == "--loop-lives")
+            opts.config.loop_lives = true;
+        else if (arg == "--licm")
+            opts.config.licm = true;
+        else if (arg == "--gvn")
+            opts.config.gvn = true;
+        else if (arg == "--memopt")
+            opts.config.memopt = true;
+        else if (arg == "--memopt-stats")
+            opts.memoptstats = true;
+        else if (arg == "--ranges")
+            opts.config.ranges = true;
+        else if (arg == "--divconst")
+            opts.config.divconst = true;
+        else if (arg == "--unroll") {
+            int factor;
+            if (!parseOptionalInt(argc, argv, &i, &factor, 4) || factor > 255)
+                errMsgAndQuit(opts.progname, "--unroll argument must be between 1 and 255");
+            opts.config.unroll = uint8_t(factor);
+        }
         else if (arg == "--stkskip") {
             if (!parseOptionalInt(argc, argv, &i, &opts.stkskip, 100))
                 errMsgAndQuit(opts.progname, "--stkskip argument must be greater than zero");
@@ -2866,6 +3015,21 @@ processCmdLine(int argc, char **argv, CmdLineOptions& opts)
         else if (arg == "--nosse") {
             i386_sse = false;
         }
+#elif defined NANOJIT_X64
+        else if (arg == "--noavx") {
+            opts.config.x64_avx = opts.config.x64_avx2 = opts.config.x64_fma = false;
+        }
+        else if (arg == "--nobitops") {
+            opts.config.x64_popcnt = opts.config.x64_lzcnt = false;
+            opts.config.x64_bmi1 = opts.config.x64_bmi2 = false;
+        }
+        else if (arg == "--nosse41") {
+            opts.config.i386_sse41 = false;
+        }
+        else if (arg == "--show-avx2") {
+            cout << (opts.config.x64_avx2 ? "yes" : "no") << "\n";
+            exit(0);
+        }
 #elif defined NANOJIT_ARM
         else if ((arg == "--arch") && (i < argc-1)) {
             char* endptr;
@@ -2990,6 +3154,8 @@ main(int argc, char **argv)
     processCmdLine(argc, argv, opts);
 
     Lirasm lasm(opts.verbose, opts.config);
+    lasm.mRoundTrip = opts.roundtrip;
+    lasm.mMemOptStats = opts.memoptstats;
     if (opts.random) {
         lasm.assembleRandom(opts.random, opts.optimize);
     } else {
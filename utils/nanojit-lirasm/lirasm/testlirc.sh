@@ -94,6 +94,7 @@ function runtests {
 if [[ $($LIRASM --show-arch 2>/dev/null) == "i386" ]] ; then
     # i386 with SSE2.
     runtests "."
+    runtests "."               "--roundtrip"
     runtests "hardfloat"
     runtests "32-bit"
     runtests "littleendian"
@@ -112,9 +113,37 @@ if [[ $($LIRASM --show-arch 2>/dev/null) == "i386" ]] ; then
 elif [[ $($LIRASM --show-arch 2>/dev/null) == "X64" ]] ; then
     # X64.
     runtests "."
+    runtests "."               "--roundtrip"
+    runtests "."               "--lookahead"
+    runtests "."               "--loop-lives"
+    runtests "."               "--licm"
+    runtests "."               "--gvn"
+    runtests "."               "--memopt"
+    runtests "memopt"          "--memopt --memopt-stats"
+    runtests "."               "--ranges"
+    runtests "."               "--divconst"
+    runtests "."               "--unroll"
     runtests "hardfloat"
+    runtests "hardfloat"       "--lookahead"
+    runtests "."               "--noavx"
+    runtests "hardfloat"       "--noavx"
+    runtests "fma"
+    runtests "fma"             "--noavx"
+    runtests "bitops"
+    runtests "bitops"          "--nobitops"
+    runtests "bitops"          "--optimize"
+    runtests "fpext"
+    runtests "fpext"           "--nosse41"
+    runtests "fpext"           "--optimize"
     runtests "64-bit"
+    runtests "64-bit"          "--ranges"
+    runtests "64-bit"          "--divconst"
+    runtests "64-bit"          "--unroll"
     runtests "littleendian"
+    if [[ $($LIRASM --show-avx2) == "yes" ]] ; then
+        runtests "avx"
+        runtests "avx"         "--lookahead"
+    fi
     runtest "--random 1000000"
     runtest "--random 1000000 --optimize"
 
@@ -122,6 +151,7 @@ elif [[ $($LIRASM --show-arch 2>/dev/null) == "arm" ]] ; then
     # ARMv7 with VFP.  We could test without VFP but such a platform seems
     # unlikely.  ARM is bi-endian but usually configured as little-endian.
     runtests "."
+    runtests "."               "--roundtrip"
     runtests "hardfloat"
     runtests "32-bit"
     runtests "littleendian"
@@ -131,6 +161,7 @@ elif [[ $($LIRASM --show-arch 2>/dev/null) == "arm" ]] ; then
 elif [[ $($LIRASM --show-arch 2>/dev/null) == "ppc" ]] ; then
     # PPC is bi-endian but usually configured as big-endian.
     runtests "."
+    runtests "."               "--roundtrip"
     runtests "hardfloat"
     if [[ $($LIRASM --show-word-size) == "32" ]] ; then
         runtests "32-bit"
@@ -144,6 +175,7 @@ elif [[ $($LIRASM --show-arch 2>/dev/null) == "ppc" ]] ; then
 elif [[ $($LIRASM --show-arch 2>/dev/null) == "sparc" ]] ; then
     # Sparc is bi-endian but usually configured as big-endian.
     runtests "."
+    runtests "."               "--roundtrip"
     runtests "hardfloat"
     runtests "32-bit"
     runtests "bigendian"
@@ -153,6 +185,7 @@ elif [[ $($LIRASM --show-arch 2>/dev/null) == "sparc" ]] ; then
 elif [[ $($LIRASM --show-arch 2>/dev/null) == "mips" ]] ; then
     # MIPS is bi-endian but usually configured as big-endian.
     runtests "."
+    runtests "."               "--roundtrip"
     if [[ $($LIRASM --show-float) == "softfloat" ]] ; then
 	runtests "softfloat"
     else
@@ -170,6 +203,7 @@ elif [[ $($LIRASM --show-arch 2>/dev/null) == "mips" ]] ; then
 elif [[ $($LIRASM --show-arch 2>/dev/null) == "sh4" ]] ; then
     # SH4 is bi-endian but usually configured as big-endian.
     runtests "."
+    runtests "."               "--roundtrip"
     runtests "hardfloat"
     runtests "32-bit"
     runtests "bigendian"